@@ -19,9 +19,12 @@
 #include <radix/asm/acpi.h>
 #include <radix/asm/apic.h>
 #include <radix/klog.h>
+#include <radix/numa.h>
 
 #include <acpi/acpi.h>
 #include <acpi/tables/madt.h>
+#include <acpi/tables/slit.h>
+#include <acpi/tables/srat.h>
 
 #define ACPI "ACPI: "
 
@@ -42,6 +45,28 @@ static void __madt_lapic(struct acpi_madt_local_apic *s)
          s->flags & ACPI_MADT_LOCAL_APIC_ACTIVE ? "" : "in");
 }
 
+/*
+ * Processors with APIC IDs of 255 or greater are described by x2APIC entries.
+ * Firmware may also list other processors in both forms.
+ */
+static void __madt_x2apic(struct acpi_madt_local_x2apic *s)
+{
+    if (s->lapic_flags & ACPI_MADT_LOCAL_APIC_ACTIVE &&
+        !lapic_from_id(s->local_apic_id)) {
+        if (!lapic_add(s->local_apic_id)) {
+            klog(KLOG_WARNING,
+                 ACPI "maximum number of CPUs reached, ignoring x2apic %u",
+                 s->local_apic_id);
+            return;
+        }
+    }
+
+    klog(KLOG_INFO,
+         ACPI "x2APIC id %u %sactive",
+         s->local_apic_id,
+         s->lapic_flags & ACPI_MADT_LOCAL_APIC_ACTIVE ? "" : "in");
+}
+
 static void __madt_ioapic(struct acpi_madt_io_apic *s)
 {
     ioapic_add(s->id, s->address, s->global_irq_base);
@@ -172,6 +197,9 @@ static void madt_parse_all(struct acpi_subtable_header *header)
     case ACPI_MADT_LOCAL_APIC:
         __madt_lapic((struct acpi_madt_local_apic *)header);
         break;
+    case ACPI_MADT_LOCAL_X2APIC:
+        __madt_x2apic((struct acpi_madt_local_x2apic *)header);
+        break;
     case ACPI_MADT_INTERRUPT_OVERRIDE:
         __madt_override((struct acpi_madt_interrupt_override *)header);
         break;
@@ -204,3 +232,18 @@ int acpi_parse_madt(void)
 
     return 0;
 }
+
+/*
+ * acpi_numa_init:
+ * Read the NUMA topology of the system from the ACPI SRAT and SLIT
+ * and bring its nodes online. Must run after the MADT has been parsed.
+ */
+void acpi_numa_init(void)
+{
+    if (acpi_parse_srat() == 0) {
+        acpi_parse_slit();
+        lapic_numa_init();
+    }
+
+    numa_init();
+}
@@ -30,6 +30,7 @@
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/mm.h>
+#include <radix/numa.h>
 #include <radix/percpu.h>
 #include <radix/slab.h>
 #include <radix/smp.h>
@@ -39,6 +40,7 @@
 #include <radix/vmm.h>
 
 #include <acpi/tables/madt.h>
+#include <acpi/tables/srat.h>
 #include <stdbool.h>
 #include <string.h>
 
@@ -163,6 +165,15 @@ static spinlock_t ioapic_lock = SPINLOCK_INIT;
 #define APIC_MAX_FLAT_CPUS    8
 #define APIC_MAX_CLUSTER_CPUS 60
 
+/*
+ * In x2APIC mode, local APIC registers are accessed through MSRs at a fixed
+ * offset from their xAPIC register numbers. The ICR is a single 64-bit MSR.
+ */
+#define X2APIC_MSR_BASE 0x800
+#define X2APIC_MSR_ICR  (X2APIC_MSR_BASE + APIC_REG_ICR_LO)
+
+#define X2APIC_LDR_CLUSTER_SHIFT 16
+
 /* Local APIC base addresses */
 paddr_t lapic_phys_base;
 addr_t lapic_virt_base;
@@ -190,6 +201,9 @@ static struct lapic_lvt lapic_lvt_default[] = {
 static struct lapic lapic_list[MAX_CPUS];
 static unsigned int cpus_available = 0;
 
+/* whether local APICs are operating in x2APIC mode */
+static bool x2apic_mode = false;
+
 DEFINE_PER_CPU(struct lapic *, local_apic) = NULL;
 
 static DEFINE_PER_CPU(unsigned int, ipis_sent) = 0;
@@ -296,6 +310,7 @@ struct ioapic *ioapic_add(int id, addr_t phys_addr, int irq_base)
 
     for (i = 0; i < irq_count; ++i) {
         ioapic->pins[i].irq = irq_base + i;
+        ioapic->pins[i].cpu = -1;
 
         /*
          * Assume that IRQ 0 is an EXTINT, 1-15 are ISA IRQs
@@ -469,7 +484,8 @@ int ioapic_unmask(struct ioapic *ioapic, unsigned int pin)
 static void __ioapic_program_pin(struct ioapic *ioapic, unsigned int pin)
 {
     struct ioapic_pin *p;
-    uint32_t low, high;
+    struct lapic *lapic;
+    uint32_t low, high, mode;
 
     if (pin >= ioapic->irq_count)
         return;
@@ -478,8 +494,29 @@ static void __ioapic_program_pin(struct ioapic *ioapic, unsigned int pin)
     if (p->bus_type == BUS_TYPE_NONE)
         return;
 
-    low = (p->irq + IRQ_BASE) | IOREDLO_DESTMODE_LOGICAL;
-    low |= (p->flags & APIC_INT_MODE_MASK) << IOREDLO_DELMODE_SHIFT;
+    low = p->irq + IRQ_BASE;
+    mode = p->flags & APIC_INT_MODE_MASK;
+
+    lapic = p->cpu >= 0 ? cpu_var(local_apic, p->cpu) : NULL;
+    if (lapic && lapic->id < 0xFF) {
+        /*
+         * Route the interrupt to a single processor by its physical
+         * APIC ID. Lowest priority arbitration is meaningless with a
+         * single destination.
+         */
+        if (mode == APIC_INT_MODE_LOW_PRIO)
+            mode = APIC_INT_MODE_FIXED;
+        high = lapic->id << IOREDHI_DESTINATION_SHIFT;
+    } else {
+        /*
+         * Send interrupt to all CPUs. In x2APIC mode, the 8-bit logical
+         * destination is zero-extended, addressing the first eight
+         * processors of cluster 0.
+         */
+        low |= IOREDLO_DESTMODE_LOGICAL;
+        high = 0xFF << IOREDHI_DESTINATION_SHIFT;
+    }
+    low |= mode << IOREDLO_DELMODE_SHIFT;
 
     if (!(p->flags & APIC_INT_ACTIVE_HIGH))
         low |= IOREDLO_POLARITY_ACTIVE_LOW;
@@ -488,11 +525,13 @@ static void __ioapic_program_pin(struct ioapic *ioapic, unsigned int pin)
     if (p->flags & APIC_INT_MASKED)
         low |= IOREDLO_INTERRUPT_MASK;
 
-    /* send interrupt to all CPUs */
-    high = 0xFF << IOREDHI_DESTINATION_SHIFT;
-
-    ioapic_reg_write(ioapic, IOAPIC_IOREDLO(pin), low);
+    /*
+     * Keep the entry masked while its destination is changed so that
+     * no interrupt is delivered with a partially written entry.
+     */
+    ioapic_reg_write(ioapic, IOAPIC_IOREDLO(pin), low | IOREDLO_INTERRUPT_MASK);
     ioapic_reg_write(ioapic, IOAPIC_IOREDHI(pin), high);
+    ioapic_reg_write(ioapic, IOAPIC_IOREDLO(pin), low);
 }
 
 /*
@@ -534,7 +573,7 @@ static void ioapic_program_all(void)
 
 static void lapic_enable(paddr_t base)
 {
-    int eax, edx;
+    uint32_t eax, edx, curr, unused;
 
     eax = (base & PAGE_MASK) | IA32_APIC_BASE_ENABLE;
 #if CONFIG(X86_PAE)
@@ -543,16 +582,52 @@ static void lapic_enable(paddr_t base)
     edx = 0;
 #endif  // CONFIG(X86_PAE)
 
+    if (x2apic_mode) {
+        /* x2APIC mode can only be entered from an enabled xAPIC */
+        rdmsr(IA32_APIC_BASE, &curr, &unused);
+        if (!(curr & IA32_APIC_BASE_EXTD))
+            wrmsr(IA32_APIC_BASE, eax, edx);
+        eax |= IA32_APIC_BASE_EXTD;
+    }
+
     wrmsr(IA32_APIC_BASE, eax, edx);
 }
 
+/*
+ * x2apic_preenabled:
+ * Check whether firmware has already switched the local APIC into x2APIC
+ * mode, which cannot be left without disabling the APIC.
+ */
+static bool x2apic_preenabled(void)
+{
+    uint32_t eax, edx;
+
+    if (!cpu_supports(CPUID_X2APIC))
+        return false;
+
+    rdmsr(IA32_APIC_BASE, &eax, &edx);
+    return (eax & IA32_APIC_BASE_EXTD) != 0;
+}
+
 static __always_inline uint32_t lapic_reg_read(uint16_t reg)
 {
+    uint32_t lo, hi;
+
+    if (x2apic_mode) {
+        rdmsr(X2APIC_MSR_BASE + reg, &lo, &hi);
+        return lo;
+    }
+
     return *(uint32_t *)(lapic_virt_base + (reg << 4));
 }
 
 static __always_inline void lapic_reg_write(uint16_t reg, uint32_t value)
 {
+    if (x2apic_mode) {
+        wrmsr(X2APIC_MSR_BASE + reg, value, 0);
+        return;
+    }
+
     *(uint32_t *)(lapic_virt_base + (reg << 4)) = value;
 }
 
@@ -585,6 +660,24 @@ struct lapic *lapic_add(unsigned int id)
     return lapic;
 }
 
+/*
+ * lapic_numa_init:
+ * Assign each CPU the NUMA node of its local APIC from the SRAT.
+ * APs are assumed to be numbered in the order of their local APICs,
+ * as they are by apic_start_smp, which corrects the assignment if
+ * an AP fails to start.
+ */
+void lapic_numa_init(void)
+{
+    size_t i;
+
+    if (!apic_enabled())
+        return;
+
+    for (i = 0; i < cpus_available; ++i)
+        numa_set_cpu_node(i, acpi_srat_apic_node(lapic_list[i].id));
+}
+
 static __always_inline void __lvt_set_flags(struct lapic *lapic,
                                             int pin,
                                             uint32_t clear,
@@ -723,6 +816,7 @@ static uint8_t lapic_logid_cluster(int cpu_number)
 /* lapic_error_handler: handle a local APIC error interrupt */
 void lapic_error_handler(void)
 {
+    unsigned long long start = irq_stat_enter();
     uint32_t esr;
 
     system_pic->eoi(APIC_VEC_ERROR);
@@ -747,6 +841,8 @@ void lapic_error_handler(void)
         klog(KLOG_ERROR, APIC "received illegal interrupt vector");
     if (esr & APIC_ESR_ILLEGAL_REGISTER)
         klog(KLOG_ERROR, APIC "illegal register access");
+
+    irq_stat_exit(APIC_VEC_ERROR, start);
 }
 
 static void lapic_interrupt_setup(void)
@@ -758,23 +854,34 @@ static void lapic_interrupt_setup(void)
 }
 
 static void __lapic_send_ipi(uint8_t vec,
-                             uint8_t dest,
+                             uint32_t dest,
                              uint32_t destmode,
                              uint32_t shorthand,
                              uint8_t mode)
 {
-    uint32_t hi, lo;
+    uint32_t lo;
 
     lo = APIC_ICR_LO_LEVEL_ASSERT | destmode | vec;
     lo |= (uint32_t)mode << APIC_ICR_LO_DELMODE_SHIFT;
-    hi = 0;
 
-    if (!shorthand)
-        hi = (uint32_t)dest << APIC_ICR_HI_DEST_SHIFT;
-    else
+    if (shorthand) {
         lo |= shorthand;
+        dest = 0;
+    }
+
+    if (x2apic_mode) {
+        /*
+         * The x2APIC ICR takes a full 32-bit destination and is written
+         * with a single MSR access. Unlike an MMIO write, WRMSR to the ICR
+         * is not ordered with earlier stores, so fence them explicitly
+         * before the target CPUs can observe the IPI.
+         */
+        asm volatile("mfence; lfence" : : : "memory");
+        wrmsr(X2APIC_MSR_ICR, lo, dest);
+        return;
+    }
 
-    lapic_reg_write(APIC_REG_ICR_HI, hi);
+    lapic_reg_write(APIC_REG_ICR_HI, dest << APIC_ICR_HI_DEST_SHIFT);
     barrier();
     lapic_reg_write(APIC_REG_ICR_LO, lo);
 }
@@ -783,7 +890,7 @@ static void __lapic_send_ipi(uint8_t vec,
 // the set of processors addressed by dest or the given shorthand, with the
 // specified interrupt delivery mode.
 static void lapic_send_ipi(uint8_t vec,
-                           uint8_t dest,
+                           uint32_t dest,
                            uint32_t shorthand,
                            uint8_t mode)
 {
@@ -795,7 +902,7 @@ static void lapic_send_ipi(uint8_t vec,
 // Issues an interprocessor interrupt with the specified vector to a single
 // processor identified by `lapic_id`.
 static void lapic_send_ipi_phys(uint8_t vec,
-                                uint8_t lapic_id,
+                                uint32_t lapic_id,
                                 uint32_t shorthand,
                                 uint8_t mode)
 {
@@ -804,12 +911,12 @@ static void lapic_send_ipi_phys(uint8_t vec,
 
 #endif  // CONFIG(SMP)
 
-static int lapic_send_ipi_flat(unsigned int vec, cpumask_t cpumask)
+static int lapic_send_ipi_flat(unsigned int vec, const cpumask_t *cpumask)
 {
     if (vec < IRQ_BASE || vec > X86_NUM_INTERRUPT_VECTORS)
         return EINVAL;
 
-    lapic_send_ipi(vec, cpumask & 0xFF, 0, APIC_INT_MODE_FIXED);
+    lapic_send_ipi(vec, cpumask->bits[0] & 0xFF, 0, APIC_INT_MODE_FIXED);
     this_cpu_inc(ipis_sent);
     return 0;
 }
@@ -819,42 +926,121 @@ static int lapic_send_ipi_flat(unsigned int vec, cpumask_t cpumask)
  * Send an IPI to a set of processors specified by `cpumask`
  * in local APIC cluster addressing mode.
  */
-static int lapic_send_ipi_cluster(unsigned int vec, cpumask_t cpumask)
+/*
+ * __lapic_send_ipi_shorthand:
+ * Send an IPI using a destination shorthand if `targets` is all online CPUs
+ * or all except the current one, avoiding looping through clusters.
+ * Returns true if the IPI was sent.
+ */
+static bool __lapic_send_ipi_shorthand(unsigned int vec,
+                                       const cpumask_t *targets)
+{
+    const cpumask_t *online;
+    cpumask_t others;
+
+    online = cpumask_online();
+    if (cpumask_equal(targets, online)) {
+        lapic_send_ipi(vec, 0, APIC_ICR_LO_SHORTHAND_ALL, APIC_INT_MODE_FIXED);
+        return true;
+    }
+
+    others = *online;
+    cpumask_clear_cpu(&others, processor_id());
+    if (cpumask_equal(targets, &others)) {
+        lapic_send_ipi(
+            vec, 0, APIC_ICR_LO_SHORTHAND_OTHER, APIC_INT_MODE_FIXED);
+        return true;
+    }
+
+    return false;
+}
+
+static int lapic_send_ipi_cluster(unsigned int vec, const cpumask_t *cpumask)
 {
-    int cluster, ids, cpu_id;
-    cpumask_t online;
+    cpumask_t targets;
+    int cpu, cluster, ids;
 
     if (vec < IRQ_BASE || vec > X86_NUM_INTERRUPT_VECTORS)
         return EINVAL;
 
-    online = cpumask_online();
-    cpumask &= online;
-    cpu_id = processor_id();
+    cpumask_and(&targets, cpumask, cpumask_online());
 
     this_cpu_inc(ipis_sent);
 
-    /* check for common shorthands to avoid looping through clusters */
-    if (cpumask == online) {
-        lapic_send_ipi(vec, 0, APIC_ICR_LO_SHORTHAND_ALL, APIC_INT_MODE_FIXED);
+    if (__lapic_send_ipi_shorthand(vec, &targets))
         return 0;
+
+    /*
+     * Send an IPI to the required cpus in each cluster. CPUs are numbered
+     * sequentially within clusters of four, so the set bits are gathered
+     * cluster by cluster.
+     */
+    cluster = -1;
+    ids = 0;
+    for_each_cpu (cpu, &targets) {
+        if (cpu >= APIC_MAX_CLUSTER_CPUS)
+            break;
+
+        if (cpu >> 2 != cluster) {
+            if (ids)
+                lapic_send_ipi(vec, ids | cluster << 4, 0,
+                               APIC_INT_MODE_FIXED);
+            cluster = cpu >> 2;
+            ids = 0;
+        }
+        ids |= 1 << (cpu & 3);
     }
 
-    if (cpumask == (online & ~(CPUMASK_CPU(cpu_id)))) {
-        lapic_send_ipi(
-            vec, 0, APIC_ICR_LO_SHORTHAND_OTHER, APIC_INT_MODE_FIXED);
+    if (ids)
+        lapic_send_ipi(vec, ids | cluster << 4, 0, APIC_INT_MODE_FIXED);
+
+    return 0;
+}
+
+/*
+ * x2apic_send_ipi_cluster:
+ * Send an IPI to a set of processors specified by `cpumask` using x2APIC
+ * logical cluster addressing. Each cluster holds up to 16 processors, and
+ * there is no limit on the number of clusters.
+ */
+static int x2apic_send_ipi_cluster(unsigned int vec, const cpumask_t *cpumask)
+{
+    cpumask_t targets;
+    struct lapic *lapic;
+    uint32_t dest;
+    int cpu;
+
+    if (vec < IRQ_BASE || vec > X86_NUM_INTERRUPT_VECTORS)
+        return EINVAL;
+
+    cpumask_and(&targets, cpumask, cpumask_online());
+
+    this_cpu_inc(ipis_sent);
+
+    if (__lapic_send_ipi_shorthand(vec, &targets))
         return 0;
-    }
 
-    /* send an ipi to the required cpus in each cluster */
-    for (cluster = 0; cpumask && cluster < 16; cpumask >>= 4, ++cluster) {
-        ids = cpumask & 0xF;
-        if (!ids)
+    /*
+     * Merge the logical IDs of consecutive CPUs in the same cluster into a
+     * single IPI. Processor IDs are assigned in APIC ID order, so CPUs in a
+     * cluster are usually adjacent in the mask.
+     */
+    dest = 0;
+    for_each_cpu (cpu, &targets) {
+        lapic = cpu_var(local_apic, cpu);
+        if (!lapic)
             continue;
 
-        ids |= cluster << 4;
-        lapic_send_ipi(vec, ids, 0, APIC_INT_MODE_FIXED);
+        if (dest && (dest ^ lapic->logical_id) >> X2APIC_LDR_CLUSTER_SHIFT) {
+            lapic_send_ipi(vec, dest, 0, APIC_INT_MODE_FIXED);
+            dest = 0;
+        }
+        dest |= lapic->logical_id;
     }
 
+    if (dest)
+        lapic_send_ipi(vec, dest, 0, APIC_INT_MODE_FIXED);
+
     return 0;
 }
 
@@ -877,29 +1063,38 @@ int lapic_init(void)
         return 1;
     }
 
-    this_cpu_write(local_apic, lapic);
-
-    if (cpus_available <= APIC_MAX_FLAT_CPUS) {
-        lapic_reg_write(APIC_REG_DFR, APIC_DFR_MODEL_FLAT);
-        logical_id = lapic_logid_flat(cpu_number);
-    } else if (cpus_available > APIC_MAX_CLUSTER_CPUS) {
+    if (x2apic_mode) {
         /*
-         * TODO: give multiple CPUs same logical ID.
-         * Temporarily just use cluster mode for the maximum
-         * number of cluster CPUs.
+         * x2APIC mode always uses cluster addressing, with the logical ID
+         * fixed by hardware based on the processor's APIC ID.
          */
-        if (cpu_number >= APIC_MAX_CLUSTER_CPUS)
-            return 1;
-
-        lapic_reg_write(APIC_REG_DFR, APIC_DFR_MODEL_CLUSTER);
-        logical_id = lapic_logid_cluster(cpu_number);
+        lapic->logical_id = lapic_reg_read(APIC_REG_LDR);
     } else {
-        lapic_reg_write(APIC_REG_DFR, APIC_DFR_MODEL_CLUSTER);
-        logical_id = lapic_logid_cluster(cpu_number);
+        if (cpus_available <= APIC_MAX_FLAT_CPUS) {
+            lapic_reg_write(APIC_REG_DFR, APIC_DFR_MODEL_FLAT);
+            logical_id = lapic_logid_flat(cpu_number);
+        } else if (cpus_available > APIC_MAX_CLUSTER_CPUS) {
+            /*
+             * xAPIC cluster mode can only address 15 clusters of 4.
+             * Processors beyond that require x2APIC mode.
+             */
+            if (cpu_number >= APIC_MAX_CLUSTER_CPUS)
+                return 1;
+
+            lapic_reg_write(APIC_REG_DFR, APIC_DFR_MODEL_CLUSTER);
+            logical_id = lapic_logid_cluster(cpu_number);
+        } else {
+            lapic_reg_write(APIC_REG_DFR, APIC_DFR_MODEL_CLUSTER);
+            logical_id = lapic_logid_cluster(cpu_number);
+        }
+
+        lapic->logical_id = logical_id << APIC_LDR_ID_SHIFT;
+        lapic_reg_write(APIC_REG_LDR, lapic->logical_id);
     }
 
+    this_cpu_write(local_apic, lapic);
+
     lapic_reg_write(APIC_REG_TPR, 0);
-    lapic_reg_write(APIC_REG_LDR, logical_id << APIC_LDR_ID_SHIFT);
     lapic_reg_write(APIC_REG_TIMER_INITIAL, 0);
 
     /* program LVT entires */
@@ -1081,14 +1276,42 @@ static void apic_unmask(unsigned int irq)
     ioapic_unmask(ioapic, pin);
 }
 
+/*
+ * apic_route_irq:
+ * Route the specified IRQ to a single CPU, or to all CPUs if `cpu` is -1.
+ */
+static int apic_route_irq(unsigned int irq, int cpu)
+{
+    struct ioapic *ioapic;
+    unsigned int pin;
+    unsigned long irqstate;
+
+    ioapic = __ioapic_pin_from_set_irq(irq, &pin);
+    if (!ioapic)
+        return EINVAL;
+
+    if (cpu >= 0 && !cpu_var(local_apic, cpu))
+        return EINVAL;
+
+    spin_lock_irq(&ioapic_lock, &irqstate);
+    ioapic->pins[pin].cpu = cpu;
+    __ioapic_program_pin(ioapic, pin);
+    spin_unlock_irq(&ioapic_lock, irqstate);
+
+    return 0;
+}
+
 static struct pic apic = {.eoi = apic_eoi,
                           .mask = apic_mask,
                           .unmask = apic_unmask,
+                          .route_irq = apic_route_irq,
                           .irq_count = 0,
                           .name = "APIC"};
 
 bool apic_enabled(void) { return this_cpu_read(local_apic) != NULL; }
 
+unsigned int lapic_ipis_sent(int cpu) { return cpu_var(ipis_sent, cpu); }
+
 static void bsp_apic_fail(void)
 {
     this_cpu_write(local_apic, NULL);
@@ -1105,22 +1328,36 @@ int bsp_apic_init(void)
 
     irq_disable();
 
+    x2apic_mode = x2apic_preenabled() ||
+                  (CONFIG(X86_X2APIC) && cpu_supports(CPUID_X2APIC));
+
     ioapic_program_all();
-    lapic_virt_base = (addr_t)vmalloc(PAGE_SIZE);
-    map_page_kernel(
-        lapic_virt_base, lapic_phys_base, PROT_WRITE, PAGE_CP_UNCACHEABLE);
+
+    /* x2APIC registers are accessed through MSRs rather than MMIO */
+    if (!x2apic_mode) {
+        lapic_virt_base = (addr_t)vmalloc(PAGE_SIZE);
+        map_page_kernel(
+            lapic_virt_base, lapic_phys_base, PROT_WRITE, PAGE_CP_UNCACHEABLE);
+    }
 
     if (lapic_init() != 0) {
-        vfree((void *)lapic_virt_base);
+        if (!x2apic_mode)
+            vfree((void *)lapic_virt_base);
         bsp_apic_fail();
         return 1;
     }
 
-    if (cpus_available > APIC_MAX_FLAT_CPUS)
+    if (x2apic_mode)
+        apic.send_ipi = x2apic_send_ipi_cluster;
+    else if (cpus_available > APIC_MAX_FLAT_CPUS)
         apic.send_ipi = lapic_send_ipi_cluster;
     else
         apic.send_ipi = lapic_send_ipi_flat;
 
+    klog(KLOG_INFO,
+         APIC "local APICs in %s mode",
+         x2apic_mode ? "x2APIC" : "xAPIC");
+
     system_pic = &apic;
 
     irq_enable();
@@ -1164,6 +1401,8 @@ void apic_start_smp(unsigned int vector)
     for (unsigned apic = 1; apic < cpus_available; ++apic) {
         ap_active = false;
         prepare_ap_boot(next_processor_id);
+        numa_set_cpu_node(next_processor_id,
+                          acpi_srat_apic_node(lapic_list[apic].id));
         start = time_ns();
 
         int retries = 3;
@@ -21,6 +21,7 @@
 #include <radix/asm/idt.h>
 #include <radix/asm/pat.h>
 #include <radix/cpu.h>
+#include <radix/fpu.h>
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/percpu.h>
@@ -78,6 +79,7 @@ struct cpu_info {
     struct cache_info cache_info;
     long cpuid_extended_max;
     uint64_t cpu_extended_features;
+    unsigned long cpu_structured_features;
 };
 
 static DEFINE_PER_CPU(struct cpu_info, cpu_info);
@@ -135,6 +137,12 @@ void read_cpu_info(void)
     this_cpu_write(cpu_info.cpuid_max, cpuid_max);
     this_cpu_write(cpu_info.cpu_features, cpu_features);
 
+    /* store structured extended feature flags from cpuid 7 */
+    if (cpuid_max >= 7) {
+        cpuid_count(7, 0, buf[0], buf[1], buf[2], buf[3]);
+        this_cpu_write(cpu_info.cpu_structured_features, buf[1]);
+    }
+
     if (!cpu_shared_features)
         cpu_shared_features = cpu_features;
     else
@@ -176,6 +184,12 @@ bool cpu_supports_extended(uint64_t features)
            features;
 }
 
+bool cpu_supports_structured(unsigned long features)
+{
+    return (this_cpu_read(cpu_info.cpu_structured_features) & features) ==
+           features;
+}
+
 static void add_cache(unsigned char level,
                       unsigned char type,
                       unsigned long size,
@@ -826,6 +840,9 @@ int cpu_init(int ap)
     }
 
     pat_init();
+    i386_fpu_init(ap);
+    if (!ap)
+        i386_string_init();
     set_cpu_online(processor_id());
 
     return 0;
@@ -21,6 +21,7 @@
 #include <radix/asm/gdt.h>
 #include <radix/asm/regs.h>
 #include <radix/compiler.h>
+#include <radix/fpu.h>
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/smp.h>
@@ -52,10 +53,41 @@ void debug_handler(const struct interrupt_context *intctx)
          processor_id());
 }
 
-void double_fault_handler(const struct interrupt_context *intctx)
+// Raised by the first FPU instruction a task executes after being switched in.
+void device_not_available_handler(const struct interrupt_context *intctx)
 {
-    // TODO(frolv): Handle this.
-    panic("Double fault exception at eip %p", intctx->regs.ip);
+    if (!is_user_mode_interrupt(intctx)) {
+        panic("FPU used outside of kernel_fpu_begin at eip %p",
+              intctx->regs.ip);
+    }
+
+    i386_fpu_restore_current();
+}
+
+// Faults with a stack pointer this far above the bottom of a kernel stack are
+// considered overflows; the CPU may have been pushing a frame when it faulted.
+#define STACK_OVERFLOW_SLACK 256
+
+// Runs on the double fault TSS. The state of the faulting context was saved in
+// the CPU's main TSS by the task switch.
+void double_fault_handler(void)
+{
+    struct task *curr = current_task();
+    uint32_t ip, sp;
+
+    tss_saved_context(&ip, &sp);
+
+    if (curr && curr->stack_top) {
+        const uint32_t base = (uintptr_t)curr->stack_top - curr->stack_size;
+        if (sp >= base - PAGE_SIZE && sp < base + STACK_OVERFLOW_SLACK) {
+            panic("kernel stack overflow in task %d at eip %p, esp %p",
+                  curr->pid,
+                  (void *)ip,
+                  (void *)sp);
+        }
+    }
+
+    panic("Double fault exception at eip %p, esp %p", (void *)ip, (void *)sp);
 }
 
 void gpf_handler(const struct interrupt_context *intctx, uint32_t error)
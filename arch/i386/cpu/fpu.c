@@ -0,0 +1,393 @@
+/*
+ * arch/i386/cpu/fpu.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/assert.h>
+#include <radix/compiler.h>
+#include <radix/cpu.h>
+#include <radix/error.h>
+#include <radix/fpu.h>
+#include <radix/irqstate.h>
+#include <radix/kernel.h>
+#include <radix/klog.h>
+#include <radix/percpu.h>
+#include <radix/slab.h>
+#include <radix/smp.h>
+#include <radix/task.h>
+
+#include <string.h>
+
+// XSAVE state components.
+#define XFEATURE_X87 (1ULL << 0)
+#define XFEATURE_SSE (1ULL << 1)
+#define XFEATURE_AVX (1ULL << 2)
+
+#define XFEATURES_SUPPORTED (XFEATURE_X87 | XFEATURE_SSE | XFEATURE_AVX)
+
+// cpuid 0xD, sub-leaf 1 EAX bits.
+#define CPUID_XSAVEOPT (1 << 0)
+
+#define MXCSR_DEFAULT 0x1F80
+
+#define FNSAVE_STATE_SIZE 108
+#define FXSAVE_STATE_SIZE 512
+
+enum fpu_save_mode {
+    FPU_NONE,
+    FPU_FNSAVE,
+    FPU_FXSAVE,
+    FPU_XSAVE,
+    FPU_XSAVEOPT,
+};
+
+static enum fpu_save_mode fpu_mode = FPU_NONE;
+static uint64_t xfeatures;
+static size_t fpu_state_size;
+
+// Saved task states are opaque blocks of fpu_state_size bytes, laid out as
+// defined by the save instruction in use.
+static struct slab_cache *fpu_cache;
+
+// Clean FPU state copied into a task's area before its first use.
+static struct fpu_state *fpu_init_state;
+
+// The task whose FPU state was last loaded on each CPU. Its registers are
+// still live if the task hasn't since run its FPU code anywhere else.
+static DEFINE_PER_CPU(struct task *, fpu_owner) = NULL;
+
+// Whether the current task has used the FPU since it was switched in, i.e.
+// CR0.TS is clear and its registers must be saved when it is switched out.
+static DEFINE_PER_CPU(int, fpu_in_use) = 0;
+
+static DEFINE_PER_CPU(int, in_kernel_fpu) = 0;
+static DEFINE_PER_CPU(unsigned long, kernel_fpu_irqstate) = 0;
+
+static __always_inline void clts(void) { asm volatile("clts"); }
+static __always_inline void stts(void) { cpu_modify_cr0(0, CR0_TS); }
+
+static __always_inline void xsetbv(uint32_t reg, uint64_t val)
+{
+    asm volatile("xsetbv"
+                 :
+                 : "c"(reg), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+static __always_inline void fpu_reset(void)
+{
+    asm volatile("fninit");
+    if (fpu_mode >= FPU_FXSAVE) {
+        const uint32_t mxcsr = MXCSR_DEFAULT;
+        asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+    }
+}
+
+static void fpu_save(struct fpu_state *fpu)
+{
+    const uint32_t lo = xfeatures;
+    const uint32_t hi = xfeatures >> 32;
+
+    switch (fpu_mode) {
+    case FPU_XSAVEOPT:
+        asm volatile("xsaveopt (%0)"
+                     :
+                     : "r"(fpu), "a"(lo), "d"(hi)
+                     : "memory");
+        break;
+    case FPU_XSAVE:
+        asm volatile("xsave (%0)" : : "r"(fpu), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_FXSAVE:
+        asm volatile("fxsave (%0)" : : "r"(fpu) : "memory");
+        break;
+    case FPU_FNSAVE:
+        // fnsave reinitializes the FPU, so the registers no longer hold the
+        // owner's state.
+        asm volatile("fnsave (%0)" : : "r"(fpu) : "memory");
+        this_cpu_write(fpu_owner, NULL);
+        break;
+    default:
+        break;
+    }
+}
+
+static void fpu_restore(const struct fpu_state *fpu)
+{
+    const uint32_t lo = xfeatures;
+    const uint32_t hi = xfeatures >> 32;
+
+    switch (fpu_mode) {
+    case FPU_XSAVEOPT:
+    case FPU_XSAVE:
+        asm volatile("xrstor (%0)" : : "r"(fpu), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_FXSAVE:
+        asm volatile("fxrstor (%0)" : : "r"(fpu) : "memory");
+        break;
+    case FPU_FNSAVE:
+        asm volatile("frstor (%0)" : : "r"(fpu) : "memory");
+        break;
+    default:
+        break;
+    }
+}
+
+// Selects the save instruction and the set of XSAVE components. Must run
+// before the FPU is enabled on any CPU.
+static void fpu_detect(void)
+{
+    unsigned long a, b, c, d;
+
+    if (cpu_supports(CPUID_XSAVE)) {
+        cpuid_count(0xD, 0, a, b, c, d);
+        xfeatures = (((uint64_t)d << 32) | a) & XFEATURES_SUPPORTED;
+        if (!cpu_supports(CPUID_AVX)) {
+            xfeatures &= ~XFEATURE_AVX;
+        }
+
+        cpuid_count(0xD, 1, a, b, c, d);
+        fpu_mode = (a & CPUID_XSAVEOPT) ? FPU_XSAVEOPT : FPU_XSAVE;
+    } else if (cpu_supports(CPUID_FXSR)) {
+        fpu_mode = FPU_FXSAVE;
+        fpu_state_size = FXSAVE_STATE_SIZE;
+    } else {
+        fpu_mode = FPU_FNSAVE;
+        fpu_state_size = FNSAVE_STATE_SIZE;
+    }
+}
+
+// Sizes the per-task state areas and records the initial FPU state. Runs on
+// the BSP once its FPU has been enabled.
+static void fpu_setup_state(void)
+{
+    static const char *mode_names[] = {
+        [FPU_FNSAVE] = "fnsave",
+        [FPU_FXSAVE] = "fxsave",
+        [FPU_XSAVE] = "xsave",
+        [FPU_XSAVEOPT] = "xsaveopt",
+    };
+    unsigned long a, b, c, d;
+
+    if (fpu_mode >= FPU_XSAVE) {
+        // EBX reports the size required by the components enabled in XCR0.
+        cpuid_count(0xD, 0, a, b, c, d);
+        fpu_state_size = b;
+    }
+
+    // XSAVE requires 64-byte alignment and FXSAVE 16.
+    fpu_cache = create_cache(
+        "fpu_state", fpu_state_size, 64, SLAB_PANIC, NULL);
+
+    fpu_init_state = alloc_cache(fpu_cache);
+    if (IS_ERR(fpu_init_state)) {
+        panic("failed to allocate initial FPU state");
+    }
+
+    // The XSAVE header must be zeroed for the area to be restorable.
+    memset(fpu_init_state, 0, fpu_state_size);
+    fpu_reset();
+    fpu_save(fpu_init_state);
+
+    klog(KLOG_INFO,
+         "fpu: using %s, %lu byte state, xfeatures 0x%llx",
+         mode_names[fpu_mode],
+         (unsigned long)fpu_state_size,
+         xfeatures);
+}
+
+void i386_fpu_init(bool ap)
+{
+    if (!cpu_supports(CPUID_FPU)) {
+        // Without an FPU, every floating point instruction faults.
+        cpu_modify_cr0(0, CR0_EM);
+        if (!ap) {
+            klog(KLOG_WARNING, "fpu: no FPU present");
+        }
+        return;
+    }
+
+    if (!ap) {
+        fpu_detect();
+    }
+
+    cpu_modify_cr0(CR0_EM | CR0_TS, CR0_MP | CR0_NE);
+
+    if (fpu_mode >= FPU_FXSAVE) {
+        cpu_modify_cr4(0, CR4_OSFXSR | CR4_OSXMMEXCPT);
+    }
+    if (fpu_mode >= FPU_XSAVE) {
+        cpu_modify_cr4(0, CR4_OSXSAVE);
+        xsetbv(0, xfeatures);
+    }
+
+    if (!ap) {
+        fpu_setup_state();
+    }
+
+    // The first FPU instruction of any task faults and loads its state.
+    stts();
+}
+
+void i386_fpu_restore_current(void)
+{
+    struct task *curr = current_task();
+    const int cpu = processor_id();
+
+    if (fpu_mode == FPU_NONE) {
+        klog(KLOG_ERROR,
+             "fpu: process %d used the FPU, which is not present",
+             curr->pid);
+        irq_disable();
+        task_exit(curr, ENODEV);
+    }
+
+    clts();
+    this_cpu_write(fpu_in_use, 1);
+
+    // The task's registers may still be loaded from the last time it ran here,
+    // in which case all that was needed was to clear TS.
+    if (curr->fpu && this_cpu_read(fpu_owner) == curr && curr->fpu_cpu == cpu) {
+        return;
+    }
+
+    if (!curr->fpu) {
+        struct fpu_state *fpu = alloc_cache(fpu_cache);
+        if (IS_ERR(fpu)) {
+            // The task has not touched the FPU yet; exiting it releases the
+            // FPU through the finished task path of i386_fpu_switch_out.
+            klog(KLOG_ERROR,
+                 "fpu: failed to allocate FPU state for process %d",
+                 curr->pid);
+            irq_disable();
+            task_exit(curr, ERR_VAL(fpu));
+        }
+        memcpy(fpu, fpu_init_state, fpu_state_size);
+        curr->fpu = fpu;
+    }
+
+    fpu_restore(curr->fpu);
+    this_cpu_write(fpu_owner, curr);
+    curr->fpu_cpu = cpu;
+}
+
+void i386_kernel_fpu_begin(void)
+{
+    unsigned long irqstate;
+
+    assert(fpu_mode != FPU_NONE);
+
+    irq_save(irqstate);
+    assert(!this_cpu_read(in_kernel_fpu));
+    this_cpu_write(in_kernel_fpu, 1);
+    this_cpu_write(kernel_fpu_irqstate, irqstate);
+
+    clts();
+
+    if (this_cpu_read(fpu_in_use)) {
+        fpu_save(current_task()->fpu);
+        this_cpu_write(fpu_in_use, 0);
+    }
+
+    // The task's registers are about to be overwritten, so they will have to
+    // be restored from its saved state on its next FPU instruction.
+    this_cpu_write(fpu_owner, NULL);
+    fpu_reset();
+}
+
+void i386_kernel_fpu_end(void)
+{
+    assert(this_cpu_read(in_kernel_fpu));
+
+    stts();
+    this_cpu_write(in_kernel_fpu, 0);
+    irq_restore(this_cpu_read(kernel_fpu_irqstate));
+}
+
+bool i386_kernel_fpu_has_sse2(void)
+{
+    return fpu_mode >= FPU_FXSAVE && cpu_supports(CPUID_SSE2);
+}
+
+// Called with interrupts disabled before switching away from `prev`.
+void i386_fpu_switch_out(struct task *prev)
+{
+    // A finished task's state is about to be freed along with it, so there is
+    // no point in saving it, and the registers must not be left claimed by it.
+    if (prev->state == TASK_FINISHED) {
+        if (this_cpu_read(fpu_owner) == prev) {
+            this_cpu_write(fpu_owner, NULL);
+        }
+        if (this_cpu_read(fpu_in_use)) {
+            this_cpu_write(fpu_in_use, 0);
+            stts();
+        }
+        return;
+    }
+
+    if (!this_cpu_read(fpu_in_use)) {
+        return;
+    }
+
+    // `prev` ran FPU code during its timeslice. Its registers are saved but
+    // left loaded, so that if it is the next task to use the FPU on this CPU
+    // they don't need to be restored.
+    fpu_save(prev->fpu);
+    this_cpu_write(fpu_in_use, 0);
+    stts();
+}
+
+int i386_fpu_fork(struct task *task, struct task *parent)
+{
+    unsigned long irqstate;
+
+    if (!parent->fpu) {
+        return 0;
+    }
+
+    struct fpu_state *fpu = alloc_cache(fpu_cache);
+    if (IS_ERR(fpu)) {
+        return ENOMEM;
+    }
+
+    irq_save(irqstate);
+
+    // Bring the parent's saved state up to date if it is currently live.
+    if (parent == current_task() && this_cpu_read(fpu_in_use)) {
+        fpu_save(parent->fpu);
+        if (fpu_mode == FPU_FNSAVE) {
+            fpu_restore(parent->fpu);
+            this_cpu_write(fpu_owner, parent);
+        }
+    }
+
+    irq_restore(irqstate);
+
+    memcpy(fpu, parent->fpu, fpu_state_size);
+    task->fpu = fpu;
+    task->fpu_cpu = -1;
+
+    return 0;
+}
+
+void i386_fpu_release(struct task *task)
+{
+    if (!task->fpu) {
+        return;
+    }
+
+    free_cache(fpu_cache, task->fpu);
+    task->fpu = NULL;
+}
@@ -18,14 +18,23 @@
 
 #include <radix/asm/gdt.h>
 #include <radix/compiler.h>
+#include <radix/cpu.h>
 #include <radix/irq.h>
 #include <radix/percpu.h>
 
 #include <string.h>
 
-DEFINE_PER_CPU(uint64_t, gdt[8]);
+DEFINE_PER_CPU(uint64_t, gdt[GDT_NUM_ENTRIES]);
 DEFINE_PER_CPU(uint32_t, tss[26]);
 
+// Double faults are handled through a task gate, which switches to a separate
+// TSS and stack. This allows overflows of a kernel stack into its guard page to
+// be reported, as the faulting stack cannot be used.
+#define DF_STACK_SIZE 4096
+
+static DEFINE_PER_CPU(uint32_t, df_tss[26]);
+static DEFINE_PER_CPU(uint8_t, df_stack[DF_STACK_SIZE]);
+
 #define GDT_SIZE (sizeof gdt)
 #define TSS_SIZE (sizeof tss)
 
@@ -34,7 +43,10 @@ extern void tss_load(uintptr_t gdt_offset);
 
 extern uint32_t bsp_stack_top;
 
+extern void double_fault(void);
+
 static void tss_init(uint32_t *tss_ptr, uint32_t esp0, uint32_t ss0);
+static void df_tss_init(uint32_t *tss_ptr, uint8_t *stack);
 
 #define GDT_ACCESSED   (1 << 0)
 #define GDT_RW         (1 << 1)
@@ -84,13 +96,19 @@ static __always_inline void gdt_set(
     raw_cpu_write(gdt[entry], gdt_entry(base, lim, access, flags));
 }
 
-static void __gdt_init(uint64_t *gdt_ptr, uint32_t *tss_ptr, uint32_t fsbase)
+static void __gdt_init(uint64_t *gdt_ptr,
+                       uint32_t *tss_ptr,
+                       uint32_t *df_tss_ptr,
+                       uint8_t *df_stack_ptr,
+                       uint32_t fsbase)
 {
-    uint32_t tss_base;
+    uint32_t tss_base, df_tss_base;
 
     tss_base = (uintptr_t)tss_ptr;
+    df_tss_base = (uintptr_t)df_tss_ptr;
 
     tss_init(tss_ptr, bsp_stack_top, GDT_OFFSET(GDT_KERNEL_DATA));
+    df_tss_init(df_tss_ptr, df_stack_ptr);
 
     gdt_ptr[GDT_NULL] = gdt_entry(0, 0, 0, 0);
     gdt_ptr[GDT_KERNEL_CODE] =
@@ -110,18 +128,27 @@ static void __gdt_init(uint64_t *gdt_ptr, uint32_t *tss_ptr, uint32_t fsbase)
         gdt_entry(fsbase, 0xFFFFFFFF, GDT_DATA | GDT_DPL(3), GDT_FLAGS_DEFAULT);
     gdt_ptr[GDT_GS] =
         gdt_entry(0, 0xFFFFFFFF, GDT_DATA | GDT_DPL(3), GDT_FLAGS_DEFAULT);
+    gdt_ptr[GDT_DF_TSS] =
+        gdt_entry(df_tss_base,
+                  df_tss_base + TSS_SIZE,
+                  GDT_PRESENT | GDT_DPL(0) | GDT_EXEC | GDT_ACCESSED,
+                  GDT_FLAGS_32BIT);
 
     gdt_load(gdt_ptr, GDT_SIZE);
     tss_load(GDT_OFFSET(GDT_TSS));
 }
 
 // Populates and loads an early boot GDT for the bootstrap processor.
-void gdt_init_early(void) { __gdt_init(gdt, tss, 0); }
+void gdt_init_early(void) { __gdt_init(gdt, tss, df_tss, df_stack, 0); }
 
 // Populates and loads the global descriptor table for the current CPU.
 void gdt_init(uint32_t fsbase)
 {
-    __gdt_init(raw_cpu_ptr(gdt), raw_cpu_ptr(tss), fsbase);
+    __gdt_init(raw_cpu_ptr(gdt),
+               raw_cpu_ptr(tss),
+               raw_cpu_ptr(df_tss),
+               raw_cpu_ptr(df_stack),
+               fsbase);
 }
 
 // Populates and loads the GDT belonging to the given CPU ID on the current CPU.
@@ -129,7 +156,11 @@ void gdt_init(uint32_t fsbase)
 // of processor_id(), which requires a functional GDT).
 void gdt_init_cpu(int cpu, uint32_t fsbase)
 {
-    __gdt_init(cpu_ptr(gdt, cpu), cpu_ptr(tss, cpu), fsbase);
+    __gdt_init(cpu_ptr(gdt, cpu),
+               cpu_ptr(tss, cpu),
+               cpu_ptr(df_tss, cpu),
+               cpu_ptr(df_stack, cpu),
+               fsbase);
 }
 
 // Sets the fsbase on the current CPU during early boot. Called by the BSP
@@ -163,6 +194,19 @@ void gdt_set_gsbase(uint32_t base)
 
 void tss_set_stack(uint32_t new_esp) { this_cpu_write(tss[1], new_esp); }
 
+// Returns the address of the current CPU's TSS ESP0 field, which holds the top
+// of the running task's kernel stack.
+uint32_t *tss_stack_ptr(void) { return raw_cpu_ptr(&tss[1]); }
+
+// Reads the instruction and stack pointers saved in the current CPU's TSS when
+// it last switched away through a task gate, i.e. at a double fault.
+void tss_saved_context(uint32_t *ip, uint32_t *sp)
+{
+    // EIP at offset 0x20, ESP at offset 0x38.
+    *ip = this_cpu_read(tss[8]);
+    *sp = this_cpu_read(tss[14]);
+}
+
 // Initializes the task state segment.
 //
 // ESP0 is the value assigned to the stack pointer in a cross-privilege
@@ -179,3 +223,30 @@ static void tss_init(uint32_t *tss_ptr, uint32_t esp0, uint32_t ss0)
     // IOPB at offset 0x66.
     tss_ptr[25] = TSS_SIZE << 16;
 }
+
+// Initializes the double fault TSS to run the double fault handler with
+// interrupts disabled on `stack`, in the kernel's address space.
+static void df_tss_init(uint32_t *tss_ptr, uint8_t *stack)
+{
+    memset(tss_ptr, 0, TSS_SIZE);
+
+    // CR3 at offset 0x1C. This runs during boot, while the kernel's page
+    // directory is loaded.
+    tss_ptr[7] = cpu_read_cr3();
+    // EIP and EFLAGS at offsets 0x20 and 0x24.
+    tss_ptr[8] = (uintptr_t)double_fault;
+    // Bit 1 of EFLAGS is always set. IF is clear.
+    tss_ptr[9] = 0x2;
+    // ESP at offset 0x38.
+    tss_ptr[14] = (uintptr_t)(stack + DF_STACK_SIZE);
+    // ES, CS, SS, DS, FS and GS at offsets 0x48 to 0x5C. FS and GS are kept
+    // so that per-CPU variables remain accessible.
+    tss_ptr[18] = GDT_OFFSET(GDT_KERNEL_DATA);
+    tss_ptr[19] = GDT_OFFSET(GDT_KERNEL_CODE);
+    tss_ptr[20] = GDT_OFFSET(GDT_KERNEL_DATA);
+    tss_ptr[21] = GDT_OFFSET(GDT_KERNEL_DATA);
+    tss_ptr[22] = GDT_OFFSET(GDT_FS);
+    tss_ptr[23] = GDT_OFFSET(GDT_GS);
+    // IOPB at offset 0x66.
+    tss_ptr[25] = TSS_SIZE << 16;
+}
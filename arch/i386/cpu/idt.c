@@ -89,9 +89,9 @@ void idt_init_early(void)
             GDT_OFFSET(GDT_KERNEL_CODE),
             IDT_32BIT_TRAP_GATE);
     idt_set(X86_EXCEPTION_DF,
-            double_fault,
-            GDT_OFFSET(GDT_KERNEL_CODE),
-            IDT_32BIT_TRAP_GATE);
+            NULL,
+            GDT_OFFSET(GDT_DF_TSS),
+            IDT_32BIT_TASK_GATE);
     idt_set(X86_EXCEPTION_CP,
             coprocessor_segment,
             GDT_OFFSET(GDT_KERNEL_CODE),
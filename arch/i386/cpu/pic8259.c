@@ -123,7 +123,7 @@ static void pic8259_unmask(unsigned int irq)
 }
 
 static int pic8259_send_ipi(__unused unsigned int vec,
-                            __unused cpumask_t cpumask)
+                            __unused const cpumask_t *cpumask)
 {
     /* no-op */
     return 0;
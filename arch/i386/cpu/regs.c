@@ -18,6 +18,7 @@
 
 #include <radix/asm/gdt.h>
 #include <radix/asm/regs.h>
+#include <radix/asm/syscall.h>
 #include <radix/cpu.h>
 #include <radix/klog.h>
 #include <radix/kthread.h>
@@ -126,3 +127,44 @@ int user_task_setup(struct task *task, paddr_t stack, addr_t entry)
 
     return 0;
 }
+
+int user_task_fork_setup(struct task *task, const struct task *parent)
+{
+    const struct syscall_context *ctx =
+        (const struct syscall_context *)parent->stack_top - 1;
+
+    // Copy the parent's ring 3 interrupt stack frame onto the new task's kernel
+    // stack so that it returns to the same user context.
+    uint32_t *ks = task->stack_top;
+    ks[-1] = ctx->ss;
+    ks[-2] = ctx->sp;
+    ks[-3] = ctx->flags;
+    ks[-4] = ctx->cs;
+    ks[-5] = ctx->ip;
+
+    struct regs *regs = &task->regs;
+
+    regs->sp = (addr_t)(ks - 5);
+    regs->ip = (uint32_t)task_user_entry;
+
+    // Registers preserved across the system call are restored from the
+    // parent's context. The return value of fork in the new task is 0.
+    regs->di = ctx->di;
+    regs->si = ctx->si;
+    regs->bx = ctx->bx;
+    regs->bp = ctx->bp;
+    regs->ax = 0;
+    regs->cx = 0;
+    regs->dx = 0;
+
+    regs->gs = GDT_OFFSET(GDT_GS);
+    regs->fs = GDT_OFFSET(GDT_FS);
+    regs->es = ctx->es;
+    regs->ds = ctx->ds;
+    regs->ss = GDT_OFFSET(GDT_KERNEL_DATA);
+
+    regs->cs = GDT_OFFSET(GDT_KERNEL_CODE);
+    regs->flags = EFLAGS_IF | EFLAGS_ID;
+
+    return 0;
+}
@@ -19,9 +19,23 @@
 #include <radix/asm/pic.h>
 #include <radix/asm/regs.h>
 #include <radix/event.h>
+#include <radix/irq.h>
+#include <radix/sched.h>
+#include <radix/softirq.h>
 
 void arch_event_handler(__unused const struct interrupt_context *intctx)
 {
+    unsigned long long start = irq_stat_enter();
+
     system_pic->eoi(0);
-    event_handler();
+    bool resched = event_handler();
+
+    // Record the interrupt and run softirqs before scheduling, as the task may
+    // be switched out.
+    irq_stat_exit(APIC_VEC_TIMER, start);
+    irq_exit();
+
+    if (resched && !softirq_defer_schedule(SCHED_REPLACE)) {
+        schedule(SCHED_REPLACE);
+    }
 }
@@ -20,5 +20,6 @@
 #define ARCH_I386_RADIX_ACPI_H
 
 int acpi_parse_madt(void);
+void acpi_numa_init(void);
 
 #endif /* ARCH_I386_RADIX_ACPI_H */
@@ -40,6 +40,7 @@ struct ioapic_pin {
     uint8_t irq;
     uint8_t bus_type;
     uint16_t flags;
+    int16_t cpu; /* CPU to which the IRQ is routed, or -1 for all */
 };
 
 struct ioapic {
@@ -73,6 +74,7 @@ struct lapic_lvt {
 
 struct lapic {
     uint32_t id;
+    uint32_t logical_id;
     uint8_t timer_mode;
     uint8_t timer_div;
     uint16_t lvt_count;
@@ -97,6 +99,7 @@ struct lapic {
 
 int bsp_apic_init(void);
 bool apic_enabled(void);
+unsigned int lapic_ipis_sent(int cpu);
 
 struct ioapic *ioapic_add(int id, addr_t phys_addr, int irq_base);
 struct ioapic *ioapic_from_id(unsigned int id);
@@ -119,6 +122,7 @@ int ioapic_unmask(struct ioapic *ioapic, unsigned int pin);
 
 struct lapic *lapic_add(unsigned int id);
 struct lapic *lapic_from_id(unsigned int id);
+void lapic_numa_init(void);
 
 int lapic_set_lvt_mode(uint32_t apic_id, unsigned int pin, uint32_t mode);
 int lapic_set_lvt_polarity(uint32_t apic_id, unsigned int pin, int polarity);
@@ -30,21 +30,18 @@
 
 #include <stdint.h>
 
-#define __x86_atomic_op_generic(p, val, op)            \
-    do {                                               \
-        unsigned long __aog_irqstate;                  \
-        assert(ALIGNED((uintptr_t)(p), sizeof(*(p)))); \
-        irq_save(__aog_irqstate);                      \
-        *((volatile typeof(p))p)op val;                \
-        irq_restore(__aog_irqstate);                   \
-    } while (0)
-
 #define __x86_atomic_inst(p, val, inst, size)       \
     asm volatile(inst __X86_SUFFIX_##size " %1, %0" \
                  : "=m"(*p)                         \
                  : "r"(val)                         \
                  : "memory")
 
+#define __x86_atomic_locked_inst(p, val, inst, size)           \
+    asm volatile(__X86_LOCK inst __X86_SUFFIX_##size " %1, %0" \
+                 : "+m"(*p)                                    \
+                 : "r"(val)                                    \
+                 : "memory")
+
 #define __x86_atomic_inst_ret(p, inst, size)            \
     ({                                                  \
         typeof(*(p)) __air_ret;                         \
@@ -57,27 +54,22 @@
 #define atomic_write_1(p, val) __x86_atomic_inst(p, val, "mov", 1)
 #define atomic_write_2(p, val) __x86_atomic_inst(p, val, "mov", 2)
 #define atomic_write_4(p, val) __x86_atomic_inst(p, val, "mov", 4)
-#define atomic_write_8(p, val) __x86_atomic_op_generic(p, val, =)
 
-#define atomic_or_1(p, val) __x86_atomic_inst(p, val, "or", 1)
-#define atomic_or_2(p, val) __x86_atomic_inst(p, val, "or", 2)
-#define atomic_or_4(p, val) __x86_atomic_inst(p, val, "or", 4)
-#define atomic_or_8(p, val) __x86_atomic_op_generic(p, val, |=)
+#define atomic_or_1(p, val) __x86_atomic_locked_inst(p, val, "or", 1)
+#define atomic_or_2(p, val) __x86_atomic_locked_inst(p, val, "or", 2)
+#define atomic_or_4(p, val) __x86_atomic_locked_inst(p, val, "or", 4)
 
-#define atomic_and_1(p, val) __x86_atomic_inst(p, val, "and", 1)
-#define atomic_and_2(p, val) __x86_atomic_inst(p, val, "and", 2)
-#define atomic_and_4(p, val) __x86_atomic_inst(p, val, "and", 4)
-#define atomic_and_8(p, val) __x86_atomic_op_generic(p, val, &=)
+#define atomic_and_1(p, val) __x86_atomic_locked_inst(p, val, "and", 1)
+#define atomic_and_2(p, val) __x86_atomic_locked_inst(p, val, "and", 2)
+#define atomic_and_4(p, val) __x86_atomic_locked_inst(p, val, "and", 4)
 
-#define atomic_add_1(p, val) __x86_atomic_inst(p, val, "add", 1)
-#define atomic_add_2(p, val) __x86_atomic_inst(p, val, "add", 2)
-#define atomic_add_4(p, val) __x86_atomic_inst(p, val, "add", 4)
-#define atomic_add_8(p, val) __x86_atomic_op_generic(p, val, +=)
+#define atomic_add_1(p, val) __x86_atomic_locked_inst(p, val, "add", 1)
+#define atomic_add_2(p, val) __x86_atomic_locked_inst(p, val, "add", 2)
+#define atomic_add_4(p, val) __x86_atomic_locked_inst(p, val, "add", 4)
 
-#define atomic_sub_1(p, val) __x86_atomic_inst(p, val, "sub", 1)
-#define atomic_sub_2(p, val) __x86_atomic_inst(p, val, "sub", 2)
-#define atomic_sub_4(p, val) __x86_atomic_inst(p, val, "sub", 4)
-#define atomic_sub_8(p, val) __x86_atomic_op_generic(p, val, -=)
+#define atomic_sub_1(p, val) __x86_atomic_locked_inst(p, val, "sub", 1)
+#define atomic_sub_2(p, val) __x86_atomic_locked_inst(p, val, "sub", 2)
+#define atomic_sub_4(p, val) __x86_atomic_locked_inst(p, val, "sub", 4)
 
 #define atomic_read_1(p) __x86_atomic_inst_ret(p, "mov", 1)
 #define atomic_read_2(p) __x86_atomic_inst_ret(p, "mov", 2)
@@ -123,35 +115,92 @@
 #define atomic_cmpxchg_2(p, old, new) __x86_atomic_cmpxchg(p, old, new, 2)
 #define atomic_cmpxchg_4(p, old, new) __x86_atomic_cmpxchg(p, old, new, 4)
 
-extern void __read_not_implemented_for_size(void);
-extern void __swap_not_implemented_for_size(void);
-extern void __cmpxchg_not_implemented_for_size(void);
-extern void __fetch_add_not_implemented_for_size(void);
-
-// TODO(frolv): Implement these.
-#define atomic_read_8(p)                   \
-    ({                                     \
-        typeof(*(p)) __ar_ret = 0;         \
-        __read_not_implemented_for_size(); \
-        __ar_ret;                          \
+//
+// 64-bit operations are built on top of cmpxchg8b.
+//
+
+// Compares the 64-bit value at `p` with `old` and replaces it with `new` if
+// they are equal. Returns the value that was at `p`.
+static __always_inline uint64_t __x86_cmpxchg8b(volatile uint64_t *p,
+                                                uint64_t old,
+                                                uint64_t new)
+{
+    uint64_t prev;
+
+    asm volatile(__X86_LOCK "cmpxchg8b %1"
+                 : "=A"(prev), "+m"(*p)
+                 : "b"((uint32_t)new), "c"((uint32_t)(new >> 32)), "0"(old)
+                 : "memory");
+    return prev;
+}
+
+// Conversions between the type pointed to by `p` and a 64-bit integer. These
+// go through a union rather than a cast so that the 8-byte operations still
+// compile when the atomic_* macros are expanded for smaller types.
+#define __x86_to_u64(p, val) \
+    ({                       \
+        union {              \
+            uint64_t u;      \
+            typeof(*(p)) v;  \
+        } __tu = { 0 };      \
+        __tu.v = (val);      \
+        __tu.u;              \
     })
 
-#define atomic_swap_8(p, val)              \
-    ({                                     \
-        __swap_not_implemented_for_size(); \
-        val;                               \
+#define __x86_from_u64(p, val) \
+    ({                         \
+        union {                \
+            uint64_t u;        \
+            typeof(*(p)) v;    \
+        } __fu;                \
+        __fu.u = (val);        \
+        __fu.v;                \
     })
 
-#define atomic_cmpxchg_8(p, old, new)         \
-    ({                                        \
-        __cmpxchg_not_implemented_for_size(); \
-        old;                                  \
+// Atomically replaces the 64-bit value at `p` with `op(old, val)`, retrying
+// until no other CPU has modified it in between. Evaluates to the old value.
+//
+// The initial plain read may tear, but a torn value will simply fail the first
+// comparison and be replaced by the real contents of `p`.
+#define __x86_atomic_rmw_8(p, val, op)                                         \
+    ({                                                                         \
+        volatile uint64_t *__rmw_p = (volatile uint64_t *)(p);                 \
+        const uint64_t __rmw_v = __x86_to_u64(p, val);                         \
+        uint64_t __rmw_old = *__rmw_p;                                         \
+        uint64_t __rmw_prev;                                                   \
+        while ((__rmw_prev = __x86_cmpxchg8b(                                  \
+                    __rmw_p, __rmw_old, op(__rmw_old, __rmw_v))) != __rmw_old) \
+            __rmw_old = __rmw_prev;                                            \
+        __rmw_old;                                                             \
     })
 
-#define atomic_fetch_add_8(p, val)              \
-    ({                                          \
-        __fetch_add_not_implemented_for_size(); \
-        val;                                    \
-    })
+#define __x86_op_set(old, val) (val)
+#define __x86_op_or(old, val)  ((old) | (val))
+#define __x86_op_and(old, val) ((old) & (val))
+#define __x86_op_add(old, val) ((old) + (val))
+#define __x86_op_sub(old, val) ((old) - (val))
+
+#define atomic_write_8(p, val) ((void)__x86_atomic_rmw_8(p, val, __x86_op_set))
+#define atomic_or_8(p, val)    ((void)__x86_atomic_rmw_8(p, val, __x86_op_or))
+#define atomic_and_8(p, val)   ((void)__x86_atomic_rmw_8(p, val, __x86_op_and))
+#define atomic_add_8(p, val)   ((void)__x86_atomic_rmw_8(p, val, __x86_op_add))
+#define atomic_sub_8(p, val)   ((void)__x86_atomic_rmw_8(p, val, __x86_op_sub))
+
+// A compare-exchange which writes back the value it compares against reads the
+// 64-bit value atomically, without modifying it.
+#define atomic_read_8(p)                                               \
+    __x86_from_u64(p, __x86_cmpxchg8b((volatile uint64_t *)(p), 0, 0))
+
+#define atomic_swap_8(p, val)                                   \
+    __x86_from_u64(p, __x86_atomic_rmw_8(p, val, __x86_op_set))
+
+#define atomic_cmpxchg_8(p, old, new)                        \
+    __x86_from_u64(p,                                        \
+                   __x86_cmpxchg8b((volatile uint64_t *)(p), \
+                                   __x86_to_u64(p, old),     \
+                                   __x86_to_u64(p, new)))
+
+#define atomic_fetch_add_8(p, val)                              \
+    __x86_from_u64(p, __x86_atomic_rmw_8(p, val, __x86_op_add))
 
 #endif  // ARCH_I386_RADIX_ATOMIC_H
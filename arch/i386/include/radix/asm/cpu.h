@@ -51,10 +51,12 @@ static __always_inline unsigned long cpuid_supported(void)
 
 bool cpu_supports(uint64_t features);
 bool cpu_supports_extended(uint64_t features);
+bool cpu_supports_structured(unsigned long features);
 
 #define __arch_cache_line_size()   i386_cache_line_size()
 #define __arch_set_kernel_stack(s) i386_set_kernel_stack(s)
 #define __arch_cache_str()         i386_cache_str()
+#define __arch_string_benchmark()  i386_string_benchmark()
 
 void read_cpu_info(void);
 
@@ -65,4 +67,8 @@ unsigned long i386_cache_line_size(void);
 void i386_set_kernel_stack(void *stack);
 char *i386_cache_str(void);
 
+/* Selects the string function implementations for the CPU's features. */
+void i386_string_init(void);
+void i386_string_benchmark(void);
+
 #endif /* ARCH_I386_RADIX_CPU_H */
@@ -109,6 +109,9 @@
 #define CPUID_EXT_RDTSCP  (1ULL << 27)
 #define CPUID_EXT_X64     (1ULL << 29)
 
+// cpuid 07h (sub-leaf 0) EBX bits.
+#define CPUID_SEF_ERMS (1UL << 9)
+
 // cpuid 80000001h ECX bits.
 #define CPUID_EXT_LAHF      (1ULL << 32)
 #define CPUID_EXT_LZCNT     (1ULL << 37)
@@ -198,6 +201,14 @@ static __always_inline unsigned long cpu_read_cr3(void)
         : "=a"(a), "=r"(b), "=c"(c), "=d"(d) \
         : "0"(eax))
 
+#define cpuid_count(eax, ecx, a, b, c, d)    \
+    asm volatile(                            \
+        "xchg %%ebx, %1\n\t"                 \
+        "cpuid\n\t"                          \
+        "xchg %%ebx, %1"                     \
+        : "=a"(a), "=r"(b), "=c"(c), "=d"(d) \
+        : "0"(eax), "2"(ecx))
+
 #define __modify_control_register(cr, clear, set) \
     asm volatile("movl %%" cr                     \
                  ", %%eax\n\t"                    \
@@ -235,6 +246,13 @@ static __always_inline void cpu_update_flags(unsigned long clear,
         : "r"(~clear), "r"(set));
 }
 
+static __always_inline unsigned long long cpu_read_tsc(void)
+{
+    unsigned long long tsc;
+    asm volatile("rdtsc" : "=A"(tsc));
+    return tsc;
+}
+
 #define cpu_pause() asm volatile("pause")
 
 #endif /* __KERNEL__ */
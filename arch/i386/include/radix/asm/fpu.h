@@ -0,0 +1,52 @@
+/*
+ * arch/i386/include/radix/asm/fpu.h
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCH_I386_RADIX_FPU_H
+#define ARCH_I386_RADIX_FPU_H
+
+#ifndef RADIX_FPU_H
+#error only <radix/fpu.h> can be included directly
+#endif
+
+#include <stdbool.h>
+
+struct task;
+
+// Enables the FPU and any SSE/AVX state on the current CPU. On the BSP, this
+// also selects the save instruction and sizes per-task state areas.
+void i386_fpu_init(bool ap);
+
+// Loads the current task's FPU state following a device-not-available fault.
+void i386_fpu_restore_current(void);
+
+void i386_kernel_fpu_begin(void);
+void i386_kernel_fpu_end(void);
+bool i386_kernel_fpu_has_sse2(void);
+
+void i386_fpu_switch_out(struct task *prev);
+int i386_fpu_fork(struct task *task, struct task *parent);
+void i386_fpu_release(struct task *task);
+
+#define __arch_kernel_fpu_begin    i386_kernel_fpu_begin
+#define __arch_kernel_fpu_end      i386_kernel_fpu_end
+#define __arch_kernel_fpu_has_sse2 i386_kernel_fpu_has_sse2
+#define __arch_fpu_switch_out      i386_fpu_switch_out
+#define __arch_fpu_fork            i386_fpu_fork
+#define __arch_fpu_release         i386_fpu_release
+
+#endif  // ARCH_I386_RADIX_FPU_H
@@ -29,7 +29,9 @@ enum {
     GDT_USER_DATA,
     GDT_TSS,
     GDT_FS,
-    GDT_GS
+    GDT_GS,
+    GDT_DF_TSS,
+    GDT_NUM_ENTRIES
 };
 
 #define GDT_DESCRIPTOR_SIZE 8
@@ -43,5 +45,7 @@ void gdt_set_fsbase(uint32_t base);
 void gdt_set_gsbase(uint32_t base);
 
 void tss_set_stack(uint32_t new_esp);
+uint32_t *tss_stack_ptr(void);
+void tss_saved_context(uint32_t *ip, uint32_t *sp);
 
 #endif /* ARCH_I386_RADIX_GDT_H */
@@ -19,12 +19,15 @@
 #ifndef ARCH_I386_RADIX_IPI_H
 #define ARCH_I386_RADIX_IPI_H
 
+#include <radix/cpumask.h>
+
 #define __arch_send_panic_ipi       i386_send_panic_ipi
-#define __arch_send_timer_ipi       i386_send_timer_ipi
 #define __arch_send_sched_wake(cpu) i386_send_sched_wake(cpu)
 
+#define __arch_send_call_function_ipi(mask) i386_send_call_function_ipi(mask)
+
 void i386_send_panic_ipi(void);
-void i386_send_timer_ipi(void);
 void i386_send_sched_wake(int cpu);
+void i386_send_call_function_ipi(const cpumask_t *mask);
 
 #endif  // ARCH_I386_RADIX_IPI_H
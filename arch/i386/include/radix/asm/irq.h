@@ -31,21 +31,35 @@
 #define VECTOR_TO_IRQ(vec) ((vec)-IRQ_BASE)
 #define IRQ_TO_VECTOR(irq) ((irq) + IRQ_BASE)
 
-#define __arch_irq_init      interrupt_init
-#define __arch_in_irq        in_interrupt
-#define __arch_irq_install   install_interrupt_handler
-#define __arch_irq_uninstall uninstall_interrupt_handler
+#define NR_IRQS (VECTOR_TO_IRQ(X86_LAST_ASSIGNABLE_VECTOR) + 1)
+
+#define __arch_irq_init       interrupt_init
+#define __arch_irq_stats_dump interrupt_stats_dump
+#define __arch_in_irq         in_interrupt
+#define __arch_irq_install    install_interrupt_handler
+#define __arch_irq_uninstall  uninstall_interrupt_handler
 
 void interrupt_init(void);
 int in_interrupt(void);
 
 DECLARE_PER_CPU(int, interrupt_depth);
 
+// Interrupt accounting. Every handler brackets its work with these to record
+// the number of interrupts received on each vector and, with CONFIG_IRQ_STATS,
+// the time spent handling them.
+unsigned long long irq_stat_enter(void);
+void irq_stat_exit(unsigned int vector, unsigned long long start);
+void irq_stats_init(void);
+void interrupt_stats_dump(void);
+
 int __arch_request_irq(struct irq_descriptor *desc);
 int __arch_request_fixed_irq(unsigned int irq,
                              void *device,
-                             irq_handler_t handler);
+                             irq_handler_t handler,
+                             struct irq_thread *thread);
 void __arch_release_irq(unsigned int irq, void *device);
+int __arch_route_irq(unsigned int irq, int cpu);
+unsigned long __arch_irq_count(unsigned int irq, int cpu);
 
 static __always_inline void __arch_mask_irq(unsigned int irq)
 {
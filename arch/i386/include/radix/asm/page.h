@@ -86,6 +86,9 @@ int i386_map_pages_vmm(const struct vmm_space *vmm,
 
 int i386_unmap_pages(addr_t virt, size_t n);
 
+bool i386_page_is_cow(addr_t virt);
+int i386_remap_cow_page(addr_t virt, paddr_t phys);
+
 int i386_set_cache_policy(addr_t virt, enum cache_policy policy);
 
 void i386_tlb_flush_all(int sync);
@@ -108,6 +111,9 @@ void i386_tlb_flush_page(addr_t addr, int sync);
 void i386_tlb_flush_page_lazy(addr_t addr);
 
 void i386_switch_address_space(struct vmm_space *vmm);
+void i386_address_space_stats(unsigned long *loads, unsigned long *avoided);
+void i386_set_lazy_address_space(bool enable);
+bool i386_sync_kernel_pde(addr_t virt);
 
 static __always_inline addr_t __arch_pa(addr_t v)
 {
@@ -126,8 +132,13 @@ static __always_inline addr_t __arch_pa(addr_t v)
 #define __arch_map_pages            i386_map_pages
 #define __arch_map_pages_vmm        i386_map_pages_vmm
 #define __arch_unmap_pages          i386_unmap_pages
+#define __arch_page_is_cow          i386_page_is_cow
+#define __arch_remap_cow_page       i386_remap_cow_page
 #define __arch_set_cache_policy     i386_set_cache_policy
 #define __arch_switch_address_space i386_switch_address_space
+#define __arch_address_space_stats  i386_address_space_stats
+#define __arch_set_lazy_address_space i386_set_lazy_address_space
+#define __arch_sync_kernel_mapping    i386_sync_kernel_pde
 
 #define __arch_tlb_flush_all            i386_tlb_flush_all
 #define __arch_tlb_flush_nonglobal      i386_tlb_flush_nonglobal
@@ -67,6 +67,9 @@
 #define _PAGE_BIT_PAT      7
 #define _PAGE_BIT_GLOBAL   8
 
+// Software-defined bits, ignored by the MMU.
+#define _PAGE_BIT_COW 9
+
 #if CONFIG(X86_NX)
 #define _PAGE_BIT_NX 63
 #endif  // CONFIG(X86_NX)
@@ -80,6 +83,7 @@
 #define PAGE_DIRTY    (((pteval_t)1) << _PAGE_BIT_DIRTY)
 #define PAGE_PAT      (((pteval_t)1) << _PAGE_BIT_PAT)
 #define PAGE_GLOBAL   (((pteval_t)1) << _PAGE_BIT_GLOBAL)
+#define PAGE_COW      (((pteval_t)1) << _PAGE_BIT_COW)
 
 #if CONFIG(X86_NX)
 #define PAGE_NX (((pteval_t)1) << _PAGE_BIT_NX)
@@ -23,9 +23,10 @@
 
 struct pic {
     void (*eoi)(unsigned int);
-    int (*send_ipi)(unsigned int, cpumask_t);
+    int (*send_ipi)(unsigned int, const cpumask_t *);
     void (*mask)(unsigned int);
     void (*unmask)(unsigned int);
+    int (*route_irq)(unsigned int, int);
     unsigned int irq_count;
     char name[16];
 };
@@ -47,7 +47,8 @@ struct regs {
     uint32_t ip;
     uint32_t flags;
 
-    // TODO(frolv): FPU, SSE, etc.
+    // FPU, SSE and AVX state is saved separately, only for tasks which use it.
+    // See arch/i386/cpu/fpu.c.
 };
 
 // The layout of the stack during an interrupt, as set up by _interrupt_common
@@ -20,13 +20,39 @@
 #define ARCH_I386_RADIX_SYSCALL_H
 
 #define X86_SYS_EXIT     0
-#define X86_NUM_SYSCALLS 1
+#define X86_SYS_FORK     1
+#define X86_SYS_GETPID   2
+#define X86_NUM_SYSCALLS 3
 
 #if !__ASSEMBLY__
 
+#include <stdint.h>
+
+// The layout of a user task's kernel stack during a system call, as set up by
+// syscall and sysenter_entry in arch/i386/irq/syscall.S. It sits directly below
+// the task's stack_top.
+struct syscall_context {
+    uint32_t args[2];
+    uint32_t pad[3];
+    uint32_t di;
+    uint32_t si;
+    uint32_t bx;
+    uint32_t es;
+    uint32_t ds;
+    uint32_t bp;
+
+    // Pushed by the CPU on entry from ring 3.
+    uint32_t ip;
+    uint32_t cs;
+    uint32_t flags;
+    uint32_t sp;
+    uint32_t ss;
+};
+
 void arch_syscall_init(void);
 
 void syscall(void);
+void sysenter_entry(void);
 
 extern void *syscall_table[X86_NUM_SYSCALLS];
 
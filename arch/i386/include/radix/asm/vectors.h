@@ -77,7 +77,7 @@
 
 #define IPI_VEC_PANIC         0xC0
 #define IPI_VEC_TLB_SHOOTDOWN 0xC1
-#define IPI_VEC_TIMER_ACTION  0xC2
+#define IPI_VEC_CALL_FUNCTION 0xC2
 #define IPI_VEC_SCHED_WAKE    0xC3
 
 // x86 syscall interrupt uses vector 222 (0xde).
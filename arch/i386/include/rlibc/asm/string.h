@@ -27,11 +27,31 @@
 
 #include <stddef.h>
 
+#ifdef __KERNEL__
+/*
+ * Calls of at least these sizes go to out-of-line implementations selected at
+ * boot for the CPU's features (see arch/i386/lib/string.c). Smaller calls are
+ * handled inline.
+ */
+#define __MEMSET_LARGE 256
+#define __MEMCPY_LARGE 256
+#define __MEMCHR_LARGE 64
+
+extern void *(*__memset_large)(void *, int, size_t);
+extern void *(*__memcpy_large)(void *, const void *, size_t);
+extern void *(*__memchr_large)(const void *, int, size_t);
+#endif
+
 #define __ARCH_HAS_MEMSET
 static __always_inline void *memset(void *s, int c, size_t n)
 {
     int a, b;
 
+#ifdef __KERNEL__
+    if (n >= __MEMSET_LARGE)
+        return __memset_large(s, c, n);
+#endif
+
     if (n > 0) {
         asm volatile(
             "rep\n\t"
@@ -49,6 +69,11 @@ static __always_inline void *memcpy(void *dst, const void *src, size_t n)
 {
     int a, b, c;
 
+#ifdef __KERNEL__
+    if (n >= __MEMCPY_LARGE)
+        return __memcpy_large(dst, src, n);
+#endif
+
     if (n > 0) {
         asm volatile(
             "rep\n\t"
@@ -76,6 +101,11 @@ static __always_inline void *memchr(const void *s, int c, size_t n)
     if (!n)
         return NULL;
 
+#ifdef __KERNEL__
+    if (n >= __MEMCHR_LARGE)
+        return __memchr_large(s, c, n);
+#endif
+
     asm volatile(
         "repne\n\t"
         "scasb\n\t"
@@ -24,6 +24,7 @@
 #include <radix/irq.h>
 #include <radix/kernel.h>
 #include <radix/slab.h>
+#include <radix/softirq.h>
 #include <radix/task.h>
 
 #include <string.h>
@@ -39,8 +40,11 @@ static void irq_nop(void *device);
 
 /* interrupt handler functions */
 static struct irq_descriptor irq_descriptors[X86_NUM_INTERRUPT_VECTORS] = {
-    [0 ... X86_NUM_INTERRUPT_VECTORS - 1] = {
-        .handler = irq_nop, .device = NULL, .flags = 0, .next = NULL}};
+    [0 ... X86_NUM_INTERRUPT_VECTORS - 1] = {.handler = irq_nop,
+                                             .device = NULL,
+                                             .flags = 0,
+                                             .thread = NULL,
+                                             .next = NULL}};
 
 static uint8_t num_irq_descriptors[X86_NUM_INTERRUPT_VECTORS] = {
     [0 ... X86_NUM_INTERRUPT_VECTORS - 1] = 1};
@@ -144,6 +148,11 @@ int __arch_request_irq(struct irq_descriptor *desc)
         return vector;
     }
 
+    // A threaded IRQ's number must be known before it can first fire.
+    if (desc->thread) {
+        irq_thread_set_irq(desc->thread, VECTOR_TO_IRQ(vector));
+    }
+
     if (irq_descriptors[vector].handler == irq_nop) {
         memcpy(&irq_descriptors[vector], desc, sizeof *desc);
         kfree(desc);
@@ -159,7 +168,8 @@ int __arch_request_irq(struct irq_descriptor *desc)
 
 int __arch_request_fixed_irq(unsigned int irq,
                              void *device,
-                             irq_handler_t handler)
+                             irq_handler_t handler,
+                             struct irq_thread *thread)
 {
     struct irq_descriptor *desc;
     unsigned long irqstate;
@@ -187,6 +197,7 @@ int __arch_request_fixed_irq(unsigned int irq,
 
     desc->handler = handler;
     desc->device = device;
+    desc->thread = thread;
     desc->next = NULL;
 
     spin_unlock_irq(&irq_vector_spinlock, irqstate);
@@ -219,6 +230,7 @@ void __arch_release_irq(unsigned int irq, void *device)
             desc->handler = irq_nop;
             desc->device = NULL;
             desc->flags = 0;
+            desc->thread = NULL;
             if (irq <= system_pic->irq_count) {
                 system_pic->mask(irq);
             }
@@ -232,15 +244,36 @@ void __arch_release_irq(unsigned int irq, void *device)
     spin_unlock_irq(&irq_vector_spinlock, irqstate);
 }
 
+/*
+ * __arch_route_irq:
+ * Route the specified IRQ to a single CPU, or to all CPUs if `cpu` is -1.
+ * Only IRQs connected to the system PIC can be routed.
+ */
+int __arch_route_irq(unsigned int irq, int cpu)
+{
+    if (!system_pic->route_irq || irq >= system_pic->irq_count)
+        return EINVAL;
+
+    return system_pic->route_irq(irq, cpu);
+}
+
 // Common interrupt handler. Calls handler functions for specified interrupt.
 void interrupt_handler(__unused struct interrupt_context *intctx, int vector)
 {
+    unsigned long long start = irq_stat_enter();
+
     system_pic->eoi(vector);
 
     struct irq_descriptor *desc = &irq_descriptors[vector];
     for (; desc; desc = desc->next) {
         desc->handler(desc->device);
+        if (desc->thread) {
+            irq_thread_wake(desc->thread);
+        }
     }
+
+    irq_stat_exit(vector, start);
+    irq_exit();
 }
 
 int in_interrupt(void) { return this_cpu_read(interrupt_depth) > 0; }
@@ -264,10 +297,12 @@ void interrupt_init(void)
 
     irq_descriptors[IPI_VEC_PANIC].flags |= IRQ_RESERVED;
     irq_descriptors[IPI_VEC_TLB_SHOOTDOWN].flags |= IRQ_RESERVED;
-    irq_descriptors[IPI_VEC_TIMER_ACTION].flags |= IRQ_RESERVED;
+    irq_descriptors[IPI_VEC_CALL_FUNCTION].flags |= IRQ_RESERVED;
     irq_descriptors[IPI_VEC_SCHED_WAKE].flags |= IRQ_RESERVED;
 
     next_shared_vector = IRQ_BASE + system_pic->irq_count;
+
+    irq_stats_init();
 }
 
 /* irq_nop: no-op IRQ handler */
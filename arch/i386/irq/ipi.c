@@ -19,13 +19,14 @@
 #include <radix/asm/idt.h>
 #include <radix/asm/pic.h>
 #include <radix/ipi.h>
+#include <radix/irq.h>
 #include <radix/sched.h>
 #include <radix/smp.h>
-#include <radix/timer.h>
+#include <radix/softirq.h>
 
 void panic_shutdown(void);
 void tlb_shootdown(void);
-void timer_action(void);
+void call_function(void);
 void sched_wake(void);
 
 // Configures IPI vectors.
@@ -41,8 +42,8 @@ void arch_ipi_init(void)
             GDT_OFFSET(GDT_KERNEL_CODE),
             IDT_32BIT_INTERRUPT_GATE);
 
-    idt_set(IPI_VEC_TIMER_ACTION,
-            timer_action,
+    idt_set(IPI_VEC_CALL_FUNCTION,
+            call_function,
             GDT_OFFSET(GDT_KERNEL_CODE),
             IDT_32BIT_INTERRUPT_GATE);
 
@@ -54,27 +55,41 @@ void arch_ipi_init(void)
 
 void i386_send_panic_ipi(void)
 {
-    system_pic->send_ipi(IPI_VEC_PANIC, CPUMASK_ALL_OTHER);
+    const cpumask_t others = CPUMASK_ALL_OTHER;
+    system_pic->send_ipi(IPI_VEC_PANIC, &others);
 }
 
-void i386_send_timer_ipi(void)
+void i386_send_call_function_ipi(const cpumask_t *mask)
 {
-    system_pic->send_ipi(IPI_VEC_TIMER_ACTION, CPUMASK_ALL_OTHER);
+    system_pic->send_ipi(IPI_VEC_CALL_FUNCTION, mask);
 }
 
 void i386_send_sched_wake(int cpu)
 {
-    system_pic->send_ipi(IPI_VEC_SCHED_WAKE, CPUMASK_CPU(cpu));
+    const cpumask_t target = CPUMASK_CPU(cpu);
+    system_pic->send_ipi(IPI_VEC_SCHED_WAKE, &target);
 }
 
-void timer_action_handler(__unused const struct interrupt_context *intctx)
+void call_function_handler(__unused const struct interrupt_context *intctx)
 {
-    system_pic->eoi(IPI_VEC_TIMER_ACTION);
-    handle_timer_action();
+    unsigned long long start = irq_stat_enter();
+
+    system_pic->eoi(IPI_VEC_CALL_FUNCTION);
+    smp_call_function_interrupt();
+
+    irq_stat_exit(IPI_VEC_CALL_FUNCTION, start);
 }
 
 void sched_wake_handler(__unused const struct interrupt_context *intctx)
 {
+    unsigned long long start = irq_stat_enter();
+
     system_pic->eoi(IPI_VEC_SCHED_WAKE);
-    schedule(SCHED_PREEMPT);
+
+    // Record the interrupt before scheduling, as the task may be switched out.
+    irq_stat_exit(IPI_VEC_SCHED_WAKE, start);
+
+    if (!softirq_defer_schedule(SCHED_PREEMPT)) {
+        schedule(SCHED_PREEMPT);
+    }
 }
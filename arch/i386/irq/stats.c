@@ -0,0 +1,160 @@
+/*
+ * arch/i386/irq/stats.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/asm/apic.h>
+#include <radix/config.h>
+#include <radix/cpu.h>
+#include <radix/irq.h>
+#include <radix/klog.h>
+#include <radix/percpu.h>
+#include <radix/smp.h>
+
+#include <stdbool.h>
+
+#define IRQ_STATS "irq: "
+
+// Number of times each interrupt vector has been received by each CPU.
+static DEFINE_PER_CPU(unsigned long[X86_NUM_INTERRUPT_VECTORS], irq_counts);
+
+#if CONFIG(IRQ_STATS)
+
+// Handler times are bucketed by powers of four, with the first bucket holding
+// times below 2^IRQ_HIST_SHIFT cycles and the last everything from 1M up.
+#define IRQ_HIST_BUCKETS 8
+#define IRQ_HIST_SHIFT   8
+
+struct irq_timing {
+    unsigned long long total;
+    unsigned long long max;
+    unsigned int hist[IRQ_HIST_BUCKETS];
+};
+
+// Time spent in the handler of each non-exception vector by each CPU,
+// measured in TSC cycles.
+static DEFINE_PER_CPU(struct irq_timing[X86_NUM_INTERRUPT_VECTORS - IRQ_BASE],
+                      irq_timings);
+
+static bool irq_timing_enabled = false;
+
+static __always_inline unsigned int irq_hist_bucket(unsigned long long cycles)
+{
+    unsigned int bucket = 0;
+
+    cycles >>= IRQ_HIST_SHIFT;
+    while (cycles && bucket < IRQ_HIST_BUCKETS - 1) {
+        cycles >>= 2;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+#endif  // CONFIG(IRQ_STATS)
+
+void irq_stats_init(void)
+{
+#if CONFIG(IRQ_STATS)
+    irq_timing_enabled = cpu_supports(CPUID_TSC);
+#endif
+}
+
+// Returns the timestamp at which an interrupt handler started, to be passed to
+// irq_stat_exit when it completes.
+unsigned long long irq_stat_enter(void)
+{
+#if CONFIG(IRQ_STATS)
+    if (irq_timing_enabled) {
+        return cpu_read_tsc();
+    }
+#endif
+    return 0;
+}
+
+// Records the completion of an interrupt on `vector` whose handler started at
+// `start`.
+void irq_stat_exit(unsigned int vector, unsigned long long start)
+{
+    ++(*raw_cpu_ptr(&irq_counts))[vector];
+
+#if CONFIG(IRQ_STATS)
+    if (!irq_timing_enabled || vector < IRQ_BASE) {
+        return;
+    }
+
+    const unsigned long long cycles = cpu_read_tsc() - start;
+    struct irq_timing *t = &(*raw_cpu_ptr(&irq_timings))[vector - IRQ_BASE];
+
+    t->total += cycles;
+    if (cycles > t->max) {
+        t->max = cycles;
+    }
+    ++t->hist[irq_hist_bucket(cycles)];
+#else
+    (void)start;
+#endif
+}
+
+unsigned long __arch_irq_count(unsigned int irq, int cpu)
+{
+    return cpu_var(irq_counts, cpu)[IRQ_TO_VECTOR(irq)];
+}
+
+// Logs interrupt counts for every vector which has been received, and the
+// distribution of its handler times on each CPU.
+void interrupt_stats_dump(void)
+{
+    unsigned int vector;
+    unsigned long count;
+    int cpu;
+
+#if CONFIG(IRQ_STATS)
+    klog(KLOG_INFO,
+         IRQ_STATS "vec  cpu      count   avg(cyc)   max(cyc)  "
+                   "<256 <1K <4K <16K <64K <256K <1M >=1M");
+#else
+    klog(KLOG_INFO, IRQ_STATS "vec  cpu      count");
+#endif
+
+    for (vector = IRQ_BASE; vector < X86_NUM_INTERRUPT_VECTORS; ++vector) {
+        for_each_cpu (cpu, cpumask_online()) {
+            count = cpu_var(irq_counts, cpu)[vector];
+            if (count == 0) {
+                continue;
+            }
+
+#if CONFIG(IRQ_STATS)
+            const struct irq_timing *t =
+                &cpu_var(irq_timings, cpu)[vector - IRQ_BASE];
+
+            klog(KLOG_INFO,
+                 IRQ_STATS "0x%02X %3d %10lu %10llu %10llu  "
+                           "%4u %3u %3u %4u %4u %5u %3u %4u",
+                 vector, cpu, count, t->total / count, t->max,
+                 t->hist[0], t->hist[1], t->hist[2], t->hist[3],
+                 t->hist[4], t->hist[5], t->hist[6], t->hist[7]);
+#else
+            klog(KLOG_INFO, IRQ_STATS "0x%02X %3d %10lu", vector, cpu, count);
+#endif
+        }
+    }
+
+    for_each_cpu (cpu, cpumask_online()) {
+        klog(KLOG_INFO,
+             IRQ_STATS "cpu %d sent %u IPIs", cpu, lapic_ipis_sent(cpu));
+    }
+}
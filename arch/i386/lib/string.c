@@ -0,0 +1,518 @@
+/*
+ * arch/i386/lib/string.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Out-of-line implementations of the memory functions for large sizes. The
+// inline versions in <rlibc/asm/string.h> call through the __*_large pointers,
+// which are pointed at the best implementations for the CPU at boot.
+
+#include <radix/compiler.h>
+#include <radix/config.h>
+#include <radix/cpu.h>
+#include <radix/fpu.h>
+#include <radix/kernel.h>
+#include <radix/klog.h>
+#include <radix/mm.h>
+#include <radix/time.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Sizes from which stores bypass the cache. Zeroing or copying a whole page
+// usually happens just before it is handed to a user or a device, and would
+// otherwise evict the working set.
+#define NT_THRESHOLD PAGE_SIZE
+
+// The SSE2 memchr has to save and restore FPU state, which only pays off for
+// longer scans.
+#define MEMCHR_SSE2_THRESHOLD 512
+
+typedef uint32_t __attribute__((__may_alias__)) word_t;
+
+static void *memset_stosl(void *s, int c, size_t n)
+{
+    const uint32_t pattern = (uint8_t)c * 0x01010101U;
+    int a, b;
+
+    asm volatile(
+        "rep\n\t"
+        "stosl\n\t"
+        "movl %4, %%ecx\n\t"
+        "andl $3, %%ecx\n\t"
+        "rep\n\t"
+        "stosb"
+        : "=&c"(a), "=&D"(b)
+        : "a"(pattern), "0"(n / 4), "g"(n), "1"(s)
+        : "memory");
+
+    return s;
+}
+
+// With enhanced rep movsb/stosb (ERMS), the byte string instructions are
+// microcoded to move whole cache lines and outperform their dword forms.
+static void *memset_erms(void *s, int c, size_t n)
+{
+    int a, b;
+
+    asm volatile(
+        "rep\n\t"
+        "stosb"
+        : "=&c"(a), "=&D"(b)
+        : "a"(c), "0"(n), "1"(s)
+        : "memory");
+
+    return s;
+}
+
+static void *memcpy_movsl(void *dst, const void *src, size_t n)
+{
+    int a, b, c;
+
+    asm volatile(
+        "rep\n\t"
+        "movsl\n\t"
+        "movl %4, %%ecx\n\t"
+        "andl $3, %%ecx\n\t"
+        "rep\n\t"
+        "movsb"
+        : "=&c"(a), "=&D"(b), "=&S"(c)
+        : "0"(n / 4), "g"(n), "1"(dst), "2"(src)
+        : "memory");
+
+    return dst;
+}
+
+static void *memcpy_erms(void *dst, const void *src, size_t n)
+{
+    int a, b, c;
+
+    asm volatile(
+        "rep\n\t"
+        "movsb"
+        : "=&c"(a), "=&D"(b), "=&S"(c)
+        : "0"(n), "1"(dst), "2"(src)
+        : "memory");
+
+    return dst;
+}
+
+// The best cached implementations, used for sizes below NT_THRESHOLD and for
+// the unaligned edges of non-temporal operations.
+static void *(*memset_cached)(void *, int, size_t) = memset_stosl;
+static void *(*memcpy_cached)(void *, const void *, size_t) = memcpy_movsl;
+
+// memset using SSE2 non-temporal stores from general purpose registers, which
+// don't require saving any FPU state.
+static void *memset_nt(void *s, int c, size_t n)
+{
+    const uint32_t pattern = (uint8_t)c * 0x01010101U;
+    uint8_t *p = s;
+
+    if (n < NT_THRESHOLD) {
+        return memset_cached(s, c, n);
+    }
+
+    size_t head = -(uintptr_t)p & 63;
+    memset_cached(p, c, head);
+    p += head;
+    n -= head;
+
+    size_t body = n & ~63;
+    uint8_t *end = p + body;
+
+    asm volatile(
+        "1:\n\t"
+        "movnti %2, 0(%0)\n\t"
+        "movnti %2, 4(%0)\n\t"
+        "movnti %2, 8(%0)\n\t"
+        "movnti %2, 12(%0)\n\t"
+        "movnti %2, 16(%0)\n\t"
+        "movnti %2, 20(%0)\n\t"
+        "movnti %2, 24(%0)\n\t"
+        "movnti %2, 28(%0)\n\t"
+        "movnti %2, 32(%0)\n\t"
+        "movnti %2, 36(%0)\n\t"
+        "movnti %2, 40(%0)\n\t"
+        "movnti %2, 44(%0)\n\t"
+        "movnti %2, 48(%0)\n\t"
+        "movnti %2, 52(%0)\n\t"
+        "movnti %2, 56(%0)\n\t"
+        "movnti %2, 60(%0)\n\t"
+        "addl $64, %0\n\t"
+        "cmpl %1, %0\n\t"
+        "jne 1b\n\t"
+        "sfence"
+        : "+r"(p)
+        : "r"(end), "r"(pattern)
+        : "memory", "cc");
+
+    memset_cached(p, c, n - body);
+    return s;
+}
+
+static void *memcpy_nt(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    uint32_t a, b;
+
+    if (n < NT_THRESHOLD) {
+        return memcpy_cached(dst, src, n);
+    }
+
+    size_t head = -(uintptr_t)d & 63;
+    memcpy_cached(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    size_t body = n & ~63;
+    uint8_t *end = d + body;
+
+    asm volatile(
+        "1:\n\t"
+        "movl 0(%1), %2\n\t"
+        "movl 4(%1), %3\n\t"
+        "movnti %2, 0(%0)\n\t"
+        "movnti %3, 4(%0)\n\t"
+        "movl 8(%1), %2\n\t"
+        "movl 12(%1), %3\n\t"
+        "movnti %2, 8(%0)\n\t"
+        "movnti %3, 12(%0)\n\t"
+        "movl 16(%1), %2\n\t"
+        "movl 20(%1), %3\n\t"
+        "movnti %2, 16(%0)\n\t"
+        "movnti %3, 20(%0)\n\t"
+        "movl 24(%1), %2\n\t"
+        "movl 28(%1), %3\n\t"
+        "movnti %2, 24(%0)\n\t"
+        "movnti %3, 28(%0)\n\t"
+        "movl 32(%1), %2\n\t"
+        "movl 36(%1), %3\n\t"
+        "movnti %2, 32(%0)\n\t"
+        "movnti %3, 36(%0)\n\t"
+        "movl 40(%1), %2\n\t"
+        "movl 44(%1), %3\n\t"
+        "movnti %2, 40(%0)\n\t"
+        "movnti %3, 44(%0)\n\t"
+        "movl 48(%1), %2\n\t"
+        "movl 52(%1), %3\n\t"
+        "movnti %2, 48(%0)\n\t"
+        "movnti %3, 52(%0)\n\t"
+        "movl 56(%1), %2\n\t"
+        "movl 60(%1), %3\n\t"
+        "movnti %2, 56(%0)\n\t"
+        "movnti %3, 60(%0)\n\t"
+        "addl $64, %1\n\t"
+        "addl $64, %0\n\t"
+        "cmpl %4, %0\n\t"
+        "jne 1b\n\t"
+        "sfence"
+        : "+r"(d), "+r"(s), "=&r"(a), "=&r"(b)
+        : "r"(end)
+        : "memory", "cc");
+
+    memcpy_cached(d, s, n - body);
+    return dst;
+}
+
+static void *memchr_scasb(const void *s, int c, size_t n)
+{
+    void *ret;
+    int a;
+
+    if (n == 0) {
+        return NULL;
+    }
+
+    asm volatile(
+        "repne\n\t"
+        "scasb\n\t"
+        "je 1f\n\t"
+        "movl $1, %0\n"
+        "1:\tdecl %0"
+        : "=D"(ret), "=&c"(a)
+        : "a"(c), "0"(s), "1"(n)
+        : "memory");
+
+    return ret;
+}
+
+// Checks a word at a time for the byte, using the fact that subtracting 1 from
+// each byte of a word only borrows into the top bit of a byte which was 0.
+static void *memchr_swar(const void *s, int c, size_t n)
+{
+    const uint8_t *p = s;
+    const uint8_t ch = c;
+
+    for (; n > 0 && !ALIGNED((uintptr_t)p, 4); --n, ++p) {
+        if (*p == ch) {
+            return (void *)p;
+        }
+    }
+
+    const uint32_t pattern = ch * 0x01010101U;
+    for (; n >= 4; n -= 4, p += 4) {
+        uint32_t v = *(const word_t *)p ^ pattern;
+        if ((v - 0x01010101U) & ~v & 0x80808080U) {
+            break;
+        }
+    }
+
+    for (; n > 0; --n, ++p) {
+        if (*p == ch) {
+            return (void *)p;
+        }
+    }
+
+    return NULL;
+}
+
+static void *memchr_sse2(const void *s, int c, size_t n)
+{
+    const uint8_t *p = s;
+    const uint8_t ch = c;
+    uint32_t mask = 0;
+
+    if (n < MEMCHR_SSE2_THRESHOLD) {
+        return memchr_swar(s, c, n);
+    }
+
+    size_t head = -(uintptr_t)p & 15;
+    const void *found = memchr_swar(p, c, head);
+    if (found) {
+        return (void *)found;
+    }
+    p += head;
+    n -= head;
+
+    kernel_fpu_begin();
+
+    // Broadcast the byte to all of xmm1, then compare 16 bytes at a time.
+    // The kernel is built without SSE, so the compiler neither uses the xmm
+    // registers itself nor accepts them as clobbers.
+    asm volatile(
+        "movd %3, %%xmm1\n\t"
+        "punpcklbw %%xmm1, %%xmm1\n\t"
+        "punpcklwd %%xmm1, %%xmm1\n\t"
+        "pshufd $0, %%xmm1, %%xmm1\n"
+        "1:\n\t"
+        "movdqa (%0), %%xmm0\n\t"
+        "pcmpeqb %%xmm1, %%xmm0\n\t"
+        "pmovmskb %%xmm0, %2\n\t"
+        "testl %2, %2\n\t"
+        "jnz 2f\n\t"
+        "addl $16, %0\n\t"
+        "subl $16, %1\n\t"
+        "cmpl $16, %1\n\t"
+        "jae 1b\n"
+        "2:"
+        : "+r"(p), "+r"(n), "=&r"(mask)
+        : "r"((uint32_t)ch)
+        : "memory", "cc");
+
+    kernel_fpu_end();
+
+    if (mask) {
+        return (void *)(p + __builtin_ctz(mask));
+    }
+
+    return memchr_swar(p, c, n);
+}
+
+void *(*__memset_large)(void *, int, size_t) = memset_stosl;
+void *(*__memcpy_large)(void *, const void *, size_t) = memcpy_movsl;
+void *(*__memchr_large)(const void *, int, size_t) = memchr_scasb;
+
+struct string_impl {
+    const char *name;
+    void *func;
+    bool available;
+};
+
+enum { STRING_MEMSET, STRING_MEMCPY, STRING_MEMCHR, STRING_NUM_FUNCS };
+
+// Implementations of each function, from most to least preferred.
+static struct string_impl string_impls[STRING_NUM_FUNCS][3] = {
+    [STRING_MEMSET] = {
+        { "nt", memset_nt, false },
+        { "erms", memset_erms, false },
+        { "stosl", memset_stosl, true },
+    },
+    [STRING_MEMCPY] = {
+        { "nt", memcpy_nt, false },
+        { "erms", memcpy_erms, false },
+        { "movsl", memcpy_movsl, true },
+    },
+    [STRING_MEMCHR] = {
+        { "sse2", memchr_sse2, false },
+        { "swar", memchr_swar, true },
+        { "scasb", memchr_scasb, true },
+    },
+};
+
+static struct string_impl *string_best_impl(int func)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(string_impls[func]); ++i) {
+        if (string_impls[func][i].available) {
+            return &string_impls[func][i];
+        }
+    }
+
+    // The last implementation of each function is always available.
+    __builtin_unreachable();
+}
+
+void i386_string_init(void)
+{
+    const bool erms = cpu_supports_structured(CPUID_SEF_ERMS);
+    const bool sse2 = cpu_supports(CPUID_SSE2);
+
+    string_impls[STRING_MEMSET][0].available = sse2;
+    string_impls[STRING_MEMSET][1].available = erms;
+    string_impls[STRING_MEMCPY][0].available = sse2;
+    string_impls[STRING_MEMCPY][1].available = erms;
+    string_impls[STRING_MEMCHR][0].available = kernel_fpu_has_sse2();
+
+    if (erms) {
+        memset_cached = memset_erms;
+        memcpy_cached = memcpy_erms;
+    }
+
+    __memset_large = string_best_impl(STRING_MEMSET)->func;
+    __memcpy_large = string_best_impl(STRING_MEMCPY)->func;
+    __memchr_large = string_best_impl(STRING_MEMCHR)->func;
+
+    klog(KLOG_INFO,
+         "string: memset %s, memcpy %s, memchr %s",
+         string_best_impl(STRING_MEMSET)->name,
+         string_best_impl(STRING_MEMCPY)->name,
+         string_best_impl(STRING_MEMCHR)->name);
+}
+
+#if CONFIG(STRING_BENCHMARK)
+
+static const char *string_func_names[STRING_NUM_FUNCS] = {
+    "memset",
+    "memcpy",
+    "memchr",
+};
+
+#define STRING_BENCH_ORDER 4
+#define STRING_BENCH_BYTES MIB(8)
+
+static const size_t string_bench_sizes[] = {
+    64, 256, KIB(1), KIB(4), KIB(16), KIB(64),
+};
+
+// Returns the throughput of `impl` of `func` on `size` bytes in MiB/s.
+static uint64_t string_bench_run(int func,
+                                 const struct string_impl *impl,
+                                 uint8_t *dst,
+                                 uint8_t *src,
+                                 size_t size)
+{
+    void *(*set)(void *, int, size_t) = impl->func;
+    void *(*cpy)(void *, const void *, size_t) = impl->func;
+    void *(*chr)(const void *, int, size_t) = impl->func;
+    const size_t rounds = STRING_BENCH_BYTES / size;
+
+    // The byte searched for is only at the end of the buffer.
+    src[size - 1] = 0xFF;
+
+    uint64_t start = time_ns();
+
+    for (size_t i = 0; i < rounds; ++i) {
+        switch (func) {
+        case STRING_MEMSET:
+            set(dst, (int)i, size);
+            break;
+        case STRING_MEMCPY:
+            cpy(dst, src, size);
+            break;
+        case STRING_MEMCHR:
+            if (chr(src, 0xFF, size) != src + size - 1) {
+                klog(KLOG_ERROR, "string benchmark: memchr/%s failed",
+                     impl->name);
+                return 0;
+            }
+            break;
+        }
+    }
+
+    uint64_t elapsed = time_ns() - start;
+    src[size - 1] = 0;
+
+    return elapsed ? STRING_BENCH_BYTES * NSEC_PER_SEC / MIB(1) / elapsed : 0;
+}
+
+void i386_string_benchmark(void)
+{
+    char buf[128];
+
+    struct page *dst_pages = alloc_pages(PA_STANDARD, STRING_BENCH_ORDER);
+    if (IS_ERR(dst_pages)) {
+        klog(KLOG_ERROR, "string benchmark: failed to allocate buffers");
+        return;
+    }
+
+    struct page *src_pages = alloc_pages(PA_STANDARD, STRING_BENCH_ORDER);
+    if (IS_ERR(src_pages)) {
+        klog(KLOG_ERROR, "string benchmark: failed to allocate buffers");
+        free_pages(dst_pages);
+        return;
+    }
+
+    uint8_t *dst = dst_pages->mem;
+    uint8_t *src = src_pages->mem;
+    memset(src, 0, PAGE_SIZE << STRING_BENCH_ORDER);
+
+    klog(KLOG_INFO,
+         "string benchmark: MiB/s at sizes "
+         "64, 256, 1K, 4K, 16K, 64K");
+
+    for (int func = 0; func < STRING_NUM_FUNCS; ++func) {
+        for (size_t i = 0; i < ARRAY_SIZE(string_impls[func]); ++i) {
+            const struct string_impl *impl = &string_impls[func][i];
+            if (!impl->available) {
+                continue;
+            }
+
+            int len = snprintf(buf,
+                               sizeof buf,
+                               "%s/%s:",
+                               string_func_names[func],
+                               impl->name);
+
+            for (size_t j = 0; j < ARRAY_SIZE(string_bench_sizes); ++j) {
+                uint64_t mibs = string_bench_run(
+                    func, impl, dst, src, string_bench_sizes[j]);
+                len += snprintf(
+                    buf + len, sizeof buf - len, " %llu", mibs);
+            }
+
+            klog(KLOG_INFO, "string benchmark: %s", buf);
+        }
+    }
+
+    free_pages(src_pages);
+    free_pages(dst_pages);
+}
+
+#endif  // CONFIG(STRING_BENCHMARK)
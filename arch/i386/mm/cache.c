@@ -18,8 +18,10 @@
 
 #include <radix/compiler.h>
 #include <radix/cpu.h>
+#include <radix/irqstate.h>
 #include <radix/kernel.h>
 #include <radix/mm.h>
+#include <radix/smp.h>
 
 static __always_inline void invlpg(addr_t addr)
 {
@@ -54,15 +56,58 @@ static void __tlb_flush_range(addr_t start, addr_t end)
         invlpg(start);
 }
 
+static void tlb_flush_all_fn(__unused void *arg) { __tlb_flush_all(); }
+
+static void tlb_flush_nonglobal_fn(__unused void *arg)
+{
+    __tlb_flush_nonglobal();
+}
+
+struct tlb_flush_range_args {
+    addr_t start;
+    addr_t end;
+};
+
+static void tlb_flush_range_fn(void *arg)
+{
+    struct tlb_flush_range_args *args = arg;
+    __tlb_flush_range(args->start, args->end);
+}
+
+static void tlb_flush_page_fn(void *arg) { invlpg((addr_t)arg); }
+
+/*
+ * tlb_flush_cpus:
+ * Run the flush `func` on the current processor and every other online one.
+ * The current processor is flushed directly so that this also works before
+ * it has been marked online.
+ */
+static void tlb_flush_cpus(void (*func)(void *), void *arg, int sync)
+{
+    unsigned long irqstate;
+    cpumask_t others;
+
+    irq_save(irqstate);
+
+    func(arg);
+
+    others = *cpumask_online();
+    cpumask_clear_cpu(&others, processor_id());
+    if (!cpumask_empty(&others))
+        smp_call_function_many(&others, func, arg, sync);
+
+    irq_restore(irqstate);
+}
+
 /*
  * i386_tlb_flush_all:
  * Flush all entries in all CPUs' TLBs.
  * This function should be called only when absolutely necessary.
+ * If `sync` is set, wait for every processor to complete its flush.
  */
 void i386_tlb_flush_all(int sync)
 {
-    __tlb_flush_all();
-    (void)sync;
+    tlb_flush_cpus(tlb_flush_all_fn, NULL, sync);
 }
 
 /*
@@ -71,18 +116,23 @@ void i386_tlb_flush_all(int sync)
  */
 void i386_tlb_flush_nonglobal(int sync)
 {
-    __tlb_flush_nonglobal();
-    (void)sync;
+    tlb_flush_cpus(tlb_flush_nonglobal_fn, NULL, sync);
 }
 
 /*
  * i386_tlb_flush_range:
  * Flush all pages between `start` and `end` from all processors' TLBs.
+ * The range is passed on the stack, so an asynchronous flush of a range
+ * falls back to flushing everything.
  */
 void i386_tlb_flush_range(addr_t start, addr_t end, int sync)
 {
-    __tlb_flush_range(start, end);
-    (void)sync;
+    struct tlb_flush_range_args args = { .start = start, .end = end };
+
+    if (sync)
+        tlb_flush_cpus(tlb_flush_range_fn, &args, 1);
+    else
+        tlb_flush_cpus(tlb_flush_all_fn, NULL, 0);
 }
 
 /*
@@ -91,8 +141,7 @@ void i386_tlb_flush_range(addr_t start, addr_t end, int sync)
  */
 void i386_tlb_flush_page(addr_t addr, int sync)
 {
-    invlpg(addr);
-    (void)sync;
+    tlb_flush_cpus(tlb_flush_page_fn, (void *)addr, sync);
 }
 
 /*
@@ -20,16 +20,54 @@
 #include <radix/cpu.h>
 #include <radix/irq.h>
 #include <radix/kernel.h>
+#include <radix/klog.h>
 #include <radix/mm.h>
 #include <radix/task.h>
 #include <radix/vmm.h>
 
+#include <string.h>
+
 #define X86_PF_PROTECTION  (1 << 0)
 #define X86_PF_WRITE       (1 << 1)
 #define X86_PF_USER        (1 << 2)
 #define X86_PF_RESERVED    (1 << 3)
 #define X86_PF_INSTRUCTION (1 << 4)
 
+// Attempts to resolve a write to a copy-on-write page in the current task's
+// address space. Returns true if the fault was handled.
+static bool do_cow_pf(addr_t fault_addr, int error)
+{
+    struct task *curr = current_task();
+
+    if (!(error & X86_PF_PROTECTION) || !(error & X86_PF_WRITE)) {
+        return false;
+    }
+
+    if (!curr || !curr->vmm || fault_addr >= KERNEL_VIRTUAL_BASE ||
+        !page_is_cow(fault_addr)) {
+        return false;
+    }
+
+    struct vmm_area *area = vmm_get_allocated_area(curr->vmm, fault_addr);
+    if (!area) {
+        return false;
+    }
+
+    // The task cannot continue without its own copy of the page.
+    int err = vmm_cow_fault(area, fault_addr);
+    if (err != 0) {
+        klog(KLOG_ERROR,
+             "could not copy page %p for task %d: %s",
+             fault_addr & PAGE_MASK,
+             curr->pid,
+             strerror(err));
+        irq_disable();
+        task_exit(curr, err);
+    }
+
+    return true;
+}
+
 // Resolves a page fault triggered by a kernel thread.
 static void do_kernel_pf(addr_t fault_addr, addr_t fault_ip, int error)
 {
@@ -47,6 +85,17 @@ static void do_kernel_pf(addr_t fault_addr, addr_t fault_ip, int error)
               fault_ip);
     }
 
+    // The kernel may write to user memory on behalf of a task.
+    if (do_cow_pf(fault_addr, error)) {
+        return;
+    }
+
+    // The current address space may not yet have the page table for a kernel
+    // address which was mapped in another address space.
+    if (!(error & X86_PF_PROTECTION) && i386_sync_kernel_pde(fault_addr)) {
+        return;
+    }
+
     if (error & X86_PF_PROTECTION) {
         panic("illegal %s virtual address %p [eip: %p]\n",
               access,
@@ -81,7 +130,7 @@ static void do_kernel_pf(addr_t fault_addr, addr_t fault_ip, int error)
     }
 
     map_page_kernel(page, page_to_phys(p), PROT_WRITE, PAGE_CP_DEFAULT);
-    vmm_add_area_pages(area, p);
+    vmm_add_area_pages(area, p, page);
 }
 
 void page_fault_handler(const struct interrupt_context *intctx, int error)
@@ -90,7 +139,11 @@ void page_fault_handler(const struct interrupt_context *intctx, int error)
     addr_t fault_instruction = intctx->regs.ip;
 
     if (error & X86_PF_USER) {
-        // TODO(frolv): Handle userspace page faults.
+        if (do_cow_pf(fault_addr, error)) {
+            return;
+        }
+
+        // TODO(frolv): Handle other userspace page faults.
         panic("page fault in user task %d at address %p",
               current_task()->pid,
               fault_addr);
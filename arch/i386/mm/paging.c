@@ -25,8 +25,10 @@
 #include <radix/klog.h>
 #include <radix/limits.h>
 #include <radix/mm.h>
+#include <radix/percpu.h>
 #include <radix/slab.h>
 #include <radix/smp.h>
+#include <radix/task.h>
 #include <radix/vmm.h>
 
 #include <string.h>
@@ -34,6 +36,24 @@
 // The page directory containing the kernel's page mappings.
 extern pde_t kernel_pgdir[PTRS_PER_PGDIR];
 
+// Every address space has its own copy of the kernel's page directory entries.
+// When a page table for a kernel address is created in one address space, it
+// is recorded in kernel_pgdir, from which other spaces pick it up the first
+// time they fault on the address (see i386_sync_kernel_pde), or when they are
+// next loaded (see sync_kernel_pgdir).
+static void unload_address_space(struct vmm_space *vmm);
+
+// Incremented each time an entry is added to kernel_pgdir.
+static int kernel_pgdir_gen = 0;
+
+static __always_inline void publish_kernel_pde(addr_t virt, pde_t pde)
+{
+    if (virt >= KERNEL_VIRTUAL_BASE) {
+        kernel_pgdir[PGDIR_INDEX(virt)] = pde;
+        atomic_inc(&kernel_pgdir_gen);
+    }
+}
+
 // Allocates a new page directory for a process and copies entries from the
 // kernel's page directory into it, from index `start` to `end`.
 //
@@ -112,6 +132,53 @@ static int free_page_directory(paddr_t phys, size_t start, size_t end)
     return 0;
 }
 
+// Copies the entries of user page table `src` into `dst`. Writable pages are
+// write-protected in both tables and marked copy-on-write, so that the first
+// write through either mapping faults and receives a private copy of the page.
+static void clone_page_table(pte_t *src, pte_t *dst)
+{
+    for (size_t i = 0; i < PTRS_PER_PGTBL; ++i) {
+        pteval_t value = PTE(src[i]);
+
+        if ((value & PAGE_PRESENT) && (value & PAGE_RW)) {
+            value = (value & ~PAGE_RW) | PAGE_COW;
+            src[i] = make_pte(value);
+        }
+
+        dst[i] = make_pte(value);
+    }
+}
+
+// Allocates a new page table for entry `pdi` of directory `dst_pgdir`, and
+// fills it with a copy-on-write clone of page table `src_pgtbl`. The new table
+// is temporarily mapped at `dst_pgtbl` while it is being filled.
+static int clone_pgdir_entry(pde_t *src_pgdir,
+                             pte_t *src_pgtbl,
+                             pde_t *dst_pgdir,
+                             pte_t *dst_pgtbl,
+                             size_t pdi)
+{
+    struct page *p = alloc_page(PA_PAGETABLE);
+    if (IS_ERR(p)) {
+        return ERR_VAL(p);
+    }
+
+    const paddr_t phys = page_to_phys(p);
+
+    int err = map_page_kernel(
+        (addr_t)dst_pgtbl, phys, PROT_WRITE, PAGE_CP_UNCACHEABLE);
+    if (err) {
+        free_pages(p);
+        return err;
+    }
+
+    clone_page_table(src_pgtbl, dst_pgtbl);
+    unmap_pages((addr_t)dst_pgtbl, 1);
+
+    dst_pgdir[pdi] = make_pde(phys | (PDE(src_pgdir[pdi]) & ~PAGE_MASK));
+    return 0;
+}
+
 static int ___map_page(pde_t *pgdir,
                        pte_t *pgtbl,
                        size_t pdi,
@@ -171,7 +238,9 @@ int __unmap_pages(pde_t *pgdir, size_t pdi, pte_t *pgtbl, addr_t virt, size_t n)
         ++unmapped;
         virt += PAGE_SIZE;
         if (++curr_pti == PTRS_PER_PGTBL) {
-            if (initial_pti == 0) {
+            // Kernel page tables may be in use by other address spaces, so
+            // they are never freed.
+            if (initial_pti == 0 && virt - PAGE_SIZE < KERNEL_VIRTUAL_BASE) {
                 // All pages in the table are unmapped.
                 phys = PDE(pgdir[pdi]) & PAGE_MASK;
                 free_pages(phys_to_page(phys));
@@ -190,33 +259,22 @@ int __unmap_pages(pde_t *pgdir, size_t pdi, pte_t *pgtbl, addr_t virt, size_t n)
 // page table entry for the index is present, allocates a new one.
 static int load_and_map_page_table(pde_t *pgdir, size_t pdi, pte_t *pgtbl)
 {
-    bool allocated = false;
-
     if (!(PDE(pgdir[pdi]) & PAGE_PRESENT)) {
-        struct page *p = alloc_page(PA_PAGETABLE);
+        // Page tables are written through uncached mappings, so have the page
+        // allocator provide them already zeroed.
+        struct page *p = alloc_page(PA_PAGETABLE | __PA_ZERO);
         if (IS_ERR(p)) {
             return ERR_VAL(p);
         }
 
         pgdir[pdi] =
             make_pde(page_to_phys(p) | PAGE_USER | PAGE_RW | PAGE_PRESENT);
-        allocated = true;
     }
 
     paddr_t phys = PDE(pgdir[pdi]) & PAGE_MASK;
 
-    int err =
-        map_page_kernel((addr_t)pgtbl, phys, PROT_WRITE, PAGE_CP_UNCACHEABLE);
-    if (err) {
-        return err;
-    }
-
-    if (allocated) {
-        // A newly-allocated page table should be zeroed.
-        memset(pgtbl, 0, PAGE_SIZE);
-    }
-
-    return 0;
+    return map_page_kernel(
+        (addr_t)pgtbl, phys, PROT_WRITE, PAGE_CP_UNCACHEABLE);
 }
 
 #if CONFIG(X86_PAE)
@@ -322,7 +380,14 @@ static int __map_page(addr_t virt, paddr_t phys, pteval_t flags)
 
     pgdir = get_page_dir(pdpti);
     pgtbl = get_page_table(pdpti, pdi);
-    return ___map_page(pgdir, pgtbl, pdi, pti, phys, flags);
+
+    const bool new_table = !(PDE(pgdir[pdi]) & PAGE_PRESENT);
+    int err = ___map_page(pgdir, pgtbl, pdi, pti, phys, flags);
+    if (!err && new_table) {
+        publish_kernel_pde(virt, pgdir[pdi]);
+    }
+
+    return err;
 }
 
 static int __map_pages_vmm(const struct vmm_space *vmm,
@@ -383,11 +448,9 @@ static int __map_pages_vmm(const struct vmm_space *vmm,
             // Unmap the previous page directory.
             unmap_pages((addr_t)pgdir, 1);
 
-            bool allocated_pgdir = false;
-
             if (!(PDPTE(pdpt[pdpti]) & PAGE_PRESENT)) {
                 // Allocate a new page directory for the PDPT.
-                struct page *p = alloc_page(PA_PAGETABLE);
+                struct page *p = alloc_page(PA_PAGETABLE | __PA_ZERO);
                 if (IS_ERR(p)) {
                     status = ERR_VAL(p);
                     break;
@@ -401,8 +464,6 @@ static int __map_pages_vmm(const struct vmm_space *vmm,
                 const size_t recursive_index = (PTRS_PER_PGDIR - 4) + pdpti;
                 kernel_pd[recursive_index] =
                     make_pde(pgdir_phys | PAGE_RW | PAGE_PRESENT);
-
-                allocated_pgdir = true;
             }
 
             const paddr_t directory = PDPTE(pdpt[pdpti]) & PAGE_MASK;
@@ -412,11 +473,6 @@ static int __map_pages_vmm(const struct vmm_space *vmm,
                                           PAGE_CP_UNCACHEABLE))) {
                 break;
             }
-
-            if (allocated_pgdir) {
-                // A newly-allocated page directory should be zeroed.
-                memset(pgdir, 0, PAGE_SIZE);
-            }
         }
 
         // Check if advancing to a new page table; if so, map it.
@@ -507,6 +563,7 @@ int arch_vmm_setup(struct vmm_space *vmm)
 
     // Clone the kernel's page directory for the process, excluding the final
     // four entries, which are the recursively mapped page directories.
+    vmm->kernel_gen = atomic_read(&kernel_pgdir_gen);
     pde_t *kernel_pd = clone_kernel_pgdir(0, PTRS_PER_PGDIR - 4);
     if (IS_ERR(kernel_pd)) {
         return ERR_VAL(kernel_pd);
@@ -527,8 +584,90 @@ int arch_vmm_setup(struct vmm_space *vmm)
     return 0;
 }
 
+int arch_vmm_clone(struct vmm_space *dst, struct vmm_space *src)
+{
+    assert(src == current_task()->vmm);
+
+    pdpte_t *src_pdpt = ((struct pdpt *)src->paging_ctx)->entries;
+    pdpte_t *dst_pdpt = ((struct pdpt *)dst->paging_ctx)->entries;
+
+    // Temporary mappings for the new address space's kernel page directory,
+    // and the user page directory and page table currently being filled.
+    struct vmm_area *area =
+        vmm_alloc_size(vmm_kernel(), 3 * PAGE_SIZE, VMM_READ | VMM_WRITE);
+    if (IS_ERR(area)) {
+        return ERR_VAL(area);
+    }
+
+    pde_t *kernel_pd = (pde_t *)area->base;
+    pde_t *dst_pgdir = (pde_t *)(area->base + PAGE_SIZE);
+    pte_t *dst_pgtbl = (pte_t *)(area->base + 2 * PAGE_SIZE);
+
+    const paddr_t kernel_pd_phys = PDPTE(dst_pdpt[PDPT_ENTRY_C0]) & PAGE_MASK;
+    int err = map_page_kernel(
+        (addr_t)kernel_pd, kernel_pd_phys, PROT_WRITE, PAGE_CP_UNCACHEABLE);
+    if (err) {
+        vmm_free(area);
+        return err;
+    }
+
+    for (size_t pdpti = 0; pdpti < PTRS_PER_PDPT && !err; ++pdpti) {
+        if (pdpti == PDPT_ENTRY_C0 ||
+            !(PDPTE(src_pdpt[pdpti]) & PAGE_PRESENT)) {
+            continue;
+        }
+
+        struct page *p = alloc_page(PA_PAGETABLE | __PA_ZERO);
+        if (IS_ERR(p)) {
+            err = ERR_VAL(p);
+            break;
+        }
+
+        const paddr_t pgdir_phys = page_to_phys(p);
+        dst_pdpt[pdpti] = make_pdpte(pgdir_phys | PAGE_PRESENT);
+
+        // Recursively map the new directory into the address space.
+        kernel_pd[(PTRS_PER_PGDIR - 4) + pdpti] =
+            make_pde(pgdir_phys | PAGE_RW | PAGE_PRESENT);
+
+        err = map_page_kernel(
+            (addr_t)dst_pgdir, pgdir_phys, PROT_WRITE, PAGE_CP_UNCACHEABLE);
+        if (err) {
+            break;
+        }
+
+        pde_t *src_pgdir = get_page_dir(pdpti);
+        for (size_t pdi = 0; pdi < PTRS_PER_PGDIR; ++pdi) {
+            if (!(PDE(src_pgdir[pdi]) & PAGE_PRESENT)) {
+                continue;
+            }
+
+            err = clone_pgdir_entry(src_pgdir,
+                                    get_page_table(pdpti, pdi),
+                                    dst_pgdir,
+                                    dst_pgtbl,
+                                    pdi);
+            if (err) {
+                break;
+            }
+        }
+
+        unmap_pages((addr_t)dst_pgdir, 1);
+    }
+
+    unmap_pages((addr_t)kernel_pd, 1);
+    vmm_free(area);
+
+    // Entries in the source address space were write-protected.
+    tlb_flush_nonglobal_lazy();
+
+    return err;
+}
+
 void arch_vmm_release(struct vmm_space *vmm)
 {
+    unload_address_space(vmm);
+
     struct pdpt *pdpt = vmm->paging_ctx;
 
     for (size_t i = 0; i < PTRS_PER_PDPT; ++i) {
@@ -596,7 +735,14 @@ static int __map_page(addr_t virt, paddr_t phys, pteval_t flags)
 
     get_paging_indices(virt, &pdi, &pti);
     pgtbl = get_page_table(pdi);
-    return ___map_page(pgdir, pgtbl, pdi, pti, phys, flags);
+
+    const bool new_table = !(PDE(pgdir[pdi]) & PAGE_PRESENT);
+    int err = ___map_page(pgdir, pgtbl, pdi, pti, phys, flags);
+    if (!err && new_table) {
+        publish_kernel_pde(virt, pgdir[pdi]);
+    }
+
+    return err;
 }
 
 static int __map_pages_vmm(const struct vmm_space *vmm,
@@ -694,6 +840,7 @@ int i386_unmap_pages(addr_t virt, size_t n)
 
 int arch_vmm_setup(struct vmm_space *vmm)
 {
+    vmm->kernel_gen = atomic_read(&kernel_pgdir_gen);
     pde_t *kernel_pd = clone_kernel_pgdir(PGDIR_INDEX(KERNEL_VIRTUAL_BASE),
                                           PTRS_PER_PGDIR - 1);
 
@@ -709,8 +856,53 @@ int arch_vmm_setup(struct vmm_space *vmm)
     return 0;
 }
 
+int arch_vmm_clone(struct vmm_space *dst, struct vmm_space *src)
+{
+    assert(src == current_task()->vmm);
+
+    // Temporary mappings for the new page directory and the page table
+    // currently being filled.
+    struct vmm_area *area =
+        vmm_alloc_size(vmm_kernel(), 2 * PAGE_SIZE, VMM_READ | VMM_WRITE);
+    if (IS_ERR(area)) {
+        return ERR_VAL(area);
+    }
+
+    pde_t *dst_pgdir = (pde_t *)area->base;
+    pte_t *dst_pgtbl = (pte_t *)(area->base + PAGE_SIZE);
+
+    int err = map_page_kernel(
+        (addr_t)dst_pgdir, dst->paging_base, PROT_WRITE, PAGE_CP_UNCACHEABLE);
+    if (err) {
+        vmm_free(area);
+        return err;
+    }
+
+    for (size_t pdi = 0; pdi < PGDIR_INDEX(KERNEL_VIRTUAL_BASE); ++pdi) {
+        if (!(PDE(pgdir[pdi]) & PAGE_PRESENT)) {
+            continue;
+        }
+
+        err = clone_pgdir_entry(
+            pgdir, get_page_table(pdi), dst_pgdir, dst_pgtbl, pdi);
+        if (err) {
+            break;
+        }
+    }
+
+    unmap_pages((addr_t)dst_pgdir, 1);
+    vmm_free(area);
+
+    // Entries in the source address space were write-protected.
+    tlb_flush_nonglobal_lazy();
+
+    return err;
+}
+
 void arch_vmm_release(struct vmm_space *vmm)
 {
+    unload_address_space(vmm);
+
     free_page_directory(vmm->paging_base, 0, PGDIR_INDEX(KERNEL_VIRTUAL_BASE));
     free_pages(phys_to_page(vmm->paging_base));
 }
@@ -745,6 +937,37 @@ int i386_addr_mapped(addr_t virt)
     return pte ? PTE(*pte) & PAGE_PRESENT : 0;
 }
 
+/*
+ * i386_page_is_cow:
+ * Return true if address `virt` is mapped to a copy-on-write page.
+ */
+bool i386_page_is_cow(addr_t virt)
+{
+    pte_t *pte = pgtbl_entry(virt);
+    return pte && (PTE(*pte) & PAGE_PRESENT) && (PTE(*pte) & PAGE_COW);
+}
+
+/*
+ * i386_remap_cow_page:
+ * Replace the copy-on-write mapping of `virt` with a writable mapping to
+ * physical address `phys`, keeping the rest of its attributes.
+ */
+int i386_remap_cow_page(addr_t virt, paddr_t phys)
+{
+    pte_t *pte;
+    pteval_t flags;
+
+    pte = pgtbl_entry(virt);
+    if (!pte || !(PTE(*pte) & PAGE_COW))
+        return EINVAL;
+
+    flags = PTE(*pte) & ~((pteval_t)PAGE_MASK | PAGE_COW);
+    *pte = make_pte((phys & PAGE_MASK) | flags | PAGE_RW);
+    tlb_flush_page_lazy(virt & PAGE_MASK);
+
+    return 0;
+}
+
 static int mp_args_to_flags(pteval_t *flags, int prot, enum cache_policy cp);
 
 /*
@@ -887,6 +1110,12 @@ static int mp_args_to_flags(pteval_t *flags, int prot, enum cache_policy cp)
     }
 #endif  // CONFIG(X86_NX)
 
+    // WC and WP cache policies are only available through PAT.
+    if (!cpu_supports(CPUID_PAT) &&
+        (cp == PAGE_CP_WRITE_COMBINING || cp == PAGE_CP_WRITE_PROTECTED)) {
+        cp = PAGE_CP_WRITE_BACK;
+    }
+
     return cp_to_flags(flags, cp);
 }
 
@@ -919,13 +1148,216 @@ int i386_set_cache_policy(addr_t virt, enum cache_policy policy)
     return 0;
 }
 
+// The address space whose page tables are loaded in each CPU's CR3.
+static DEFINE_PER_CPU(struct vmm_space *, loaded_vmm) = NULL;
+
+static DEFINE_PER_CPU(unsigned long, cr3_loads) = 0;
+static DEFINE_PER_CPU(unsigned long, cr3_loads_avoided) = 0;
+
+static bool lazy_address_space = true;
+
+// Each CPU's window through which it writes to the kernel page directory of an
+// address space which isn't loaded. The windows are mapped when the kernel's
+// address space is initialized, before any other exists, so every space shares
+// their page table.
+static addr_t pgdir_windows;
+static pte_t *pgdir_window_ptes[MAX_CPUS];
+
+static void pgdir_windows_init(void)
+{
+    struct vmm_area *area = vmm_alloc_size(
+        vmm_kernel(), MAX_CPUS * PAGE_SIZE, VMM_READ | VMM_WRITE);
+    if (IS_ERR(area)) {
+        panic("failed to allocate page directory windows: %s\n",
+              strerror(ERR_VAL(area)));
+    }
+
+    pgdir_windows = area->base;
+    for (int cpu = 0; cpu < MAX_CPUS; ++cpu) {
+        const addr_t virt = pgdir_windows + cpu * PAGE_SIZE;
+        int err = map_page_kernel(
+            virt, virt_to_phys(kernel_pgdir), PROT_WRITE, PAGE_CP_UNCACHEABLE);
+        if (err) {
+            panic("failed to map page directory window: %s\n",
+                  strerror(err));
+        }
+        pgdir_window_ptes[cpu] = pgtbl_entry(virt);
+    }
+}
+
+// Copies the kernel page directory entries which `vmm` is missing into it
+// before it is loaded. Switching address spaces happens on the outgoing task's
+// stack, shortly before moving to the incoming task's, and either may be mapped
+// by a page table which `vmm` has never seen. A fault on a stack can't be
+// resolved by i386_sync_kernel_pde, as handling the fault needs the stack.
+static void sync_kernel_pgdir(struct vmm_space *vmm)
+{
+    const int gen = atomic_read(&kernel_pgdir_gen);
+    if (vmm->kernel_gen == gen) {
+        return;
+    }
+
+#if CONFIG(X86_PAE)
+    const pdpte_t *pdpt = ((struct pdpt *)vmm->paging_ctx)->entries;
+    const paddr_t phys = PDPTE(pdpt[PDPT_ENTRY_C0]) & PAGE_MASK;
+    const size_t start = 0;
+    const size_t end = PTRS_PER_PGDIR - 4;
+#else
+    const paddr_t phys = vmm->paging_base;
+    const size_t start = PGDIR_INDEX(KERNEL_VIRTUAL_BASE);
+    const size_t end = PTRS_PER_PGDIR - 1;
+#endif  // CONFIG(X86_PAE)
+
+    const int cpu = processor_id();
+    const addr_t window = pgdir_windows + cpu * PAGE_SIZE;
+    pte_t *const pte = pgdir_window_ptes[cpu];
+    pde_t *const dir = (pde_t *)window;
+
+    *pte = make_pte(phys | (PTE(*pte) & ~(pteval_t)PAGE_MASK));
+    tlb_flush_page_lazy(window);
+
+    for (size_t i = start; i < end; ++i) {
+        if (!(PDE(dir[i]) & PAGE_PRESENT) &&
+            (PDE(kernel_pgdir[i]) & PAGE_PRESENT)) {
+            dir[i] = kernel_pgdir[i];
+        }
+    }
+
+    vmm->kernel_gen = gen;
+}
+
+// Switches to address space `vmm`, only writing CR3 if it is really needed.
+//
+// Kernel threads don't access user memory, and every address space maps the
+// kernel, so kthreads run in whichever address space the CPU already has
+// loaded instead of the kernel's own. A user address space which is still
+// loaded is reused if its task last ran on this CPU; otherwise, the task may
+// have changed its mappings elsewhere, and the reload is needed to flush
+// stale TLB entries.
 void i386_switch_address_space(struct vmm_space *vmm)
 {
-    if (vmm) {
-        cpu_write_cr3(vmm->paging_base);
+    struct vmm_space *loaded = this_cpu_read(loaded_vmm);
+    const int cpu = processor_id();
+
+    if (!vmm) {
+        return;
+    }
+
+    if (lazy_address_space && loaded) {
+        if (vmm == vmm_kernel() ||
+            (vmm == loaded && atomic_read(&vmm->last_cpu) == cpu)) {
+            this_cpu_inc(cr3_loads_avoided);
+            return;
+        }
+    }
+
+    // Publish the new address space before checking whether compaction is
+    // replacing one of its pages. The xchg is a full barrier, pairing with the
+    // cmpxchg of vmm->migrating before arch_vmm_loaded: either compaction sees
+    // this CPU's load and backs off, or this CPU waits for it to finish.
+    atomic_swap(raw_cpu_ptr(&loaded_vmm), vmm);
+    while (atomic_read(&vmm->migrating) > 0) {
+        cpu_pause();
+    }
+
+    if (vmm != vmm_kernel()) {
+        sync_kernel_pgdir(vmm);
+    }
+
+    cpu_write_cr3(vmm->paging_base);
+    this_cpu_inc(cr3_loads);
+
+    if (vmm != vmm_kernel()) {
+        atomic_write(&vmm->last_cpu, cpu);
+    }
+}
+
+static void __unload_address_space(void *arg)
+{
+    struct vmm_space *kernel = vmm_kernel();
+
+    if (this_cpu_read(loaded_vmm) == arg) {
+        cpu_write_cr3(kernel->paging_base);
+        this_cpu_write(loaded_vmm, kernel);
     }
 }
 
+// Makes every CPU which has `vmm` loaded switch to the kernel's address space,
+// so that its page tables can be freed.
+static void unload_address_space(struct vmm_space *vmm)
+{
+    cpumask_t mask;
+    int cpu;
+
+    cpumask_clear(&mask);
+    for_each_cpu (cpu, cpumask_online()) {
+        if (atomic_read(&cpu_var(loaded_vmm, cpu)) == vmm) {
+            cpumask_set_cpu(&mask, cpu);
+        }
+    }
+
+    if (!cpumask_empty(&mask)) {
+        smp_call_function_many(&mask, __unload_address_space, vmm, true);
+    }
+}
+
+bool arch_vmm_loaded(struct vmm_space *vmm)
+{
+    int cpu;
+
+    for_each_cpu (cpu, cpumask_online()) {
+        if (atomic_read(&cpu_var(loaded_vmm, cpu)) == vmm) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void i386_address_space_stats(unsigned long *loads, unsigned long *avoided)
+{
+    int cpu;
+
+    *loads = 0;
+    *avoided = 0;
+    for_each_cpu (cpu, cpumask_online()) {
+        *loads += cpu_var(cr3_loads, cpu);
+        *avoided += cpu_var(cr3_loads_avoided, cpu);
+    }
+}
+
+void i386_set_lazy_address_space(bool enable)
+{
+    atomic_write(&lazy_address_space, enable);
+}
+
+// Copies the page directory entry for a kernel address from kernel_pgdir into
+// the current address space if it is missing there. Returns true if an entry
+// was copied, in which case the faulting access should be retried.
+bool i386_sync_kernel_pde(addr_t virt)
+{
+    const size_t pdi = PGDIR_INDEX(virt);
+
+#if CONFIG(X86_PAE)
+    pde_t *const pgdir = get_page_dir(PDPT_INDEX(virt));
+    const size_t recursive_start = PTRS_PER_PGDIR - 4;
+#else
+    const size_t recursive_start = PTRS_PER_PGDIR - 1;
+#endif  // CONFIG(X86_PAE)
+
+    if (virt < KERNEL_VIRTUAL_BASE || pdi >= recursive_start) {
+        return false;
+    }
+
+    if ((PDE(pgdir[pdi]) & PAGE_PRESENT) ||
+        !(PDE(kernel_pgdir[pdi]) & PAGE_PRESENT)) {
+        return false;
+    }
+
+    pgdir[pdi] = kernel_pgdir[pdi];
+    return true;
+}
+
 void arch_vmm_init(struct vmm_space *kernel_vmm_space)
 {
     kernel_vmm_space->paging_base = cpu_read_cr3();
@@ -939,6 +1371,8 @@ void arch_vmm_init(struct vmm_space *kernel_vmm_space)
                               SLAB_PANIC,
                               NULL);
 #endif  // CONFIG(X86_PAE)
+
+    pgdir_windows_init();
 }
 
 int cpu_paging_init(bool is_bootstrap_processor)
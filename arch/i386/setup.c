@@ -16,6 +16,7 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <radix/asm/acpi.h>
 #include <radix/asm/apic.h>
 #include <radix/cpu.h>
 #include <radix/timer.h>
@@ -27,6 +28,7 @@ void arch_main_setup(void)
 {
     acpi_init();
     bsp_init();
+    acpi_numa_init();
 
     hpet_register();
     acpi_pm_register();
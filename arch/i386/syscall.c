@@ -16,19 +16,42 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <radix/asm/gdt.h>
 #include <radix/asm/idt.h>
+#include <radix/asm/msr.h>
 #include <radix/asm/syscall.h>
 #include <radix/asm/vectors.h>
+#include <radix/cpu.h>
+#include <radix/klog.h>
+#include <radix/smp.h>
 #include <radix/syscall.h>
 
+// Programs the current CPU's sysenter MSRs. The kernel stack pointer is read
+// from the TSS on entry, so it doesn't need to be updated on task switches.
+static void sysenter_init_cpu(__unused void *arg)
+{
+    wrmsr(IA32_SYSENTER_CS, GDT_OFFSET(GDT_KERNEL_CODE), 0);
+    wrmsr(IA32_SYSENTER_ESP, (uintptr_t)tss_stack_ptr(), 0);
+    wrmsr(IA32_SYSENTER_EIP, (uintptr_t)sysenter_entry, 0);
+}
+
 void arch_syscall_init(void)
 {
+    // The interrupt gate is always available, and is the only entry path on
+    // processors without sysenter.
     idt_set(VEC_SYSCALL,
             syscall,
             GDT_OFFSET(GDT_KERNEL_CODE),
             IDT_GATE_INT | IDT_DPL(3) | IDT_PRESENT);
+
+    if (cpu_supports(CPUID_SEP)) {
+        smp_call_function_many(cpumask_online(), sysenter_init_cpu, NULL, true);
+        klog(KLOG_INFO, "syscall: sysenter enabled");
+    }
 }
 
 void *syscall_table[X86_NUM_SYSCALLS] = {
     [X86_SYS_EXIT] = sys_exit,
+    [X86_SYS_FORK] = sys_fork,
+    [X86_SYS_GETPID] = sys_getpid,
 };
@@ -0,0 +1,63 @@
+/*
+ * drivers/acpi/tables/slit.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/klog.h>
+#include <radix/numa.h>
+
+#include <acpi/acpi.h>
+#include <acpi/tables/slit.h>
+#include <acpi/tables/srat.h>
+
+#define SLIT "ACPI: SLIT: "
+
+/*
+ * acpi_parse_slit:
+ * Parse the ACPI SLIT, setting the distances between NUMA nodes.
+ * Localities are proximity domains, which are mapped to nodes by the SRAT.
+ */
+int acpi_parse_slit(void)
+{
+    struct acpi_slit *slit;
+    uint64_t count, i, j;
+    int from, to;
+
+    slit = acpi_find_table(ACPI_SLIT_SIGNATURE);
+    if (!slit)
+        return 1;
+
+    count = slit->locality_count;
+    if (count > slit->header.length ||
+        sizeof *slit + count * count > slit->header.length) {
+        klog(KLOG_ERROR, SLIT "invalid locality count %llu", count);
+        return 1;
+    }
+
+    for (i = 0; i < count; ++i) {
+        if ((from = acpi_pxm_to_node(i)) == NUMA_NO_NODE)
+            continue;
+
+        for (j = 0; j < count; ++j) {
+            if ((to = acpi_pxm_to_node(j)) == NUMA_NO_NODE)
+                continue;
+
+            numa_set_distance(from, to, slit->entry[i * count + j]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * drivers/acpi/tables/srat.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/klog.h>
+#include <radix/numa.h>
+
+#include <acpi/acpi.h>
+#include <acpi/tables/srat.h>
+
+#define SRAT "ACPI: SRAT: "
+
+/*
+ * Proximity domains are arbitrary 32-bit values. They are assigned
+ * dense NUMA node IDs in the order in which they are first seen.
+ */
+static uint32_t node_pxm[MAX_NUMNODES];
+static int srat_nodes = 0;
+
+#define SRAT_MAX_CPUS 256
+
+struct srat_cpu {
+    uint32_t apic_id;
+    int node;
+};
+
+static struct srat_cpu srat_cpus[SRAT_MAX_CPUS];
+static int srat_ncpus = 0;
+
+int acpi_pxm_to_node(uint32_t pxm)
+{
+    int node;
+
+    for (node = 0; node < srat_nodes; ++node) {
+        if (node_pxm[node] == pxm)
+            return node;
+    }
+
+    return NUMA_NO_NODE;
+}
+
+/* pxm_node: return the node of `pxm`, assigning it one if it is new */
+static int pxm_node(uint32_t pxm)
+{
+    int node;
+
+    node = acpi_pxm_to_node(pxm);
+    if (node != NUMA_NO_NODE)
+        return node;
+
+    if (srat_nodes == MAX_NUMNODES) {
+        klog(KLOG_WARNING,
+             SRAT "maximum number of nodes reached, ignoring PXM %u",
+             pxm);
+        return NUMA_NO_NODE;
+    }
+
+    node_pxm[srat_nodes] = pxm;
+    return srat_nodes++;
+}
+
+int acpi_srat_apic_node(uint32_t apic_id)
+{
+    int i;
+
+    for (i = 0; i < srat_ncpus; ++i) {
+        if (srat_cpus[i].apic_id == apic_id)
+            return srat_cpus[i].node;
+    }
+
+    return NUMA_NO_NODE;
+}
+
+static void srat_add_cpu(uint32_t apic_id, uint32_t pxm)
+{
+    int node;
+
+    if ((node = pxm_node(pxm)) == NUMA_NO_NODE)
+        return;
+
+    if (srat_ncpus == SRAT_MAX_CPUS) {
+        klog(KLOG_WARNING,
+             SRAT "too many processors, ignoring APIC id %u",
+             apic_id);
+        return;
+    }
+
+    srat_cpus[srat_ncpus].apic_id = apic_id;
+    srat_cpus[srat_ncpus].node = node;
+    ++srat_ncpus;
+
+    klog(KLOG_INFO, SRAT "APIC id %u PXM %u node %d", apic_id, pxm, node);
+}
+
+static void __srat_cpu(struct acpi_srat_cpu_affinity *s)
+{
+    uint32_t pxm;
+
+    if (!(s->flags & ACPI_SRAT_CPU_ENABLED))
+        return;
+
+    pxm = s->proximity_domain_lo | s->proximity_domain_hi[0] << 8 |
+          s->proximity_domain_hi[1] << 16 |
+          (uint32_t)s->proximity_domain_hi[2] << 24;
+    srat_add_cpu(s->apic_id, pxm);
+}
+
+static void __srat_x2apic_cpu(struct acpi_srat_x2apic_cpu_affinity *s)
+{
+    if (!(s->flags & ACPI_SRAT_CPU_ENABLED))
+        return;
+
+    srat_add_cpu(s->apic_id, s->proximity_domain);
+}
+
+static void __srat_mem(struct acpi_srat_mem_affinity *s)
+{
+    uint64_t base, len;
+    int node;
+
+    base = s->base_address;
+    len = s->length;
+    if (!(s->flags & ACPI_SRAT_MEM_ENABLED) || !len)
+        return;
+
+    if ((node = pxm_node(s->proximity_domain)) == NUMA_NO_NODE)
+        return;
+
+    if (numa_add_memblk(node, base, len) != 0) {
+        klog(KLOG_WARNING,
+             SRAT "ignoring memory 0x%llx-0x%llx, too many ranges",
+             base,
+             base + len - 1);
+        return;
+    }
+
+    klog(KLOG_INFO,
+         SRAT "memory 0x%llx-0x%llx PXM %u node %d%s",
+         base,
+         base + len - 1,
+         s->proximity_domain,
+         node,
+         s->flags & ACPI_SRAT_MEM_HOT_PLUGGABLE ? " hotplug" : "");
+}
+
+static void srat_parse_entry(struct acpi_subtable_header *header)
+{
+    switch (header->type) {
+    case ACPI_SRAT_CPU_AFFINITY:
+        __srat_cpu((struct acpi_srat_cpu_affinity *)header);
+        break;
+    case ACPI_SRAT_MEMORY_AFFINITY:
+        __srat_mem((struct acpi_srat_mem_affinity *)header);
+        break;
+    case ACPI_SRAT_X2APIC_CPU_AFFINITY:
+        __srat_x2apic_cpu((struct acpi_srat_x2apic_cpu_affinity *)header);
+        break;
+    }
+}
+
+/*
+ * acpi_parse_srat:
+ * Parse the ACPI SRAT, assigning processors and memory to NUMA nodes.
+ */
+int acpi_parse_srat(void)
+{
+    struct acpi_srat *srat;
+    struct acpi_subtable_header *header;
+    unsigned char *p, *end;
+
+    srat = acpi_find_table(ACPI_SRAT_SIGNATURE);
+    if (!srat)
+        return 1;
+
+    p = (unsigned char *)(srat + 1);
+    end = (unsigned char *)srat + srat->header.length;
+
+    while (p + sizeof *header <= end) {
+        header = (struct acpi_subtable_header *)p;
+        if (!header->length)
+            break;
+
+        srat_parse_entry(header);
+        p += header->length;
+    }
+
+    return 0;
+}
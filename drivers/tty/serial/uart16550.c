@@ -0,0 +1,393 @@
+/*
+ * drivers/tty/serial/uart16550.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/compiler.h>
+#include <radix/config.h>
+#include <radix/console.h>
+#include <radix/io.h>
+#include <radix/irq.h>
+#include <radix/klog.h>
+#include <radix/serial.h>
+#include <radix/spinlock.h>
+
+#include <stdbool.h>
+
+#if CONFIG(SERIAL_CONSOLE)
+
+#define COM1_PORT 0x3F8
+#define COM1_IRQ  4
+
+/* Register offsets from the port's base address. */
+#define UART_RBR 0 /* receive buffer (read, DLAB = 0) */
+#define UART_THR 0 /* transmit holding (write, DLAB = 0) */
+#define UART_DLL 0 /* divisor latch low (DLAB = 1) */
+#define UART_IER 1 /* interrupt enable (DLAB = 0) */
+#define UART_DLM 1 /* divisor latch high (DLAB = 1) */
+#define UART_IIR 2 /* interrupt identification (read) */
+#define UART_FCR 2 /* FIFO control (write) */
+#define UART_LCR 3 /* line control */
+#define UART_MCR 4 /* modem control */
+#define UART_LSR 5 /* line status */
+#define UART_MSR 6 /* modem status */
+#define UART_SCR 7 /* scratch */
+
+#define UART_IER_RDI  0x01
+#define UART_IER_THRI 0x02
+
+#define UART_IIR_NO_INT  0x01
+#define UART_IIR_ID      0x0E
+#define UART_IIR_MSI     0x00
+#define UART_IIR_THRI    0x02
+#define UART_IIR_RDI     0x04
+#define UART_IIR_RLSI    0x06
+#define UART_IIR_TIMEOUT 0x0C
+#define UART_IIR_FIFO    0xC0
+
+#define UART_FCR_ENABLE     0x01
+#define UART_FCR_CLEAR_RCVR 0x02
+#define UART_FCR_CLEAR_XMIT 0x04
+#define UART_FCR_TRIGGER_14 0xC0
+
+#define UART_LCR_WLEN8 0x03
+#define UART_LCR_DLAB  0x80
+
+#define UART_MCR_DTR  0x01
+#define UART_MCR_RTS  0x02
+#define UART_MCR_OUT2 0x08
+#define UART_MCR_LOOP 0x10
+
+#define UART_LSR_DR   0x01
+#define UART_LSR_THRE 0x20
+#define UART_LSR_TEMT 0x40
+
+/* Input clock of the baud rate generator divided by 16. */
+#define UART_BASE_BAUD 115200
+
+#define UART_FIFO_SIZE 16
+
+/* Size of the transmit ring buffer. Must be a power of 2. */
+#define UART_TX_BUFSIZE 8192
+#define UART_TX_MASK    (UART_TX_BUFSIZE - 1)
+
+/*
+ * Output is copied into a ring buffer, from which it is moved to the UART
+ * a FIFO's worth at a time. Once interrupts are enabled, refills happen from
+ * the THR empty interrupt, so writers never wait on the line unless the
+ * ring buffer fills up.
+ */
+struct uart_port {
+    unsigned int base;
+    unsigned int irq;
+    unsigned int fifo_size;
+    spinlock_t lock;
+    bool irq_enabled;
+    bool tx_active;
+    uint8_t ier;
+    unsigned int head;
+    unsigned int tail;
+    char txbuf[UART_TX_BUFSIZE];
+};
+
+static struct uart_port com1 = {
+    .base = COM1_PORT,
+    .irq = COM1_IRQ,
+    .lock = SPINLOCK_INIT,
+};
+
+static struct console serial_console;
+static struct consfn serial_fn;
+
+static __always_inline uint8_t uart_in(struct uart_port *port, int reg)
+{
+    return inb(port->base + reg);
+}
+
+static __always_inline void uart_out(struct uart_port *port, int reg, uint8_t v)
+{
+    outb(port->base + reg, v);
+}
+
+static __always_inline bool uart_tx_empty(struct uart_port *port)
+{
+    return port->head == port->tail;
+}
+
+/*
+ * __uart_fill_fifo:
+ * Move up to a FIFO's worth of buffered output to the UART. The transmit
+ * FIFO must be empty.
+ */
+static void __uart_fill_fifo(struct uart_port *port)
+{
+    unsigned int i;
+
+    for (i = 0; i < port->fifo_size && !uart_tx_empty(port); ++i)
+        uart_out(port, UART_THR, port->txbuf[port->tail++ & UART_TX_MASK]);
+}
+
+/* __uart_wait_thre: spin until the transmit FIFO is empty */
+static __always_inline void __uart_wait_thre(struct uart_port *port)
+{
+    while (!(uart_in(port, UART_LSR) & UART_LSR_THRE))
+        ;
+}
+
+/* __uart_drain: synchronously transmit all buffered output */
+static void __uart_drain(struct uart_port *port)
+{
+    while (!uart_tx_empty(port)) {
+        __uart_wait_thre(port);
+        __uart_fill_fifo(port);
+    }
+}
+
+/*
+ * __uart_start_tx:
+ * Start transmitting buffered output. Without interrupts, everything is
+ * sent before returning. Otherwise, the FIFO is filled if it is empty and
+ * the THR empty interrupt is enabled to continue from there.
+ */
+static void __uart_start_tx(struct uart_port *port)
+{
+    if (!port->irq_enabled) {
+        __uart_drain(port);
+        return;
+    }
+
+    if (port->tx_active || uart_tx_empty(port))
+        return;
+
+    if (uart_in(port, UART_LSR) & UART_LSR_THRE)
+        __uart_fill_fifo(port);
+
+    port->tx_active = true;
+    port->ier |= UART_IER_THRI;
+    uart_out(port, UART_IER, port->ier);
+}
+
+static void __uart_putc(struct uart_port *port, char ch)
+{
+    /*
+     * If the buffer is full, the line is the bottleneck. Wait for the FIFO
+     * to empty and refill it directly, which also keeps output in order.
+     */
+    if (port->head - port->tail == UART_TX_BUFSIZE) {
+        __uart_wait_thre(port);
+        __uart_fill_fifo(port);
+    }
+
+    port->txbuf[port->head++ & UART_TX_MASK] = ch;
+}
+
+static void uart_irq_handler(void *device)
+{
+    struct uart_port *port = device;
+    uint8_t iir;
+
+    spin_lock(&port->lock);
+
+    while (!((iir = uart_in(port, UART_IIR)) & UART_IIR_NO_INT)) {
+        switch (iir & UART_IIR_ID) {
+        case UART_IIR_THRI:
+            __uart_fill_fifo(port);
+            if (uart_tx_empty(port)) {
+                port->tx_active = false;
+                port->ier &= ~UART_IER_THRI;
+                uart_out(port, UART_IER, port->ier);
+            }
+            break;
+        case UART_IIR_RDI:
+        case UART_IIR_TIMEOUT:
+            /* input is not used; discard it */
+            while (uart_in(port, UART_LSR) & UART_LSR_DR)
+                uart_in(port, UART_RBR);
+            break;
+        case UART_IIR_RLSI:
+            uart_in(port, UART_LSR);
+            break;
+        case UART_IIR_MSI:
+            uart_in(port, UART_MSR);
+            break;
+        }
+    }
+
+    spin_unlock(&port->lock);
+}
+
+/*
+ * uart_probe:
+ * Check that a UART exists at `port` by writing its scratch register, then
+ * program it for 8N1 at the configured baud rate with FIFOs enabled.
+ */
+static int uart_probe(struct uart_port *port)
+{
+    unsigned int divisor;
+    uint8_t v;
+
+    uart_out(port, UART_SCR, 0x5A);
+    if (uart_in(port, UART_SCR) != 0x5A)
+        return 1;
+    uart_out(port, UART_SCR, 0xA5);
+    if (uart_in(port, UART_SCR) != 0xA5)
+        return 1;
+
+    port->ier = 0;
+    uart_out(port, UART_IER, 0);
+
+    divisor = UART_BASE_BAUD / CONFIG(SERIAL_BAUD);
+    uart_out(port, UART_LCR, UART_LCR_DLAB);
+    uart_out(port, UART_DLL, divisor & 0xFF);
+    uart_out(port, UART_DLM, (divisor >> 8) & 0xFF);
+    uart_out(port, UART_LCR, UART_LCR_WLEN8);
+
+    uart_out(port, UART_FCR, UART_FCR_ENABLE | UART_FCR_CLEAR_RCVR |
+                             UART_FCR_CLEAR_XMIT | UART_FCR_TRIGGER_14);
+
+    /* Only a 16550A reports working FIFOs. Older parts send one at a time. */
+    v = uart_in(port, UART_IIR);
+    port->fifo_size = (v & UART_IIR_FIFO) == UART_IIR_FIFO ? UART_FIFO_SIZE
+                                                           : 1;
+
+    /* OUT2 gates the UART's interrupt line on PC hardware. */
+    uart_out(port, UART_MCR, UART_MCR_DTR | UART_MCR_RTS | UART_MCR_OUT2);
+
+    return 0;
+}
+
+void serial_console_register(void)
+{
+    if (uart_probe(&com1) != 0)
+        return;
+
+    list_init(&serial_console.list);
+    console_register(&serial_console, "ttyS0", &serial_fn, 0);
+    klog_add_console(&serial_console);
+}
+
+void serial_console_enable_irq(void)
+{
+    unsigned long irqstate;
+
+    if (!com1.fifo_size)
+        return;
+
+    if (request_fixed_irq(com1.irq, &com1, uart_irq_handler) != 0) {
+        klog(KLOG_ERROR, "serial: failed to map COM1 to IRQ %u", com1.irq);
+        return;
+    }
+
+    spin_lock_irq(&com1.lock, &irqstate);
+    com1.irq_enabled = true;
+    spin_unlock_irq(&com1.lock, irqstate);
+
+    unmask_irq(com1.irq);
+    klog(KLOG_INFO, "serial: ttyS0 at 0x%03x, IRQ %u, %u byte FIFO",
+         com1.base, com1.irq, com1.fifo_size);
+}
+
+void serial_panic_write(const char *s, size_t len)
+{
+    if (!com1.fifo_size)
+        return;
+
+    /* The lock holder may have been stopped by the panic. */
+    spin_init(&com1.lock);
+    com1.irq_enabled = false;
+
+    __uart_drain(&com1);
+    while (len--) {
+        if (*s == '\n')
+            __uart_putc(&com1, '\r');
+        __uart_putc(&com1, *s++);
+    }
+    __uart_drain(&com1);
+}
+
+static int serial_init(struct console *c)
+{
+    c->cols = 80;
+    c->rows = 25;
+    c->cursor_x = 0;
+    c->cursor_y = 0;
+    c->screenbuf = NULL;
+    c->screenbuf_size = 0;
+    c->fg_color = CON_COLOR_WHITE;
+    c->bg_color = CON_COLOR_BLACK;
+    c->default_color = c->fg_color | c->bg_color << 4;
+    c->color = c->default_color;
+    mutex_init(&c->lock);
+
+    return 0;
+}
+
+/*
+ * serial_write:
+ * Queue `n` characters from `buf` for transmission, translating newlines
+ * to CRLF.
+ */
+static int serial_write(__unused struct console *c, const char *buf, size_t n)
+{
+    unsigned long irqstate;
+    size_t i;
+
+    spin_lock_irq(&com1.lock, &irqstate);
+    for (i = 0; i < n; ++i) {
+        if (buf[i] == '\n')
+            __uart_putc(&com1, '\r');
+        __uart_putc(&com1, buf[i]);
+    }
+    __uart_start_tx(&com1);
+    spin_unlock_irq(&com1.lock, irqstate);
+
+    return n;
+}
+
+static int serial_putc(struct console *c, int ch)
+{
+    char put = ch;
+
+    return serial_write(c, &put, 1);
+}
+
+/* serial_flush: wait until all buffered output has been sent */
+static int serial_flush(__unused struct console *c)
+{
+    unsigned long irqstate;
+
+    spin_lock_irq(&com1.lock, &irqstate);
+    __uart_drain(&com1);
+    while (!(uart_in(&com1, UART_LSR) & UART_LSR_TEMT))
+        ;
+    spin_unlock_irq(&com1.lock, irqstate);
+
+    return 0;
+}
+
+/* serial_dummy: dummy function for operations without meaning on a UART */
+static int serial_dummy() { return 0; }
+
+static struct consfn serial_fn = {.init = serial_init,
+                                  .putc = serial_putc,
+                                  .write = serial_write,
+                                  .clear = serial_dummy,
+                                  .set_color = serial_dummy,
+                                  .move_cursor = serial_dummy,
+                                  .flush = serial_flush,
+                                  .destroy = serial_dummy};
+
+#endif  /* CONFIG(SERIAL_CONSOLE) */
@@ -22,6 +22,8 @@
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/mm.h>
+#include <radix/time.h>
+#include <radix/workqueue.h>
 
 #include <string.h>
 
@@ -33,6 +35,14 @@
 #define VGATEXT_NORMAL  0
 #define VGATEXT_BOLD    (1 << 3)
 
+/*
+ * Minimum time between two flushes of the shadow buffer to VGA memory.
+ * Output written within this period is flushed from a delayed work item.
+ */
+#define VGATEXT_FLUSH_INTERVAL (20 * NSEC_PER_MSEC)
+
+#define VGATEXT_ALL_ROWS ((1U << VGATEXT_HEIGHT) - 1)
+
 #define VGA_MISC_OUTPUT_OUT 0x3C2
 #define VGA_MISC_OUTPUT_IN  0x3CC
 
@@ -49,6 +59,25 @@ static __always_inline uint16_t vgatext_entry(uint8_t c, uint8_t color)
 static struct console vgatext_console;
 static struct consfn vgatext_fn;
 
+/*
+ * Writes to VGA memory are uncached and slow, so all drawing is done to a
+ * shadow buffer in RAM, which is copied out by vgatext_flush.
+ *
+ * The shadow buffer is a ring of rows. Screen row 0 is stored at row
+ * `vgatext_top` of the buffer, so scrolling only has to advance the ring
+ * and clear a single row. `vgatext_dirty` holds a bit for each screen row
+ * which differs from VGA memory.
+ */
+static uint16_t vgatext_shadow[VGATEXT_HEIGHT * VGATEXT_WIDTH];
+static int vgatext_top;
+static uint32_t vgatext_dirty;
+static int vgatext_cursor_dirty;
+static uint64_t vgatext_last_flush;
+
+static void vgatext_flush_work(struct work *work);
+static struct delayed_work vgatext_flush_dwork =
+    DELAYED_WORK_INIT(vgatext_flush_dwork, vgatext_flush_work);
+
 void vgatext_register(void)
 {
     list_init(&vgatext_console.list);
@@ -61,17 +90,15 @@ static int vgatext_move_cursor(struct console *c, int x, int y);
 /* vgatext_clear: clear the VGA text buffer */
 static int vgatext_clear(struct console *c)
 {
-    int x, y, ind;
+    int i;
     uint16_t *screenbuf = c->screenbuf;
 
     mutex_lock(&c->lock);
-    for (y = 0; y < VGATEXT_HEIGHT; ++y) {
-        for (x = 0; x < VGATEXT_WIDTH; ++x) {
-            ind = y * VGATEXT_WIDTH + x;
-            screenbuf[ind] = vgatext_entry(' ', c->color);
-        }
-    }
+    for (i = 0; i < VGATEXT_HEIGHT * VGATEXT_WIDTH; ++i)
+        screenbuf[i] = vgatext_entry(' ', c->color);
 
+    vgatext_top = 0;
+    vgatext_dirty = VGATEXT_ALL_ROWS;
     vgatext_move_cursor(c, 0, 0);
     mutex_unlock(&c->lock);
 
@@ -86,7 +113,7 @@ static int vgatext_init(struct console *c)
     c->rows = VGATEXT_HEIGHT;
     c->cursor_x = 0;
     c->cursor_y = 0;
-    c->screenbuf = (void *)VGATEXT_BUFFER;
+    c->screenbuf = vgatext_shadow;
     c->screenbuf_size = c->rows * c->cols * sizeof(uint16_t);
     c->fg_color = CON_COLOR_WHITE;
     c->bg_color = CON_COLOR_BLACK;
@@ -101,33 +128,48 @@ static int vgatext_init(struct console *c)
     return vgatext_clear(c);
 }
 
-/* vgatext_put: write ch to position x, y of vga text buffer */
-static __always_inline void vgatext_put(struct console *c, int ch, int x, int y)
+/* vgatext_row: return the shadow buffer row displayed at screen row y */
+static __always_inline uint16_t *vgatext_row(struct console *c, int y)
 {
     uint16_t *screenbuf = c->screenbuf;
 
-    screenbuf[y * VGATEXT_WIDTH + x] = vgatext_entry(ch, c->color);
+    y += vgatext_top;
+    if (y >= VGATEXT_HEIGHT)
+        y -= VGATEXT_HEIGHT;
+
+    return screenbuf + y * VGATEXT_WIDTH;
+}
+
+/* vgatext_put: write ch to position x, y of vga text buffer */
+static __always_inline void vgatext_put(struct console *c, int ch, int x, int y)
+{
+    vgatext_row(c, y)[x] = vgatext_entry(ch, c->color);
+    vgatext_dirty |= 1U << y;
 }
 
 /* vgatext_nextrow: advance to the next row, scrolling if necessary */
 static void vgatext_nextrow(struct console *c)
 {
-    uint16_t *screenbuf;
+    uint16_t *row;
     int x;
 
     c->cursor_x = 0;
-    screenbuf = c->screenbuf;
     if (c->cursor_y == VGATEXT_HEIGHT - 1) {
-        /* move each row up by one, discarding the first */
-        memmove(screenbuf,
-                screenbuf + VGATEXT_WIDTH,
-                c->cursor_y * VGATEXT_WIDTH * sizeof(uint16_t));
-        /* clear the final row */
+        /*
+         * Rotate the ring so that the first row becomes the last,
+         * then clear it. Every row on screen has moved.
+         */
+        if (++vgatext_top == VGATEXT_HEIGHT)
+            vgatext_top = 0;
+
+        row = vgatext_row(c, c->cursor_y);
         for (x = 0; x < VGATEXT_WIDTH; ++x)
-            vgatext_put(c, ' ', x, c->cursor_y);
+            row[x] = vgatext_entry(' ', c->color);
+        vgatext_dirty = VGATEXT_ALL_ROWS;
     } else {
         ++c->cursor_y;
     }
+    vgatext_cursor_dirty = 1;
 }
 
 /* vgatext_putchar: write ch to current vga position */
@@ -148,6 +190,79 @@ static void vgatext_update_cursor(int x, int y)
     outb(0x3D5, pos & 0xFF);
 }
 
+/*
+ * __vgatext_flush:
+ * Copy all damaged rows of the shadow buffer to VGA memory and update
+ * the hardware cursor. Must be called with the console locked.
+ */
+static void __vgatext_flush(struct console *c)
+{
+    uint16_t *vga = (uint16_t *)VGATEXT_BUFFER;
+    uint32_t dirty;
+    int y;
+
+    dirty = vgatext_dirty;
+    vgatext_dirty = 0;
+
+    while (dirty) {
+        y = __builtin_ctz(dirty);
+        dirty &= dirty - 1;
+        memcpy(vga + y * VGATEXT_WIDTH,
+               vgatext_row(c, y),
+               VGATEXT_WIDTH * sizeof(uint16_t));
+    }
+
+    if (vgatext_cursor_dirty) {
+        vgatext_cursor_dirty = 0;
+        vgatext_update_cursor(c->cursor_x, c->cursor_y);
+    }
+
+    vgatext_last_flush = time_ns();
+}
+
+/*
+ * vgatext_commit:
+ * Flush the shadow buffer if the previous flush was long enough ago,
+ * otherwise schedule a flush for when it will be. Must be called with
+ * the console locked.
+ */
+static void vgatext_commit(struct console *c)
+{
+    uint64_t elapsed;
+
+    if (!vgatext_dirty && !vgatext_cursor_dirty)
+        return;
+
+    elapsed = time_ns() - vgatext_last_flush;
+
+    /* Output before workers exist can't be deferred. */
+    if (elapsed >= VGATEXT_FLUSH_INTERVAL || !workqueue_ready()) {
+        __vgatext_flush(c);
+        return;
+    }
+
+    queue_delayed_work(system_wq,
+                       &vgatext_flush_dwork,
+                       VGATEXT_FLUSH_INTERVAL - elapsed);
+}
+
+static void vgatext_flush_work(__unused struct work *work)
+{
+    mutex_lock(&vgatext_console.lock);
+    __vgatext_flush(&vgatext_console);
+    mutex_unlock(&vgatext_console.lock);
+}
+
+/* vgatext_flush: write all pending output to VGA memory immediately */
+static int vgatext_flush(struct console *c)
+{
+    mutex_lock(&c->lock);
+    __vgatext_flush(c);
+    mutex_unlock(&c->lock);
+
+    return 0;
+}
+
 /*
  * vgatext_write:
  * Write `n` characters from `buf` to the VGA text buffer.
@@ -184,8 +299,9 @@ static int vgatext_write(struct console *c, const char *buf, size_t n)
         ++written;
         ++buf;
     }
+    vgatext_cursor_dirty = 1;
+    vgatext_commit(c);
     mutex_unlock(&c->lock);
-    vgatext_update_cursor(c->cursor_x, c->cursor_y);
 
     return written;
 }
@@ -220,7 +336,8 @@ static int vgatext_move_cursor(struct console *c, int x, int y)
 {
     c->cursor_x = x;
     c->cursor_y = y;
-    vgatext_update_cursor(c->cursor_x, c->cursor_y);
+    vgatext_cursor_dirty = 1;
+    vgatext_commit(c);
 
     return 0;
 }
@@ -234,4 +351,5 @@ static struct consfn vgatext_fn = {.init = vgatext_init,
                                    .clear = vgatext_clear,
                                    .set_color = vgatext_set_color,
                                    .move_cursor = vgatext_move_cursor,
+                                   .flush = vgatext_flush,
                                    .destroy = vgatext_dummy};
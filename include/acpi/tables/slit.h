@@ -0,0 +1,45 @@
+/*
+ * include/acpi/tables/slit.h
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ACPI_TABLES_SLIT_H
+#define ACPI_TABLES_SLIT_H
+
+#include <acpi/tables/sdt.h>
+#include <radix/compiler.h>
+#include <stdint.h>
+
+#define ACPI_SLIT_SIGNATURE "SLIT"
+
+/*
+ * System Locality Information Table: a locality_count x locality_count
+ * matrix of relative distances between proximity domains, row-major.
+ */
+struct acpi_slit {
+    struct acpi_sdt_header header;
+    uint64_t locality_count;
+    uint8_t entry[];
+} __packed;
+
+/*
+ * Parse the SLIT and record the distances between all NUMA nodes.
+ * Must be called after acpi_parse_srat. Returns nonzero if there is
+ * no valid SLIT.
+ */
+int acpi_parse_slit(void);
+
+#endif /* ACPI_TABLES_SLIT_H */
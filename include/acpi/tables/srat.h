@@ -0,0 +1,95 @@
+/*
+ * include/acpi/tables/srat.h
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ACPI_TABLES_SRAT_H
+#define ACPI_TABLES_SRAT_H
+
+#include <acpi/tables/sdt.h>
+#include <radix/compiler.h>
+#include <stdint.h>
+
+enum {
+    ACPI_SRAT_CPU_AFFINITY = 0,
+    ACPI_SRAT_MEMORY_AFFINITY = 1,
+    ACPI_SRAT_X2APIC_CPU_AFFINITY = 2
+};
+
+#define ACPI_SRAT_SIGNATURE "SRAT"
+
+/* System Resource Affinity Table */
+struct acpi_srat {
+    struct acpi_sdt_header header;
+    uint32_t table_revision;
+    uint64_t reserved;
+} __packed;
+
+/*
+ * Corresponding subtables for above types.
+ * From Linux include/acpi/actbl3.h
+ */
+
+struct acpi_srat_cpu_affinity {
+    struct acpi_subtable_header header;
+    uint8_t proximity_domain_lo;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t local_sapic_eid;
+    uint8_t proximity_domain_hi[3];
+    uint32_t clock_domain;
+} __packed;
+
+#define ACPI_SRAT_CPU_ENABLED 1
+
+struct acpi_srat_mem_affinity {
+    struct acpi_subtable_header header;
+    uint32_t proximity_domain;
+    uint16_t reserved;
+    uint64_t base_address;
+    uint64_t length;
+    uint32_t reserved1;
+    uint32_t flags;
+    uint64_t reserved2;
+} __packed;
+
+#define ACPI_SRAT_MEM_ENABLED       (1 << 0)
+#define ACPI_SRAT_MEM_HOT_PLUGGABLE (1 << 1)
+#define ACPI_SRAT_MEM_NON_VOLATILE  (1 << 2)
+
+struct acpi_srat_x2apic_cpu_affinity {
+    struct acpi_subtable_header header;
+    uint16_t reserved;
+    uint32_t proximity_domain;
+    uint32_t apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __packed;
+
+/*
+ * Parse the SRAT, registering the memory ranges of each proximity domain
+ * with the NUMA subsystem. Returns nonzero if there is no SRAT.
+ */
+int acpi_parse_srat(void);
+
+/* Return the NUMA node of the processor with local APIC ID `apic_id`. */
+int acpi_srat_apic_node(uint32_t apic_id);
+
+/* Return the NUMA node assigned to proximity domain `pxm`, if any. */
+int acpi_pxm_to_node(uint32_t pxm);
+
+#endif /* ACPI_TABLES_SRAT_H */
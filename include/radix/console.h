@@ -48,6 +48,7 @@ struct consfn {
     int (*clear)(struct console *);
     int (*set_color)(struct console *, int, int);
     int (*move_cursor)(struct console *, int, int);
+    int (*flush)(struct console *);
     int (*destroy)(struct console *);
 };
 
@@ -25,4 +25,10 @@
 #define cpu_set_kernel_stack(s) __arch_set_kernel_stack(s)
 #define cpu_cache_str()         __arch_cache_str()
 
+/*
+ * Measures the throughput of each available implementation of the memory
+ * functions across a range of sizes.
+ */
+#define cpu_string_benchmark() __arch_string_benchmark()
+
 #endif /* RADIX_CPU_H */
@@ -19,16 +19,218 @@
 #ifndef RADIX_CPUMASK_H
 #define RADIX_CPUMASK_H
 
+#include <radix/atomic.h>
+#include <radix/bits.h>
+#include <radix/compiler.h>
 #include <radix/config.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define MAX_CPUS CONFIG(MAX_CPUS)
 
-#if MAX_CPUS > 32
-typedef uint64_t cpumask_t;
-#else
-typedef uint32_t cpumask_t;
-#endif
+#define CPUMASK_WORD_BITS (8 * sizeof(unsigned long))
+#define CPUMASK_WORDS \
+    ((MAX_CPUS + CPUMASK_WORD_BITS - 1) / CPUMASK_WORD_BITS)
+
+// Bits of the final word of a cpumask which represent valid CPUs.
+#define CPUMASK_LAST_WORD_MASK                         \
+    (MAX_CPUS % CPUMASK_WORD_BITS                      \
+         ? (1UL << (MAX_CPUS % CPUMASK_WORD_BITS)) - 1 \
+         : ~0UL)
+
+// A set of CPUs, stored as a bitmap of native words so that each word can be
+// updated atomically regardless of how many CPUs are supported. CPU `n` is
+// represented by bit `n % CPUMASK_WORD_BITS` of word `n / CPUMASK_WORD_BITS`.
+//
+// cpumasks may be copied by assignment. Larger operations take pointers.
+typedef struct {
+    unsigned long bits[CPUMASK_WORDS];
+} cpumask_t;
+
+#define __cpumask_word(cpu) ((unsigned int)(cpu) / CPUMASK_WORD_BITS)
+#define __cpumask_bit(cpu)  (1UL << ((unsigned int)(cpu) % CPUMASK_WORD_BITS))
+
+static __always_inline void cpumask_clear(cpumask_t *mask)
+{
+    for (unsigned int i = 0; i < CPUMASK_WORDS; ++i) {
+        mask->bits[i] = 0;
+    }
+}
+
+// Sets every supported CPU in `mask`.
+static __always_inline void cpumask_setall(cpumask_t *mask)
+{
+    for (unsigned int i = 0; i < CPUMASK_WORDS; ++i) {
+        mask->bits[i] = ~0UL;
+    }
+    mask->bits[CPUMASK_WORDS - 1] &= CPUMASK_LAST_WORD_MASK;
+}
+
+static __always_inline void cpumask_set_cpu(cpumask_t *mask, int cpu)
+{
+    mask->bits[__cpumask_word(cpu)] |= __cpumask_bit(cpu);
+}
+
+static __always_inline void cpumask_clear_cpu(cpumask_t *mask, int cpu)
+{
+    mask->bits[__cpumask_word(cpu)] &= ~__cpumask_bit(cpu);
+}
+
+// Atomic versions of cpumask_set_cpu and cpumask_clear_cpu, for masks which
+// are shared between CPUs.
+static __always_inline void cpumask_set_cpu_atomic(cpumask_t *mask, int cpu)
+{
+    atomic_or(&mask->bits[__cpumask_word(cpu)], __cpumask_bit(cpu));
+}
+
+static __always_inline void cpumask_clear_cpu_atomic(cpumask_t *mask, int cpu)
+{
+    atomic_and(&mask->bits[__cpumask_word(cpu)], ~__cpumask_bit(cpu));
+}
+
+static __always_inline bool cpumask_test_cpu(const cpumask_t *mask, int cpu)
+{
+    return (mask->bits[__cpumask_word(cpu)] & __cpumask_bit(cpu)) != 0;
+}
+
+static __always_inline bool cpumask_empty(const cpumask_t *mask)
+{
+    for (unsigned int i = 0; i < CPUMASK_WORDS; ++i) {
+        if (mask->bits[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static __always_inline bool cpumask_equal(const cpumask_t *a,
+                                          const cpumask_t *b)
+{
+    for (unsigned int i = 0; i < CPUMASK_WORDS; ++i) {
+        if (a->bits[i] != b->bits[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns true if every CPU in `a` is also in `b`.
+static __always_inline bool cpumask_subset(const cpumask_t *a,
+                                           const cpumask_t *b)
+{
+    for (unsigned int i = 0; i < CPUMASK_WORDS; ++i) {
+        if (a->bits[i] & ~b->bits[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The following set `dst` to the result of a bitwise operation on `a` and `b`,
+// and return true if the result is non-empty. `dst` may alias either operand.
+
+static __always_inline bool cpumask_and(cpumask_t *dst,
+                                        const cpumask_t *a,
+                                        const cpumask_t *b)
+{
+    unsigned long any = 0;
+    for (unsigned int i = 0; i < CPUMASK_WORDS; ++i) {
+        any |= dst->bits[i] = a->bits[i] & b->bits[i];
+    }
+    return any != 0;
+}
+
+static __always_inline bool cpumask_or(cpumask_t *dst,
+                                       const cpumask_t *a,
+                                       const cpumask_t *b)
+{
+    unsigned long any = 0;
+    for (unsigned int i = 0; i < CPUMASK_WORDS; ++i) {
+        any |= dst->bits[i] = a->bits[i] | b->bits[i];
+    }
+    return any != 0;
+}
+
+// Sets `dst` to the CPUs in `a` which are not in `b`.
+static __always_inline bool cpumask_andnot(cpumask_t *dst,
+                                           const cpumask_t *a,
+                                           const cpumask_t *b)
+{
+    unsigned long any = 0;
+    for (unsigned int i = 0; i < CPUMASK_WORDS; ++i) {
+        any |= dst->bits[i] = a->bits[i] & ~b->bits[i];
+    }
+    return any != 0;
+}
+
+// Returns the number of CPUs in `mask`.
+static __always_inline int cpumask_weight(const cpumask_t *mask)
+{
+    int weight = 0;
+    for (unsigned int i = 0; i < CPUMASK_WORDS; ++i) {
+        weight += __builtin_popcountl(mask->bits[i]);
+    }
+    return weight;
+}
+
+// Returns the lowest CPU in `mask` which is greater than `cpu`, or -1 if there
+// is none. Passing -1 as `cpu` returns the first CPU in the mask.
+static __always_inline int cpumask_next(const cpumask_t *mask, int cpu)
+{
+    unsigned int next = cpu + 1;
+    unsigned int word = next / CPUMASK_WORD_BITS;
+
+    if (next >= MAX_CPUS) {
+        return -1;
+    }
+
+    unsigned long bits =
+        mask->bits[word] & (~0UL << (next % CPUMASK_WORD_BITS));
+    while (!bits) {
+        if (++word == CPUMASK_WORDS) {
+            return -1;
+        }
+        bits = mask->bits[word];
+    }
+
+    next = word * CPUMASK_WORD_BITS + ffs(bits) - 1;
+    return next < MAX_CPUS ? (int)next : -1;
+}
+
+#define cpumask_first(mask) cpumask_next((mask), -1)
+
+#define for_each_cpu(cpu, mask) \
+    for ((cpu) = -1; ((cpu) = cpumask_next((mask), (cpu))) != -1;)
+
+// Constructors for common masks, which return the mask by value.
+
+static __always_inline cpumask_t cpumask_of(int cpu)
+{
+    cpumask_t mask;
+    cpumask_clear(&mask);
+    cpumask_set_cpu(&mask, cpu);
+    return mask;
+}
+
+static __always_inline cpumask_t cpumask_all(void)
+{
+    cpumask_t mask;
+    cpumask_setall(&mask);
+    return mask;
+}
+
+static __always_inline cpumask_t cpumask_all_but(int cpu)
+{
+    cpumask_t mask;
+    cpumask_setall(&mask);
+    cpumask_clear_cpu(&mask, cpu);
+    return mask;
+}
+
+// Static initializer for a mask containing only CPU 0.
+// clang-format off
+#define CPUMASK_INIT_CPU0 { .bits = { 1 } }
+// clang-format on
 
 #endif  // RADIX_CPUMASK_H
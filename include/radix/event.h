@@ -27,7 +27,7 @@
 void event_init(void);
 void event_start(void);
 void cpu_event_init(void);
-void event_handler(void);
+bool event_handler(void);
 
 void timekeeping_event_set_period(uint64_t period);
 
@@ -36,4 +36,21 @@ void sched_event_del(void);
 
 int sleep_event_add(struct task *task, uint64_t timestamp);
 
+// Schedules `func(arg, data)` to be called at `timestamp` on the current CPU.
+// The function runs in interrupt context, from the event handler, and must not
+// block. As a callback may already be running when it is cancelled, it should
+// check whether it is still wanted, e.g. using `data` as a sequence number.
+int callback_event_add(uint64_t timestamp,
+                       void (*func)(void *, unsigned long),
+                       void *arg,
+                       unsigned long data);
+
+// Removes a callback event added on `cpu` with the given function and
+// arguments, if it has not yet run. Once this returns, the callback is not
+// running and will not run. Must not be called from an interrupt handler.
+void callback_event_del(int cpu,
+                        void (*func)(void *, unsigned long),
+                        void *arg,
+                        unsigned long data);
+
 #endif /* RADIX_EVENT_H */
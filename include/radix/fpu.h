@@ -0,0 +1,46 @@
+/*
+ * include/radix/fpu.h
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_FPU_H
+#define RADIX_FPU_H
+
+#include <radix/asm/fpu.h>
+
+// Floating point and vector register state is saved and restored lazily. A
+// task's state is only loaded once it executes an FPU instruction, and is only
+// saved when it is switched out if it was used during its timeslice.
+
+// Allows kernel code to use floating point and vector registers until the
+// matching kernel_fpu_end. Any live state of the current task is saved first.
+// Interrupts are disabled within the section, and sections cannot be nested.
+#define kernel_fpu_begin() __arch_kernel_fpu_begin()
+#define kernel_fpu_end()   __arch_kernel_fpu_end()
+
+// Returns true if kernel_fpu_begin provides SSE2.
+#define kernel_fpu_has_sse2() __arch_kernel_fpu_has_sse2()
+
+// Called by the scheduler before switching away from `prev`.
+#define fpu_switch_out(prev) __arch_fpu_switch_out(prev)
+
+// Copies the FPU state of `parent` into `task`. Returns 0 or ENOMEM.
+#define fpu_fork(task, parent) __arch_fpu_fork(task, parent)
+
+// Frees the saved FPU state of an exited task.
+#define fpu_release(task) __arch_fpu_release(task)
+
+#endif  // RADIX_FPU_H
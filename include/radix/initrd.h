@@ -19,13 +19,50 @@
 #ifndef RADIX_INITRD_H
 #define RADIX_INITRD_H
 
+#include <radix/list.h>
+
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+enum initrd_file_type {
+    INITRD_FILE_REGULAR,
+    INITRD_FILE_DIRECTORY,
+};
+
+// The file is stored as an LZ4 frame and has not yet been decompressed.
+#define INITRD_FILE_COMPRESSED (1 << 0)
+
+// A file or directory within the initrd.
+//
+// The initrd is parsed once at boot into a tree of these, rooted at an unnamed
+// directory, with every node also indexed by its full path in a hash table.
 struct initrd_file {
+    // Path of the file relative to the initrd root, without leading or trailing
+    // slashes, and its final component.
     const char *path;
+    const char *name;
+
+    // Contents of the file, and their uncompressed size. `base` is NULL for
+    // compressed files until they are first accessed through
+    // `initrd_file_data()`, which should be used instead of reading it.
     const uint8_t *base;
     size_t size;
+    enum initrd_file_type type;
+    uint32_t flags;
+
+    // Compressed contents of the file within the initrd.
+    const uint8_t *raw;
+    size_t raw_size;
+
+    // Directory tree linkage. `children` is only used by directories.
+    struct initrd_file *parent;
+    struct list children;
+    struct list sibling;
+
+    // Next file in the same hash bucket.
+    struct initrd_file *hash_next;
+    uint32_t hash;
 };
 
 #ifdef __cplusplus
@@ -34,8 +71,28 @@ extern "C" {
 
 int read_initrd(const void *ptr, size_t len);
 
+// Looks up a file or directory by its path within the initrd. Leading and
+// trailing slashes are ignored, so "/bin/", "bin" and "./bin" are equivalent.
+// The empty path refers to the root directory.
 const struct initrd_file *initrd_get_file(const char *path);
 
+// Returns the root directory of the initrd.
+const struct initrd_file *initrd_root(void);
+
+// Returns the contents of a regular file, decompressing them on first access
+// if the initrd is compressed. The returned buffer is `file->size` bytes long
+// and remains valid forever.
+const uint8_t *initrd_file_data(const struct initrd_file *file);
+
+static inline bool initrd_is_dir(const struct initrd_file *file)
+{
+    return file->type == INITRD_FILE_DIRECTORY;
+}
+
+// Iterates over the immediate children of directory `dir`.
+#define initrd_for_each_child(child, dir) \
+    list_for_each_entry (child, &(dir)->children, sibling)
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -22,31 +22,72 @@
 #ifdef __KERNEL__
 
 #include <radix/compiler.h>
+#include <radix/config.h>
+#include <radix/cpumask.h>
 
 typedef void (*irq_handler_t)(void *);
 
+struct irq_thread;
+
 struct irq_descriptor {
     irq_handler_t handler;
     void *device;
     unsigned long flags;
+    struct irq_thread *thread;
     struct irq_descriptor *next;
 };
 
 #define IRQ_ALLOW_SHARED (1 << 0)
 
+/* Keep the IRQ masked until its threaded handler has run. */
+#define IRQ_ONESHOT (1 << 1)
+
 __must_check int request_irq(void *device,
                              irq_handler_t handler,
                              unsigned long flags);
 __must_check int request_fixed_irq(unsigned int irq,
                                    void *device,
                                    irq_handler_t handler);
+__must_check int request_threaded_irq(void *device,
+                                      irq_handler_t handler,
+                                      irq_handler_t thread_fn,
+                                      unsigned long flags);
+__must_check int request_fixed_threaded_irq(unsigned int irq,
+                                            void *device,
+                                            irq_handler_t handler,
+                                            irq_handler_t thread_fn,
+                                            unsigned long flags);
 void release_irq(unsigned int irq, void *device);
 
+void irq_thread_set_irq(struct irq_thread *thread, unsigned int irq);
+void irq_thread_wake(struct irq_thread *thread);
+
+int irq_set_affinity(unsigned int irq, const cpumask_t *mask);
+int irq_get_affinity(unsigned int irq, cpumask_t *mask);
+int irq_move(unsigned int irq, int cpu);
+int irq_target_cpu(unsigned int irq);
+
+/* Number of times the specified IRQ has been received by `cpu`. */
+#define irq_cpu_count(irq, cpu) __arch_irq_count(irq, cpu)
+
+#if CONFIG(IRQ_BALANCE)
+void irq_balance_init(void);
+#else
+#define irq_balance_init()
+#endif
+
+#if CONFIG(IRQ_STATS_DUMP_INTERVAL)
+void irq_stats_dump_init(void);
+#else
+#define irq_stats_dump_init()
+#endif
+
 #define mask_irq(irq)   __arch_mask_irq(irq)
 #define unmask_irq(irq) __arch_unmask_irq(irq)
 
-#define irq_init __arch_irq_init
-#define in_irq   __arch_in_irq
+#define irq_init       __arch_irq_init
+#define in_irq         __arch_in_irq
+#define irq_stats_dump __arch_irq_stats_dump
 
 #endif /* __KERNEL__ */
 
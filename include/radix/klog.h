@@ -27,4 +27,10 @@ void klog(int level, const char *format, ...);
 
 void klog_set_console(struct console *c);
 
+/*
+ * Adds a console to which the kernel log is written in addition to the one
+ * set by klog_set_console. Returns ENOSPC if no more consoles can be added.
+ */
+int klog_add_console(struct console *c);
+
 #endif /* RADIX_KLOG_H */
@@ -19,6 +19,7 @@
 #ifndef RADIX_KTHREAD_H
 #define RADIX_KTHREAD_H
 
+#include <radix/config.h>
 #include <radix/task.h>
 
 #define KTHREAD_NAME_LEN 0x40
@@ -32,6 +33,20 @@ struct task *kthread_run(
 void kthread_start(struct task *thread);
 void kthread_stop(struct task *thread);
 
+// Blocks the running kthread until another context calls kthread_wake on it.
+// If the thread was woken since it last waited, returns immediately.
+void kthread_wait(void);
+
+// Wakes `thread` if it is blocked in kthread_wait, or otherwise causes its next
+// kthread_wait call to return immediately. Safe to call from interrupt context.
+void kthread_wake(struct task *thread);
+
 __noreturn void kthread_exit(void);
 
+#if CONFIG(KTHREAD_BENCHMARK)
+// Repeatedly spawns short-lived kthreads and reports the cost of creating them
+// and of a full spawn/exit cycle.
+void kthread_benchmark(void);
+#endif
+
 #endif /* RADIX_KTHREAD_H */
@@ -0,0 +1,72 @@
+/*
+ * include/radix/lz4.h
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_LZ4_H
+#define RADIX_LZ4_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LZ4_FRAME_MAGIC 0x184D2204U
+
+// Frame descriptor flags, as defined by the LZ4 frame format.
+#define LZ4_FLG_DICT_ID           (1 << 0)
+#define LZ4_FLG_CONTENT_CHECKSUM  (1 << 2)
+#define LZ4_FLG_CONTENT_SIZE      (1 << 3)
+#define LZ4_FLG_BLOCK_CHECKSUM    (1 << 4)
+#define LZ4_FLG_BLOCK_INDEPENDENT (1 << 5)
+
+struct lz4_frame_info {
+    uint64_t content_size;  // Only valid with LZ4_FLG_CONTENT_SIZE.
+    size_t header_size;
+    uint8_t flags;
+};
+
+// Parses the header of an LZ4 frame located at `src`.
+//
+// Returns 0 on success or EINVAL if `src` does not begin with a supported
+// frame. Frames which depend on an external dictionary are not supported.
+int lz4_frame_info(const void *src, size_t len, struct lz4_frame_info *info);
+
+// Decompresses the LZ4 frame at `src` into the buffer `dst`, storing the number
+// of bytes written in `out_len`.
+//
+// Returns 0 on success, EINVAL if the frame is malformed, or ENOSPC if its
+// contents do not fit within `dst_len` bytes. Checksums are not verified, but
+// all reads and writes are bounds checked.
+int lz4_frame_decompress(const void *src,
+                         size_t src_len,
+                         void *dst,
+                         size_t dst_len,
+                         size_t *out_len);
+
+// Computes the decompressed length of the LZ4 frame at `src` by walking its
+// sequences without writing any output. Used for frames which do not record
+// their content size in the header.
+int lz4_frame_measure(const void *src, size_t src_len, size_t *len);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // RADIX_LZ4_H
@@ -60,6 +60,19 @@ uint64_t usedmem(void);
 
 void buddy_init(struct multiboot_info *mbt);
 
+/*
+ * Split the kernel and user zones between NUMA nodes once the topology
+ * is known. Called by numa_init.
+ */
+void buddy_numa_init(void);
+
+/*
+ * Pre-zeroed page pools for __PA_ZERO allocations. zero_pool_refill is
+ * called by idle CPUs to clear a page at a time ahead of use.
+ */
+void zero_pool_init(void);
+bool zero_pool_refill(void);
+
 /*
  * The maximum amount of pages that can be allocated
  * at a time is 2^{PA_MAX_ORDER}.
@@ -84,9 +97,45 @@ void buddy_init(struct multiboot_info *mbt);
 #define PA_PAGETABLE (__PA_ZONE_USR | __PA_NO_MAP)
 #define PA_LOWMEM    (__PA_ZONE_LOW)
 
+/*
+ * Kernel and user zone allocations are served from the requesting CPU's
+ * NUMA node, or from `node` for alloc_pages_node, falling back to other
+ * nodes in order of distance.
+ */
 struct page *alloc_pages(unsigned int flags, size_t ord);
+struct page *alloc_pages_node(int node, unsigned int flags, size_t ord);
 void free_pages(struct page *p);
 
+/*
+ * Fragmentation of a buddy allocator zone. Indices are per order,
+ * in thousandths:
+ *   unusable   - share of free memory in blocks too small for an
+ *                allocation of the order.
+ *   frag_index - for an allocation of the order which would fail,
+ *                near 0 if it is for lack of memory and near 1000
+ *                if it is due to fragmentation; -1 if it wouldn't.
+ */
+struct zone_frag_stats {
+    size_t total_pages;
+    size_t free_pages;
+    size_t free_blocks[PA_ORDERS];
+    int unusable[PA_ORDERS];
+    int frag_index[PA_ORDERS];
+};
+
+/*
+ * Report the fragmentation of the zone on `node` used by allocation `flags`.
+ */
+void zone_fragmentation(unsigned int flags,
+                        int node,
+                        struct zone_frag_stats *stats);
+
+/*
+ * Start the thread which migrates user pages to recover high-order
+ * blocks when allocations fail due to fragmentation.
+ */
+void compaction_init(void);
+
 static __always_inline struct page *alloc_page(unsigned int flags)
 {
     return alloc_pages(flags, 0);
@@ -182,6 +231,14 @@ static inline int map_pages_vmm(const struct vmm_space *vmm,
 #define unmap_pages(virt, n) __arch_unmap_pages(virt, n)
 #define unmap_page(virt)     __arch_unmap_pages(virt, 1)
 
+// Checks whether `virt` in the current address space is mapped to a page which
+// is shared copy-on-write.
+#define page_is_cow(virt) __arch_page_is_cow(virt)
+
+// Replaces the copy-on-write mapping of `virt` in the current address space
+// with a writable mapping to physical address `phys`.
+#define remap_cow_page(virt, phys) __arch_remap_cow_page(virt, phys)
+
 #define set_cache_policy(virt, type) __arch_set_cache_policy(virt, type)
 
 #define mark_page_wb(virt)      set_cache_policy(virt, PAGE_CP_WRITE_BACK)
@@ -191,8 +248,23 @@ static inline int map_pages_vmm(const struct vmm_space *vmm,
 #define mark_page_wc(virt)      set_cache_policy(virt, PAGE_CP_WRITE_COMBINING)
 #define mark_page_wp(virt)      set_cache_policy(virt, PAGE_CP_WRITE_PROTECTED)
 
+// Switches the current CPU to address space `vmm`. Switches to the kernel's
+// address space are lazy: kernel threads run in whichever address space the
+// CPU already has loaded.
 #define switch_address_space(vmm) __arch_switch_address_space(vmm)
 
+// Reports how many address space switches across all CPUs reloaded the page
+// tables and how many were avoided.
+#define address_space_stats(loads, avoided) \
+    __arch_address_space_stats(loads, avoided)
+
+// Enables or disables lazy address space switching.
+#define set_lazy_address_space(enable) __arch_set_lazy_address_space(enable)
+
+// Ensures that the kernel's mapping of `virt` is visible in the current address
+// space, for kernel memory which is accessed where a fault cannot be handled.
+#define sync_kernel_mapping(virt) __arch_sync_kernel_mapping(virt)
+
 /*
  * TLB control functions.
  */
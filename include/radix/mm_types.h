@@ -88,8 +88,21 @@
 #define PM_PAGE_ZONE_USR  (1 << 19)
 
 struct page {
-    void *slab_cache;     /* address of slab cache */
-    void *slab_desc;      /* address of slab descriptor */
+    union {
+        /* slab pages */
+        struct {
+            void *slab_cache; /* address of slab cache */
+            void *slab_desc;  /* address of slab descriptor */
+        };
+        /*
+         * Reverse map of single user pages, used to migrate them.
+         * Other pages outside of slabs have PAGE_UNINIT_MAGIC here.
+         */
+        struct {
+            void *vmm_block; /* vmm_block which owns the page */
+            addr_t vmm_addr; /* virtual address of the page in it */
+        };
+    };
     void *mem;            /* start of the page itself */
     unsigned long status; /* information about state */
     struct list list;     /* buddy allocator list */
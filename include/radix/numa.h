@@ -0,0 +1,52 @@
+/*
+ * include/radix/numa.h
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_NUMA_H
+#define RADIX_NUMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_NUMNODES 8
+#define NUMA_NO_NODE (-1)
+
+// Relative distances between nodes, as used by the ACPI SLIT.
+#define LOCAL_DISTANCE  10
+#define REMOTE_DISTANCE 20
+
+// Firmware table parsers describe the system's topology through these before
+// numa_init is called. Node IDs are dense, starting from 0.
+int numa_add_memblk(int node, uint64_t base, uint64_t len);
+void numa_set_distance(int from, int to, int distance);
+void numa_set_cpu_node(int cpu, int node);
+
+// Brings the described nodes online and splits the page allocator's zones
+// between them. Without a description, the system is treated as a single node.
+void numa_init(void);
+
+int numa_node_count(void);
+int cpu_to_node(int cpu);
+int numa_node_id(void);
+int pfn_to_node(size_t pfn);
+int node_distance(int from, int to);
+
+// Returns the `i`th closest node to `node`, starting from `node` itself, or
+// NUMA_NO_NODE once all nodes have been returned.
+int numa_fallback_node(int node, int i);
+
+#endif /* RADIX_NUMA_H */
@@ -0,0 +1,52 @@
+/*
+ * include/radix/pid.h
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_PID_H
+#define RADIX_PID_H
+
+struct task;
+
+// PIDs are allocated from the range [1, PID_MAX).
+#define PID_MAX 32768
+
+// Assigns an unused PID to `task` and adds it to the global task registry.
+// PIDs are handed out cyclically, so a freed PID is not reused until the rest
+// of the PID space has been cycled through.
+//
+// Returns 0 on success, EAGAIN if no PIDs are available, or ENOMEM if the
+// lookup table could not be extended.
+int pid_alloc(struct task *task);
+
+// Removes `task` from the task registry and releases its PID.
+void pid_free(struct task *task);
+
+// Returns the task with the specified PID, or NULL if there is none.
+//
+// The lookup does not take any locks. As tasks are not reference counted, the
+// caller must otherwise ensure that the task cannot exit while it is in use.
+struct task *pid_task(int pid);
+
+// Calls `func` on every task in the registry, stopping early if it returns a
+// nonzero value, which is then returned. `func` runs with the registry locked
+// and interrupts disabled, and must not create or free tasks.
+int task_for_each(int (*func)(struct task *, void *), void *arg);
+
+// Returns the number of tasks in the registry.
+unsigned int task_count(void);
+
+#endif  // RADIX_PID_H
@@ -19,6 +19,7 @@
 #ifndef RADIX_SCHED_H
 #define RADIX_SCHED_H
 
+#include <radix/config.h>
 #include <radix/irqstate.h>
 #include <radix/task.h>
 
@@ -53,4 +54,10 @@ int sched_add(struct task *t);
 
 void sched_unblock(struct task *task);
 
+#if CONFIG(SCHED_SWITCH_BENCHMARK)
+// Ping-pongs between two kernel threads on one CPU, with and without lazy
+// address space switching, and reports the cost of a context switch.
+void sched_switch_benchmark(void);
+#endif
+
 #endif  // RADIX_SCHED_H
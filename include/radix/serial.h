@@ -0,0 +1,55 @@
+/*
+ * include/radix/serial.h
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_SERIAL_H
+#define RADIX_SERIAL_H
+
+#include <radix/config.h>
+
+#include <stddef.h>
+
+#if CONFIG(SERIAL_CONSOLE)
+
+/*
+ * Probe for a 16550 UART on COM1 and, if one is present, register it as a
+ * console and add it to the kernel log. Output is polled until
+ * serial_console_enable_irq is called.
+ */
+void serial_console_register(void);
+
+/*
+ * Switch the serial console to interrupt-driven transmission. Requires the
+ * interrupt subsystem to be running.
+ */
+void serial_console_enable_irq(void);
+
+/*
+ * Write `len` bytes directly to the serial port, after any buffered output,
+ * without taking locks or relying on interrupts. For use by panic().
+ */
+void serial_panic_write(const char *s, size_t len);
+
+#else
+
+#define serial_console_register()
+#define serial_console_enable_irq()
+#define serial_panic_write(s, len)
+
+#endif  /* CONFIG(SERIAL_CONSOLE) */
+
+#endif /* RADIX_SERIAL_H */
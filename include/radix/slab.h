@@ -41,9 +41,38 @@ struct slab_cache {
     struct list free_slabs;    /* empty slabs */
     struct list list;          /* list of caches */
 
+    /* statistics, protected by lock */
+    size_t num_slabs;     /* slabs owned by the cache */
+    size_t active_objs;   /* objects currently allocated */
+    size_t peak_objs;     /* maximum number of active objects */
+    unsigned long allocs; /* successful allocations */
+    unsigned long frees;  /* objects freed */
+    unsigned long fails;  /* allocations which failed to grow the cache */
+    unsigned long long req_bytes; /* bytes requested by allocations */
+
+    /* leak watchdog state */
+    size_t watch_objs;        /* active objects at last check */
+    size_t watch_base;        /* active objects when growth began */
+    unsigned int watch_ticks; /* consecutive checks with growth */
+
     char cache_name[NAME_LEN]; /* human-readable cache name */
 };
 
+/* A snapshot of a cache's statistics. */
+struct slab_stats {
+    size_t objsize;
+    size_t objs_per_slab;
+    size_t pages_per_slab;
+    size_t num_slabs;
+    size_t active_objs;
+    size_t total_objs;
+    size_t peak_objs;
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long fails;
+    unsigned long long req_bytes;
+};
+
 struct slab_desc {
     struct list list;  /* list to which slab belongs */
     void *first;       /* address of first object on slab */
@@ -68,12 +97,45 @@ int shrink_cache(struct slab_cache *cache);
 void *alloc_cache(struct slab_cache *cache);
 void free_cache(struct slab_cache *cache, void *obj);
 
+void cache_stats(struct slab_cache *cache, struct slab_stats *stats);
+
+/*
+ * Call `func` on every slab cache in the system. The cache list is
+ * locked during the iteration, so `func` must not create or destroy
+ * caches.
+ */
+void for_each_cache(void (*func)(struct slab_cache *, void *), void *arg);
+
+/* Print slabinfo-style statistics for every cache. */
+void slab_info_dump(void);
+
+/*
+ * Start the watchdog which periodically logs caches whose number of
+ * active objects keeps growing, suggesting a leak.
+ */
+void slab_watchdog_init(void);
+
 #define SLAB_MIN_ALIGN    __alignof__(unsigned long long)
 #define SLAB_MIN_OBJ_SIZE (sizeof(unsigned long long))
 
-#define KMALLOC_MAX_SIZE 0x2000
+#define KMALLOC_MAX_SIZE 0x10000
 
 void *kmalloc(size_t size);
+
+/*
+ * Allocate `size` bytes from the kmalloc caches where possible, or
+ * otherwise from virtually contiguous pages which are faulted in on
+ * first access. The memory is not physically contiguous.
+ */
+void *kvmalloc(size_t size);
+
+/* Free memory from kmalloc or kvmalloc. */
 void kfree(void *ptr);
 
+/*
+ * Print how well each kmalloc size class fits the sizes requested
+ * from it, and how often kvmalloc fell back to vmalloc.
+ */
+void kmalloc_stats_dump(void);
+
 #endif /* RADIX_SLAB_H */
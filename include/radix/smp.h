@@ -35,16 +35,15 @@ DECLARE_PER_CPU(int, processor_id);
 #define processor_id() 0
 #endif  // CONFIG(SMP)
 
-#define CPUMASK_CPU(cpu) ((cpumask_t)(1 << (cpu)))
+#define CPUMASK_CPU(cpu)     cpumask_of(cpu)
+#define CPUMASK_ALL          cpumask_all()
+#define CPUMASK_ALL_BUT(cpu) cpumask_all_but(cpu)
+#define CPUMASK_ALL_OTHER    CPUMASK_ALL_BUT(processor_id())
+#define CPUMASK_SELF         CPUMASK_CPU(processor_id())
 
-#define CPUMASK_ALL                   (~((cpumask_t)0))
-#define CPUMASK_ALL_BUT(cpu)          (CPUMASK_ALL & ~CPUMASK_CPU(cpu))
-#define CPUMASK_ALL_BUT_MASK(cpumask) (CPUMASK_ALL & ~(cpumask))
-#define CPUMASK_ALL_OTHER             CPUMASK_ALL_BUT(processor_id())
-#define CPUMASK_SELF                  CPUMASK_CPU(processor_id())
-
-cpumask_t cpumask_online(void);
-cpumask_t cpumask_idle(void);
+// The returned masks are live and may change as CPUs come online or go idle.
+const cpumask_t *cpumask_online(void);
+const cpumask_t *cpumask_idle(void);
 
 void set_cpu_online(int cpu);
 void set_cpu_offline(int cpu);
@@ -53,22 +52,30 @@ void set_cpu_active(int cpu);
 
 static inline bool is_idle(int cpu)
 {
-    return (cpumask_idle() & CPUMASK_CPU(cpu)) != 0;
+    return cpumask_test_cpu(cpumask_idle(), cpu);
 }
 
-#define cpumask_first(cpumask) (ffs(cpumask) - 1)
+// Runs `func(arg)` on every online CPU in `mask`, including the calling CPU
+// if it is set. Calls queued to a CPU which has not yet processed its previous
+// calls share a single IPI. If `wait` is true, returns once every CPU has run
+// the function.
+//
+// `func` runs in interrupt context on remote CPUs and must not itself issue
+// cross-CPU calls. Must not be called from an interrupt handler.
+void smp_call_function_many(const cpumask_t *mask,
+                            void (*func)(void *),
+                            void *arg,
+                            bool wait);
 
-static __always_inline int cpumask_next(cpumask_t cpumask, int cpu)
-{
-    if (cpu == -1) {
-        return cpumask_first(cpumask);
-    }
-    return fns(cpumask, cpu + 1) - 1;
-}
+// Runs `func(arg)` on `cpu`, as with smp_call_function_many.
+void smp_call_function_single(int cpu,
+                              void (*func)(void *),
+                              void *arg,
+                              bool wait);
 
-#define for_each_cpu(cpu, cpumask)                           \
-    for ((cpu) = -1; (cpu) = cpumask_next((cpumask), (cpu)), \
-        (cpu) != -1 && (cpu) < MAX_CPUS;)
+// Runs all cross-CPU calls queued to the current CPU. Called from the
+// architecture's call function IPI handler.
+void smp_call_function_interrupt(void);
 
 #if CONFIG(SMP)
 void smp_init(void);
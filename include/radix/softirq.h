@@ -0,0 +1,63 @@
+/*
+ * include/radix/softirq.h
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_SOFTIRQ_H
+#define RADIX_SOFTIRQ_H
+
+#include <radix/sched.h>
+
+#include <stdbool.h>
+
+// Softirqs are per-CPU deferred handlers which run with interrupts enabled
+// once the interrupt that raised them has been handled. They must not block.
+//
+// Softirqs are run in order of their number.
+enum softirq {
+    SOFTIRQ_HI,
+    SOFTIRQ_TIMER,
+    SOFTIRQ_DEVICE,
+    SOFTIRQ_LO,
+    NR_SOFTIRQS,
+};
+
+typedef void (*softirq_handler_t)(void);
+
+// Registers the handler for softirq `nr`.
+void open_softirq(enum softirq nr, softirq_handler_t handler);
+
+// Marks softirq `nr` as pending on the current CPU.
+void raise_softirq(enum softirq nr);
+
+// Runs any softirqs pending on the current CPU.
+void do_softirq(void);
+
+// Called by architecture interrupt handlers after an interrupt has been
+// handled, with interrupts disabled.
+void irq_exit(void);
+
+// Called by interrupt handlers before they invoke the scheduler. If the
+// interrupt arrived while the CPU was running softirqs, the task cannot be
+// switched out, so the scheduler call is deferred until the softirqs complete
+// and this returns true.
+bool softirq_defer_schedule(enum sched_action action);
+
+// Starts a ksoftirqd thread for each online CPU, to which softirqs are deferred
+// when they are raised faster than they can be handled on interrupt exit.
+void softirq_init(void);
+
+#endif  // RADIX_SOFTIRQ_H
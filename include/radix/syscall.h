@@ -19,6 +19,8 @@
 #ifndef RADIX_SYSCALL_H
 #define RADIX_SYSCALL_H
 
+#include <radix/config.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -28,6 +30,19 @@ void syscall_init(void);
 // Terminates the current task with the specified exit status.
 void sys_exit(int status);
 
+// Creates a copy of the current task which shares its memory copy-on-write.
+// Returns the PID of the new task to the caller, and 0 within the new task.
+int sys_fork(void);
+
+// Returns the PID of the current task.
+int sys_getpid(void);
+
+#if CONFIG(SYSCALL_BENCHMARK)
+// Starts the /sysbench program from the initrd, which times system call round
+// trips through each available entry path. Its results are logged on exit.
+void syscall_benchmark(void);
+#endif
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -66,9 +66,14 @@ static inline bool is_ustar(const struct tar_header *header)
 }
 
 struct tar_iter {
+    // Neither of these strings is guaranteed to be null-terminated if it fills
+    // its entire header field. The full path of the entry is prefix/name when
+    // the prefix is non-empty.
     const char *file_name;
+    const char *file_prefix;
     const uint8_t *file_data;
     size_t file_size;
+    char file_type;
 };
 
 // Iterates over a tar archive in memory, calling the provided function on each
@@ -29,7 +29,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+struct fpu_state;
 struct vmm_space;
+struct worker;
 
 enum task_state {
     // The task is ready to be scheduled.
@@ -76,9 +78,16 @@ struct task {
     uint64_t sched_ts;
     uint64_t remaining_time;
     char **cmdline;
+    size_t cmdline_size;
     char *cwd;
     int errno;
     int exit_status;
+    struct list registry;
+    int wake_state;
+    struct worker *worker;
+    struct fpu_state *fpu;  // Allocated on the task's first FPU use.
+    int fpu_cpu;            // CPU on which `fpu` was last loaded.
+    int numa_node;          // Node holding the task's memory, if known.
 };
 
 #ifdef __cplusplus
@@ -102,9 +111,27 @@ int task_comparator(const struct task *a, const struct task *b);
 DECLARE_PER_CPU(struct task *, current_task);
 #define current_task() (this_cpu_read(current_task))
 
+// Allocates and frees task structs. Allocated tasks are assigned a PID and
+// added to the task registry (see radix/pid.h). Freed tasks are held by the CPU
+// which freed them for reuse by its next task_alloc().
 struct task *task_alloc(void);
 void task_free(struct task *task);
 
+// Minimum size of a task's command line buffer.
+#define TASK_CMDLINE_MIN_SIZE 0x40
+
+// Returns a buffer of at least `size` bytes to hold a single-string command
+// line for `task`, replacing its current command line. A buffer retained from
+// a previous use of the task struct is reused if it is large enough.
+char *task_cmdline_buffer(struct task *task, size_t size);
+
+// Allocates and frees kernel stacks of 2^order pages, identified by their
+// lowest address. Stacks are virtually contiguous with a guard page below.
+// Small stacks are cached per CPU so that repeatedly creating and destroying
+// tasks does not need to map and unmap them.
+void *task_stack_alloc(int order);
+void task_stack_free(void *stack, int order);
+
 void task_exit(struct task *task, int status);
 
 // Creates a new user mode task running the executable located at a specified
@@ -119,6 +146,14 @@ void task_exit(struct task *task, int status);
 // Returns an ERR_PTR to the initialized task.
 struct task *task_create(const char *path);
 
+// Creates a copy of user task `parent`, which must currently be executing a
+// system call. The new task receives a copy-on-write clone of the parent's
+// address space and resumes from the same point in user mode, with a return
+// value of 0. The task is not started.
+//
+// Returns an ERR_PTR to the new task.
+struct task *task_fork(struct task *parent);
+
 // Sets up the registers and stack for a kernel thread to start executing
 // function `func` with argument `arg`. Implemented by individual architectures.
 void kthread_reg_setup(struct regs *regs,
@@ -133,6 +168,11 @@ void kthread_reg_setup(struct regs *regs,
 // user stack. It is already mapped into the task's address space.
 int user_task_setup(struct task *task, paddr_t stack, addr_t entry);
 
+// Sets up the registers and stack for a task forked from `parent` to return to
+// user mode from the parent's current system call. Implemented by individual
+// architectures.
+int user_task_fork_setup(struct task *task, const struct task *parent);
+
 // Switches from running task old to task new. Implemented separately by each
 // architecture. Once the function call returns, `new` should be executing.
 //
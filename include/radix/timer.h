@@ -81,6 +81,4 @@ void set_percpu_timer_data(struct percpu_timer_data *pcpu_data);
 void set_percpu_irq_timer_data(struct percpu_timer_data *pcpu_data);
 int cpu_timer_init(void);
 
-void handle_timer_action(void);
-
 #endif /* RADIX_TIMER_H */
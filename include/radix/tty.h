@@ -35,4 +35,8 @@ static inline void tty_putchar(int c)
 
 void tty_flush(void);
 
+// Starts the TTY output thread. Before this is called, TTY writes are rendered
+// synchronously by the writer.
+void tty_init(void);
+
 #endif /* RADIX_TTY_H */
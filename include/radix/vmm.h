@@ -60,6 +60,14 @@ struct vmm_space {
     paddr_t paging_base;
     void *paging_ctx;
     int pages;
+    int last_cpu;  // CPU which most recently loaded this address space.
+
+    // Generation of the kernel's page directory last copied into the space.
+    int kernel_gen;
+
+    // 1 while compaction is replacing one of the space's pages, during which
+    // it cannot be loaded, or -1 once the space is being released.
+    int migrating;
 };
 
 // Initializes the virtual memory management system.
@@ -71,6 +79,13 @@ struct vmm_space *vmm_new(void);
 // Releases a vmm_space.
 void vmm_release(struct vmm_space *vmm);
 
+// Creates a copy of the current task's address space `vmm`. No memory is
+// copied; every page is shared between the two spaces and copied on the first
+// write to it from either one.
+//
+// Returns an ERR_PTR to the new address space.
+struct vmm_space *vmm_clone(struct vmm_space *vmm);
+
 // Returns the kernel's address space.
 struct vmm_space *vmm_kernel(void);
 
@@ -93,13 +108,23 @@ void vfree(void *ptr);
 
 struct vmm_area *vmm_get_allocated_area(struct vmm_space *vmm, addr_t addr);
 
-// Marks a block of physical pages as allocated for a VMM area. This does not
-// map the pages to addresses in the area; that must be done separately.
-void vmm_add_area_pages(struct vmm_area *area, struct page *p);
+// Marks a block of physical pages, mapped at `addr`, as allocated for a VMM
+// area. This does not map the pages to addresses in the area; that must be done
+// separately.
+void vmm_add_area_pages(struct vmm_area *area, struct page *p, addr_t addr);
 
 // Maps physical pages to an address within an allocated VMM area.
 int vmm_map_pages(struct vmm_area *area, addr_t addr, struct page *p);
 
+// Resolves a write to copy-on-write address `addr` in `area` of the current
+// address space, giving the area a private, writable copy of its page.
+int vmm_cow_fault(struct vmm_area *area, addr_t addr);
+
+// Moves the contents and mapping of user page `p` to the unmapped page `new`,
+// freeing `p` on success. Only single pages owned by one address space which
+// isn't loaded on any CPU can be migrated; others fail with EBUSY.
+int vmm_migrate_page(struct page *p, struct page *new);
+
 void vmm_space_dump(struct vmm_space *vmm);
 
 //
@@ -115,4 +140,12 @@ int arch_vmm_setup(struct vmm_space *vmm);
 // Frees an address space.
 void arch_vmm_release(struct vmm_space *vmm);
 
+// Checks whether any CPU has `vmm` loaded. Once vmm->migrating is set, CPUs
+// which don't have `vmm` loaded must wait for it to be cleared to load it.
+bool arch_vmm_loaded(struct vmm_space *vmm);
+
+// Copies the user page mappings of the current address space `src` into `dst`,
+// write-protecting writable pages in both for copy-on-write.
+int arch_vmm_clone(struct vmm_space *dst, struct vmm_space *src);
+
 #endif  // RADIX_VMM_H
@@ -0,0 +1,154 @@
+/*
+ * include/radix/workqueue.h
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RADIX_WORKQUEUE_H
+#define RADIX_WORKQUEUE_H
+
+#include <radix/atomic.h>
+#include <radix/list.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct task;
+struct work;
+struct worker_pool;
+struct workqueue;
+
+typedef void (*work_func_t)(struct work *);
+
+// A function call deferred to process context, run by a kernel worker thread.
+// Work items are usually embedded in a larger struct which the function
+// recovers using container_of.
+//
+// A work item is queued at most once at a time. It may be queued again as soon
+// as its function has started running, including from the function itself.
+struct work {
+    struct list entry;
+    work_func_t func;
+    int pending;
+    struct worker_pool *pool;
+};
+
+#define WORK_INIT(name, fn)                    \
+    {                                          \
+        LIST_INIT((name).entry), (fn), 0, NULL \
+    }
+
+// A work item which is queued once a delay has passed.
+struct delayed_work {
+    struct work work;
+    struct workqueue *wq;
+    int cpu;
+    unsigned long timer;
+    unsigned long timer_seq;
+};
+
+#define DELAYED_WORK_INIT(name, fn)                \
+    {                                              \
+        WORK_INIT((name).work, fn), NULL, -1, 0, 0 \
+    }
+
+// Work from an unbound workqueue may run on any CPU. Work from other
+// workqueues runs on the CPU from which it was queued.
+#define WQ_UNBOUND (1 << 0)
+
+#define WQ_NAME_LEN 0x20
+
+struct workqueue {
+    char name[WQ_NAME_LEN];
+    unsigned int flags;
+};
+
+// Shared workqueues for work which doesn't need a queue of its own.
+extern struct workqueue *system_wq;
+extern struct workqueue *system_unbound_wq;
+
+void work_init(struct work *work, work_func_t func);
+void delayed_work_init(struct delayed_work *dwork, work_func_t func);
+
+static inline bool work_pending(struct work *work)
+{
+    return atomic_read(&work->pending) != 0;
+}
+
+// Creates a workqueue. Workqueues are lightweight handles; the worker threads
+// which run their work are shared between all workqueues with the same
+// binding.
+//
+// Returns an ERR_PTR to the new workqueue.
+struct workqueue *create_workqueue(const char *name, unsigned int flags);
+void destroy_workqueue(struct workqueue *wq);
+
+// Queues `work` on `wq`, to run on the specified CPU. If the workqueue is
+// unbound or the CPU has no workers, the work goes to the unbound pool.
+//
+// Returns false if the work was already pending. Safe to call from interrupt
+// context.
+bool queue_work_on(int cpu, struct workqueue *wq, struct work *work);
+
+// Queues `work` on `wq` to run on the current CPU.
+bool queue_work(struct workqueue *wq, struct work *work);
+
+// Queues `dwork` on `wq` once `delay` nanoseconds have passed. The delay is
+// tracked by a kernel event on the current CPU, which then queues the work
+// to that CPU.
+//
+// Returns false if the work was already pending, either waiting for its delay
+// or queued.
+bool queue_delayed_work(struct workqueue *wq,
+                        struct delayed_work *dwork,
+                        uint64_t delay);
+
+// Removes `work` from its workqueue if it has not yet started running.
+// Returns true if the work was pending and has been cancelled. A work function
+// which is already running is not waited for.
+bool cancel_work(struct work *work);
+
+// As cancel_work, additionally removing the delayed work's timer if its delay
+// has not yet expired. Must not be called from an interrupt handler.
+bool cancel_delayed_work(struct delayed_work *dwork);
+
+static inline bool schedule_work(struct work *work)
+{
+    return queue_work(system_wq, work);
+}
+
+static inline bool schedule_delayed_work(struct delayed_work *dwork,
+                                         uint64_t delay)
+{
+    return queue_delayed_work(system_wq, dwork, delay);
+}
+
+// Concurrency management hooks, called when a worker thread blocks on and
+// returns from a sleeping lock. Worker pools only run as many workers at once
+// as they need to keep their CPUs busy; when a worker blocks, another is woken,
+// or created if none are idle, to continue processing the pool's work.
+//
+// `wq_worker_sleeping` must be called with interrupts disabled, after the
+// task's state has been set to blocked.
+void wq_worker_sleeping(struct task *task);
+void wq_worker_running(struct task *task);
+
+void workqueue_init(void);
+
+// Returns true once workqueue_init has started the worker threads. Work queued
+// before then is held until the workers start.
+bool workqueue_ready(void);
+
+#endif  // RADIX_WORKQUEUE_H
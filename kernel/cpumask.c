@@ -16,20 +16,19 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <radix/atomic.h>
 #include <radix/smp.h>
 
-static cpumask_t online_cpus = CPUMASK_CPU(0);
-static cpumask_t idle_cpus = 0;
+static cpumask_t online_cpus = CPUMASK_INIT_CPU0;
+static cpumask_t idle_cpus;
 
-cpumask_t cpumask_online(void) { return online_cpus; }
+const cpumask_t *cpumask_online(void) { return &online_cpus; }
 
-cpumask_t cpumask_idle(void) { return idle_cpus; }
+const cpumask_t *cpumask_idle(void) { return &idle_cpus; }
 
-void set_cpu_online(int cpu) { atomic_or(&online_cpus, CPUMASK_CPU(cpu)); }
+void set_cpu_online(int cpu) { cpumask_set_cpu_atomic(&online_cpus, cpu); }
 
-void set_cpu_offline(int cpu) { atomic_and(&online_cpus, ~CPUMASK_CPU(cpu)); }
+void set_cpu_offline(int cpu) { cpumask_clear_cpu_atomic(&online_cpus, cpu); }
 
-void set_cpu_idle(int cpu) { atomic_or(&idle_cpus, CPUMASK_CPU(cpu)); }
+void set_cpu_idle(int cpu) { cpumask_set_cpu_atomic(&idle_cpus, cpu); }
 
-void set_cpu_active(int cpu) { atomic_and(&idle_cpus, ~CPUMASK_CPU(cpu)); }
+void set_cpu_active(int cpu) { cpumask_clear_cpu_atomic(&idle_cpus, cpu); }
@@ -56,6 +56,25 @@ int __elf_load_segment(struct vmm_area *area,
         int pages = pow2(ord);
         size_t chunk_size = pages * PAGE_SIZE;
 
+        // Chunks without any file data, such as most of .bss, are taken
+        // already zeroed from the page allocator and don't need to be mapped.
+        if (copy_size == 0 || addr + chunk_size <= copy_addr) {
+            struct page *p = alloc_pages(PA_USER | __PA_ZERO, ord);
+            if (IS_ERR(p)) {
+                return ERR_VAL(p);
+            }
+
+            int err = vmm_map_pages(area, addr, p);
+            if (err != 0) {
+                free_pages(p);
+                return err;
+            }
+
+            size_pages -= pages;
+            addr += chunk_size;
+            continue;
+        }
+
         uint8_t *ptr = vmalloc(chunk_size);
         if (!ptr) {
             return ENOMEM;
@@ -79,24 +98,25 @@ int __elf_load_segment(struct vmm_area *area,
         }
 
         // Memory prior to the copy address is zeroed.
+        uint8_t *dst = ptr;
         if (addr < copy_addr) {
             const size_t zero_before = min(copy_addr - addr, chunk_size);
-            memset(ptr, 0, zero_before);
-            ptr += zero_before;
+            memset(dst, 0, zero_before);
+            dst += zero_before;
             chunk_size -= zero_before;
         }
 
         if (chunk_size > 0) {
             size_t to_copy = min(chunk_size, copy_size);
             if (to_copy > 0) {
-                memcpy(ptr, copy_ptr, to_copy);
+                memcpy(dst, copy_ptr, to_copy);
                 copy_ptr += to_copy;
                 copy_size -= to_copy;
             }
 
             // Zero any remaining space after the copied data.
             if (to_copy != chunk_size) {
-                memset(ptr + to_copy, 0, chunk_size - to_copy);
+                memset(dst + to_copy, 0, chunk_size - to_copy);
             }
         }
 
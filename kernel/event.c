@@ -40,6 +40,7 @@ enum event_type {
     EVENT_SLEEP,
     EVENT_TIME,
     EVENT_DUMMY,
+    EVENT_CALLBACK,
 };
 
 struct event {
@@ -52,13 +53,20 @@ struct event {
 
         // Task to wake for a sleep event.
         struct task *sl_task;
+
+        // Function to call for a callback event.
+        struct {
+            void (*cb_func)(void *, unsigned long);
+            void *cb_arg;
+            unsigned long cb_data;
+        };
     };
 
     unsigned long flags;
 };
 
-#define EVENT_STATIC    (1 << 2)
-#define EVENT_TYPE(evt) ((evt)->flags & 0x3)
+#define EVENT_STATIC    (1 << 3)
+#define EVENT_TYPE(evt) ((evt)->flags & 0x7)
 
 static struct slab_cache *event_cache;
 
@@ -70,8 +78,6 @@ static DEFINE_PER_CPU(spinlock_t, event_lock);
 static DEFINE_PER_CPU(struct event *, dummy_event) = NULL;
 static DEFINE_PER_CPU(struct event *, sched_event) = NULL;
 
-static DEFINE_PER_CPU(unsigned int, event_interrupt_count) = 0;
-
 static void __event_insert(struct event *evt);
 static void __event_schedule(const struct event *evt);
 
@@ -98,6 +104,10 @@ static void event_process(struct event *evt)
     case EVENT_DUMMY:
         // Nothing to do here.
         break;
+
+    case EVENT_CALLBACK:
+        evt->cb_func(evt->cb_arg, evt->cb_data);
+        break;
     }
 }
 
@@ -113,14 +123,14 @@ static __always_inline void event_free(struct event *evt)
     }
 }
 
-// Main handler function called when an event interrupt occurs.
-void event_handler(void)
+// Main handler function called when an event interrupt occurs. Returns true if
+// a scheduler event has fired, in which case the caller must call schedule()
+// once it has finished handling the interrupt.
+bool event_handler(void)
 {
     unsigned long irqstate;
     irq_save(irqstate);
 
-    this_cpu_inc(event_interrupt_count);
-
     struct list *eventq = raw_cpu_ptr(&event_queue);
     bool should_schedule = false;
 
@@ -148,12 +158,8 @@ void event_handler(void)
         __event_schedule(list_first_entry(eventq, struct event, list));
     }
 
-    // After all events have run, the scheduler can now be called if needed.
-    if (should_schedule) {
-        schedule(SCHED_REPLACE);
-    }
-
     irq_restore(irqstate);
+    return should_schedule;
 }
 
 static void timekeeping_event_init(uint64_t period, uint64_t initial);
@@ -393,6 +399,71 @@ int sleep_event_add(struct task *task, uint64_t timestamp)
     return 0;
 }
 
+int callback_event_add(uint64_t timestamp,
+                       void (*func)(void *, unsigned long),
+                       void *arg,
+                       unsigned long data)
+{
+    struct event *evt = event_alloc();
+    if (IS_ERR(evt)) {
+        return ERR_VAL(evt);
+    }
+
+    evt->timestamp = timestamp;
+    evt->flags = EVENT_CALLBACK;
+    evt->cb_func = func;
+    evt->cb_arg = arg;
+    evt->cb_data = data;
+
+    __event_add(evt);
+    return 0;
+}
+
+struct callback_event_match {
+    void (*func)(void *, unsigned long);
+    void *arg;
+    unsigned long data;
+};
+
+// Removes the first callback event on the current CPU matching `p`. Runs with
+// interrupts disabled, so the event handler is not midway through processing
+// it: the event is either still queued or has already run and been freed.
+static void __callback_event_del(void *p)
+{
+    struct callback_event_match *match = p;
+    struct event *evt, *found = NULL;
+    unsigned long irqstate;
+
+    spin_lock_irq(this_cpu_ptr(&event_lock), &irqstate);
+    list_for_each_entry (evt, raw_cpu_ptr(&event_queue), list) {
+        if (EVENT_TYPE(evt) == EVENT_CALLBACK && evt->cb_func == match->func &&
+            evt->cb_arg == match->arg && evt->cb_data == match->data) {
+            found = evt;
+            break;
+        }
+    }
+    spin_unlock_irq(this_cpu_ptr(&event_lock), irqstate);
+
+    if (found) {
+        __event_remove(found);
+        event_free(found);
+    }
+}
+
+void callback_event_del(int cpu,
+                        void (*func)(void *, unsigned long),
+                        void *arg,
+                        unsigned long data)
+{
+    struct callback_event_match match = {
+        .func = func,
+        .arg = arg,
+        .data = data,
+    };
+
+    smp_call_function_single(cpu, __callback_event_del, &match, true);
+}
+
 // Initialize per-CPU event structures and data. Must be run by each CPU in the
 // system separately.
 void cpu_event_init(void)
@@ -409,6 +480,4 @@ void cpu_event_init(void)
     dummy->timestamp = 0;
     dummy->flags = EVENT_STATIC | EVENT_DUMMY;
     this_cpu_write(dummy_event, dummy);
-
-    this_cpu_write(event_interrupt_count, 0);
 }
@@ -15,11 +15,17 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
-
+#include <radix/config.h>
 #include <radix/initrd.h>
+#include <radix/kernel.h>
 #include <radix/klog.h>
+#include <radix/lz4.h>
+#include <radix/mm.h>
+#include <radix/mutex.h>
 #include <radix/slab.h>
 #include <radix/tar.h>
+#include <radix/time.h>
+#include <radix/vmm.h>
 
 #include <errno.h>
 #include <string.h>
@@ -28,92 +34,672 @@
 
 enum initrd_format {
     INITRD_TAR,
+    INITRD_TAR_LZ4,
     INITRD_UNKNOWN,
 };
 
+// A compressed initrd is a ustar archive whose first entry is an empty file
+// with this name, followed by files which are each an individual LZ4 frame.
+// Keeping the archive itself uncompressed allows the initrd to be indexed at
+// boot without decompressing anything; files are decompressed only when they
+// are first used.
+#define INITRD_LZ4_MARKER ".radix-lz4"
+
+// Hash table indexing every file in the initrd by its full path. It is sized
+// from the number of archive entries before any files are added, so chains
+// stay short no matter how many files the initrd holds.
+struct initrd_index {
+    struct initrd_file **buckets;
+    uint32_t mask;
+};
+
 struct initrd_context {
     const void *rd_base;
     size_t rd_size;
-    struct initrd_file *files;
+    struct initrd_file root;
+    struct initrd_index index;
+    size_t num_entries;
     size_t num_files;
-    size_t capacity;
+    size_t num_dirs;
+
+    // Whether the initrd's files are LZ4 compressed, and their total
+    // compressed and uncompressed sizes.
+    bool compressed;
+    uint64_t raw_bytes;
+    uint64_t content_bytes;
 };
 
-static void __initrd_add_file(struct initrd_context *ctx,
-                              const char *filepath,
-                              const uint8_t *base,
-                              size_t size)
+static struct initrd_context initrd = {};
+
+static struct slab_cache *initrd_file_cache;
+
+// Serializes decompression of initrd files.
+static struct mutex initrd_decompress_lock =
+    MUTEX_INIT(initrd_decompress_lock);
+
+// 32-bit FNV-1a.
+#define PATH_HASH_BASIS 2166136261U
+#define PATH_HASH_PRIME 16777619U
+
+static uint32_t __path_hash(const char *path, size_t len)
 {
-    if (ctx->num_files == ctx->capacity) {
-        ctx->capacity *= 2;
+    uint32_t hash = PATH_HASH_BASIS;
 
-        struct initrd_file *tmp = kmalloc(ctx->capacity * sizeof *tmp);
-        memcpy(tmp, ctx->files, ctx->num_files * sizeof *ctx->files);
-        kfree(ctx->files);
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)path[i];
+        hash *= PATH_HASH_PRIME;
+    }
+
+    return hash;
+}
 
-        ctx->files = tmp;
+static size_t __bounded_strlen(const char *s, size_t max)
+{
+    size_t len = 0;
+    while (len < max && s[len] != '\0') {
+        ++len;
+    }
+    return len;
+}
+
+// Strips leading "/" and "./" components and trailing slashes from the first
+// `*len` characters of `path`. Returns the start of the normalized path and
+// stores its length in `len`.
+static const char *__path_normalize(const char *path, size_t *len)
+{
+    size_t n = *len;
+
+    while (n > 0) {
+        if (path[0] == '/') {
+            path += 1;
+            n -= 1;
+        } else if (path[0] == '.' && (n == 1 || path[1] == '/')) {
+            path += min(n, (size_t)2);
+            n -= min(n, (size_t)2);
+        } else {
+            break;
+        }
+    }
+
+    while (n > 0 && path[n - 1] == '/') {
+        --n;
     }
 
-    struct initrd_file *file = &ctx->files[ctx->num_files++];
-    file->path = filepath;
-    file->base = base;
+    *len = n;
+    return path;
+}
+
+// Returns the length of the directory portion of a normalized path, which is 0
+// for files in the root directory.
+static size_t __path_dirname_len(const char *path, size_t len)
+{
+    while (len > 0 && path[len - 1] != '/') {
+        --len;
+    }
+    return len > 0 ? len - 1 : 0;
+}
+
+static void initrd_file_init(void *p)
+{
+    struct initrd_file *file = p;
+
+    memset(file, 0, sizeof *file);
+    list_init(&file->children);
+    list_init(&file->sibling);
+}
+
+static int __index_init(struct initrd_index *index, size_t entries)
+{
+    size_t nbuckets = PAGE_SIZE / sizeof *index->buckets;
+    size_t ord = 0;
+
+    while (nbuckets < entries && ord < PA_MAX_ORDER) {
+        nbuckets <<= 1;
+        ++ord;
+    }
+
+    // Large indices fall back to vmalloc rather than needing high-order pages.
+    index->buckets = kvmalloc(nbuckets * sizeof *index->buckets);
+    if (!index->buckets) {
+        return ENOMEM;
+    }
+
+    index->mask = nbuckets - 1;
+    memset(index->buckets, 0, nbuckets * sizeof *index->buckets);
+
+    return 0;
+}
+
+static struct initrd_file *__index_find(const struct initrd_context *ctx,
+                                        const char *path,
+                                        size_t len,
+                                        uint32_t hash)
+{
+    struct initrd_file *file = ctx->index.buckets[hash & ctx->index.mask];
+
+    for (; file != NULL; file = file->hash_next) {
+        if (file->hash == hash && strncmp(file->path, path, len) == 0 &&
+            file->path[len] == '\0') {
+            return file;
+        }
+    }
+
+    return NULL;
+}
+
+static struct initrd_file *__initrd_lookup(struct initrd_context *ctx,
+                                           const char *path,
+                                           size_t len)
+{
+    if (len == 0) {
+        return &ctx->root;
+    }
+
+    return __index_find(ctx, path, len, __path_hash(path, len));
+}
+
+// Creates a file at normalized path `path` within directory `parent`.
+//
+// Unless `persistent` is set, `path` is a temporary buffer and is copied.
+// Otherwise, it is only copied if it is not null-terminated at `len`.
+static struct initrd_file *__initrd_file_create(struct initrd_context *ctx,
+                                                struct initrd_file *parent,
+                                                const char *path,
+                                                size_t len,
+                                                enum initrd_file_type type,
+                                                bool persistent)
+{
+    struct initrd_file *file = alloc_cache(initrd_file_cache);
+    if (IS_ERR(file)) {
+        return NULL;
+    }
+
+    if (!persistent || path[len] != '\0') {
+        char *copy = kmalloc(len + 1);
+        if (!copy) {
+            free_cache(initrd_file_cache, file);
+            return NULL;
+        }
+
+        memcpy(copy, path, len);
+        copy[len] = '\0';
+        path = copy;
+    }
+
+    size_t dirname_len = __path_dirname_len(path, len);
+
+    file->path = path;
+    file->name = dirname_len > 0 ? path + dirname_len + 1 : path;
+    file->type = type;
+    file->parent = parent;
+    file->hash = __path_hash(path, len);
+
+    list_ins(&parent->children, &file->sibling);
+
+    struct initrd_file **bucket =
+        &ctx->index.buckets[file->hash & ctx->index.mask];
+    file->hash_next = *bucket;
+    *bucket = file;
+
+    if (type == INITRD_FILE_DIRECTORY) {
+        ++ctx->num_dirs;
+    } else {
+        ++ctx->num_files;
+    }
+
+    return file;
+}
+
+// Returns the directory at normalized path `path`, creating it and any of its
+// missing ancestors. Archives don't have to contain entries for every directory
+// leading up to a file.
+static struct initrd_file *__initrd_mkdir_p(struct initrd_context *ctx,
+                                            const char *path,
+                                            size_t len,
+                                            bool persistent)
+{
+    struct initrd_file *dir;
+    size_t end = len;
+
+    // Find the deepest ancestor which already exists. The root always does.
+    while (!(dir = __initrd_lookup(ctx, path, end))) {
+        end = __path_dirname_len(path, end);
+    }
+
+    // Create every missing directory below it.
+    while (end < len) {
+        if (!initrd_is_dir(dir)) {
+            return NULL;
+        }
+
+        end = end > 0 ? end + 1 : 0;
+        while (end < len && path[end] != '/') {
+            ++end;
+        }
+
+        dir = __initrd_file_create(
+            ctx, dir, path, end, INITRD_FILE_DIRECTORY, persistent);
+        if (!dir) {
+            return NULL;
+        }
+    }
+
+    return initrd_is_dir(dir) ? dir : NULL;
+}
+
+// Adds an entry for the file or directory at `path` to the initrd, returning
+// the file. If a file already exists at the path, it is returned instead, or
+// NULL if it is of a different type.
+static struct initrd_file *__initrd_add_file(struct initrd_context *ctx,
+                                             const char *path,
+                                             size_t len,
+                                             bool persistent,
+                                             enum initrd_file_type type)
+{
+    path = __path_normalize(path, &len);
+    if (len == 0) {
+        // Entry for the root directory itself.
+        return type == INITRD_FILE_DIRECTORY ? &ctx->root : NULL;
+    }
+
+    // A directory may already have been created implicitly by one of its
+    // children. Otherwise, later entries for the same path replace earlier
+    // ones, as they would when extracting the archive.
+    struct initrd_file *file = __initrd_lookup(ctx, path, len);
+    if (file != NULL) {
+        if (file->type != type) {
+            klog(KLOG_WARNING,
+                 INITRD "ignoring duplicate %s of different type",
+                 file->path);
+            return NULL;
+        }
+        return file;
+    }
+
+    struct initrd_file *parent = __initrd_mkdir_p(
+        ctx, path, __path_dirname_len(path, len), persistent);
+    if (!parent) {
+        return ERR_PTR(ENOTDIR);
+    }
+
+    file = __initrd_file_create(ctx, parent, path, len, type, persistent);
+    if (!file) {
+        return ERR_PTR(ENOMEM);
+    }
+
+    return file;
+}
+
+// Sets the contents of regular file `file` to `size` bytes at `data`.
+//
+// In a compressed initrd, only the frame header is read to determine the
+// file's size. Files which are not LZ4 frames are used as-is.
+static int __initrd_set_contents(struct initrd_context *ctx,
+                                 struct initrd_file *file,
+                                 const uint8_t *data,
+                                 size_t size)
+{
+    struct lz4_frame_info info;
+
+    file->base = data;
     file->size = size;
+    file->flags &= ~INITRD_FILE_COMPRESSED;
+    file->raw = data;
+    file->raw_size = size;
 
-    klog(KLOG_INFO, INITRD "found initrd file: %s [size %uB]", filepath, size);
+    if (!ctx->compressed) {
+        return 0;
+    }
+
+    ctx->raw_bytes += size;
+
+    if (lz4_frame_info(data, size, &info) != 0) {
+        klog(KLOG_WARNING,
+             INITRD "%s is not LZ4 compressed, using it as-is",
+             file->path);
+        ctx->content_bytes += size;
+        return 0;
+    }
+
+    size_t content_size;
+
+    if (info.flags & LZ4_FLG_CONTENT_SIZE) {
+        if (info.content_size > SIZE_MAX) {
+            return EFBIG;
+        }
+        content_size = info.content_size;
+    } else {
+        // The frame doesn't record its size, so its blocks have to be walked
+        // to find it. Archives should be built with --content-size to avoid
+        // this.
+        int err = lz4_frame_measure(data, size, &content_size);
+        if (err != 0) {
+            return err;
+        }
+    }
+
+    ctx->content_bytes += content_size;
+
+    // Empty files have nothing to decompress.
+    if (content_size != 0) {
+        file->base = NULL;
+        file->size = content_size;
+        file->flags |= INITRD_FILE_COMPRESSED;
+    } else {
+        file->size = 0;
+    }
+
+    return 0;
 }
 
 enum initrd_format __initrd_format(const void *ptr, size_t len)
 {
     if (is_ustar(ptr) && len >= sizeof(struct tar_header)) {
+        const struct tar_header *header = ptr;
+
+        if (strncmp(header->filename,
+                    INITRD_LZ4_MARKER,
+                    sizeof header->filename) == 0) {
+            return INITRD_TAR_LZ4;
+        }
         return INITRD_TAR;
     }
 
     return INITRD_UNKNOWN;
 }
 
+static void __initrd_tar_count_callback(void *context,
+                                        __unused struct tar_iter *iter)
+{
+    struct initrd_context *ctx = context;
+    ++ctx->num_entries;
+}
+
 static void __initrd_tar_iter_callback(void *context, struct tar_iter *iter)
 {
     struct initrd_context *ctx = context;
-    __initrd_add_file(ctx, iter->file_name, iter->file_data, iter->file_size);
+    enum initrd_file_type type;
+
+    switch (iter->file_type) {
+    case TAR_TYPE_FILE:
+    case '\0':
+        type = INITRD_FILE_REGULAR;
+        break;
+
+    case TAR_TYPE_DIR:
+        type = INITRD_FILE_DIRECTORY;
+        break;
+
+    default:
+        klog(KLOG_WARNING,
+             INITRD "ignoring %.100s: unsupported entry type %c",
+             iter->file_name,
+             iter->file_type);
+        return;
+    }
+
+    size_t name_len = __bounded_strlen(
+        iter->file_name, FIELD_SIZEOF(struct tar_header, filename));
+    size_t prefix_len = __bounded_strlen(
+        iter->file_prefix, FIELD_SIZEOF(struct tar_header, prefix));
+
+    struct initrd_file *file;
+
+    if (prefix_len == 0) {
+        if (ctx->compressed &&
+            strncmp(iter->file_name, INITRD_LZ4_MARKER, name_len) == 0 &&
+            name_len == sizeof INITRD_LZ4_MARKER - 1) {
+            return;
+        }
+
+        file = __initrd_add_file(ctx, iter->file_name, name_len, true, type);
+    } else {
+        // The full path is split across the prefix and name fields of the
+        // header, so it has to be joined together.
+        char path[FIELD_SIZEOF(struct tar_header, prefix) +
+                  FIELD_SIZEOF(struct tar_header, filename) + 2];
+
+        memcpy(path, iter->file_prefix, prefix_len);
+        path[prefix_len] = '/';
+        memcpy(path + prefix_len + 1, iter->file_name, name_len);
+        path[prefix_len + 1 + name_len] = '\0';
+
+        file = __initrd_add_file(
+            ctx, path, prefix_len + 1 + name_len, false, type);
+    }
+
+    int err = 0;
+
+    if (IS_ERR(file)) {
+        err = ERR_VAL(file);
+    } else if (file && type == INITRD_FILE_REGULAR) {
+        err = __initrd_set_contents(
+            ctx, file, iter->file_data, iter->file_size);
+    }
+
+    if (err != 0) {
+        klog(KLOG_ERROR,
+             INITRD "failed to add %.100s: %s",
+             iter->file_name,
+             strerror(err));
+    }
 }
 
 static int __read_tar_initrd(struct initrd_context *ctx)
 {
+    tar_foreach(ctx->rd_base, ctx, __initrd_tar_count_callback);
+
+    int err = __index_init(&ctx->index, ctx->num_entries);
+    if (err != 0) {
+        klog(KLOG_ERROR,
+             INITRD "failed to allocate index for %u entries",
+             ctx->num_entries);
+        return err;
+    }
+
     tar_foreach(ctx->rd_base, ctx, __initrd_tar_iter_callback);
     return 0;
 }
 
-static struct initrd_context initrd = {};
+#if CONFIG(INITRD_BENCHMARK)
+
+#define INITRD_BENCH_ROUNDS 16
+
+// Returns the file following `file` in a pre-order walk of the directory tree,
+// or NULL once the whole tree has been visited.
+static const struct initrd_file *__initrd_next(const struct initrd_file *file)
+{
+    if (!list_empty((struct list *)&file->children)) {
+        return list_first_entry(&file->children, struct initrd_file, sibling);
+    }
+
+    while (file != &initrd.root) {
+        if (file->sibling.next != &file->parent->children) {
+            return list_next_entry(file, sibling);
+        }
+        file = file->parent;
+    }
+
+    return NULL;
+}
+
+// Looks up every file in the initrd by its path a number of times, and reports
+// the average lookup time.
+static void __initrd_benchmark(void)
+{
+    const struct initrd_file *file;
+    size_t lookups = 0;
+    size_t failures = 0;
+
+    uint64_t start = time_ns();
+
+    for (int i = 0; i < INITRD_BENCH_ROUNDS; ++i) {
+        file = __initrd_next(&initrd.root);
+        for (; file != NULL; file = __initrd_next(file)) {
+            if (initrd_get_file(file->path) != file) {
+                ++failures;
+            }
+            ++lookups;
+        }
+    }
+
+    uint64_t lookup_ns = time_ns() - start;
+
+    klog(KLOG_INFO,
+         INITRD "benchmark: %u lookups in %llu us (%llu ns/lookup), "
+                "%u failed",
+         lookups,
+         lookup_ns / NSEC_PER_USEC,
+         lookups ? lookup_ns / lookups : 0,
+         failures);
+}
+
+#endif  // CONFIG(INITRD_BENCHMARK)
 
 int read_initrd(const void *ptr, size_t len)
 {
     klog(KLOG_INFO, INITRD "Reading initrd");
 
+    initrd_file_cache = create_cache("initrd_file",
+                                     sizeof(struct initrd_file),
+                                     SLAB_MIN_ALIGN,
+                                     SLAB_PANIC,
+                                     initrd_file_init);
+
     initrd.rd_base = ptr;
     initrd.rd_size = len;
-    initrd.capacity = 4;
+    initrd.num_entries = 0;
     initrd.num_files = 0;
-    initrd.files = kmalloc(initrd.capacity * sizeof *initrd.files);
+    initrd.num_dirs = 0;
+    initrd.compressed = false;
+    initrd.raw_bytes = 0;
+    initrd.content_bytes = 0;
+
+    initrd_file_init(&initrd.root);
+    initrd.root.path = "";
+    initrd.root.name = "";
+    initrd.root.type = INITRD_FILE_DIRECTORY;
+
+    uint64_t start = time_ns();
+    int err;
 
     switch (__initrd_format(ptr, len)) {
     case INITRD_TAR:
-        return __read_tar_initrd(&initrd);
+        err = __read_tar_initrd(&initrd);
+        break;
+
+    case INITRD_TAR_LZ4:
+        initrd.compressed = true;
+        err = __read_tar_initrd(&initrd);
+        break;
 
     case INITRD_UNKNOWN:
+    default:
         klog(KLOG_ERROR, INITRD "Unknown initrd at %p size %u", ptr, len);
         return EINVAL;
     }
 
+    if (err != 0) {
+        return err;
+    }
+
+    klog(KLOG_INFO,
+         INITRD "found %u files in %u directories [%llu us]",
+         initrd.num_files,
+         initrd.num_dirs,
+         (time_ns() - start) / NSEC_PER_USEC);
+
+    if (initrd.compressed) {
+        klog(KLOG_INFO,
+             INITRD "%llu KiB compressed, %llu KiB uncompressed",
+             initrd.raw_bytes / KIB(1),
+             initrd.content_bytes / KIB(1));
+    }
+
+#if CONFIG(INITRD_BENCHMARK)
+    __initrd_benchmark();
+#endif
+
     return 0;
 }
 
 const struct initrd_file *initrd_get_file(const char *path)
 {
-    for (size_t i = 0; i < initrd.num_files; ++i) {
-        if (strcmp(initrd.files[i].path, path) == 0) {
-            return &initrd.files[i];
+    if (!initrd.index.buckets) {
+        return NULL;
+    }
+
+    size_t len = strlen(path);
+    path = __path_normalize(path, &len);
+
+    return __initrd_lookup(&initrd, path, len);
+}
+
+const struct initrd_file *initrd_root(void) { return &initrd.root; }
+
+static const uint8_t *__initrd_decompress(struct initrd_file *file)
+{
+    // Pages of the buffer are only allocated as the decompressor writes to
+    // them, so memory is used for exactly what the file needs.
+    uint8_t *buf = vmalloc(file->size);
+    if (!buf) {
+        return ERR_PTR(ENOMEM);
+    }
+
+    uint64_t start = time_ns();
+    size_t len;
+
+    int err = lz4_frame_decompress(
+        file->raw, file->raw_size, buf, file->size, &len);
+    if (err == 0 && len != file->size) {
+        err = EINVAL;
+    }
+
+    if (err != 0) {
+        klog(KLOG_ERROR,
+             INITRD "failed to decompress %s: %s",
+             file->path,
+             strerror(err));
+        vfree(buf);
+        return ERR_PTR(err);
+    }
+
+    klog(KLOG_INFO,
+         INITRD "decompressed %s (%u -> %u bytes) [%llu us]",
+         file->path,
+         file->raw_size,
+         file->size,
+         (time_ns() - start) / NSEC_PER_USEC);
+
+    return buf;
+}
+
+const uint8_t *initrd_file_data(const struct initrd_file *file)
+{
+    if (initrd_is_dir(file)) {
+        return ERR_PTR(EISDIR);
+    }
+
+    if (!(file->flags & INITRD_FILE_COMPRESSED) || file->base) {
+        return file->base;
+    }
+
+    // Initrd files are only ever const to their users.
+    struct initrd_file *f = (struct initrd_file *)file;
+    const uint8_t *data;
+
+    mutex_lock(&initrd_decompress_lock);
+
+    data = f->base;
+    if (!data) {
+        data = __initrd_decompress(f);
+        if (!IS_ERR(data)) {
+            // Ensure the contents are written before they are published.
+            barrier();
+            f->base = data;
         }
     }
 
-    return NULL;
+    mutex_unlock(&initrd_decompress_lock);
+    return data;
 }
@@ -0,0 +1,160 @@
+/*
+ * kernel/irq/balance.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/error.h>
+#include <radix/irq.h>
+#include <radix/klog.h>
+#include <radix/kthread.h>
+#include <radix/sleep.h>
+#include <radix/smp.h>
+
+#include <string.h>
+
+#if CONFIG(IRQ_BALANCE)
+
+#define IRQ_BALANCE_INTERVAL_MS CONFIG(IRQ_BALANCE_INTERVAL)
+
+/*
+ * IRQs which fire fewer times than this per second are ignored by the
+ * balancer, as moving them costs more than it gains.
+ */
+#define IRQ_BALANCE_MIN_RATE 32
+
+#define IRQ_BALANCE_MIN_COUNT \
+    (IRQ_BALANCE_MIN_RATE * IRQ_BALANCE_INTERVAL_MS / 1000 + 1)
+
+struct irq_load {
+    unsigned int irq;
+    unsigned long count;
+};
+
+/*
+ * State of the balancer. Only accessed from the balancer thread.
+ */
+static unsigned long irq_totals[NR_IRQS];
+static struct irq_load hot_irqs[NR_IRQS];
+static unsigned long cpu_load[MAX_CPUS];
+
+/* IRQs which the system PIC is unable to route. */
+static unsigned char irq_unroutable[NR_IRQS];
+
+/*
+ * irq_balance_collect:
+ * Find the IRQs which have fired at least IRQ_BALANCE_MIN_COUNT times since
+ * the previous pass, sorted by descending count. Returns the number found.
+ */
+static size_t irq_balance_collect(void)
+{
+    unsigned long total, count;
+    unsigned int irq;
+    size_t i, n;
+    int cpu;
+
+    n = 0;
+    for (irq = 0; irq < NR_IRQS; ++irq) {
+        total = 0;
+        for_each_cpu (cpu, cpumask_online())
+            total += irq_cpu_count(irq, cpu);
+
+        count = total - irq_totals[irq];
+        irq_totals[irq] = total;
+
+        if (irq_unroutable[irq] || count < IRQ_BALANCE_MIN_COUNT)
+            continue;
+
+        for (i = n; i > 0 && hot_irqs[i - 1].count < count; --i)
+            hot_irqs[i] = hot_irqs[i - 1];
+        hot_irqs[i].irq = irq;
+        hot_irqs[i].count = count;
+        ++n;
+    }
+
+    return n;
+}
+
+/*
+ * irq_balance_pass:
+ * Spread the busiest IRQs across CPUs, assigning each in turn to the
+ * least loaded CPU in its affinity. An IRQ is only moved if doing so
+ * significantly reduces the imbalance, to avoid bouncing IRQs between
+ * similarly loaded CPUs.
+ */
+static void irq_balance_pass(void)
+{
+    cpumask_t allowed;
+    size_t i, n;
+    int cpu, best, cur;
+
+    n = irq_balance_collect();
+    if (n == 0)
+        return;
+
+    memset(cpu_load, 0, sizeof cpu_load);
+
+    for (i = 0; i < n; ++i) {
+        const unsigned int irq = hot_irqs[i].irq;
+        const unsigned long count = hot_irqs[i].count;
+
+        irq_get_affinity(irq, &allowed);
+        if (!cpumask_and(&allowed, &allowed, cpumask_online()))
+            continue;
+
+        best = -1;
+        for_each_cpu (cpu, &allowed) {
+            if (best < 0 || cpu_load[cpu] < cpu_load[best])
+                best = cpu;
+        }
+
+        cur = irq_target_cpu(irq);
+        if (cur >= 0 && cpumask_test_cpu(&allowed, cur) &&
+            cpu_load[cur] - cpu_load[best] <= count / 2)
+            best = cur;
+
+        if (best != cur && irq_move(irq, best) != 0) {
+            irq_unroutable[irq] = 1;
+            continue;
+        }
+
+        cpu_load[best] += count;
+    }
+}
+
+static void irq_balance_thread(__unused void *arg)
+{
+    while (1) {
+        sleep_ms(IRQ_BALANCE_INTERVAL_MS);
+
+        if (cpumask_weight(cpumask_online()) > 1)
+            irq_balance_pass();
+    }
+}
+
+/*
+ * irq_balance_init:
+ * Start the IRQ balancer thread.
+ */
+void irq_balance_init(void)
+{
+    struct task *thread;
+
+    thread = kthread_run(irq_balance_thread, NULL, 0, "irq_balance");
+    if (IS_ERR(thread))
+        klog(KLOG_ERROR, "irq: failed to start balancer");
+}
+
+#endif  // CONFIG(IRQ_BALANCE)
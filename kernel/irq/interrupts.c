@@ -16,9 +16,45 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <radix/atomic.h>
 #include <radix/error.h>
 #include <radix/irq.h>
+#include <radix/kthread.h>
+#include <radix/list.h>
 #include <radix/slab.h>
+#include <radix/smp.h>
+#include <radix/spinlock.h>
+
+#include <stdbool.h>
+
+/*
+ * A kernel thread running the bottom half of a device's IRQ handler.
+ */
+struct irq_thread {
+    struct task *task;
+    irq_handler_t thread_fn;
+    void *device;
+    unsigned int irq;
+    unsigned long flags;
+    int pending;
+    int stop;
+    struct list list;
+};
+
+static struct list irq_threads = LIST_INIT(irq_threads);
+static spinlock_t irq_threads_lock = SPINLOCK_INIT;
+
+/*
+ * Affinity of each IRQ. Until an affinity is set, an IRQ may run on any
+ * online CPU, and is delivered wherever the system PIC sends it by default.
+ */
+static struct irq_affinity {
+    cpumask_t mask;
+    int cpu;
+    bool restricted;
+} irq_affinity[NR_IRQS] = {[0 ... NR_IRQS - 1] = {.cpu = -1}};
+
+static spinlock_t irq_affinity_lock = SPINLOCK_INIT;
 
 /*
  * request_irq:
@@ -41,6 +77,7 @@ int request_irq(void *device, irq_handler_t handler, unsigned long flags)
     desc->handler = handler;
     desc->device = device;
     desc->flags = flags;
+    desc->thread = NULL;
     desc->next = NULL;
 
     irq = __arch_request_irq(desc);
@@ -61,7 +98,209 @@ int request_fixed_irq(unsigned int irq, void *device, irq_handler_t handler)
     if (!device || !handler)
         return EINVAL;
 
-    return __arch_request_fixed_irq(irq, device, handler);
+    return __arch_request_fixed_irq(irq, device, handler, NULL);
+}
+
+/*
+ * irq_thread_set_irq:
+ * Record the IRQ number assigned to a threaded IRQ. Called by the architecture
+ * before the IRQ's descriptor is installed, so that the number is known the
+ * first time the IRQ fires.
+ */
+void irq_thread_set_irq(struct irq_thread *thread, unsigned int irq)
+{
+    atomic_write(&thread->irq, irq);
+}
+
+/*
+ * irq_thread_wake:
+ * Called from the hard IRQ handler to schedule the threaded handler.
+ */
+void irq_thread_wake(struct irq_thread *thread)
+{
+    struct task *task;
+
+    if (thread->flags & IRQ_ONESHOT)
+        mask_irq(thread->irq);
+
+    atomic_write(&thread->pending, 1);
+
+    /* The task is not set until the thread has been created. */
+    task = atomic_read(&thread->task);
+    if (task)
+        kthread_wake(task);
+}
+
+static void irq_thread_func(void *p)
+{
+    struct irq_thread *thread = p;
+
+    unsigned long irqstate;
+
+    while (!atomic_read(&thread->stop)) {
+        if (!atomic_swap(&thread->pending, 0)) {
+            kthread_wait();
+            continue;
+        }
+
+        thread->thread_fn(thread->device);
+
+        /* A released IRQ is left masked. */
+        if ((thread->flags & IRQ_ONESHOT) && !atomic_read(&thread->stop))
+            unmask_irq(thread->irq);
+    }
+
+    /*
+     * release_irq wakes the task under irq_threads_lock after setting stop.
+     * Wait for it to finish before exiting, as the task is freed on exit.
+     */
+    spin_lock_irq(&irq_threads_lock, &irqstate);
+    spin_unlock_irq(&irq_threads_lock, irqstate);
+
+    kfree(thread);
+}
+
+static struct irq_thread *irq_thread_alloc(void *device,
+                                           irq_handler_t thread_fn,
+                                           unsigned long flags)
+{
+    struct irq_thread *thread;
+
+    thread = kmalloc(sizeof *thread);
+    if (!thread)
+        return NULL;
+
+    thread->task = NULL;
+    thread->thread_fn = thread_fn;
+    thread->device = device;
+    thread->irq = 0;
+    thread->flags = flags;
+    thread->pending = 0;
+    thread->stop = 0;
+    list_init(&thread->list);
+
+    return thread;
+}
+
+/*
+ * irq_thread_start:
+ * Create and start the kernel thread for a registered threaded IRQ.
+ * If this fails, the IRQ is released.
+ */
+static int irq_thread_start(struct irq_thread *thread, unsigned int irq)
+{
+    struct task *task;
+    unsigned long irqstate;
+
+    task = kthread_create(irq_thread_func, thread, 0, "irq/%u", irq);
+    if (IS_ERR(task)) {
+        __arch_release_irq(irq, thread->device);
+        kfree(thread);
+        return ERR_VAL(task);
+    }
+
+    atomic_write(&thread->task, task);
+
+    spin_lock_irq(&irq_threads_lock, &irqstate);
+    list_add(&irq_threads, &thread->list);
+    spin_unlock_irq(&irq_threads_lock, irqstate);
+
+    kthread_start(task);
+
+    return 0;
+}
+
+/* Primary handler for threaded IRQs which do not provide one. */
+static void irq_thread_primary(__unused void *device) {}
+
+/*
+ * request_threaded_irq:
+ * Request an IRQ for the specified device, split into a primary handler run
+ * in interrupt context and a threaded handler run by a dedicated kernel thread
+ * with interrupts enabled. The thread runs each time the IRQ fires, after the
+ * primary handler. The primary handler may be NULL.
+ *
+ * If IRQ_ONESHOT is set in `flags`, the IRQ is masked from the time it fires
+ * until its threaded handler completes. This is required for level-triggered
+ * devices which are not silenced by the primary handler.
+ *
+ * Returns the IRQ number if successful, or a negative number indicating the
+ * error if not.
+ */
+int request_threaded_irq(void *device,
+                         irq_handler_t handler,
+                         irq_handler_t thread_fn,
+                         unsigned long flags)
+{
+    struct irq_descriptor *desc;
+    struct irq_thread *thread;
+    int irq, err;
+
+    if (!device || !thread_fn)
+        return -EINVAL;
+
+    thread = irq_thread_alloc(device, thread_fn, flags);
+    if (!thread)
+        return -ENOMEM;
+
+    desc = kmalloc(sizeof *desc);
+    if (!desc) {
+        kfree(thread);
+        return -ENOMEM;
+    }
+
+    desc->handler = handler ? handler : irq_thread_primary;
+    desc->device = device;
+    desc->flags = flags;
+    desc->thread = thread;
+    desc->next = NULL;
+
+    irq = __arch_request_irq(desc);
+    if (irq < 0) {
+        kfree(desc);
+        kfree(thread);
+        return irq;
+    }
+
+    err = irq_thread_start(thread, irq);
+    return err ? -err : irq;
+}
+
+/*
+ * request_fixed_threaded_irq:
+ * Request a specific IRQ number for the specified device, with a threaded
+ * handler as in request_threaded_irq. Returns 0 on success, error code on
+ * failure.
+ */
+int request_fixed_threaded_irq(unsigned int irq,
+                               void *device,
+                               irq_handler_t handler,
+                               irq_handler_t thread_fn,
+                               unsigned long flags)
+{
+    struct irq_thread *thread;
+    int err;
+
+    if (!device || !thread_fn)
+        return EINVAL;
+
+    thread = irq_thread_alloc(device, thread_fn, flags);
+    if (!thread)
+        return ENOMEM;
+
+    /* The IRQ may fire as soon as it is requested. */
+    irq_thread_set_irq(thread, irq);
+
+    err = __arch_request_fixed_irq(irq,
+                                   device,
+                                   handler ? handler : irq_thread_primary,
+                                   thread);
+    if (err) {
+        kfree(thread);
+        return err;
+    }
+
+    return irq_thread_start(thread, irq);
 }
 
 /*
@@ -70,5 +309,143 @@ int request_fixed_irq(unsigned int irq, void *device, irq_handler_t handler)
  */
 void release_irq(unsigned int irq, void *device)
 {
+    struct irq_thread *thread, *found = NULL;
+    unsigned long irqstate;
+
     __arch_release_irq(irq, device);
+
+    spin_lock_irq(&irq_threads_lock, &irqstate);
+    list_for_each_entry (thread, &irq_threads, list) {
+        if (thread->irq == irq && thread->device == device) {
+            found = thread;
+            list_del(&found->list);
+            break;
+        }
+    }
+
+    /*
+     * The thread frees itself once it sees that it has been stopped, but not
+     * before this lock is released, so its task is still valid to wake.
+     */
+    if (found) {
+        atomic_write(&found->stop, 1);
+        kthread_wake(found->task);
+    }
+    spin_unlock_irq(&irq_threads_lock, irqstate);
+}
+
+/*
+ * __irq_allowed_cpus:
+ * Store the set of online CPUs on which the specified IRQ may run in `mask`.
+ * Returns false if there are none.
+ */
+static bool __irq_allowed_cpus(unsigned int irq, cpumask_t *mask)
+{
+    if (!irq_affinity[irq].restricted) {
+        *mask = *cpumask_online();
+        return true;
+    }
+
+    return cpumask_and(mask, &irq_affinity[irq].mask, cpumask_online());
+}
+
+/*
+ * irq_set_affinity:
+ * Restrict the specified IRQ to the CPUs in `mask`, rerouting it if it is
+ * currently delivered elsewhere. Returns 0 on success, error code on failure.
+ */
+int irq_set_affinity(unsigned int irq, const cpumask_t *mask)
+{
+    cpumask_t allowed;
+    unsigned long irqstate;
+    int cpu, err;
+
+    if (irq >= NR_IRQS)
+        return EINVAL;
+
+    if (!cpumask_and(&allowed, mask, cpumask_online()))
+        return EINVAL;
+
+    spin_lock_irq(&irq_affinity_lock, &irqstate);
+
+    cpu = irq_affinity[irq].cpu;
+    if (cpu < 0 || !cpumask_test_cpu(&allowed, cpu))
+        cpu = cpumask_first(&allowed);
+
+    err = __arch_route_irq(irq, cpu);
+    if (err == 0) {
+        irq_affinity[irq].mask = *mask;
+        irq_affinity[irq].cpu = cpu;
+        irq_affinity[irq].restricted = true;
+    }
+
+    spin_unlock_irq(&irq_affinity_lock, irqstate);
+    return err;
+}
+
+/*
+ * irq_get_affinity:
+ * Store the set of CPUs on which the specified IRQ may run in `mask`.
+ */
+int irq_get_affinity(unsigned int irq, cpumask_t *mask)
+{
+    unsigned long irqstate;
+
+    if (irq >= NR_IRQS)
+        return EINVAL;
+
+    spin_lock_irq(&irq_affinity_lock, &irqstate);
+    if (irq_affinity[irq].restricted)
+        *mask = irq_affinity[irq].mask;
+    else
+        cpumask_setall(mask);
+    spin_unlock_irq(&irq_affinity_lock, irqstate);
+
+    return 0;
+}
+
+/*
+ * irq_move:
+ * Route the specified IRQ to `cpu`, which must be an online CPU within the
+ * IRQ's affinity. Returns 0 on success, error code on failure.
+ */
+int irq_move(unsigned int irq, int cpu)
+{
+    cpumask_t allowed;
+    unsigned long irqstate;
+    int err;
+
+    if (irq >= NR_IRQS || cpu < 0 || cpu >= MAX_CPUS)
+        return EINVAL;
+
+    spin_lock_irq(&irq_affinity_lock, &irqstate);
+
+    if (!__irq_allowed_cpus(irq, &allowed) ||
+        !cpumask_test_cpu(&allowed, cpu)) {
+        spin_unlock_irq(&irq_affinity_lock, irqstate);
+        return EINVAL;
+    }
+
+    err = 0;
+    if (irq_affinity[irq].cpu != cpu) {
+        err = __arch_route_irq(irq, cpu);
+        if (err == 0)
+            irq_affinity[irq].cpu = cpu;
+    }
+
+    spin_unlock_irq(&irq_affinity_lock, irqstate);
+    return err;
+}
+
+/*
+ * irq_target_cpu:
+ * Return the CPU to which the specified IRQ is routed, or -1 if it has not
+ * been routed to a specific CPU.
+ */
+int irq_target_cpu(unsigned int irq)
+{
+    if (irq >= NR_IRQS)
+        return -1;
+
+    return irq_affinity[irq].cpu;
 }
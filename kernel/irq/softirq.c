@@ -0,0 +1,165 @@
+/*
+ * kernel/irq/softirq.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/atomic.h>
+#include <radix/bits.h>
+#include <radix/error.h>
+#include <radix/irq.h>
+#include <radix/klog.h>
+#include <radix/kthread.h>
+#include <radix/percpu.h>
+#include <radix/sched.h>
+#include <radix/smp.h>
+#include <radix/softirq.h>
+
+/*
+ * Maximum number of times pending softirqs are processed on interrupt exit
+ * before the remainder is handed off to ksoftirqd.
+ */
+#define SOFTIRQ_MAX_RESTART 8
+
+static softirq_handler_t softirq_vec[NR_SOFTIRQS];
+
+static DEFINE_PER_CPU(unsigned long, softirq_pending) = 0;
+static DEFINE_PER_CPU(int, softirq_active) = 0;
+static DEFINE_PER_CPU(struct task *, ksoftirqd) = NULL;
+
+/* Scheduler calls deferred while softirqs were running. */
+#define SOFTIRQ_RESCHED_PREEMPT (1 << 0)
+#define SOFTIRQ_RESCHED_REPLACE (1 << 1)
+
+static DEFINE_PER_CPU(int, softirq_resched) = 0;
+
+void open_softirq(enum softirq nr, softirq_handler_t handler)
+{
+    softirq_vec[nr] = handler;
+}
+
+void raise_softirq(enum softirq nr)
+{
+    unsigned long irqstate;
+
+    irq_save(irqstate);
+    this_cpu_write(softirq_pending, this_cpu_read(softirq_pending) | (1 << nr));
+    irq_restore(irqstate);
+}
+
+/*
+ * __do_softirq:
+ * Run pending softirqs on the current CPU with interrupts enabled.
+ * Must be called with interrupts disabled. If softirqs continue to be
+ * raised after SOFTIRQ_MAX_RESTART passes, wakes the CPU's ksoftirqd
+ * to finish them.
+ */
+static void __do_softirq(void)
+{
+    unsigned long pending;
+    int restart = SOFTIRQ_MAX_RESTART;
+    struct task *thread;
+
+    this_cpu_write(softirq_active, 1);
+
+    while ((pending = this_cpu_read(softirq_pending)) != 0) {
+        if (restart-- == 0) {
+            thread = this_cpu_read(ksoftirqd);
+            if (thread)
+                kthread_wake(thread);
+            break;
+        }
+
+        this_cpu_write(softirq_pending, 0);
+        irq_enable();
+
+        while (pending) {
+            unsigned int nr = ffs(pending) - 1;
+
+            pending &= pending - 1;
+            if (softirq_vec[nr])
+                softirq_vec[nr]();
+        }
+
+        irq_disable();
+    }
+
+    this_cpu_write(softirq_active, 0);
+
+    const int resched = this_cpu_read(softirq_resched);
+    if (resched) {
+        this_cpu_write(softirq_resched, 0);
+        schedule(resched & SOFTIRQ_RESCHED_REPLACE ? SCHED_REPLACE
+                                                   : SCHED_PREEMPT);
+    }
+}
+
+void do_softirq(void)
+{
+    unsigned long irqstate;
+
+    irq_save(irqstate);
+    if (this_cpu_read(softirq_pending) && !this_cpu_read(softirq_active))
+        __do_softirq();
+    irq_restore(irqstate);
+}
+
+void irq_exit(void)
+{
+    if (this_cpu_read(softirq_pending) && !this_cpu_read(softirq_active))
+        __do_softirq();
+}
+
+bool softirq_defer_schedule(enum sched_action action)
+{
+    if (!this_cpu_read(softirq_active))
+        return false;
+
+    this_cpu_write(softirq_resched,
+                   this_cpu_read(softirq_resched) |
+                       (action == SCHED_REPLACE ? SOFTIRQ_RESCHED_REPLACE
+                                                : SOFTIRQ_RESCHED_PREEMPT));
+    return true;
+}
+
+static void ksoftirqd_func(__unused void *arg)
+{
+    while (1) {
+        kthread_wait();
+        do_softirq();
+
+        /* Let other tasks run before handling any remaining softirqs. */
+        if (this_cpu_read(softirq_pending))
+            sched_yield();
+    }
+}
+
+void softirq_init(void)
+{
+    struct task *thread;
+    int cpu;
+
+    for_each_cpu (cpu, cpumask_online()) {
+        thread = kthread_create(ksoftirqd_func, NULL, 0, "ksoftirqd/%d", cpu);
+        if (IS_ERR(thread)) {
+            klog(KLOG_ERROR, "softirq: failed to create ksoftirqd/%d", cpu);
+            continue;
+        }
+
+        thread->cpu_restrict = CPUMASK_CPU(cpu);
+        cpu_var(ksoftirqd, cpu) = thread;
+        kthread_start(thread);
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * kernel/irq/stats.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/error.h>
+#include <radix/irq.h>
+#include <radix/klog.h>
+#include <radix/kthread.h>
+#include <radix/sleep.h>
+
+#if CONFIG(IRQ_STATS_DUMP_INTERVAL)
+
+#define IRQ_STATS_DUMP_INTERVAL_MS (CONFIG(IRQ_STATS_DUMP_INTERVAL) * 1000ULL)
+
+static void irq_stats_dump_thread(__unused void *arg)
+{
+    while (1) {
+        sleep_ms(IRQ_STATS_DUMP_INTERVAL_MS);
+        irq_stats_dump();
+    }
+}
+
+/*
+ * irq_stats_dump_init:
+ * Start a thread which periodically logs the interrupt statistics.
+ */
+void irq_stats_dump_init(void)
+{
+    struct task *thread;
+
+    thread = kthread_run(irq_stats_dump_thread, NULL, 0, "irq_stats");
+    if (IS_ERR(thread))
+        klog(KLOG_ERROR, "irq: failed to start statistics thread");
+}
+
+#endif  // CONFIG(IRQ_STATS_DUMP_INTERVAL)
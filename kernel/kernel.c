@@ -18,6 +18,7 @@
 
 #include <radix/boot.h>
 #include <radix/compiler.h>
+#include <radix/config.h>
 #include <radix/cpu.h>
 #include <radix/event.h>
 #include <radix/initrd.h>
@@ -29,11 +30,16 @@
 #include <radix/multiboot.h>
 #include <radix/percpu.h>
 #include <radix/sched.h>
+#include <radix/serial.h>
+#include <radix/slab.h>
 #include <radix/smp.h>
+#include <radix/softirq.h>
 #include <radix/syscall.h>
 #include <radix/task.h>
+#include <radix/tty.h>
 #include <radix/version.h>
 #include <radix/vmm.h>
+#include <radix/workqueue.h>
 
 #include <string.h>
 
@@ -66,9 +72,33 @@ static void kernel_boot_thread(void *p)
 
     event_start();
     smp_init();
+    softirq_init();
+    workqueue_init();
+    slab_watchdog_init();
+    compaction_init();
+    tty_init();
+    irq_balance_init();
+    irq_stats_dump_init();
+    serial_console_enable_irq();
 
     syscall_init();
 
+#if CONFIG(KTHREAD_BENCHMARK)
+    kthread_benchmark();
+#endif
+
+#if CONFIG(SCHED_SWITCH_BENCHMARK)
+    sched_switch_benchmark();
+#endif
+
+#if CONFIG(SYSCALL_BENCHMARK)
+    syscall_benchmark();
+#endif
+
+#if CONFIG(STRING_BENCHMARK)
+    cpu_string_benchmark();
+#endif
+
     while (1) {
         HALT();
     }
@@ -77,11 +107,14 @@ static void kernel_boot_thread(void *p)
 // Kernel entry point.
 int kmain(struct multiboot_info *mbt)
 {
+    serial_console_register();
+
     klog(KLOG_INFO, KERNEL_NAME " " KERNEL_VERSION);
 
     buddy_init(mbt);
     slab_init();
     vmm_init();
+    zero_pool_init();
 
     arch_main_setup();
     irq_init();
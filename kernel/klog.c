@@ -25,6 +25,7 @@
 #include <radix/spinlock.h>
 #include <radix/time.h>
 
+#include <errno.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -32,6 +33,7 @@
 #include <string.h>
 
 #define KLOG_MAX_MSG_LEN 256
+#define KLOG_MAX_CONSOLES 2
 #define KLOG_WRAPAROUND  0xFFFF
 
 struct klog_entry {
@@ -54,14 +56,16 @@ static struct {
     struct klog_entry *write_cursor;
 
     // TODO(frolv): This shouldn't be here. It's for early debugging.
-    struct console *console;
+    // The first console is the one set by klog_set_console; the rest mirror
+    // it and are added by klog_add_console.
+    struct console *consoles[KLOG_MAX_CONSOLES];
 } kernel_log = {
     .lock = SPINLOCK_INIT,
     .buffer_start = (uintptr_t)klog_buffer,
     .buffer_end = (uintptr_t)klog_buffer + sizeof klog_buffer,
     .sequence_number = 0,
     .write_cursor = (struct klog_entry *)klog_buffer,
-    .console = NULL,
+    .consoles = {NULL},
 };
 
 static size_t klog_entry_size(const struct klog_entry *entry)
@@ -113,7 +117,13 @@ static void klog_console_write(const struct klog_entry *entry)
 {
     char buf[KLOG_MAX_MSG_LEN + 32];
     size_t size = klog_print(entry, buf);
-    kernel_log.console->actions->write(kernel_log.console, buf, size);
+
+    for (int i = 0; i < KLOG_MAX_CONSOLES; ++i) {
+        struct console *c = kernel_log.consoles[i];
+        if (c) {
+            c->actions->write(c, buf, size);
+        }
+    }
 }
 
 static void vklog(int level, const char *format, va_list ap)
@@ -146,7 +156,7 @@ static void vklog(int level, const char *format, va_list ap)
 
     spin_unlock_irq(&kernel_log.lock, irqstate);
 
-    if (kernel_log.console && processor_id() == 0) {
+    if (processor_id() == 0) {
         klog_console_write(entry);
     }
 }
@@ -159,4 +169,16 @@ void klog(int level, const char *format, ...)
     va_end(ap);
 }
 
-void klog_set_console(struct console *c) { kernel_log.console = c; }
+void klog_set_console(struct console *c) { kernel_log.consoles[0] = c; }
+
+int klog_add_console(struct console *c)
+{
+    for (int i = 1; i < KLOG_MAX_CONSOLES; ++i) {
+        if (!kernel_log.consoles[i]) {
+            kernel_log.consoles[i] = c;
+            return 0;
+        }
+    }
+
+    return ENOSPC;
+}
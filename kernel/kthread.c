@@ -17,13 +17,17 @@
  */
 
 #include <radix/assert.h>
+#include <radix/atomic.h>
 #include <radix/bits.h>
 #include <radix/irq.h>
+#include <radix/klog.h>
 #include <radix/kthread.h>
 #include <radix/mm.h>
 #include <radix/sched.h>
 #include <radix/slab.h>
+#include <radix/smp.h>
 #include <radix/task.h>
+#include <radix/time.h>
 #include <radix/vmm.h>
 
 #include <stdio.h>
@@ -81,6 +85,59 @@ struct task *kthread_run(
 
 void kthread_start(struct task *thread) { sched_add(thread); }
 
+// States of a kthread's wake_state, used by kthread_wait and kthread_wake.
+enum {
+    KTHREAD_AWAKE,
+    KTHREAD_WAKE_PENDING,
+    KTHREAD_WAITING,
+};
+
+void kthread_wait(void)
+{
+    struct task *curr = current_task();
+    unsigned long irqstate;
+
+    irq_save(irqstate);
+
+    // The task must be marked as blocked before it is visible as waiting, as
+    // a waker on another CPU may unblock it at any point afterwards.
+    curr->state = TASK_BLOCKED;
+    if (atomic_cmpxchg(&curr->wake_state, KTHREAD_AWAKE, KTHREAD_WAITING) ==
+        KTHREAD_AWAKE) {
+        schedule(SCHED_REPLACE);
+    } else {
+        // A wakeup is pending; consume it without blocking.
+        curr->state = TASK_RUNNING;
+        atomic_write(&curr->wake_state, KTHREAD_AWAKE);
+    }
+
+    irq_restore(irqstate);
+}
+
+void kthread_wake(struct task *thread)
+{
+    while (1) {
+        int state = atomic_read(&thread->wake_state);
+
+        if (state == KTHREAD_WAKE_PENDING) {
+            return;
+        }
+
+        if (state == KTHREAD_AWAKE) {
+            if (atomic_cmpxchg(&thread->wake_state,
+                               KTHREAD_AWAKE,
+                               KTHREAD_WAKE_PENDING) == KTHREAD_AWAKE) {
+                return;
+            }
+        } else if (atomic_cmpxchg(&thread->wake_state,
+                                  KTHREAD_WAITING,
+                                  KTHREAD_AWAKE) == KTHREAD_WAITING) {
+            sched_unblock(thread);
+            return;
+        }
+    }
+}
+
 // Exits the running kthread.
 // All created kthreads set this function as their base return address.
 __noreturn void kthread_exit(void)
@@ -99,7 +156,7 @@ static struct task *__kthread_create(void (*func)(void *),
                                      int page_order)
 {
     struct task *thread;
-    struct page *p;
+    void *stack;
     addr_t stack_top;
 
     thread = task_alloc();
@@ -107,16 +164,17 @@ static struct task *__kthread_create(void (*func)(void *),
         return thread;
     }
 
-    p = alloc_pages(PA_STANDARD, page_order);
-    if (IS_ERR(p)) {
+    stack = task_stack_alloc(page_order);
+    if (IS_ERR(stack)) {
         task_free(thread);
-        return (void *)p;
+        return stack;
     }
 
     thread->vmm = vmm_kernel();
+    thread->wake_state = KTHREAD_AWAKE;
 
     thread->stack_size = pow2(page_order) * PAGE_SIZE;
-    stack_top = (addr_t)p->mem + thread->stack_size;
+    stack_top = (addr_t)stack + thread->stack_size;
     kthread_reg_setup(&thread->regs, stack_top, (addr_t)func, (addr_t)arg);
     thread->stack_top = (void *)stack_top;
 
@@ -125,8 +183,55 @@ static struct task *__kthread_create(void (*func)(void *),
 
 static void kthread_set_name(struct task *thread, char *name, va_list ap)
 {
-    thread->cmdline = kmalloc(2 * sizeof *thread->cmdline);
-    thread->cmdline[0] = kmalloc(KTHREAD_NAME_LEN);
-    vsnprintf(thread->cmdline[0], KTHREAD_NAME_LEN, name, ap);
-    thread->cmdline[1] = NULL;
+    char *buf = task_cmdline_buffer(thread, KTHREAD_NAME_LEN);
+    if (buf) {
+        vsnprintf(buf, KTHREAD_NAME_LEN, name, ap);
+    }
 }
+
+#if CONFIG(KTHREAD_BENCHMARK)
+
+#define KTHREAD_BENCH_ROUNDS 1000
+
+static void __kthread_bench_func(void *arg) { atomic_inc((int *)arg); }
+
+void kthread_benchmark(void)
+{
+    int exited = 0;
+    uint64_t create_ns = 0;
+
+    uint64_t start = time_ns();
+
+    for (int i = 0; i < KTHREAD_BENCH_ROUNDS; ++i) {
+        uint64_t create_start = time_ns();
+        struct task *thread =
+            kthread_create(__kthread_bench_func, &exited, 0, "kbench%d", i);
+        create_ns += time_ns() - create_start;
+
+        if (IS_ERR(thread)) {
+            klog(KLOG_ERROR, "kthread benchmark: failed to create thread");
+            return;
+        }
+
+        // Keep the thread local so that its task and stack are recycled for
+        // the next iteration.
+        thread->cpu_restrict = CPUMASK_SELF;
+        kthread_start(thread);
+
+        while (atomic_read(&exited) <= i) {
+            sched_yield();
+        }
+    }
+
+    uint64_t total_ns = time_ns() - start;
+
+    klog(KLOG_INFO,
+         "kthread benchmark: %d spawn/exit cycles in %llu us, "
+         "%llu ns/create, %llu ns/cycle",
+         KTHREAD_BENCH_ROUNDS,
+         total_ns / NSEC_PER_USEC,
+         create_ns / KTHREAD_BENCH_ROUNDS,
+         total_ns / KTHREAD_BENCH_ROUNDS);
+}
+
+#endif  // CONFIG(KTHREAD_BENCHMARK)
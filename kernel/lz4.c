@@ -0,0 +1,256 @@
+/*
+ * kernel/lz4.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/compiler.h>
+#include <radix/lz4.h>
+
+#include <errno.h>
+#include <string.h>
+
+#define LZ4_FLG_VERSION_MASK 0xC0
+#define LZ4_FLG_VERSION      0x40
+
+#define LZ4_BLOCK_UNCOMPRESSED (1U << 31)
+#define LZ4_BLOCK_SIZE_MASK    (~LZ4_BLOCK_UNCOMPRESSED)
+
+#define LZ4_MIN_MATCH 4
+
+static __always_inline uint32_t __read_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static __always_inline uint64_t __read_le64(const uint8_t *p)
+{
+    return (uint64_t)__read_le32(p) | (uint64_t)__read_le32(p + 4) << 32;
+}
+
+int lz4_frame_info(const void *src, size_t len, struct lz4_frame_info *info)
+{
+    const uint8_t *p = src;
+
+    // Magic number, FLG and BD bytes, and header checksum.
+    size_t header_size = 7;
+
+    if (len < header_size || __read_le32(p) != LZ4_FRAME_MAGIC) {
+        return EINVAL;
+    }
+
+    uint8_t flags = p[4];
+    if ((flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION ||
+        (flags & LZ4_FLG_DICT_ID)) {
+        return EINVAL;
+    }
+
+    if (flags & LZ4_FLG_CONTENT_SIZE) {
+        header_size += sizeof(uint64_t);
+        if (len < header_size) {
+            return EINVAL;
+        }
+        info->content_size = __read_le64(p + 6);
+    } else {
+        info->content_size = 0;
+    }
+
+    info->header_size = header_size;
+    info->flags = flags;
+    return 0;
+}
+
+// Reads an LZ4 length extension, where each byte is added to the length until
+// one which is not 255.
+static __always_inline int __read_length(const uint8_t **ip,
+                                         const uint8_t *iend,
+                                         size_t *len)
+{
+    uint8_t b;
+
+    do {
+        if (*ip >= iend) {
+            return EINVAL;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+
+    return 0;
+}
+
+// Decompresses a single LZ4 block into `dst` at offset `*pos`, advancing `*pos`
+// past the decompressed data. Matches may refer back to anything previously
+// written to `dst`, which handles frames with linked blocks.
+//
+// If `dst` is NULL, nothing is written and only `*pos` is advanced.
+static int __lz4_decompress_block(const uint8_t *src,
+                                  size_t src_len,
+                                  uint8_t *dst,
+                                  size_t dst_len,
+                                  size_t *pos)
+{
+    const uint8_t *ip = src;
+    const uint8_t *const iend = src + src_len;
+    size_t op = *pos;
+
+    while (ip < iend) {
+        const unsigned int token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && __read_length(&ip, iend, &literals) != 0) {
+            return EINVAL;
+        }
+
+        if (literals > (size_t)(iend - ip)) {
+            return EINVAL;
+        }
+        if (literals > dst_len - op) {
+            return ENOSPC;
+        }
+
+        if (dst) {
+            memcpy(dst + op, ip, literals);
+        }
+        op += literals;
+        ip += literals;
+
+        // The final sequence of a block consists only of literals.
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return EINVAL;
+        }
+
+        const size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+
+        if (offset == 0 || offset > op) {
+            return EINVAL;
+        }
+
+        size_t match_len = token & 0xF;
+        if (match_len == 15 && __read_length(&ip, iend, &match_len) != 0) {
+            return EINVAL;
+        }
+        match_len += LZ4_MIN_MATCH;
+
+        if (match_len > dst_len - op) {
+            return ENOSPC;
+        }
+
+        if (!dst) {
+            op += match_len;
+        } else if (offset >= match_len) {
+            memcpy(dst + op, dst + op - offset, match_len);
+            op += match_len;
+        } else {
+            // Overlapping matches repeat the last `offset` bytes, so they must
+            // be copied forwards one byte at a time.
+            for (; match_len > 0; --match_len, ++op) {
+                dst[op] = dst[op - offset];
+            }
+        }
+    }
+
+    *pos = op;
+    return 0;
+}
+
+// Decodes an LZ4 frame into `dst`, or only computes its decompressed length if
+// `dst` is NULL.
+static int __lz4_frame_decode(const void *src,
+                              size_t src_len,
+                              uint8_t *dst,
+                              size_t dst_len,
+                              size_t *out_len)
+{
+    struct lz4_frame_info info;
+    int err;
+
+    if ((err = lz4_frame_info(src, src_len, &info)) != 0) {
+        return err;
+    }
+
+    const uint8_t *p = (const uint8_t *)src + info.header_size;
+    const uint8_t *const end = (const uint8_t *)src + src_len;
+    const size_t checksum_size =
+        info.flags & LZ4_FLG_BLOCK_CHECKSUM ? sizeof(uint32_t) : 0;
+    size_t pos = 0;
+
+    while (1) {
+        if (end - p < (ptrdiff_t)sizeof(uint32_t)) {
+            return EINVAL;
+        }
+
+        const uint32_t block_header = __read_le32(p);
+        p += sizeof(uint32_t);
+
+        // A zero-sized block marks the end of the frame.
+        if (block_header == 0) {
+            break;
+        }
+
+        const size_t block_size = block_header & LZ4_BLOCK_SIZE_MASK;
+        if (block_size + checksum_size > (size_t)(end - p)) {
+            return EINVAL;
+        }
+
+        if (block_header & LZ4_BLOCK_UNCOMPRESSED) {
+            if (block_size > dst_len - pos) {
+                return ENOSPC;
+            }
+            if (dst) {
+                memcpy(dst + pos, p, block_size);
+            }
+            pos += block_size;
+        } else {
+            err = __lz4_decompress_block(p, block_size, dst, dst_len, &pos);
+            if (err != 0) {
+                return err;
+            }
+        }
+
+        p += block_size + checksum_size;
+    }
+
+    if ((info.flags & LZ4_FLG_CONTENT_SIZE) && pos != info.content_size) {
+        return EINVAL;
+    }
+
+    *out_len = pos;
+    return 0;
+}
+
+int lz4_frame_decompress(const void *src,
+                         size_t src_len,
+                         void *dst,
+                         size_t dst_len,
+                         size_t *out_len)
+{
+    if (!dst) {
+        return EINVAL;
+    }
+
+    return __lz4_frame_decode(src, src_len, dst, dst_len, out_len);
+}
+
+int lz4_frame_measure(const void *src, size_t src_len, size_t *len)
+{
+    return __lz4_frame_decode(src, src_len, NULL, SIZE_MAX, len);
+}
@@ -0,0 +1,199 @@
+/*
+ * kernel/mm/numa.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/cpumask.h>
+#include <radix/error.h>
+#include <radix/kernel.h>
+#include <radix/klog.h>
+#include <radix/mm.h>
+#include <radix/numa.h>
+#include <radix/smp.h>
+
+#define NUMA "numa: "
+
+#define NUMA_MAX_MEMBLKS 32
+
+// A range of physical memory belonging to a single node.
+struct numa_memblk {
+    size_t start_pfn;
+    size_t end_pfn;
+    int node;
+};
+
+static struct numa_memblk memblks[NUMA_MAX_MEMBLKS];
+static int nr_memblks = 0;
+
+// Number of nodes described by firmware, and the number brought online by
+// numa_init. Until then, everything is on node 0.
+static int nodes_found = 0;
+static int nr_nodes = 1;
+
+static int cpu_node[MAX_CPUS];
+
+// Distances set from the SLIT. 0 means the default distance is used.
+static uint8_t distances[MAX_NUMNODES][MAX_NUMNODES];
+
+// Each node's list of nodes, ordered by increasing distance.
+static int8_t node_order[MAX_NUMNODES][MAX_NUMNODES];
+
+int numa_add_memblk(int node, uint64_t base, uint64_t len)
+{
+    struct numa_memblk *blk;
+    uint64_t end;
+
+    if (node < 0 || node >= MAX_NUMNODES)
+        return EINVAL;
+
+    // Memory beyond the page map's limit is never used.
+    end = min(base + len, (uint64_t)MEM_LIMIT);
+    base = ALIGN(base, PAGE_SIZE);
+    if (base >= end)
+        return 0;
+
+    if (nr_memblks == NUMA_MAX_MEMBLKS)
+        return ENOSPC;
+
+    blk = &memblks[nr_memblks++];
+    blk->start_pfn = base >> PAGE_SHIFT;
+    blk->end_pfn = end >> PAGE_SHIFT;
+    blk->node = node;
+
+    nodes_found = max(nodes_found, node + 1);
+    return 0;
+}
+
+void numa_set_distance(int from, int to, int distance)
+{
+    if (from < 0 || from >= MAX_NUMNODES || to < 0 || to >= MAX_NUMNODES)
+        return;
+
+    if (distance < LOCAL_DISTANCE || distance > 0xFF) {
+        klog(KLOG_WARNING,
+             NUMA "ignoring invalid distance %d from node %d to %d",
+             distance,
+             from,
+             to);
+        return;
+    }
+
+    distances[from][to] = distance;
+}
+
+void numa_set_cpu_node(int cpu, int node)
+{
+    if (cpu < 0 || cpu >= MAX_CPUS)
+        return;
+
+    if (node < 0 || node >= MAX_NUMNODES)
+        node = 0;
+
+    cpu_node[cpu] = node;
+    nodes_found = max(nodes_found, node + 1);
+}
+
+int numa_node_count(void) { return nr_nodes; }
+
+int cpu_to_node(int cpu) { return nr_nodes > 1 ? cpu_node[cpu] : 0; }
+
+int numa_node_id(void) { return cpu_to_node(processor_id()); }
+
+int pfn_to_node(size_t pfn)
+{
+    int i;
+
+    if (nr_nodes == 1)
+        return 0;
+
+    for (i = 0; i < nr_memblks; ++i) {
+        if (pfn >= memblks[i].start_pfn && pfn < memblks[i].end_pfn)
+            return memblks[i].node;
+    }
+
+    // Memory not described by firmware is treated as part of node 0.
+    return 0;
+}
+
+int node_distance(int from, int to)
+{
+    if (distances[from][to])
+        return distances[from][to];
+
+    return from == to ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+}
+
+int numa_fallback_node(int node, int i)
+{
+    if (i >= nr_nodes)
+        return NUMA_NO_NODE;
+    if (node < 0 || node >= nr_nodes)
+        node = 0;
+
+    return node_order[node][i];
+}
+
+// Orders all nodes by their distance from `node`, with `node` itself first.
+static void build_node_order(int node)
+{
+    int8_t *order = node_order[node];
+    int i, j, n, count;
+
+    order[0] = node;
+    count = 1;
+
+    for (n = 0; n < nodes_found; ++n) {
+        if (n == node)
+            continue;
+
+        // Insertion sort. Nodes at equal distances stay in ID order.
+        for (i = count; i > 1; --i) {
+            if (node_distance(node, order[i - 1]) <= node_distance(node, n))
+                break;
+        }
+        for (j = count; j > i; --j)
+            order[j] = order[j - 1];
+        order[i] = n;
+        ++count;
+    }
+}
+
+void numa_init(void)
+{
+    int node, i;
+
+    if (nodes_found < 2 || !nr_memblks) {
+        klog(KLOG_INFO, NUMA "no NUMA topology found");
+        return;
+    }
+
+    for (node = 0; node < nodes_found; ++node) {
+        build_node_order(node);
+
+        for (i = 0; i < nodes_found; ++i) {
+            klog(KLOG_INFO,
+                 NUMA "distance node %d to %d: %d",
+                 node,
+                 i,
+                 node_distance(node, i));
+        }
+    }
+
+    nr_nodes = nodes_found;
+    klog(KLOG_INFO, NUMA "%d nodes online", nr_nodes);
+
+    buddy_numa_init();
+}
@@ -16,10 +16,17 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <radix/assert.h>
 #include <radix/bits.h>
+#include <radix/cpumask.h>
+#include <radix/atomic.h>
+#include <radix/irqstate.h>
 #include <radix/kernel.h>
 #include <radix/klog.h>
+#include <radix/kthread.h>
 #include <radix/mm.h>
+#include <radix/numa.h>
+#include <radix/smp.h>
 #include <radix/vmm.h>
 
 #include <string.h>
@@ -33,13 +40,54 @@ addr_t page_map_end = PAGE_MAP_BASE;
 static struct buddy zone_low = BUDDY_INIT;
 /* Physical memory under 16 MiB. */
 static struct buddy zone_dma = BUDDY_INIT;
-/* Memory for kernel use. */
-static struct buddy zone_reg = BUDDY_INIT;
-/* The rest of memory. */
-static struct buddy zone_usr = BUDDY_INIT;
+/* Memory for kernel use, split by NUMA node. */
+static struct buddy zone_reg[MAX_NUMNODES] = {
+    [0 ... MAX_NUMNODES - 1] = BUDDY_INIT
+};
+/* The rest of memory, split by NUMA node. */
+static struct buddy zone_usr[MAX_NUMNODES] = {
+    [0 ... MAX_NUMNODES - 1] = BUDDY_INIT
+};
 
 #define __PA_UNMAPPABLE (1 << 31)
 
+/*
+ * Pools of single pages which have already been zeroed, refilled by idle
+ * CPUs so that __PA_ZERO allocations don't have to clear memory inline.
+ * Pooled pages are allocated as far as their buddy zone is concerned.
+ */
+struct zero_pool {
+    struct list pages;
+    size_t len;
+    spinlock_t lock;
+};
+
+/* one pool per kernel and user zone, initialized by buddy_init */
+static struct zero_pool zero_pool_reg[MAX_NUMNODES];
+static struct zero_pool zero_pool_usr[MAX_NUMNODES];
+
+/* number of pages each pool is refilled to */
+#define ZERO_POOL_TARGET 256
+/* free pages below which a zone's pool is no longer refilled */
+#define ZERO_POOL_RESERVE (4 * ZERO_POOL_TARGET)
+
+/*
+ * One virtual page per CPU through which unmapped pages are zeroed.
+ * Set up by zero_pool_init.
+ */
+static addr_t zero_scratch = 0;
+
+/*
+ * Thread which migrates movable user pages to recover high-order
+ * blocks in the user zone, and the highest order of an allocation
+ * which has failed due to fragmentation since it last ran.
+ */
+static struct task *compact_thread = NULL;
+static size_t compact_order = 0;
+
+/* maximum number of regions the compaction thread attempts per run */
+#define COMPACT_MAX_TRIES 16
+
 /* total amount of usable memory in the system */
 static uint64_t memsize = 0;
 static uint64_t memused = 0;
@@ -55,12 +103,22 @@ static void buddy_populate(void);
 
 uint64_t totalmem(void) { return memsize; }
 
-uint64_t usedmem(void) { return memused; }
+uint64_t usedmem(void)
+{
+    size_t pooled = 0;
+    int node;
+
+    for (node = 0; node < MAX_NUMNODES; ++node)
+        pooled += zero_pool_reg[node].len + zero_pool_usr[node].len;
+
+    return memused - (uint64_t)pooled * PAGE_SIZE;
+}
 
 void buddy_init(struct multiboot_info *mbt)
 {
     uint64_t base, len, next;
     size_t i;
+    int node;
 
     /* mmap_addr stores the physical address of the memory map */
     mbt->mmap_addr = phys_to_virt(mbt->mmap_addr);
@@ -103,8 +161,17 @@ void buddy_init(struct multiboot_info *mbt)
     for (i = 0; i < PA_ORDERS; ++i) {
         list_init(&zone_low.ord[i]);
         list_init(&zone_dma.ord[i]);
-        list_init(&zone_reg.ord[i]);
-        list_init(&zone_usr.ord[i]);
+        for (node = 0; node < MAX_NUMNODES; ++node) {
+            list_init(&zone_reg[node].ord[i]);
+            list_init(&zone_usr[node].ord[i]);
+        }
+    }
+
+    for (node = 0; node < MAX_NUMNODES; ++node) {
+        list_init(&zero_pool_reg[node].pages);
+        spin_init(&zero_pool_reg[node].lock);
+        list_init(&zero_pool_usr[node].pages);
+        spin_init(&zero_pool_usr[node].lock);
     }
 
     buddy_populate();
@@ -115,6 +182,91 @@ static struct page *__alloc_pages(struct buddy *zone,
                                   size_t ord);
 static void buddy_split(struct buddy *zone, size_t req_ord);
 static struct page *buddy_coalesce(struct buddy *zone, struct page *p);
+static struct zero_pool *zone_zero_pool(struct buddy *zone,
+                                        unsigned int flags);
+static struct page *zero_pool_get(struct zero_pool *pool);
+static void zero_pages(struct page *p, size_t ord);
+static void compact_request(struct buddy *zone, size_t ord);
+
+static bool zone_is_reg(const struct buddy *zone)
+{
+    return zone >= zone_reg && zone < zone_reg + MAX_NUMNODES;
+}
+
+static bool zone_is_usr(const struct buddy *zone)
+{
+    return zone >= zone_usr && zone < zone_usr + MAX_NUMNODES;
+}
+
+/* zone_node: return the NUMA node of a kernel or user zone */
+static int zone_node(const struct buddy *zone)
+{
+    return zone_is_usr(zone) ? zone - zone_usr : zone - zone_reg;
+}
+
+/*
+ * page_node:
+ * Return the NUMA node of the zone to which `p` belongs. This is the
+ * node of the block created by zone_init that contains it, as blocks
+ * never coalesce beyond it.
+ */
+static int page_node(struct page *p)
+{
+    return pfn_to_node(page_to_pfn(p) - PM_PAGE_BLOCK_OFFSET(p));
+}
+
+/*
+ * zone_for_flags:
+ * Return the zone from which `flags` allocate on `node`.
+ * The DMA and low memory zones are shared by all nodes.
+ */
+static struct buddy *zone_for_flags(unsigned int flags, int node)
+{
+    if (flags & __PA_ZONE_DMA)
+        return &zone_dma;
+    if (flags & __PA_ZONE_USR)
+        return &zone_usr[node];
+    if (flags & __PA_ZONE_LOW)
+        return &zone_low;
+
+    return &zone_reg[node];
+}
+
+/*
+ * zone_alloc:
+ * Allocate 2^{ord} pages from `zone`, using its pool of zeroed
+ * pages for single pages if possible.
+ */
+static struct page *zone_alloc(struct buddy *zone,
+                               unsigned int flags,
+                               size_t ord)
+{
+    struct zero_pool *pool;
+    struct page *ret, *pooled;
+
+    pool = ord == 0 ? zone_zero_pool(zone, flags) : NULL;
+    if (pool && (flags & __PA_ZERO) && (ret = zero_pool_get(pool)))
+        return ret;
+
+    spin_lock(&zone->lock);
+
+    if (ord > zone->max_ord || zone->alloc_pages == zone->total_pages)
+        ret = ERR_PTR(ENOMEM);
+    else
+        ret = __alloc_pages(zone, flags, ord);
+
+    spin_unlock(&zone->lock);
+
+    if (IS_ERR(ret)) {
+        /* pooled pages are the last free memory in the zone */
+        if (pool && (pooled = zero_pool_get(pool)))
+            ret = pooled;
+    } else if (flags & __PA_ZERO) {
+        zero_pages(ret, ord);
+    }
+
+    return ret;
+}
 
 /*
  * alloc_pages:
@@ -122,37 +274,45 @@ static struct page *buddy_coalesce(struct buddy *zone, struct page *p);
  * Behaviour of the allocator is managed by flags.
  */
 struct page *alloc_pages(unsigned int flags, size_t ord)
+{
+    return alloc_pages_node(numa_node_id(), flags, ord);
+}
+
+/*
+ * alloc_pages_node:
+ * Allocate a contiguous block of pages, preferably on NUMA node `node`.
+ * If its zone is full, the zones of other nodes are tried in order of
+ * their distance from it.
+ */
+struct page *alloc_pages_node(int node, unsigned int flags, size_t ord)
 {
     struct buddy *zone;
     struct page *ret;
+    int i, n;
 
     if (ord > PA_MAX_ORDER)
         return ERR_PTR(EINVAL);
 
-    if (flags & __PA_ZONE_DMA) {
-        zone = &zone_dma;
-        flags |= __PA_UNMAPPABLE;
-    } else if (flags & __PA_ZONE_USR) {
-        zone = &zone_usr;
+    node = numa_fallback_node(node, 0);
+    zone = zone_for_flags(flags, node);
+    if (zone == &zone_dma || zone_is_usr(zone))
         flags |= __PA_UNMAPPABLE;
-    } else if (flags & __PA_ZONE_LOW) {
-        zone = &zone_low;
-    } else {
-        zone = &zone_reg;
-    }
 
     if ((flags & __PA_UNMAPPABLE) && !(flags & __PA_NO_MAP))
         return ERR_PTR(EINVAL);
 
-    spin_lock(&zone->lock);
+    if (!zone_is_reg(zone) && !zone_is_usr(zone))
+        return zone_alloc(zone, flags, ord);
 
-    /* TODO: if zone is full, allocate from another */
-    if (ord > zone->max_ord || zone->alloc_pages == zone->total_pages)
-        ret = ERR_PTR(ENOMEM);
-    else
-        ret = __alloc_pages(zone, flags, ord);
+    ret = ERR_PTR(ENOMEM);
+    for (i = 0; (n = numa_fallback_node(node, i)) != NUMA_NO_NODE; ++i) {
+        ret = zone_alloc(zone_for_flags(flags, n), flags, ord);
+        if (!IS_ERR(ret))
+            return ret;
+    }
 
-    spin_unlock(&zone->lock);
+    if (ord)
+        compact_request(zone, ord);
 
     return ret;
 }
@@ -179,14 +339,14 @@ void free_pages(struct page *p)
     } else if (page_to_phys(p) < MIB(16)) {
         zone = &zone_dma;
     } else if (p->status & PM_PAGE_ZONE_USR) {
-        zone = &zone_usr;
+        zone = &zone_usr[page_node(p)];
         if (p->status & PM_PAGE_MAPPED) {
-            unmap_pages((addr_t)p->mem, ord);
+            unmap_pages((addr_t)p->mem, pow2(ord));
             p->mem = (void *)PAGE_UNINIT_MAGIC;
             p->status &= ~PM_PAGE_MAPPED;
         }
     } else {
-        zone = &zone_reg;
+        zone = &zone_reg[page_node(p)];
     }
 
     spin_lock(&zone->lock);
@@ -232,7 +392,7 @@ static struct page *__alloc_pages(struct buddy *zone,
     memused += npages * PAGE_SIZE;
 
     if (!(flags & __PA_NO_MAP) && !(p->status & PM_PAGE_MAPPED)) {
-        if (zone == &zone_reg)
+        if (zone_is_reg(zone))
             virt = phys_to_virt(page_to_phys(p));
         else
             virt = (addr_t)vmalloc(npages * PAGE_SIZE);
@@ -240,9 +400,6 @@ static struct page *__alloc_pages(struct buddy *zone,
         prot = flags & __PA_READONLY ? PROT_READ : PROT_WRITE;
         map_pages_kernel(virt, page_to_phys(p), npages, prot, PAGE_CP_DEFAULT);
 
-        if (flags & __PA_ZERO)
-            memset((void *)virt, 0, npages * PAGE_SIZE);
-
         p->mem = (void *)virt;
         p->status |= PM_PAGE_MAPPED;
     }
@@ -324,6 +481,468 @@ static struct page *buddy_coalesce(struct buddy *zone, struct page *p)
     return p;
 }
 
+/*
+ * zone_zero_pool:
+ * Return the pool of zeroed pages which can satisfy an allocation
+ * with `flags` from `zone`, if any.
+ */
+static struct zero_pool *zone_zero_pool(struct buddy *zone,
+                                        unsigned int flags)
+{
+    /* pooled kernel zone pages are mapped writable */
+    if (zone_is_reg(zone) && !(flags & __PA_READONLY))
+        return &zero_pool_reg[zone_node(zone)];
+    if (zone_is_usr(zone))
+        return &zero_pool_usr[zone_node(zone)];
+
+    return NULL;
+}
+
+static struct page *zero_pool_get(struct zero_pool *pool)
+{
+    struct page *p = NULL;
+
+    spin_lock(&pool->lock);
+    if (pool->len) {
+        p = list_first_entry(&pool->pages, struct page, list);
+        list_del(&p->list);
+        pool->len--;
+    }
+    spin_unlock(&pool->lock);
+
+    return p;
+}
+
+static void zero_pool_put(struct zero_pool *pool, struct page *p)
+{
+    spin_lock(&pool->lock);
+    list_add(&pool->pages, &p->list);
+    pool->len++;
+    spin_unlock(&pool->lock);
+}
+
+/*
+ * zero_pages:
+ * Clear the block of 2^{ord} pages starting at `p`.
+ * Unmapped pages are cleared one at a time through this CPU's scratch page.
+ * It is mapped write-combining so that no cache lines for the page are left
+ * behind for its users, who may map it uncached (e.g. page tables). The
+ * invlpg on unmap drains the write-combining buffers.
+ */
+static void zero_pages(struct page *p, size_t ord)
+{
+    unsigned long irqstate;
+    addr_t virt;
+    size_t i;
+
+    if (p->status & PM_PAGE_MAPPED) {
+        memset(p->mem, 0, pow2(ord) * PAGE_SIZE);
+        return;
+    }
+
+    assert(zero_scratch != 0);
+
+    for (i = 0; i < pow2(ord); ++i) {
+        irq_save(irqstate);
+        virt = zero_scratch + processor_id() * PAGE_SIZE;
+        map_page_kernel(virt, page_to_phys(p + i), PROT_WRITE,
+                        PAGE_CP_WRITE_COMBINING);
+        memset((void *)virt, 0, PAGE_SIZE);
+        unmap_pages(virt, 1);
+        irq_restore(irqstate);
+    }
+}
+
+/* zero_pool_init: set up the scratch pages used to zero unmapped pages */
+void zero_pool_init(void)
+{
+    addr_t virt;
+    int cpu;
+
+    virt = (addr_t)vmalloc(MAX_CPUS * PAGE_SIZE);
+    if (!virt)
+        panic("failed to allocate zero pool scratch pages");
+
+    /*
+     * Map and unmap each scratch page once to make sure its page table
+     * exists, as zero_pages cannot allocate one.
+     */
+    for (cpu = 0; cpu < MAX_CPUS; ++cpu) {
+        map_page_kernel(virt + cpu * PAGE_SIZE, 0, PROT_WRITE,
+                        PAGE_CP_DEFAULT);
+        unmap_pages(virt + cpu * PAGE_SIZE, 1);
+    }
+
+    zero_scratch = virt;
+}
+
+/*
+ * zero_pool_refill:
+ * Zero a single page and add it to a pool which is below its target size.
+ * Called by idle tasks, which refill the pools of their own NUMA node.
+ * Returns true if a page was added.
+ */
+bool zero_pool_refill(void)
+{
+    struct buddy *reg, *usr, *zone;
+    struct zero_pool *pool;
+    struct page *p;
+    unsigned int flags;
+    int node;
+
+    if (!zero_scratch)
+        return false;
+
+    node = numa_node_id();
+    reg = &zone_reg[node];
+    usr = &zone_usr[node];
+
+    if (zero_pool_reg[node].len < ZERO_POOL_TARGET &&
+        reg->total_pages - reg->alloc_pages > ZERO_POOL_RESERVE) {
+        zone = reg;
+        pool = &zero_pool_reg[node];
+        flags = PA_STANDARD;
+    } else if (zero_pool_usr[node].len < ZERO_POOL_TARGET &&
+               usr->total_pages - usr->alloc_pages > ZERO_POOL_RESERVE) {
+        zone = usr;
+        pool = &zero_pool_usr[node];
+        flags = PA_USER;
+    } else {
+        return false;
+    }
+
+    p = zone_alloc(zone, flags, 0);
+    if (IS_ERR(p))
+        return false;
+
+    /* memset clears whole pages with non-temporal stores where supported */
+    zero_pages(p, 0);
+    zero_pool_put(pool, p);
+
+    return true;
+}
+
+/*
+ * buddy_frag_stats:
+ * Compute fragmentation statistics for `zone`.
+ * Called with the zone's lock held.
+ */
+static void buddy_frag_stats(struct buddy *zone,
+                             struct zone_frag_stats *stats)
+{
+    size_t ord, blocks, suitable;
+
+    stats->total_pages = zone->total_pages;
+    stats->free_pages = 0;
+    blocks = 0;
+    for (ord = 0; ord < PA_ORDERS; ++ord) {
+        stats->free_blocks[ord] = zone->len[ord];
+        stats->free_pages += pow2(ord) * zone->len[ord];
+        blocks += zone->len[ord];
+    }
+
+    suitable = stats->free_pages;
+    for (ord = 0; ord < PA_ORDERS; ++ord) {
+        /*
+         * Unusable free space index: the share of free memory
+         * in blocks smaller than the order.
+         */
+        if (stats->free_pages)
+            stats->unusable[ord] = (uint64_t)(stats->free_pages - suitable)
+                                   * 1000 / stats->free_pages;
+        else
+            stats->unusable[ord] = 0;
+
+        /*
+         * Fragmentation index of a failed allocation: tends to 0
+         * when there is too little free memory and to 1000 when
+         * the free memory is split into too many small blocks.
+         */
+        if (suitable)
+            stats->frag_index[ord] = -1;
+        else if (!blocks)
+            stats->frag_index[ord] = 0;
+        else
+            stats->frag_index[ord] = 1000 - (1000 + (uint64_t)1000 *
+                                     stats->free_pages / pow2(ord)) / blocks;
+
+        suitable -= pow2(ord) * zone->len[ord];
+    }
+}
+
+/*
+ * zone_fragmentation:
+ * Report fragmentation of the zone on `node` used by `flags`.
+ */
+void zone_fragmentation(unsigned int flags,
+                        int node,
+                        struct zone_frag_stats *stats)
+{
+    struct buddy *zone = zone_for_flags(flags, numa_fallback_node(node, 0));
+
+    spin_lock(&zone->lock);
+    buddy_frag_stats(zone, stats);
+    spin_unlock(&zone->lock);
+}
+
+/*
+ * page_movable:
+ * Check if `p` is a single user page which can be migrated.
+ * As this is checked without the vmm locks held, vmm_migrate_page
+ * may still fail for it.
+ */
+static bool page_movable(struct page *p)
+{
+    return (p->status & PM_PAGE_ALLOCATED) &&
+           !(p->status & PM_PAGE_MAPPED) &&
+           PM_PAGE_BLOCK_ORDER(p) == 0 &&
+           PM_PAGE_REFCOUNT(p) == 1 &&
+           p->vmm_block != (void *)PAGE_UNINIT_MAGIC;
+}
+
+/*
+ * compact_region_cost:
+ * Return the number of pages which have to be migrated for the
+ * 2^{ord} pages starting at `p` to coalesce into a single block,
+ * or 0 if they cannot be.
+ */
+static size_t compact_region_cost(struct page *p, size_t ord)
+{
+    size_t i, cost, blk;
+
+    cost = 0;
+    for (i = 0; i < pow2(ord); i += pow2(blk)) {
+        blk = PM_PAGE_BLOCK_ORDER(p + i);
+        if ((p[i].status & PM_PAGE_INVALID) ||
+            !(p[i].status & PM_PAGE_ZONE_USR))
+            return 0;
+
+        if (p[i].status & PM_PAGE_ALLOCATED) {
+            if (!page_movable(p + i))
+                return 0;
+            ++cost;
+        } else if (blk == PM_PAGE_ORDER_INNER || blk >= ord) {
+            /* inside a larger block, which is either allocated or free */
+            return 0;
+        }
+    }
+
+    return cost;
+}
+
+/*
+ * compact_find_region:
+ * Find the region of 2^{ord} pages in user zone `zone`, starting at
+ * or after `from`, which can be coalesced by migrating the fewest
+ * pages. Return its first PFN, or 0 if there are none.
+ */
+static size_t compact_find_region(struct buddy *zone, size_t from, size_t ord)
+{
+    struct page *p;
+    size_t pfn, end, best, best_cost, cost;
+    int node;
+
+    end = phys_mem_end / PAGE_SIZE;
+    node = zone_node(zone);
+    best = 0;
+    best_cost = pow2(ord);
+
+    spin_lock(&zone->lock);
+    for (pfn = from; pfn + pow2(ord) <= end; ) {
+        p = page_map + pfn;
+
+        /* regions must be able to form a buddy block */
+        if (PM_PAGE_MAX_ORDER(p) < ord ||
+            !ALIGNED(PM_PAGE_BLOCK_OFFSET(p), pow2(ord))) {
+            ++pfn;
+            continue;
+        }
+
+        cost = page_node(p) == node ? compact_region_cost(p, ord) : 0;
+        if (cost && cost < best_cost) {
+            best = pfn;
+            best_cost = cost;
+        }
+        pfn += pow2(ord);
+    }
+    spin_unlock(&zone->lock);
+
+    return best;
+}
+
+/*
+ * compact_region:
+ * Migrate every allocated page in the region of 2^{ord} pages
+ * starting at `pfn` out of it, so that it coalesces when freed.
+ * Pages are moved elsewhere within `zone`, keeping them on its node.
+ */
+static int compact_region(struct buddy *zone, size_t pfn, size_t ord)
+{
+    struct list held;
+    struct page *p, *new;
+    size_t i;
+    int err;
+
+    list_init(&held);
+    err = 0;
+
+    for (i = 0; i < pow2(ord) && !err; ++i) {
+        p = page_map + pfn + i;
+        if (!(p->status & PM_PAGE_ALLOCATED))
+            continue;
+
+        /*
+         * Free pages within the region itself are held until
+         * the end, so that the new page is allocated outside it.
+         */
+        while (1) {
+            new = zone_alloc(zone, PA_USER, 0);
+            if (IS_ERR(new)) {
+                err = ERR_VAL(new);
+                break;
+            }
+            if (page_to_pfn(new) < pfn ||
+                page_to_pfn(new) >= pfn + pow2(ord))
+                break;
+            list_add(&held, &new->list);
+        }
+        if (err)
+            break;
+
+        if ((err = vmm_migrate_page(p, new)))
+            free_pages(new);
+    }
+
+    while (!list_empty(&held)) {
+        new = list_first_entry(&held, struct page, list);
+        list_del(&new->list);
+        free_pages(new);
+    }
+
+    return err;
+}
+
+static void klog_frag(const char *prefix,
+                      int node,
+                      const struct zone_frag_stats *stats,
+                      size_t ord)
+{
+    klog(KLOG_INFO,
+         "compact: node %d %s: %lu/%lu pages free, order %lu "
+         "unusable %d.%d%%, fragmentation index %d",
+         node,
+         prefix,
+         (unsigned long)stats->free_pages,
+         (unsigned long)stats->total_pages,
+         (unsigned long)ord,
+         stats->unusable[ord] / 10,
+         stats->unusable[ord] % 10,
+         stats->frag_index[ord]);
+}
+
+/*
+ * compact_zone:
+ * Migrate user pages until a free block of order `ord` exists
+ * in user zone `zone`, or no more regions can be compacted.
+ */
+static void compact_zone(struct buddy *zone, size_t ord)
+{
+    struct zone_frag_stats stats;
+    size_t from, pfn;
+    int node, tries, regions;
+
+    node = zone_node(zone);
+    zone_fragmentation(PA_USER, node, &stats);
+    klog_frag("before", node, &stats, ord);
+
+    from = zone_reg_end / PAGE_SIZE;
+    regions = 0;
+    for (tries = 0; tries < COMPACT_MAX_TRIES; ++tries) {
+        if (atomic_read(&zone->max_ord) >= ord)
+            break;
+        if (!(pfn = compact_find_region(zone, from, ord)))
+            break;
+
+        /* skip past regions which can't currently be compacted */
+        if (compact_region(zone, pfn, ord) == 0)
+            ++regions;
+        else
+            from = pfn + pow2(ord);
+    }
+
+    zone_fragmentation(PA_USER, node, &stats);
+    klog_frag("after", node, &stats, ord);
+    klog(KLOG_INFO,
+         "compact: node %d: %d order %lu regions compacted",
+         node,
+         regions,
+         (unsigned long)ord);
+}
+
+/*
+ * compact_usr:
+ * Compact each node's user zone which has no free block of order
+ * `ord`, but enough free memory for one.
+ */
+static void compact_usr(size_t ord)
+{
+    struct buddy *zone;
+    int node;
+
+    for (node = 0; node < numa_node_count(); ++node) {
+        zone = &zone_usr[node];
+        if (atomic_read(&zone->max_ord) >= ord ||
+            zone->total_pages - zone->alloc_pages < pow2(ord))
+            continue;
+
+        compact_zone(zone, ord);
+    }
+}
+
+static void compact_thread_func(__unused void *arg)
+{
+    size_t ord;
+
+    while (1) {
+        kthread_wait();
+        if ((ord = atomic_swap(&compact_order, 0)))
+            compact_usr(ord);
+    }
+}
+
+/*
+ * compact_request:
+ * Called when an allocation of order `ord` from `zone` fails.
+ * Wake the compaction thread if there is enough free memory
+ * in the user zone for the allocation to succeed once compacted.
+ */
+static void compact_request(struct buddy *zone, size_t ord)
+{
+    if (!zone_is_usr(zone) || !compact_thread)
+        return;
+    if (zone->total_pages - zone->alloc_pages < pow2(ord))
+        return;
+
+    if (ord > atomic_read(&compact_order))
+        atomic_write(&compact_order, ord);
+    kthread_wake(compact_thread);
+}
+
+/* compaction_init: start the user zone compaction thread */
+void compaction_init(void)
+{
+    struct task *thread;
+
+    thread = kthread_create(compact_thread_func, NULL, 0, "kcompactd");
+    if (IS_ERR(thread)) {
+        klog(KLOG_ERROR, "compact: failed to create thread");
+        return;
+    }
+
+    compact_thread = thread;
+    kthread_start(thread);
+}
+
 static struct memory_map *mmap = NULL;
 
 #define NEXT_MAP(mmap) \
@@ -512,8 +1131,10 @@ static void buddy_populate(void)
     pfn = zone_init(pfn, M_TO_PAGES(16), &zone_dma, 0);
     /* mark the pages in the page_map as reserved */
     pfn = zone_init(pfn, pfn + npages, NULL, kflags);
-    pfn = zone_init(pfn, zone_reg_end / PAGE_SIZE, &zone_reg, 0);
-    pfn = zone_init(pfn, phys_mem_end / PAGE_SIZE, &zone_usr, PM_PAGE_ZONE_USR);
+    /* until NUMA nodes are known, all memory is on node 0 */
+    pfn = zone_init(pfn, zone_reg_end / PAGE_SIZE, &zone_reg[0], 0);
+    pfn = zone_init(pfn, phys_mem_end / PAGE_SIZE, &zone_usr[0],
+                    PM_PAGE_ZONE_USR);
 }
 
 /*
@@ -601,3 +1222,159 @@ static size_t zone_init(size_t pfn,
 
     return pfn;
 }
+
+/*
+ * numa_node_end:
+ * Return the first PFN after `pfn` and before `end`
+ * which belongs to a different NUMA node, or `end`.
+ */
+static size_t numa_node_end(size_t pfn, size_t end)
+{
+    int node = pfn_to_node(pfn);
+
+    while (++pfn < end && pfn_to_node(pfn) == node)
+        ;
+
+    return pfn;
+}
+
+/*
+ * numa_move_block:
+ * Add the block of 2^{ord} pages at `pfn` created by zone_init,
+ * and all blocks it has been split into, to `zone`.
+ */
+static void numa_move_block(size_t pfn, size_t ord, struct buddy *zone)
+{
+    struct page *p;
+    size_t end, blk;
+
+    zone->total_pages += pow2(ord);
+
+    for (end = pfn + pow2(ord); pfn < end; pfn += pow2(blk)) {
+        p = page_map + pfn;
+        blk = PM_PAGE_BLOCK_ORDER(p);
+
+        if (p->status & PM_PAGE_ALLOCATED) {
+            zone->alloc_pages += pow2(blk);
+        } else {
+            list_add(&zone->ord[blk], &p->list);
+            zone->len[blk]++;
+            zone->max_ord = max(zone->max_ord, blk);
+        }
+    }
+}
+
+/*
+ * buddy_numa_init:
+ * Distribute the kernel and user zones' blocks between NUMA nodes.
+ * Free blocks spanning nodes are split at the boundaries so that they
+ * can never coalesce across them. Runs on the BSP during boot, before
+ * any other CPU or the zero pools are active.
+ */
+void buddy_numa_init(void)
+{
+    struct buddy *zones[] = { &zone_reg[0], &zone_usr[0] };
+    static const char *zone_names[] = { "kernel", "user" };
+    size_t total[ARRAY_SIZE(zones)], alloc[ARRAY_SIZE(zones)];
+    size_t node_total, node_alloc;
+    struct buddy *zone;
+    struct page *p;
+    size_t i, pfn, end, lim, ord, mem_end;
+    unsigned int zflags, type;
+    int node, spanning, split;
+
+    /*
+     * Until now, all memory has been on node 0.
+     * Empty its zones and redistribute every block.
+     */
+    for (i = 0; i < ARRAY_SIZE(zones); ++i) {
+        zone = zones[i];
+        total[i] = zone->total_pages;
+        alloc[i] = zone->alloc_pages;
+        for (ord = 0; ord < PA_ORDERS; ++ord) {
+            list_init(&zone->ord[ord]);
+            zone->len[ord] = 0;
+        }
+        zone->max_ord = 0;
+        zone->total_pages = 0;
+        zone->alloc_pages = 0;
+    }
+
+    mem_end = phys_mem_end / PAGE_SIZE;
+    spanning = 0;
+    split = 0;
+
+    for (pfn = M_TO_PAGES(16); pfn < mem_end; pfn = end) {
+        p = page_map + pfn;
+        ord = PM_PAGE_MAX_ORDER(p);
+        end = pfn + pow2(ord);
+
+        /* the page map and holes in memory are not in any zone */
+        if (p->status & (PM_PAGE_INVALID | PM_PAGE_RESERVED))
+            continue;
+
+        zflags = p->status & PM_PAGE_ZONE_USR;
+        type = zflags ? __PA_ZONE_USR : __PA_ZONE_REG;
+        node = pfn_to_node(pfn);
+        lim = numa_node_end(pfn, end);
+
+        if (lim == end) {
+            numa_move_block(pfn, ord, zone_for_flags(type, node));
+            continue;
+        }
+
+        /*
+         * Blocks have already been allocated from this one, so it
+         * can't be split. It stays whole on the node of its first page.
+         */
+        if (PM_PAGE_BLOCK_ORDER(p) != ord ||
+            (p->status & PM_PAGE_ALLOCATED)) {
+            numa_move_block(pfn, ord, zone_for_flags(type, node));
+            ++spanning;
+            continue;
+        }
+
+        for (i = pfn; i < end; i = lim) {
+            lim = numa_node_end(i, end);
+            zone_init(i, lim, zone_for_flags(type, pfn_to_node(i)), zflags);
+        }
+        ++split;
+    }
+
+    for (node = 0; node < numa_node_count(); ++node) {
+        klog(KLOG_INFO,
+             "numa: node %d: %lu kernel pages, %lu user pages",
+             node,
+             (unsigned long)zone_reg[node].total_pages,
+             (unsigned long)zone_usr[node].total_pages);
+    }
+    if (split)
+        klog(KLOG_INFO, "numa: split %d free blocks between nodes", split);
+    if (spanning) {
+        klog(KLOG_WARNING,
+             "numa: %d allocated blocks span multiple nodes",
+             spanning);
+    }
+
+    /* no page may be gained or lost by redistributing the blocks */
+    for (i = 0; i < ARRAY_SIZE(zones); ++i) {
+        node_total = 0;
+        node_alloc = 0;
+        for (node = 0; node < numa_node_count(); ++node) {
+            zone = zones[i] + node;
+            node_total += zone->total_pages;
+            node_alloc += zone->alloc_pages;
+        }
+
+        if (node_total != total[i] || node_alloc != alloc[i]) {
+            klog(KLOG_ERROR,
+                 "numa: %s zones hold %lu pages (%lu allocated), "
+                 "expected %lu (%lu allocated)",
+                 zone_names[i],
+                 (unsigned long)node_total,
+                 (unsigned long)node_alloc,
+                 (unsigned long)total[i],
+                 (unsigned long)alloc[i]);
+        }
+    }
+}
@@ -18,6 +18,7 @@
 
 #include "slab.h"
 
+#include <radix/atomic.h>
 #include <radix/bits.h>
 #include <radix/bootmsg.h>
 #include <radix/compiler.h>
@@ -26,11 +27,15 @@
 #include <radix/klog.h>
 #include <radix/mm.h>
 #include <radix/slab.h>
+#include <radix/time.h>
+#include <radix/vmm.h>
+#include <radix/workqueue.h>
 
 #include <stdio.h>
 #include <string.h>
 
 struct list slab_caches;
+static spinlock_t slab_caches_lock = SPINLOCK_INIT;
 
 /* The cache cache caches caches. */
 static struct slab_cache cache_cache;
@@ -101,7 +106,10 @@ struct slab_cache *create_cache(const char *name,
     }
 
     __init_cache(cache, name, size, align, flags, ctor);
+
+    spin_lock(&slab_caches_lock);
     list_ins(&slab_caches, &cache->list);
+    spin_unlock(&slab_caches_lock);
 
     return cache;
 }
@@ -127,30 +135,32 @@ void destroy_cache(struct slab_cache *cache)
         list_del(l);
     }
 
+    spin_lock(&slab_caches_lock);
     list_del(&cache->list);
+    spin_unlock(&slab_caches_lock);
+
     free_cache(&cache_cache, cache);
 }
 
 #define FREE_OBJ_ARR(s) ((uint16_t *)(s + 1))
 
 /*
- * alloc_cache:
- * Allocates a single object from the given cache.
+ * __alloc_cache:
+ * Allocate a single object from the given cache for
+ * a request of `req` bytes.
  */
-void *alloc_cache(struct slab_cache *cache)
+static void *__alloc_cache(struct slab_cache *cache, size_t req)
 {
     struct slab_desc *s;
     void *obj;
     int err;
 
-    if (unlikely(!cache))
-        return ERR_PTR(EINVAL);
-
     spin_lock(&cache->lock);
     if (list_empty(&cache->partial_slabs)) {
         /* grow the cache if no space exists */
         if (list_empty(&cache->free_slabs)) {
             if ((err = __grow_cache_unlocked(cache))) {
+                cache->fails++;
                 obj = ERR_PTR(err);
                 goto out_unlock;
             }
@@ -173,11 +183,28 @@ void *alloc_cache(struct slab_cache *cache)
         list_add(&cache->full_slabs, &s->list);
     }
 
+    cache->allocs++;
+    cache->req_bytes += req;
+    if (++cache->active_objs > cache->peak_objs)
+        cache->peak_objs = cache->active_objs;
+
 out_unlock:
     spin_unlock(&cache->lock);
     return obj;
 }
 
+/*
+ * alloc_cache:
+ * Allocates a single object from the given cache.
+ */
+void *alloc_cache(struct slab_cache *cache)
+{
+    if (unlikely(!cache))
+        return ERR_PTR(EINVAL);
+
+    return __alloc_cache(cache, cache->objsize);
+}
+
 /*
  * free_cache:
  * Free an object from the given cache.
@@ -223,6 +250,9 @@ void free_cache(struct slab_cache *cache, void *obj)
     }
     s->in_use--;
 
+    cache->frees++;
+    cache->active_objs--;
+
     spin_unlock(&cache->lock);
 }
 
@@ -244,6 +274,7 @@ static int __grow_cache_unlocked(struct slab_cache *cache)
     cache->flags |= SLAB_IS_GROWING;
 
     list_add(&cache->free_slabs, &s->list);
+    cache->num_slabs++;
 
     return 0;
 }
@@ -363,6 +394,7 @@ static int destroy_slab(struct slab_cache *cache, struct slab_desc *s)
     }
 
     free_pages(p);
+    cache->num_slabs--;
 
     return n;
 }
@@ -430,8 +462,10 @@ static void __init_cache(struct slab_cache *cache,
     cache->objsize = size;
     cache->align = calculate_align(flags, align, size);
     cache->offset = ALIGN(size, cache->align);
-    /* since the maximum object size is 8192 (2 pages) */
-    cache->slab_ord = (size > PAGE_SIZE) ? 1 : 0;
+    /* objects larger than a page get the smallest slab which fits them */
+    cache->slab_ord = 0;
+    while (pow2(cache->slab_ord) * PAGE_SIZE < cache->offset)
+        cache->slab_ord++;
 
     cache->flags = flags;
     if (size < ON_SLAB_LIMIT)
@@ -447,21 +481,179 @@ static void __init_cache(struct slab_cache *cache,
     list_init(&cache->free_slabs);
     list_init(&cache->list);
 
+    cache->num_slabs = 0;
+    cache->active_objs = 0;
+    cache->peak_objs = 0;
+    cache->allocs = 0;
+    cache->frees = 0;
+    cache->fails = 0;
+    cache->req_bytes = 0;
+    cache->watch_objs = 0;
+    cache->watch_base = 0;
+    cache->watch_ticks = 0;
+
     strlcpy(cache->cache_name, name, NAME_LEN);
 }
 
 /*
- * There are a total of 30 caches used by the kmalloc function.
+ * cache_stats:
+ * Take a consistent snapshot of the statistics of `cache`.
+ */
+void cache_stats(struct slab_cache *cache, struct slab_stats *stats)
+{
+    spin_lock(&cache->lock);
+
+    stats->objsize = cache->objsize;
+    stats->objs_per_slab = cache->count;
+    stats->pages_per_slab = pow2(cache->slab_ord);
+    stats->num_slabs = cache->num_slabs;
+    stats->active_objs = cache->active_objs;
+    stats->total_objs = cache->num_slabs * cache->count;
+    stats->peak_objs = cache->peak_objs;
+    stats->allocs = cache->allocs;
+    stats->frees = cache->frees;
+    stats->fails = cache->fails;
+    stats->req_bytes = cache->req_bytes;
+
+    spin_unlock(&cache->lock);
+}
+
+void for_each_cache(void (*func)(struct slab_cache *, void *), void *arg)
+{
+    struct slab_cache *cache;
+
+    spin_lock(&slab_caches_lock);
+    list_for_each_entry (cache, &slab_caches, list)
+        func(cache, arg);
+    spin_unlock(&slab_caches_lock);
+}
+
+static void slab_info_print(struct slab_cache *cache, void *arg)
+{
+    struct slab_stats stats;
+    size_t *total_pages = arg;
+
+    cache_stats(cache, &stats);
+    *total_pages += stats.num_slabs * stats.pages_per_slab;
+
+    printf("%-20s %8lu %8lu %6lu %5lu %3lu %6lu %8lu %10lu %10lu %5lu\n",
+           cache->cache_name,
+           (unsigned long)stats.active_objs,
+           (unsigned long)stats.total_objs,
+           (unsigned long)stats.objsize,
+           (unsigned long)stats.objs_per_slab,
+           (unsigned long)stats.pages_per_slab,
+           (unsigned long)stats.num_slabs,
+           (unsigned long)stats.peak_objs,
+           stats.allocs,
+           stats.frees,
+           stats.fails);
+}
+
+/* slab_info_dump: print the statistics of every cache */
+void slab_info_dump(void)
+{
+    size_t total_pages = 0;
+
+    printf("slabinfo:\n");
+    printf("%-20s %8s %8s %6s %5s %3s %6s %8s %10s %10s %5s\n",
+           "name",
+           "active",
+           "objs",
+           "size",
+           "per",
+           "pgs",
+           "slabs",
+           "peak",
+           "allocs",
+           "frees",
+           "fails");
+
+    for_each_cache(slab_info_print, &total_pages);
+
+    printf("total: %lu KiB in slabs\n",
+           (unsigned long)(total_pages * PAGE_SIZE / KIB(1)));
+}
+
+/*
+ * The leak watchdog samples every cache's active object count each
+ * period. A cache which has grown on every one of the last
+ * SLAB_LEAK_TICKS samples, by at least SLAB_LEAK_MIN_BYTES in total,
+ * is reported.
+ */
+#define SLAB_WATCHDOG_PERIOD (30 * NSEC_PER_SEC)
+#define SLAB_LEAK_TICKS      10
+#define SLAB_LEAK_MIN_BYTES  KIB(256)
+
+static void slab_watchdog_work(struct work *work);
+static struct delayed_work slab_watchdog_dwork =
+    DELAYED_WORK_INIT(slab_watchdog_dwork, slab_watchdog_work);
+
+static void slab_watchdog_check(struct slab_cache *cache, __unused void *arg)
+{
+    size_t active, grown;
+    unsigned long rate;
+
+    spin_lock(&cache->lock);
+    active = cache->active_objs;
+    spin_unlock(&cache->lock);
+
+    /* the watchdog state is only accessed from the watchdog work */
+    if (active <= cache->watch_objs) {
+        cache->watch_ticks = 0;
+        cache->watch_base = active;
+    } else if (++cache->watch_ticks >= SLAB_LEAK_TICKS) {
+        grown = active - cache->watch_base;
+        if (grown * cache->objsize >= SLAB_LEAK_MIN_BYTES) {
+            rate = grown * 60 * NSEC_PER_SEC /
+                   (cache->watch_ticks * SLAB_WATCHDOG_PERIOD);
+            klog(KLOG_WARNING,
+                 "slab: cache %s grew for %u checks to %lu objects "
+                 "(+%lu/min), possible leak",
+                 cache->cache_name,
+                 cache->watch_ticks,
+                 (unsigned long)active,
+                 rate);
+        }
+        cache->watch_ticks = 0;
+        cache->watch_base = active;
+    }
+
+    cache->watch_objs = active;
+}
+
+static void slab_watchdog_work(__unused struct work *work)
+{
+    for_each_cache(slab_watchdog_check, NULL);
+    schedule_delayed_work(&slab_watchdog_dwork, SLAB_WATCHDOG_PERIOD);
+}
+
+/* slab_watchdog_init: start periodic leak checks */
+void slab_watchdog_init(void)
+{
+    schedule_delayed_work(&slab_watchdog_dwork, SLAB_WATCHDOG_PERIOD);
+}
+
+/*
+ * There are a total of 33 caches used by the kmalloc function.
  * They are split into two groups, small and large.
  * The small group consists of caches for all multiples of 8 from 8-192.
  * The large group then contains the remaining powers of 2 from 256 to
- * KMALLOC_MAX_SIZE (8192).
+ * KMALLOC_MAX_SIZE (64 KiB).
+ * Only caches up to 8 KiB are grown in advance.
  */
-static struct slab_cache *kmalloc_sm_caches[24];
-static struct slab_cache *kmalloc_lg_caches[6];
+#define KMALLOC_SM_CACHES  24
+#define KMALLOC_LG_CACHES  9
+#define KMALLOC_LG_PREGROW 6
+
+static struct slab_cache *kmalloc_sm_caches[KMALLOC_SM_CACHES];
+static struct slab_cache *kmalloc_lg_caches[KMALLOC_LG_CACHES];
 
 static int kmalloc_active = 0;
 
+/* number of kvmalloc allocations which were served by vmalloc */
+static unsigned long kvmalloc_fallbacks = 0;
+
 /*
  * kmalloc_init:
  * Initialize all caches used by kmalloc.
@@ -476,7 +668,7 @@ void kmalloc_init(void)
     if (kmalloc_active)
         return;
 
-    for (i = 1; i <= 24; ++i) {
+    for (i = 1; i <= KMALLOC_SM_CACHES; ++i) {
         sz = i * 8;
         sprintf(name, "kmalloc-%lu", sz);
         cache = create_cache(name, sz, SLAB_MIN_ALIGN, SLAB_PANIC, NULL);
@@ -488,14 +680,16 @@ void kmalloc_init(void)
         kmalloc_sm_caches[i - 1] = cache;
     }
 
-    for (i = 0; i < 6; ++i) {
+    for (i = 0; i < KMALLOC_LG_CACHES; ++i) {
         sz = 256 * pow2(i);
         sprintf(name, "kmalloc-%lu", sz);
         cache = create_cache(name, sz, SLAB_MIN_ALIGN, SLAB_PANIC, NULL);
-        if ((err = __grow_cache_unlocked(cache)))
-            goto err_grow;
-        if ((err = __grow_cache_unlocked(cache)))
-            goto err_grow;
+        if (i < KMALLOC_LG_PREGROW) {
+            if ((err = __grow_cache_unlocked(cache)))
+                goto err_grow;
+            if ((err = __grow_cache_unlocked(cache)))
+                goto err_grow;
+        }
         kmalloc_lg_caches[i] = cache;
     }
 
@@ -525,15 +719,49 @@ void *kmalloc(size_t size)
         return NULL;
 
     cache = kmalloc_get_cache(size);
-    ptr = alloc_cache(cache);
+    ptr = __alloc_cache(cache, size);
 
     return IS_ERR(ptr) ? NULL : ptr;
 }
 
+void *kvmalloc(size_t size)
+{
+    void *ptr;
+
+    if (unlikely(!size))
+        return NULL;
+
+    if (size <= KMALLOC_MAX_SIZE) {
+        ptr = kmalloc(size);
+        /*
+         * Slabs of objects larger than a page need high-order
+         * pages, which may be unavailable when memory is fragmented.
+         */
+        if (ptr || size <= PAGE_SIZE)
+            return ptr;
+    }
+
+    /* pages are allocated by the page fault handler as they are used */
+    ptr = vmalloc(size);
+    if (ptr)
+        atomic_inc(&kvmalloc_fallbacks);
+
+    return ptr;
+}
+
 void kfree(void *ptr)
 {
     struct slab_cache *cache;
 
+    if (unlikely(!ptr))
+        return;
+
+    /* slab objects are in the kernel's direct mapping */
+    if ((addr_t)ptr >= RESERVED_VIRT_BASE) {
+        vfree(ptr);
+        return;
+    }
+
     cache = virt_to_page(ptr)->slab_cache;
     if (unlikely((uintptr_t)cache == PAGE_UNINIT_MAGIC)) {
         klog(KLOG_ERROR,
@@ -544,3 +772,44 @@ void kfree(void *ptr)
 
     free_cache(cache, ptr);
 }
+
+static void kmalloc_class_print(struct slab_cache *cache)
+{
+    struct slab_stats stats;
+    unsigned long long avg, waste;
+
+    cache_stats(cache, &stats);
+    if (!stats.allocs) {
+        printf("%-14s %10lu %8s %6s\n", cache->cache_name, 0UL, "-", "-");
+        return;
+    }
+
+    /* share of allocated bytes which were not requested */
+    avg = stats.req_bytes / stats.allocs;
+    waste = 1000 - stats.req_bytes * 1000 /
+                   ((unsigned long long)stats.allocs * stats.objsize);
+
+    printf("%-14s %10lu %8llu %3llu.%llu%%\n",
+           cache->cache_name,
+           stats.allocs,
+           avg,
+           waste / 10,
+           waste % 10);
+}
+
+/* kmalloc_stats_dump: print internal fragmentation of the size classes */
+void kmalloc_stats_dump(void)
+{
+    size_t i;
+
+    printf("kmalloc size classes:\n");
+    printf("%-14s %10s %8s %6s\n", "class", "allocs", "avg req", "waste");
+
+    for (i = 0; i < KMALLOC_SM_CACHES; ++i)
+        kmalloc_class_print(kmalloc_sm_caches[i]);
+    for (i = 0; i < KMALLOC_LG_CACHES; ++i)
+        kmalloc_class_print(kmalloc_lg_caches[i]);
+
+    printf("kvmalloc: %lu allocations from vmalloc\n",
+           atomic_read(&kvmalloc_fallbacks));
+}
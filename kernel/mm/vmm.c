@@ -16,6 +16,8 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <radix/asm/cpu_defs.h>
+#include <radix/atomic.h>
 #include <radix/bits.h>
 #include <radix/kernel.h>
 #include <radix/mm.h>
@@ -53,10 +55,14 @@
 //      representing a block of physical pages allocated for this vmm_block.
 //      The struct page's list stores all of the other physical page blocks
 //      allocated for this block.
+//   6. shared_pages is a list of vmm_shared_pages referencing physical page
+//      blocks allocated by another vmm_block, which this block was cloned from
+//      in a different address space. These pages are mapped copy-on-write.
 //
 struct vmm_block {
     struct vmm_area area;
     struct page *allocated_pages;
+    struct list shared_pages;
     struct vmm_space *vmm;
     uint32_t flags;
     uint32_t pad0;
@@ -65,6 +71,17 @@ struct vmm_block {
     struct rb_node addr_node;
 };
 
+// A reference to a block of physical pages shared copy-on-write with a block
+// in another address space.
+//
+// Every vmm_block mapping a block of pages, whether it allocated the pages or
+// shares them, holds a reference on its first struct page (PM_REFCOUNT). The
+// pages are freed when the last reference is dropped.
+struct vmm_shared_pages {
+    struct page *pages;
+    struct list list;
+};
+
 #define VMM_ALLOCATED (1 << 31)
 
 // Subset of the vmm API flags which is stored in block objects.
@@ -75,6 +92,11 @@ struct vmm_block {
 
 static struct slab_cache *vmm_block_cache;
 static struct slab_cache *vmm_space_cache;
+static struct slab_cache *vmm_shared_cache;
+
+// Protects the reference counts of physical pages, which can be shared between
+// address spaces.
+static spinlock_t vmm_refcount_lock = SPINLOCK_INIT;
 
 static struct vmm_space kernel_vmm_space = {
     .structures =
@@ -90,6 +112,7 @@ static struct vmm_space kernel_vmm_space = {
     .paging_base = 0,
     .paging_ctx = NULL,
     .pages = 0,
+    .last_cpu = -1,
 };
 
 struct vmm_space *vmm_kernel(void) { return &kernel_vmm_space; }
@@ -100,6 +123,7 @@ static void vmm_block_init(void *p)
 
     block->flags = 0;
     block->allocated_pages = NULL;
+    list_init(&block->shared_pages);
     list_init(&block->area.list);
     list_init(&block->global_list);
     rb_init(&block->size_node);
@@ -307,6 +331,11 @@ void vmm_init(void)
                                    SLAB_MIN_ALIGN,
                                    SLAB_PANIC,
                                    vmm_space_init);
+    vmm_shared_cache = create_cache("vmm_shared_pages",
+                                    sizeof(struct vmm_shared_pages),
+                                    SLAB_MIN_ALIGN,
+                                    SLAB_PANIC,
+                                    NULL);
 
     first = vmm_alloc_block();
     if (IS_ERR(first)) {
@@ -463,7 +492,7 @@ static void vmm_alloc_block_pages(struct vmm_block *block)
 
         map_pages_kernel(
             base, page_to_phys(p), pow2(ord), PROT_WRITE, PAGE_CP_DEFAULT);
-        vmm_add_area_pages(&block->area, p);
+        vmm_add_area_pages(&block->area, p, base);
 
         pages -= pow2(ord);
         base += pow2(ord) * PAGE_SIZE;
@@ -472,31 +501,100 @@ static void vmm_alloc_block_pages(struct vmm_block *block)
 
 static void free_pages_refcount(struct page *p)
 {
+    unsigned long irqstate;
+    bool free;
+
+    spin_lock_irq(&vmm_refcount_lock, &irqstate);
     PM_REFCOUNT_DEC(p);
-    if (PM_PAGE_REFCOUNT(p) == 0) {
+    free = PM_PAGE_REFCOUNT(p) == 0;
+    spin_unlock_irq(&vmm_refcount_lock, irqstate);
+
+    if (free) {
         free_pages(p);
     }
 }
 
-static void vmm_free_pages(struct vmm_block *block)
+static void vmm_free_shared_pages(struct vmm_block *block)
 {
-    if (!block->allocated_pages) {
-        return;
+    struct vmm_space *vmm = block->vmm;
+
+    while (!list_empty(&block->shared_pages)) {
+        struct vmm_shared_pages *shared = list_first_entry(
+            &block->shared_pages, struct vmm_shared_pages, list);
+        vmm->pages -= pow2(PM_PAGE_BLOCK_ORDER(shared->pages));
+        list_del(&shared->list);
+        free_pages_refcount(shared->pages);
+        free_cache(vmm_shared_cache, shared);
+    }
+}
+
+// Removes the block of physical pages `p` from those allocated by `block`.
+// Must be called with vmm_refcount_lock held, as compaction may concurrently
+// replace pages of an address space which isn't loaded.
+static void vmm_unlink_pages(struct vmm_block *block, struct page *p)
+{
+    if (p == block->allocated_pages) {
+        if (list_empty(&p->list)) {
+            block->allocated_pages = NULL;
+        } else {
+            block->allocated_pages =
+                list_first_entry(&p->list, struct page, list);
+            list_del(&p->list);
+        }
+    } else {
+        list_del(&p->list);
     }
 
+    p->vmm_block = (void *)PAGE_UNINIT_MAGIC;
+}
+
+static void vmm_free_pages(struct vmm_block *block)
+{
     struct vmm_space *vmm = block->vmm;
+    unsigned long irqstate;
+    struct page *p;
+
+    vmm_free_shared_pages(block);
+
+    while (block->allocated_pages) {
+        spin_lock_irq(&vmm_refcount_lock, &irqstate);
+        p = block->allocated_pages;
+        vmm_unlink_pages(block, p);
+        spin_unlock_irq(&vmm_refcount_lock, irqstate);
 
-    while (!list_empty(&block->allocated_pages->list)) {
-        struct page *p =
-            list_first_entry(&block->allocated_pages->list, struct page, list);
         vmm->pages -= pow2(PM_PAGE_BLOCK_ORDER(p));
-        list_del(&p->list);
         free_pages_refcount(p);
     }
+}
 
-    vmm->pages -= pow2(PM_PAGE_BLOCK_ORDER(block->allocated_pages));
-    free_pages_refcount(block->allocated_pages);
-    block->allocated_pages = NULL;
+// Adds a reference to the block of physical pages `p`, allocated by another
+// vmm_block, to `block`.
+static int vmm_add_shared_pages(struct vmm_block *block, struct page *p)
+{
+    unsigned long irqstate;
+
+    struct vmm_shared_pages *shared = alloc_cache(vmm_shared_cache);
+    if (IS_ERR(shared)) {
+        return ERR_VAL(shared);
+    }
+
+    spin_lock_irq(&vmm_refcount_lock, &irqstate);
+
+    // Too many address spaces are already sharing the pages.
+    if (PM_PAGE_REFCOUNT(p) == __REFCOUNT_MASK >> __REFCOUNT_SHIFT) {
+        spin_unlock_irq(&vmm_refcount_lock, irqstate);
+        free_cache(vmm_shared_cache, shared);
+        return EAGAIN;
+    }
+
+    PM_REFCOUNT_INC(p);
+    spin_unlock_irq(&vmm_refcount_lock, irqstate);
+
+    shared->pages = p;
+    list_ins(&block->shared_pages, &shared->list);
+    block->vmm->pages += pow2(PM_PAGE_BLOCK_ORDER(p));
+
+    return 0;
 }
 
 struct vmm_space *vmm_new(void)
@@ -520,11 +618,81 @@ struct vmm_space *vmm_new(void)
     list_add(&vmm->structures.block_list, &initial->global_list);
     vmm_tree_insert(&vmm->structures, initial);
 
+    vmm->last_cpu = -1;
+    vmm->migrating = 0;
     arch_vmm_setup(vmm);
 
     return vmm;
 }
 
+// Makes `block` share every physical page block mapped by `src`.
+static int vmm_share_pages(struct vmm_block *block, struct vmm_block *src)
+{
+    struct vmm_shared_pages *shared;
+    struct page *p;
+    int err;
+
+    if ((p = src->allocated_pages)) {
+        if ((err = vmm_add_shared_pages(block, p))) {
+            return err;
+        }
+        list_for_each_entry (p, &src->allocated_pages->list, list) {
+            if ((err = vmm_add_shared_pages(block, p))) {
+                return err;
+            }
+        }
+    }
+
+    list_for_each_entry (shared, &src->shared_pages, list) {
+        if ((err = vmm_add_shared_pages(block, shared->pages))) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+struct vmm_space *vmm_clone(struct vmm_space *vmm)
+{
+    assert(vmm != NULL && vmm != &kernel_vmm_space);
+
+    struct vmm_space *new = vmm_new();
+    if (!new) {
+        return ERR_PTR(ENOMEM);
+    }
+
+    // The address space being cloned belongs to the calling task, so its
+    // layout cannot change while it is being walked.
+    struct vmm_block *block;
+    int err = 0;
+
+    list_for_each_entry (block, &vmm->structures.alloc_list, area.list) {
+        struct vmm_area *area = vmm_alloc_addr(new,
+                                               block->area.base,
+                                               block->area.size,
+                                               block->flags & VMM_BLOCK_FLAGS);
+        if (IS_ERR(area)) {
+            err = ERR_VAL(area);
+            break;
+        }
+
+        if ((err = vmm_share_pages((struct vmm_block *)area, block))) {
+            break;
+        }
+    }
+
+    if (!err) {
+        err = arch_vmm_clone(new, vmm);
+    }
+
+    if (err) {
+        vmm_release(new);
+        return ERR_PTR(err);
+    }
+
+    return new;
+}
+
 void vmm_release(struct vmm_space *vmm)
 {
     if (vmm == &kernel_vmm_space) {
@@ -533,6 +701,11 @@ void vmm_release(struct vmm_space *vmm)
 
     assert(spin_try_lock(&vmm->lock));
 
+    // Wait for any page migration in the space to finish, and prevent more.
+    while (atomic_cmpxchg(&vmm->migrating, 0, -1) != 0) {
+        cpu_pause();
+    }
+
     arch_vmm_release(vmm);
 
     // Free all the blocks in the space. No need to remove them from the trees
@@ -663,7 +836,14 @@ void vfree(void *ptr)
     struct vmm_block *block =
         vmm_find_allocated(&kernel_vmm_space, (addr_t)ptr);
     if (block) {
-        vmm_free_pages(block);
+        const addr_t base = block->area.base;
+        const size_t size = block->area.size;
+
+        // Other CPUs may have cached translations for the range. Drop them
+        // before its pages are freed and the range can be reallocated.
+        unmap_pages(base, size / PAGE_SIZE);
+        tlb_flush_range(base, base + size, 1);
+        vmm_free(&block->area);
     }
 }
 
@@ -676,8 +856,10 @@ struct vmm_area *vmm_get_allocated_area(struct vmm_space *vmm, addr_t addr)
     return (struct vmm_area *)block;
 }
 
-// Adds the block of physical pages represented by `p` to `area`.
-void vmm_add_area_pages(struct vmm_area *area, struct page *p)
+// Adds the block of physical pages represented by `p`, mapped at `addr`, to
+// `area`. Single pages of user address spaces are recorded in the pages'
+// reverse map so that compaction can migrate them.
+void vmm_add_area_pages(struct vmm_area *area, struct page *p, addr_t addr)
 {
     struct vmm_block *block = (struct vmm_block *)area;
     struct vmm_space *vmm = block->vmm;
@@ -687,10 +869,12 @@ void vmm_add_area_pages(struct vmm_area *area, struct page *p)
     }
 
     if (vmm == &kernel_vmm_space) {
-        p->mem = (void *)area->base;
+        p->mem = (void *)addr;
         p->status |= PM_PAGE_MAPPED;
     }
 
+    unsigned long irqstate;
+    spin_lock_irq(&vmm_refcount_lock, &irqstate);
     PM_REFCOUNT_INC(p);
 
     if (!block->allocated_pages) {
@@ -698,6 +882,29 @@ void vmm_add_area_pages(struct vmm_area *area, struct page *p)
     } else {
         list_ins(&block->allocated_pages->list, &p->list);
     }
+
+    if (vmm && vmm != &kernel_vmm_space && PM_PAGE_BLOCK_ORDER(p) == 0) {
+        p->vmm_block = block;
+        p->vmm_addr = addr;
+    }
+    spin_unlock_irq(&vmm_refcount_lock, irqstate);
+}
+
+static int vmm_block_prot(const struct vmm_block *block)
+{
+    int prot = 0;
+
+    if (block->flags & VMM_READ) {
+        prot |= PROT_READ;
+    }
+    if (block->flags & VMM_WRITE) {
+        prot |= PROT_WRITE;
+    }
+    if (block->flags & VMM_EXEC) {
+        prot |= PROT_EXEC;
+    }
+
+    return prot;
 }
 
 int vmm_map_pages(struct vmm_area *area, addr_t addr, struct page *p)
@@ -711,27 +918,250 @@ int vmm_map_pages(struct vmm_area *area, addr_t addr, struct page *p)
 
     const struct vmm_block *block = (const struct vmm_block *)area;
 
-    int prot = 0;
-    if (block->flags & VMM_READ) {
-        prot |= PROT_READ;
+    int err = map_pages_vmm(block->vmm,
+                            addr,
+                            page_to_phys(p),
+                            pages,
+                            vmm_block_prot(block),
+                            PAGE_CP_DEFAULT);
+    if (err) {
+        return err;
     }
-    if (block->flags & VMM_WRITE) {
-        prot |= PROT_WRITE;
+
+    vmm_add_area_pages(area, p, addr);
+    return 0;
+}
+
+static bool vmm_pages_contain(const struct page *p, paddr_t phys)
+{
+    const paddr_t base = page_to_phys((struct page *)p);
+    return phys >= base &&
+           phys < base + pow2(PM_PAGE_BLOCK_ORDER(p)) * PAGE_SIZE;
+}
+
+// Finds the block of physical pages mapped by `block` which contains physical
+// address `phys`. If the pages are shared from another block, their reference
+// is stored in `shared`.
+static struct page *vmm_find_pages(struct vmm_block *block,
+                                   paddr_t phys,
+                                   struct vmm_shared_pages **shared)
+{
+    struct page *p;
+
+    *shared = NULL;
+
+    if ((p = block->allocated_pages)) {
+        if (vmm_pages_contain(p, phys)) {
+            return p;
+        }
+        list_for_each_entry (p, &block->allocated_pages->list, list) {
+            if (vmm_pages_contain(p, phys)) {
+                return p;
+            }
+        }
     }
-    if (block->flags & VMM_EXEC) {
-        prot |= PROT_EXEC;
+
+    struct vmm_shared_pages *s;
+    list_for_each_entry (s, &block->shared_pages, list) {
+        if (vmm_pages_contain(s->pages, phys)) {
+            *shared = s;
+            return s->pages;
+        }
     }
 
-    int err = map_pages_vmm(
-        block->vmm, addr, page_to_phys(p), pages, prot, PAGE_CP_DEFAULT);
-    if (err) {
+    return NULL;
+}
+
+// Removes the block of physical pages `p` from `block` and drops its reference
+// to them.
+static void vmm_drop_pages(struct vmm_block *block,
+                           struct page *p,
+                           struct vmm_shared_pages *shared)
+{
+    unsigned long irqstate;
+
+    if (shared) {
+        list_del(&shared->list);
+        free_cache(vmm_shared_cache, shared);
+    } else {
+        spin_lock_irq(&vmm_refcount_lock, &irqstate);
+        vmm_unlink_pages(block, p);
+        spin_unlock_irq(&vmm_refcount_lock, irqstate);
+    }
+
+    block->vmm->pages -= pow2(PM_PAGE_BLOCK_ORDER(p));
+    free_pages_refcount(p);
+}
+
+// Copies the page mapped at `addr` in the current address space to `dst`.
+static int vmm_copy_page(struct page *dst, addr_t addr)
+{
+    struct vmm_area *area =
+        vmm_alloc_size(&kernel_vmm_space, PAGE_SIZE, VMM_READ | VMM_WRITE);
+    if (IS_ERR(area)) {
+        return ERR_VAL(area);
+    }
+
+    int err = map_page_kernel(
+        area->base, page_to_phys(dst), PROT_WRITE, PAGE_CP_DEFAULT);
+    if (err == 0) {
+        memcpy((void *)area->base, (void *)addr, PAGE_SIZE);
+        unmap_page(area->base);
+    }
+
+    vmm_free(area);
+    return err;
+}
+
+int vmm_cow_fault(struct vmm_area *area, addr_t addr)
+{
+    struct vmm_block *block = (struct vmm_block *)area;
+    struct vmm_shared_pages *shared;
+    unsigned long irqstate;
+
+    if (!(block->flags & VMM_WRITE)) {
+        return EFAULT;
+    }
+
+    addr &= PAGE_MASK;
+    const paddr_t phys = virt_to_phys(addr);
+
+    struct page *p = vmm_find_pages(block, phys, &shared);
+    if (!p) {
+        return EFAULT;
+    }
+
+    // If no other address space references the pages, they can be written to
+    // directly. Only this address space could create new references to them.
+    spin_lock_irq(&vmm_refcount_lock, &irqstate);
+    const bool exclusive = PM_PAGE_REFCOUNT(p) == 1;
+    spin_unlock_irq(&vmm_refcount_lock, irqstate);
+
+    if (exclusive) {
+        return remap_cow_page(addr, phys);
+    }
+
+    struct page *copy = alloc_page(PA_USER);
+    if (IS_ERR(copy)) {
+        return ERR_VAL(copy);
+    }
+
+    int err = vmm_copy_page(copy, addr);
+    if (err == 0) {
+        err = remap_cow_page(addr, page_to_phys(copy));
+    }
+    if (err != 0) {
+        free_pages(copy);
         return err;
     }
 
-    vmm_add_area_pages(area, p);
+    vmm_add_area_pages(area, copy, addr);
+
+    // A single shared page is no longer mapped by this block after being
+    // copied. Larger blocks may still have other pages mapped, so they are
+    // held until the area is freed.
+    if (PM_PAGE_BLOCK_ORDER(p) == 0) {
+        vmm_drop_pages(block, p, shared);
+    }
+
     return 0;
 }
 
+int vmm_migrate_page(struct page *p, struct page *new)
+{
+    struct vmm_block *block;
+    struct vmm_space *vmm;
+    unsigned long irqstate;
+    int err;
+
+    struct vmm_area *area =
+        vmm_alloc_size(&kernel_vmm_space, 2 * PAGE_SIZE, VMM_READ | VMM_WRITE);
+    if (IS_ERR(area)) {
+        return ERR_VAL(area);
+    }
+
+    const addr_t src = area->base;
+    const addr_t dst = area->base + PAGE_SIZE;
+
+    err = map_page_kernel(src, page_to_phys(p), PROT_READ, PAGE_CP_DEFAULT);
+    if (err) {
+        goto out_free;
+    }
+    err = map_page_kernel(dst, page_to_phys(new), PROT_WRITE, PAGE_CP_DEFAULT);
+    if (err) {
+        goto out_unmap;
+    }
+
+    // The reverse map is only changed under the refcount lock, and a block
+    // drops its pages before it is freed, so while the lock is held the page's
+    // owner remains valid.
+    spin_lock_irq(&vmm_refcount_lock, &irqstate);
+
+    block = p->vmm_block;
+    if (block == (void *)PAGE_UNINIT_MAGIC || PM_PAGE_REFCOUNT(p) != 1) {
+        err = EBUSY;
+        goto out_unlock;
+    }
+
+    // Prevent the address space from being loaded while its page is replaced,
+    // so no stale TLB entries or writes to the old page can exist. Address
+    // spaces which are already loaded are skipped.
+    vmm = block->vmm;
+    if (atomic_cmpxchg(&vmm->migrating, 0, 1) != 0) {
+        err = EBUSY;
+        goto out_unlock;
+    }
+    if (arch_vmm_loaded(vmm)) {
+        err = EBUSY;
+        goto out_migrated;
+    }
+
+    memcpy((void *)dst, (void *)src, PAGE_SIZE);
+
+    err = map_pages_vmm(vmm,
+                        p->vmm_addr,
+                        page_to_phys(new),
+                        1,
+                        vmm_block_prot(block),
+                        PAGE_CP_DEFAULT);
+    if (err) {
+        goto out_migrated;
+    }
+
+    // Take the old page's place in its block.
+    if (list_empty(&p->list)) {
+        list_init(&new->list);
+    } else {
+        list_ins(&p->list, &new->list);
+        list_del(&p->list);
+    }
+    if (block->allocated_pages == p) {
+        block->allocated_pages = new;
+    }
+
+    PM_SET_REFCOUNT(new, 1);
+    new->vmm_block = block;
+    new->vmm_addr = p->vmm_addr;
+
+    PM_SET_REFCOUNT(p, 0);
+    p->vmm_block = (void *)PAGE_UNINIT_MAGIC;
+
+out_migrated:
+    atomic_write(&vmm->migrating, 0);
+out_unlock:
+    spin_unlock_irq(&vmm_refcount_lock, irqstate);
+    unmap_page(dst);
+out_unmap:
+    unmap_page(src);
+out_free:
+    vmm_free(area);
+
+    if (!err) {
+        free_pages(p);
+    }
+    return err;
+}
+
 void vmm_space_dump(struct vmm_space *vmm)
 {
     struct vmm_structures *s = &vmm->structures;
@@ -23,6 +23,7 @@
 #include <radix/mutex.h>
 #include <radix/sched.h>
 #include <radix/task.h>
+#include <radix/workqueue.h>
 
 void mutex_init(struct mutex *m)
 {
@@ -57,7 +58,16 @@ void mutex_lock(struct mutex *m)
         list_ins(&m->queue, &curr->queue);
         spin_unlock(&m->lock);
 
+        // Let the workqueue run other work while a worker thread is blocked.
+        if (curr->worker) {
+            wq_worker_sleeping(curr);
+        }
+
         schedule(SCHED_REPLACE);
+
+        if (curr->worker) {
+            wq_worker_running(curr);
+        }
     }
 
     irq_restore(irqstate);
@@ -22,6 +22,7 @@
 #include <radix/irq.h>
 #include <radix/kernel.h>
 #include <radix/list.h>
+#include <radix/serial.h>
 #include <radix/stacktrace.h>
 
 #include <stdio.h>
@@ -33,13 +34,25 @@
 
 static void raw_write(const char *s, size_t len)
 {
-    if (!active_console || !s) {
+    if (!s) {
+        return;
+    }
+
+    serial_panic_write(s, len);
+
+    if (!active_console) {
         return;
     }
 
     atomic_write(&active_console->lock.owner, 0);
     list_init(&active_console->lock.queue);
     active_console->actions->write(active_console, s, len);
+
+    // Buffered consoles may otherwise defer output to a thread which will
+    // never run again.
+    if (active_console->actions->flush) {
+        active_console->actions->flush(active_console);
+    }
 }
 
 // Prevents multiple processors from panicking at once.
@@ -23,6 +23,7 @@
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/mm.h>
+#include <radix/numa.h>
 #include <radix/percpu.h>
 #include <radix/timer.h>
 #include <radix/vmm.h>
@@ -62,6 +63,29 @@ int percpu_init(int ap)
     return 0;
 }
 
+/*
+ * percpu_populate_nodes:
+ * Back the per-CPU area of each CPU in `area` with pages from
+ * the CPU's own NUMA node.
+ */
+static void percpu_populate_nodes(struct vmm_area *area, size_t percpu_size)
+{
+    struct page *p;
+    addr_t addr;
+    size_t off;
+    int cpu;
+
+    addr = area->base;
+    for (cpu = 0; cpu < MAX_CPUS; ++cpu) {
+        for (off = 0; off < percpu_size; off += PAGE_SIZE) {
+            p = alloc_pages_node(cpu_to_node(cpu), PA_USER, 0);
+            if (IS_ERR(p) || vmm_map_pages(area, addr, p) != 0)
+                panic("failed to allocate per-CPU area for CPU %d\n", cpu);
+            addr += PAGE_SIZE;
+        }
+    }
+}
+
 /*
  * percpu_area_setup:
  * Allocate memory for per-CPU areas for all CPUs and copy
@@ -72,22 +96,32 @@ void percpu_area_setup(void)
     size_t percpu_size, align, i;
     addr_t percpu_base, base_offset;
     struct vmm_area *area;
+    uint32_t flags;
 
+    /*
+     * On NUMA systems, each CPU's area occupies whole pages
+     * so that it can be allocated on the CPU's node.
+     */
     percpu_size = percpu_end - percpu_start;
-    if (percpu_size < PAGE_SIZE / 2) {
+    if (percpu_size < PAGE_SIZE / 2 && numa_node_count() == 1) {
         align = pow2(log2(percpu_size));
         percpu_size = ALIGN(percpu_size, align);
     } else {
         percpu_size = ALIGN(percpu_size, PAGE_SIZE);
     }
 
-    area = vmm_alloc_size(vmm_kernel(),
-                          percpu_size * MAX_CPUS,
-                          VMM_READ | VMM_WRITE | VMM_ALLOC_UPFRONT);
+    flags = VMM_READ | VMM_WRITE;
+    if (numa_node_count() == 1)
+        flags |= VMM_ALLOC_UPFRONT;
+
+    area = vmm_alloc_size(vmm_kernel(), percpu_size * MAX_CPUS, flags);
     if (IS_ERR(area)) {
         panic("failed to allocate space for per-CPU areas\n");
     }
 
+    if (numa_node_count() > 1)
+        percpu_populate_nodes(area, percpu_size);
+
     percpu_base = area->base;
     base_offset = percpu_base - percpu_start;
 
@@ -0,0 +1,219 @@
+/*
+ * kernel/pid.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/atomic.h>
+#include <radix/bits.h>
+#include <radix/error.h>
+#include <radix/list.h>
+#include <radix/mm.h>
+#include <radix/pid.h>
+#include <radix/spinlock.h>
+#include <radix/task.h>
+
+#include <errno.h>
+#include <string.h>
+
+#define PID_WORD_BITS     32
+#define PID_BITMAP_WORDS  (PID_MAX / PID_WORD_BITS)
+#define PID_SUMMARY_WORDS (PID_BITMAP_WORDS / PID_WORD_BITS)
+
+// Each leaf of the PID map is a single page of task pointers.
+#define PID_LEAF_ENTRIES (PAGE_SIZE / sizeof(struct task *))
+#define PID_LEAVES       (PID_MAX / PID_LEAF_ENTRIES)
+
+static spinlock_t pid_lock = SPINLOCK_INIT;
+
+// Bitmap of allocated PIDs. PID 0 is reserved and never handed out.
+static uint32_t pid_bitmap[PID_BITMAP_WORDS] = { 1 };
+
+// Bitmap of the words of `pid_bitmap` which are completely full, allowing
+// searches to skip over large allocated ranges.
+static uint32_t pid_full[PID_SUMMARY_WORDS];
+
+// PID from which the next search for a free PID starts.
+static unsigned int pid_next = 1;
+
+// Two-level table mapping PIDs to tasks. Leaves are allocated when a PID in
+// their range is first used and are never freed, which allows lookups to walk
+// the table without holding the lock.
+static struct task **pid_map[PID_LEAVES];
+
+// All tasks which currently hold a PID.
+static struct list task_registry = LIST_INIT(task_registry);
+static unsigned int num_tasks = 0;
+
+// Finds the lowest free PID greater than or equal to `start`, or returns -1
+// if there are none.
+static int __pid_find_free(unsigned int start)
+{
+    unsigned int word = start / PID_WORD_BITS;
+    uint32_t avail = ~pid_bitmap[word] & (~0U << (start % PID_WORD_BITS));
+
+    if (avail) {
+        return word * PID_WORD_BITS + ffs(avail) - 1;
+    }
+
+    ++word;
+    while (word < PID_BITMAP_WORDS) {
+        unsigned int s = word / PID_WORD_BITS;
+        uint32_t avail_words = ~pid_full[s] & (~0U << (word % PID_WORD_BITS));
+
+        if (avail_words) {
+            word = s * PID_WORD_BITS + ffs(avail_words) - 1;
+            return word * PID_WORD_BITS + ffs(~pid_bitmap[word]) - 1;
+        }
+
+        word = (s + 1) * PID_WORD_BITS;
+    }
+
+    return -1;
+}
+
+static void __pid_set(unsigned int pid)
+{
+    unsigned int word = pid / PID_WORD_BITS;
+
+    pid_bitmap[word] |= 1U << (pid % PID_WORD_BITS);
+    if (pid_bitmap[word] == ~0U) {
+        pid_full[word / PID_WORD_BITS] |= 1U << (word % PID_WORD_BITS);
+    }
+}
+
+static void __pid_clear(unsigned int pid)
+{
+    unsigned int word = pid / PID_WORD_BITS;
+
+    pid_bitmap[word] &= ~(1U << (pid % PID_WORD_BITS));
+    pid_full[word / PID_WORD_BITS] &= ~(1U << (word % PID_WORD_BITS));
+}
+
+int pid_alloc(struct task *task)
+{
+    struct page *spare = NULL;
+    unsigned long irqstate;
+    int pid;
+
+    spin_lock_irq(&pid_lock, &irqstate);
+
+    pid = __pid_find_free(pid_next);
+    if (pid < 0) {
+        pid = __pid_find_free(1);
+        if (pid < 0) {
+            spin_unlock_irq(&pid_lock, irqstate);
+            return EAGAIN;
+        }
+    }
+
+    __pid_set(pid);
+    pid_next = pid + 1 < PID_MAX ? pid + 1 : 1;
+
+    const unsigned int index = pid / PID_LEAF_ENTRIES;
+    struct task **leaf = pid_map[index];
+
+    if (!leaf) {
+        // The PID is now reserved, so the lock can be dropped while the leaf
+        // is allocated. Another CPU may install the same leaf in the meantime.
+        spin_unlock_irq(&pid_lock, irqstate);
+
+        spare = alloc_page(PA_STANDARD);
+        if (IS_ERR(spare)) {
+            spin_lock_irq(&pid_lock, &irqstate);
+            __pid_clear(pid);
+            spin_unlock_irq(&pid_lock, irqstate);
+            return ENOMEM;
+        }
+        memset(spare->mem, 0, PAGE_SIZE);
+
+        spin_lock_irq(&pid_lock, &irqstate);
+
+        leaf = pid_map[index];
+        if (!leaf) {
+            leaf = spare->mem;
+            spare = NULL;
+
+            // The cleared leaf must be visible before it is published.
+            barrier();
+            atomic_write(&pid_map[index], leaf);
+        }
+    }
+
+    task->pid = pid;
+    atomic_write(&leaf[pid % PID_LEAF_ENTRIES], task);
+    list_add(&task_registry, &task->registry);
+    ++num_tasks;
+
+    spin_unlock_irq(&pid_lock, irqstate);
+
+    if (spare) {
+        free_pages(spare);
+    }
+
+    return 0;
+}
+
+void pid_free(struct task *task)
+{
+    const int pid = task->pid;
+    unsigned long irqstate;
+
+    if (pid <= 0) {
+        return;
+    }
+
+    spin_lock_irq(&pid_lock, &irqstate);
+
+    struct task **leaf = pid_map[pid / PID_LEAF_ENTRIES];
+    atomic_write(&leaf[pid % PID_LEAF_ENTRIES], NULL);
+    list_del(&task->registry);
+    --num_tasks;
+    __pid_clear(pid);
+
+    spin_unlock_irq(&pid_lock, irqstate);
+
+    task->pid = 0;
+}
+
+struct task *pid_task(int pid)
+{
+    if (pid <= 0 || pid >= PID_MAX) {
+        return NULL;
+    }
+
+    struct task **leaf = atomic_read(&pid_map[pid / PID_LEAF_ENTRIES]);
+    return leaf ? atomic_read(&leaf[pid % PID_LEAF_ENTRIES]) : NULL;
+}
+
+int task_for_each(int (*func)(struct task *, void *), void *arg)
+{
+    struct task *task;
+    unsigned long irqstate;
+    int ret = 0;
+
+    spin_lock_irq(&pid_lock, &irqstate);
+
+    list_for_each_entry (task, &task_registry, registry) {
+        if ((ret = func(task, arg)) != 0) {
+            break;
+        }
+    }
+
+    spin_unlock_irq(&pid_lock, irqstate);
+    return ret;
+}
+
+unsigned int task_count(void) { return atomic_read(&num_tasks); }
@@ -21,6 +21,7 @@
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/kthread.h>
+#include <radix/mm.h>
 #include <radix/percpu.h>
 #include <radix/smp.h>
 #include <radix/task.h>
@@ -33,7 +34,11 @@ static void idle_func(__unused void *p)
     while (1) {
         irq_enable();
         set_cpu_idle(processor_id());
-        HALT();
+
+        // Clear pages for future allocations before going to sleep.
+        if (!zero_pool_refill()) {
+            HALT();
+        }
     }
 }
 
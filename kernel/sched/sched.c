@@ -20,6 +20,7 @@
 #include <radix/compiler.h>
 #include <radix/cpu.h>
 #include <radix/event.h>
+#include <radix/fpu.h>
 #include <radix/ipi.h>
 #include <radix/irq.h>
 #include <radix/kernel.h>
@@ -27,6 +28,7 @@
 #include <radix/kthread.h>
 #include <radix/limits.h>
 #include <radix/mm.h>
+#include <radix/numa.h>
 #include <radix/sched.h>
 #include <radix/sleep.h>
 #include <radix/smp.h>
@@ -45,6 +47,10 @@
 
 #define PRIO_BOOST_PERIOD (500 * NSEC_PER_MSEC)
 
+// How many more active tasks the least loaded CPU on a task's NUMA node may
+// have than the least loaded CPU overall before the task is placed remotely.
+#define SCHED_NUMA_IMBALANCE 2
+
 #define SCHED "sched: "
 
 DEFINE_PER_CPU(struct task *, current_task) = NULL;
@@ -68,6 +74,10 @@ static DEFINE_PER_CPU(int, active_tasks) = 0;
 
 static DEFINE_PER_CPU(uint64_t, time_spent_idling) = 0;
 
+// A task which finished on this CPU, waiting to be freed once the CPU has
+// switched off its stack.
+static DEFINE_PER_CPU(struct task *, dead_task) = NULL;
+
 static void __prio_boost(void *p);
 
 // Initialize this processor's MLFQ priority boosting task.
@@ -125,34 +135,51 @@ static __always_inline uint64_t __prio_timeslice(int prio)
     return (5 + (prio / 2)) * NSEC_PER_MSEC;
 }
 
-// Finds the most suitable CPU on which to run the new task `t`.
+// Finds the most suitable CPU on which to run the new task `t`. CPUs on the
+// NUMA node holding the task's memory are preferred.
 static int __find_best_cpu(const struct task *t)
 {
-    cpumask_t potential = cpumask_online() & t->cpu_restrict;
+    cpumask_t potential;
+    cpumask_and(&potential, cpumask_online(), &t->cpu_restrict);
     int min_tasks = INT_MAX;
+    int min_local = INT_MAX;
     int best = -1;
+    int best_local = -1;
+
+    const int node = numa_node_count() > 1 ? t->numa_node : NUMA_NO_NODE;
 
     int cpu;
-    for_each_cpu (cpu, potential) {
+    for_each_cpu (cpu, &potential) {
         int curr_tasks = cpu_var(active_tasks, cpu);
+        bool local = cpu_to_node(cpu) == node;
 
-        // If the CPU is not running anything, choose it.
-        if (!curr_tasks) {
+        // If the CPU is not running anything and is near the task's memory,
+        // choose it.
+        if (!curr_tasks && (local || node == NUMA_NO_NODE)) {
             return cpu;
         }
 
+        if (local && curr_tasks < min_local) {
+            min_local = curr_tasks;
+            best_local = cpu;
+        }
+
         if (curr_tasks < min_tasks) {
             min_tasks = curr_tasks;
             best = cpu;
         }
     }
 
+    if (best_local != -1 && min_local - min_tasks <= SCHED_NUMA_IMBALANCE) {
+        return best_local;
+    }
+
     return best;
 }
 
 int sched_add(struct task *task)
 {
-    task->cpu_affinity = 0;
+    cpumask_clear(&task->cpu_affinity);
     task->prio_level = 0;
     task->sched_ts = 0;
     task->state = TASK_READY;
@@ -282,7 +309,7 @@ static void __update_recent_tasks(struct task *task)
                 goto shift_tasks;
             }
         }
-        evict->cpu_affinity &= ~CPUMASK_SELF;
+        cpumask_clear_cpu(&evict->cpu_affinity, processor_id());
     }
 
 shift_tasks:
@@ -328,9 +355,13 @@ static void __handle_outgoing_task(struct task *outgoing)
     }
 
     if (outgoing->state == TASK_FINISHED) {
-        // TODO(frolv): Temporarily free finished tasks immediately. This should
-        // be deferred to allow the parent to consume the result of the task.
-        task_free(outgoing);
+        // The scheduler is still running on the task's stack, so it cannot be
+        // freed until the CPU has switched to the next task.
+        // TODO(frolv): Temporarily free finished tasks once they have stopped
+        // running. This should be deferred to allow the parent to consume the
+        // result of the task.
+        assert(this_cpu_read(dead_task) == NULL);
+        this_cpu_write(dead_task, outgoing);
         return;
     }
 
@@ -344,7 +375,7 @@ static void __handle_outgoing_task(struct task *outgoing)
 static void __prepare_next_task(struct task *next, uint64_t sched_ts)
 {
     next->state = TASK_RUNNING;
-    next->cpu_affinity |= CPUMASK_SELF;
+    cpumask_set_cpu(&next->cpu_affinity, processor_id());
     next->sched_ts = sched_ts;
 
     cpu_set_kernel_stack(next->stack_top);
@@ -352,6 +383,14 @@ static void __prepare_next_task(struct task *next, uint64_t sched_ts)
 
     switch_address_space(next->vmm);
 
+    // Kernel stacks are in vmalloc space, whose page tables the address space
+    // may not have picked up yet. A fault on the stack itself cannot be
+    // handled, so make sure it is mapped before switching to it.
+    if (next->stack_top != NULL) {
+        sync_kernel_mapping((addr_t)next->stack_top - 1);
+        sync_kernel_mapping((addr_t)next->stack_top - next->stack_size);
+    }
+
     // TODO(frolv): Figure out how to handle failed sched event insertions.
     int err = sched_event_add(sched_ts + next->remaining_time);
     if (err != 0) {
@@ -361,11 +400,27 @@ static void __prepare_next_task(struct task *next, uint64_t sched_ts)
     }
 }
 
+// Frees the task which last finished on this CPU, if any. Must be called from
+// a different task.
+static void __free_dead_task(void)
+{
+    struct task *dead = this_cpu_read(dead_task);
+
+    if (dead != NULL) {
+        this_cpu_write(dead_task, NULL);
+        task_free(dead);
+    }
+}
+
 // The main scheduler function. Picks a task to run.
 void schedule(enum sched_action action)
 {
     assert(action == SCHED_REPLACE || action == SCHED_PREEMPT);
 
+    // A task which started running after the previous one finished has not
+    // gone through the end of schedule(), so may have left it behind.
+    __free_dead_task();
+
     uint64_t sched_ts = time_ns();
     struct task *curr = current_task();
 
@@ -405,6 +460,11 @@ void schedule(enum sched_action action)
     }
 
     if (curr != next) {
+        // The FPU state is switched out first, as handling the outgoing task
+        // may free it.
+        if (curr) {
+            fpu_switch_out(curr);
+        }
         __handle_outgoing_task(curr);
     }
 
@@ -414,6 +474,9 @@ void schedule(enum sched_action action)
 
     if (curr != next) {
         switch_task(curr, next);
+
+        // Now on the stack of the task which was switched to.
+        __free_dead_task();
     }
 }
 
@@ -508,3 +571,67 @@ static __noreturn void __prio_boost(__unused void *p)
         sleep(2 * PRIO_BOOST_PERIOD);
     }
 }
+
+#if CONFIG(SCHED_SWITCH_BENCHMARK)
+
+#define SWITCH_BENCH_ROUNDS 10000
+
+static void __switch_bench_func(void *arg)
+{
+    struct task *partner = arg;
+
+    for (int i = 0; i < SWITCH_BENCH_ROUNDS; ++i) {
+        kthread_wait();
+        kthread_wake(partner);
+    }
+}
+
+static void __switch_bench_run(bool lazy)
+{
+    unsigned long loads_before, avoided_before, loads, avoided;
+    struct task *curr = current_task();
+    const cpumask_t saved_restrict = curr->cpu_restrict;
+
+    struct task *thread =
+        kthread_create(__switch_bench_func, curr, 0, "kswitchbench");
+    if (IS_ERR(thread)) {
+        klog(KLOG_ERROR, "switch benchmark: failed to create thread");
+        return;
+    }
+
+    // Both threads run on the same CPU, so every wakeup is a context switch.
+    curr->cpu_restrict = CPUMASK_SELF;
+    thread->cpu_restrict = CPUMASK_SELF;
+
+    set_lazy_address_space(lazy);
+    address_space_stats(&loads_before, &avoided_before);
+    kthread_start(thread);
+
+    uint64_t start = time_ns();
+
+    for (int i = 0; i < SWITCH_BENCH_ROUNDS; ++i) {
+        kthread_wake(thread);
+        kthread_wait();
+    }
+
+    uint64_t total_ns = time_ns() - start;
+
+    address_space_stats(&loads, &avoided);
+    set_lazy_address_space(true);
+    curr->cpu_restrict = saved_restrict;
+
+    klog(KLOG_INFO,
+         "switch benchmark (%s): %llu ns/switch, %lu CR3 loads, %lu avoided",
+         lazy ? "lazy" : "eager",
+         total_ns / (2 * SWITCH_BENCH_ROUNDS),
+         loads - loads_before,
+         avoided - avoided_before);
+}
+
+void sched_switch_benchmark(void)
+{
+    __switch_bench_run(false);
+    __switch_bench_run(true);
+}
+
+#endif  // CONFIG(SCHED_SWITCH_BENCHMARK)
@@ -16,9 +16,150 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <radix/asm/cpu_defs.h>
+#include <radix/atomic.h>
+#include <radix/compiler.h>
 #include <radix/ipi.h>
+#include <radix/irqstate.h>
 #include <radix/smp.h>
 
+#include <stddef.h>
+
+// A single pending cross-CPU function call.
+struct smp_call {
+    struct smp_call *next;
+    void (*func)(void *);
+    void *arg;
+    int pending;
+};
+
+// Lock-free stack of calls queued to each CPU. Producers push onto it with a
+// compare-and-swap; the owning CPU takes the whole stack at once.
+static DEFINE_PER_CPU(struct smp_call *, call_queue) = NULL;
+
+// Call slots owned by each CPU, one for every possible target CPU. A slot is
+// reused only once its previous call has completed, so no allocation is
+// required to issue a call.
+static DEFINE_PER_CPU(struct smp_call[MAX_CPUS], call_slots);
+
+// Pushes `call` onto the queue of `cpu`. Returns true if the queue was
+// previously empty, in which case the CPU must be sent an IPI. Otherwise, an
+// IPI is already on its way and will pick up this call as well.
+static bool __smp_call_enqueue(int cpu, struct smp_call *call)
+{
+    struct smp_call **queue = cpu_ptr(&call_queue, cpu);
+    struct smp_call *head;
+
+    do {
+        head = atomic_read(queue);
+        call->next = head;
+    } while (atomic_cmpxchg(queue, head, call) != head);
+
+    return head == NULL;
+}
+
+void smp_call_function_interrupt(void)
+{
+    struct smp_call *call, *next, *list = NULL;
+
+    call = atomic_swap(raw_cpu_ptr(&call_queue), NULL);
+
+    // The queue is a stack; reverse it to run calls in the order they were
+    // issued.
+    while (call) {
+        next = call->next;
+        call->next = list;
+        list = call;
+        call = next;
+    }
+
+    while (list) {
+        call = list;
+        list = call->next;
+
+        call->func(call->arg);
+
+        // The slot may be reused by its owner as soon as this is cleared.
+        barrier();
+        atomic_write(&call->pending, 0);
+    }
+}
+
+// Waits for `call` to complete. While waiting, calls queued to this CPU are
+// run so that two CPUs calling each other with interrupts disabled do not
+// deadlock.
+static void __smp_call_wait(struct smp_call *call)
+{
+    while (atomic_read(&call->pending)) {
+        if (this_cpu_read(call_queue)) {
+            smp_call_function_interrupt();
+        }
+        cpu_pause();
+    }
+}
+
+void smp_call_function_many(const cpumask_t *mask,
+                            void (*func)(void *),
+                            void *arg,
+                            bool wait)
+{
+    struct smp_call *slots;
+    cpumask_t targets, ipi_mask;
+    unsigned long irqstate;
+    bool self;
+    int cpu, this;
+
+    irq_save(irqstate);
+
+    this = processor_id();
+    slots = *raw_cpu_ptr(&call_slots);
+
+    self = cpumask_test_cpu(mask, this);
+    cpumask_and(&targets, mask, cpumask_online());
+    cpumask_clear_cpu(&targets, this);
+    cpumask_clear(&ipi_mask);
+
+    for_each_cpu (cpu, &targets) {
+        struct smp_call *call = &slots[cpu];
+
+        // A previous asynchronous call to the CPU may still be in flight.
+        __smp_call_wait(call);
+
+        call->func = func;
+        call->arg = arg;
+        call->pending = 1;
+
+        if (__smp_call_enqueue(cpu, call)) {
+            cpumask_set_cpu(&ipi_mask, cpu);
+        }
+    }
+
+    if (!cpumask_empty(&ipi_mask)) {
+        send_call_function_ipi(&ipi_mask);
+    }
+
+    if (self) {
+        func(arg);
+    }
+
+    if (wait) {
+        for_each_cpu (cpu, &targets) {
+            __smp_call_wait(&slots[cpu]);
+        }
+    }
+
+    irq_restore(irqstate);
+}
+
+void smp_call_function_single(int cpu,
+                              void (*func)(void *),
+                              void *arg,
+                              bool wait)
+{
+    const cpumask_t mask = CPUMASK_CPU(cpu);
+    smp_call_function_many(&mask, func, arg, wait);
+}
+
 #if CONFIG(SMP)
 
 void smp_init(void)
@@ -17,21 +17,96 @@
  */
 
 #include <radix/asm/syscall.h>
+#include <radix/error.h>
 #include <radix/irqstate.h>
+#include <radix/klog.h>
 #include <radix/sched.h>
 #include <radix/syscall.h>
 #include <radix/task.h>
 
+#include <string.h>
+
 void syscall_init(void) { arch_syscall_init(); }
 
+#if CONFIG(SYSCALL_BENCHMARK)
+
+#define SYSCALL_BENCH_PATH "/sysbench"
+
+// The benchmark program exits with its average cycles per call through the
+// interrupt gate in bits 0-14 of its status, and through sysenter in bits
+// 15-29, or 0 if sysenter is not supported.
+#define SYSCALL_BENCH_CYCLES_MASK 0x7FFF
+#define SYSCALL_BENCH_SYSENTER_SHIFT 15
+
+static int syscall_bench_pid = -1;
+
+void syscall_benchmark(void)
+{
+    struct task *task = task_create(SYSCALL_BENCH_PATH);
+    if (IS_ERR(task)) {
+        klog(KLOG_ERROR,
+             "syscall benchmark: failed to start %s: %s",
+             SYSCALL_BENCH_PATH,
+             strerror(ERR_VAL(task)));
+        return;
+    }
+
+    syscall_bench_pid = task->pid;
+    sched_add(task);
+}
+
+static void syscall_benchmark_report(int status)
+{
+    unsigned int int_cycles = status & SYSCALL_BENCH_CYCLES_MASK;
+    unsigned int sysenter_cycles =
+        (status >> SYSCALL_BENCH_SYSENTER_SHIFT) & SYSCALL_BENCH_CYCLES_MASK;
+
+    if (sysenter_cycles == 0) {
+        klog(KLOG_INFO,
+             "syscall benchmark: int: %u cycles/call, sysenter unsupported",
+             int_cycles);
+    } else {
+        klog(KLOG_INFO,
+             "syscall benchmark: int: %u cycles/call, "
+             "sysenter: %u cycles/call",
+             int_cycles,
+             sysenter_cycles);
+    }
+}
+
+#endif  // CONFIG(SYSCALL_BENCHMARK)
+
 void sys_exit(int status)
 {
+    struct task *curr = current_task();
+
+#if CONFIG(SYSCALL_BENCHMARK)
+    if (curr->pid == syscall_bench_pid) {
+        syscall_benchmark_report(status);
+    }
+#endif
+
     irq_disable();
 
-    struct task *curr = current_task();
     curr->exit_status = status;
     curr->state = TASK_FINISHED;
 
     schedule(SCHED_REPLACE);
     __builtin_unreachable();
 }
+
+int sys_fork(void)
+{
+    struct task *child = task_fork(current_task());
+    if (IS_ERR(child)) {
+        return -ERR_VAL(child);
+    }
+
+    // The child may start running and exit as soon as it is scheduled.
+    int pid = child->pid;
+    sched_add(child);
+
+    return pid;
+}
+
+int sys_getpid(void) { return current_task()->pid; }
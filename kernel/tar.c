@@ -40,8 +40,10 @@ void tar_foreach(const struct tar_header *header,
 
         struct tar_iter iter = {
             .file_name = header->filename,
+            .file_prefix = header->prefix,
             .file_data = header->data,
             .file_size = size,
+            .file_type = header->type,
         };
         func(context, &iter);
 
@@ -19,11 +19,16 @@
 #include <radix/assert.h>
 #include <radix/elf.h>
 #include <radix/error.h>
+#include <radix/fpu.h>
 #include <radix/initrd.h>
+#include <radix/irqstate.h>
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/kthread.h>
 #include <radix/mm.h>
+#include <radix/numa.h>
+#include <radix/percpu.h>
+#include <radix/pid.h>
 #include <radix/sched.h>
 #include <radix/slab.h>
 #include <radix/smp.h>
@@ -35,6 +40,28 @@
 static struct slab_cache *task_cache;
 
 static void task_init(void *t);
+static void task_free_cmdline(struct task *task);
+
+// Number of freed task structs and kernel stacks of each order which are held
+// by each CPU for reuse.
+#define TASK_RESERVE_TASKS  16
+#define TASK_RESERVE_STACKS 4
+
+// Kernel stacks of orders up to this are kept for reuse. Larger stacks are
+// rare enough to go straight to the page allocator.
+#define TASK_RESERVE_MAX_STACK_ORDER 2
+
+// Recently freed tasks and kernel stacks, which are reused by the next tasks
+// created on the CPU instead of going through the slab and page allocators.
+// Task structs keep their command line buffers.
+struct task_reserve {
+    struct task *tasks[TASK_RESERVE_TASKS];
+    unsigned int num_tasks;
+    void *stacks[TASK_RESERVE_MAX_STACK_ORDER + 1][TASK_RESERVE_STACKS];
+    unsigned int num_stacks[TASK_RESERVE_MAX_STACK_ORDER + 1];
+};
+
+static DEFINE_PER_CPU(struct task_reserve, task_reserve);
 
 void tasking_init(void)
 {
@@ -56,9 +83,45 @@ void task_exit(struct task *task, int status)
     __builtin_unreachable();
 }
 
-struct task *task_alloc(void) { return alloc_cache(task_cache); }
+struct task *task_alloc(void)
+{
+    struct task *task = NULL;
+    unsigned long irqstate;
+
+    irq_save(irqstate);
+
+    struct task_reserve *reserve = raw_cpu_ptr(&task_reserve);
+    if (reserve->num_tasks > 0) {
+        task = reserve->tasks[--reserve->num_tasks];
+    }
+
+    irq_restore(irqstate);
+
+    if (task) {
+        char **cmdline = task->cmdline;
+        size_t cmdline_size = task->cmdline_size;
+
+        task_init(task);
+        task->cmdline = cmdline;
+        task->cmdline_size = cmdline_size;
+    } else {
+        task = alloc_cache(task_cache);
+        if (IS_ERR(task)) {
+            return task;
+        }
+    }
+
+    int err = pid_alloc(task);
+    if (err) {
+        task_free_cmdline(task);
+        free_cache(task_cache, task);
+        return ERR_PTR(err);
+    }
+
+    return task;
+}
 
-static void task_free_cmdline(const struct task *task)
+static void task_free_cmdline(struct task *task)
 {
     if (task->cmdline != NULL) {
         for (char **s = task->cmdline; *s; ++s) {
@@ -66,22 +129,170 @@ static void task_free_cmdline(const struct task *task)
         }
         kfree(task->cmdline);
     }
+
+    task->cmdline = NULL;
+    task->cmdline_size = 0;
 }
 
-void task_free(struct task *task)
+char *task_cmdline_buffer(struct task *task, size_t size)
 {
-    if (task->stack_top != NULL) {
-        uintptr_t stack_base = (uintptr_t)task->stack_top - task->stack_size;
-        free_pages(virt_to_page((void *)stack_base));
+    if (task->cmdline != NULL && task->cmdline_size >= size) {
+        return task->cmdline[0];
     }
 
     task_free_cmdline(task);
 
+    size = max(size, (size_t)TASK_CMDLINE_MIN_SIZE);
+
+    char **cmdline = kmalloc(2 * sizeof *cmdline);
+    if (!cmdline) {
+        return NULL;
+    }
+
+    cmdline[0] = kmalloc(size);
+    if (!cmdline[0]) {
+        kfree(cmdline);
+        return NULL;
+    }
+
+    cmdline[1] = NULL;
+    task->cmdline = cmdline;
+    task->cmdline_size = size;
+
+    return cmdline[0];
+}
+
+// Unmaps the first `mapped` pages of a kernel stack and releases its area.
+// The stack may have been used on any CPU, so every TLB is flushed before its
+// pages and address range can be handed out again.
+static void __task_stack_release(struct vmm_area *area, int mapped)
+{
+    if (mapped > 0) {
+        const addr_t stack = area->base + PAGE_SIZE;
+
+        unmap_pages(stack, mapped);
+        tlb_flush_range(stack, stack + mapped * PAGE_SIZE, 1);
+    }
+    vmm_free(area);
+}
+
+// Kernel stacks are mapped into the kernel's virtual address space from single
+// pages of the user zone, so they don't take contiguous memory from the kernel
+// zone. The page below each stack is left unmapped as a guard; an overflow into
+// it raises a double fault, which runs on a separate stack.
+static void *__task_stack_alloc(int order)
+{
+    const int pages = pow2(order);
+
+    struct vmm_area *area = vmm_alloc_size(
+        vmm_kernel(), (pages + 1) * PAGE_SIZE, VMM_READ | VMM_WRITE);
+    if (IS_ERR(area)) {
+        return area;
+    }
+
+    const addr_t stack = area->base + PAGE_SIZE;
+
+    for (int i = 0; i < pages; ++i) {
+        struct page *p = alloc_page(PA_USER);
+        if (IS_ERR(p)) {
+            __task_stack_release(area, i);
+            return p;
+        }
+
+        int err = map_page_kernel(stack + i * PAGE_SIZE,
+                                  page_to_phys(p),
+                                  PROT_WRITE,
+                                  PAGE_CP_DEFAULT);
+        if (err) {
+            free_pages(p);
+            __task_stack_release(area, i);
+            return ERR_PTR(err);
+        }
+
+        vmm_add_area_pages(area, p, stack + i * PAGE_SIZE);
+    }
+
+    return (void *)stack;
+}
+
+void *task_stack_alloc(int order)
+{
+    void *stack = NULL;
+    unsigned long irqstate;
+
+    if (order <= TASK_RESERVE_MAX_STACK_ORDER) {
+        irq_save(irqstate);
+
+        struct task_reserve *reserve = raw_cpu_ptr(&task_reserve);
+        if (reserve->num_stacks[order] > 0) {
+            stack = reserve->stacks[order][--reserve->num_stacks[order]];
+        }
+
+        irq_restore(irqstate);
+    }
+
+    return stack ? stack : __task_stack_alloc(order);
+}
+
+void task_stack_free(void *stack, int order)
+{
+    unsigned long irqstate;
+
+    if (order <= TASK_RESERVE_MAX_STACK_ORDER) {
+        irq_save(irqstate);
+
+        struct task_reserve *reserve = raw_cpu_ptr(&task_reserve);
+        if (reserve->num_stacks[order] < TASK_RESERVE_STACKS) {
+            reserve->stacks[order][reserve->num_stacks[order]++] = stack;
+            stack = NULL;
+        }
+
+        irq_restore(irqstate);
+    }
+
+    if (stack) {
+        struct vmm_area *area =
+            vmm_get_allocated_area(vmm_kernel(), (addr_t)stack - PAGE_SIZE);
+        __task_stack_release(area, pow2(order));
+    }
+}
+
+void task_free(struct task *task)
+{
+    unsigned long irqstate;
+
+    pid_free(task);
+
+    if (task->stack_top != NULL) {
+        void *stack_base = (uint8_t *)task->stack_top - task->stack_size;
+        task_stack_free(stack_base, log2(task->stack_size / PAGE_SIZE));
+    }
+
     if (task->vmm != NULL) {
         vmm_release(task->vmm);
     }
 
-    free_cache(task_cache, task);
+    fpu_release(task);
+
+    // Only command lines allocated through task_cmdline_buffer() can be reused.
+    if (task->cmdline_size == 0) {
+        task_free_cmdline(task);
+    }
+
+    irq_save(irqstate);
+
+    struct task_reserve *reserve = raw_cpu_ptr(&task_reserve);
+    if (reserve->num_tasks < TASK_RESERVE_TASKS) {
+        reserve->tasks[reserve->num_tasks++] = task;
+        task = NULL;
+    }
+
+    irq_restore(irqstate);
+
+    if (task) {
+        task_free_cmdline(task);
+        free_cache(task_cache, task);
+    }
 }
 
 // TODO(frolv): This is very basic for now. There are many more factors to take
@@ -96,9 +307,6 @@ int task_comparator(const struct task *a, const struct task *b)
     return a->remaining_time - b->remaining_time;
 }
 
-// TODO(frolv): Try something more sophisticated.
-static uint32_t next_pid = 1;
-
 static void task_init(void *t)
 {
     struct task *task = t;
@@ -106,7 +314,7 @@ static void task_init(void *t)
 
     list_init(&task->queue);
     task->cpu_restrict = CPUMASK_ALL;
-    task->pid = atomic_fetch_inc(&next_pid);
+    task->numa_node = NUMA_NO_NODE;
 }
 
 struct task *task_create(const char *path)
@@ -120,19 +328,24 @@ struct task *task_create(const char *path)
         return ERR_PTR(ENOENT);
     }
 
+    const uint8_t *image = initrd_file_data(file);
+    if (IS_ERR(image)) {
+        return ERR_PTR(ERR_VAL(image));
+    }
+
     struct task *task = task_alloc();
     if (IS_ERR(task)) {
         return task;
     }
 
-    struct page *kstack = alloc_page(PA_STANDARD);
+    uint8_t *kstack = task_stack_alloc(0);
     if (IS_ERR(kstack)) {
         status = ERR_VAL(kstack);
         goto error_cleanup;
     }
 
     task->stack_size = PAGE_SIZE;
-    task->stack_top = ((uint8_t *)kstack->mem) + PAGE_SIZE;
+    task->stack_top = kstack + PAGE_SIZE;
 
     task->vmm = vmm_new();
     if (!task->vmm) {
@@ -141,24 +354,21 @@ struct task *task_create(const char *path)
     }
 
     struct elf_context elf;
-    if ((status = elf_load(task->vmm, file->base, file->size, &elf))) {
+    if ((status = elf_load(task->vmm, image, file->size, &elf))) {
         goto error_cleanup;
     }
 
-    // TODO(frolv): Only the path is set in the command line. Support args.
-    task->cmdline = kmalloc(2 * sizeof *task->cmdline);
-    if (!task->cmdline) {
-        status = ENOMEM;
-        goto error_cleanup;
-    }
+    // The executable's pages were allocated on this CPU's node.
+    task->numa_node = numa_node_id();
 
-    task->cmdline[0] = strdup(path);
-    if (!task->cmdline[0]) {
+    // TODO(frolv): Only the path is set in the command line. Support args.
+    char *cmdline = task_cmdline_buffer(task, strlen(path) + 1);
+    if (!cmdline) {
         status = ENOMEM;
         goto error_cleanup;
     }
 
-    task->cmdline[1] = NULL;
+    strcpy(cmdline, path);
 
     // Allocate and map a physical user stack into the new task's address space.
     addr_t user_stack_base = USER_STACK_TOP - PAGE_SIZE;
@@ -175,15 +385,106 @@ struct task *task_create(const char *path)
         goto error_cleanup;
     }
 
+    // Perform architecture-specific setup of the task's user stack and
+    // registers. This is done through the stack's physical address, so it must
+    // happen before the page is mapped: once the mapping is published,
+    // compaction is free to migrate the page elsewhere.
+    if ((status = user_task_setup(task, page_to_phys(ustack), elf.entry))) {
+        free_pages(ustack);
+        goto error_cleanup;
+    }
+
     if ((status = vmm_map_pages(area, area->base, ustack))) {
         // Must manually free the page here as it won't be owned by the VMM.
         free_pages(ustack);
         goto error_cleanup;
     }
 
-    // Perform architecture-specific setup of the task's user stack and
-    // registers.
-    if ((status = user_task_setup(task, page_to_phys(ustack), elf.entry))) {
+    return task;
+
+error_cleanup:
+    task_free(task);
+    return ERR_PTR(status);
+}
+
+static char **task_copy_cmdline(char *const *cmdline)
+{
+    size_t argc = 0;
+    while (cmdline[argc]) {
+        ++argc;
+    }
+
+    char **copy = kmalloc((argc + 1) * sizeof *copy);
+    if (!copy) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < argc; ++i) {
+        copy[i] = strdup(cmdline[i]);
+        if (!copy[i]) {
+            while (i > 0) {
+                kfree(copy[--i]);
+            }
+            kfree(copy);
+            return NULL;
+        }
+    }
+
+    copy[argc] = NULL;
+    return copy;
+}
+
+struct task *task_fork(struct task *parent)
+{
+    int status = 0;
+
+    assert(parent->vmm != NULL);
+
+    struct task *task = task_alloc();
+    if (IS_ERR(task)) {
+        return task;
+    }
+
+    uint8_t *kstack = task_stack_alloc(0);
+    if (IS_ERR(kstack)) {
+        status = ERR_VAL(kstack);
+        goto error_cleanup;
+    }
+
+    task->stack_size = PAGE_SIZE;
+    task->stack_top = kstack + PAGE_SIZE;
+
+    // Only the parent's page tables are copied here. Its memory is shared until
+    // one of the two tasks writes to it.
+    struct vmm_space *vmm = vmm_clone(parent->vmm);
+    if (IS_ERR(vmm)) {
+        status = ERR_VAL(vmm);
+        goto error_cleanup;
+    }
+    task->vmm = vmm;
+
+    if (parent->cmdline != NULL) {
+        task_free_cmdline(task);
+        task->cmdline = task_copy_cmdline(parent->cmdline);
+        if (!task->cmdline) {
+            status = ENOMEM;
+            goto error_cleanup;
+        }
+    }
+
+    task->parent = parent;
+    task->priority = parent->priority;
+    task->uid = parent->uid;
+    task->gid = parent->gid;
+    task->umask = parent->umask;
+    task->cpu_restrict = parent->cpu_restrict;
+    task->numa_node = parent->numa_node;
+
+    if ((status = fpu_fork(task, parent))) {
+        goto error_cleanup;
+    }
+
+    if ((status = user_task_fork_setup(task, parent))) {
         goto error_cleanup;
     }
 
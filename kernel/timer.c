@@ -16,10 +16,10 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <radix/atomic.h>
 #include <radix/compiler.h>
 #include <radix/cpu.h>
 #include <radix/event.h>
-#include <radix/ipi.h>
 #include <radix/kernel.h>
 #include <radix/klog.h>
 #include <radix/percpu.h>
@@ -46,15 +46,13 @@ enum { TIMER_ACTION_ENABLE, TIMER_ACTION_DISABLE, TIMER_ACTION_UPDATE };
 
 #define TIMER_ACTION_IRQ_TIMER (1 << 31)
 
-#define TIMER_ACTION_COMPLETE (1 << 30)
-#define TIMER_ACTION_FAILED   (1 << 31)
+#define TIMER_ACTION_FAILED (1 << 31)
 
 static struct {
     int action;
     int state;
     void *timer;
     void *new_timer;
-    cpumask_t mask;
 } timer_action;
 
 /*
@@ -203,20 +201,59 @@ static void timer_disable(struct timer *timer)
 }
 
 /*
- * __timer_action_wait:
- * Wait for all other CPUs to complete a timer action.
+ * __timer_action_func:
+ * Perform the current timer action on the calling CPU. Runs on every
+ * CPU in the system through smp_call_function_many.
+ * There are three types of timer actions, all of which can
+ * apply to either a system timer or an IRQ timer.
+ *
+ * UPDATE       Replace a running per-CPU timer with a new per-CPU timer
+ * ENABLE       Enable a per-CPU timer
+ * DISABLE      Disable a per-CPU timer
  */
-static __always_inline void __timer_action_wait(void)
+static void __timer_action_func(__unused void *arg)
 {
-    cpumask_t online;
-
-    while (1) {
-        online = cpumask_online();
-        if ((timer_action.mask & online) == online)
+    if (timer_action.action & TIMER_ACTION_IRQ_TIMER) {
+        /* TODO: add timer actions for IRQ timers */
+        switch (timer_action.action & 0xF) {
+        case TIMER_ACTION_UPDATE:
+            /* fallthrough */
+        case TIMER_ACTION_ENABLE:
             break;
+        case TIMER_ACTION_DISABLE:
+            break;
+        }
+        return;
     }
 
-    timer_action.state |= TIMER_ACTION_COMPLETE;
+    switch (timer_action.action & 0xF) {
+    case TIMER_ACTION_UPDATE:
+        timer_disable(timer_action.timer);
+        if (timer_enable(timer_action.new_timer) != 0)
+            atomic_or(&timer_action.state, TIMER_ACTION_FAILED);
+        break;
+    case TIMER_ACTION_ENABLE:
+        if (timer_enable(timer_action.timer) != 0)
+            atomic_or(&timer_action.state, TIMER_ACTION_FAILED);
+        break;
+    case TIMER_ACTION_DISABLE:
+        timer_disable(timer_action.timer);
+        break;
+    }
+}
+
+/*
+ * __timer_action_run:
+ * Perform the current timer action across all CPUs in the system,
+ * waiting for every CPU to complete it.
+ * Returns 1 if any processors fail.
+ */
+static int __timer_action_run(void)
+{
+    timer_action.state = 0;
+    smp_call_function_many(cpumask_online(), __timer_action_func, NULL, true);
+
+    return (timer_action.state & TIMER_ACTION_FAILED) != 0;
 }
 
 /*
@@ -227,15 +264,7 @@ static __always_inline void __timer_action_wait(void)
 static int enable_percpu_timer(struct timer *timer)
 {
     timer_action.action = TIMER_ACTION_ENABLE;
-    timer_action.state = 0;
     timer_action.timer = timer;
-    timer_action.mask = CPUMASK_SELF;
-    send_timer_ipi();
-
-    if (timer_enable(timer) != 0)
-        timer_action.state |= TIMER_ACTION_FAILED;
-
-    __timer_action_wait();
 
     /*
      * During normal system operation, we can assume that a timer change
@@ -245,7 +274,7 @@ static int enable_percpu_timer(struct timer *timer)
      * Until a new timer source is found, the time_ns function is set to
      * return the last known system time.
      */
-    if (timer_action.state & TIMER_ACTION_FAILED) {
+    if (__timer_action_run() != 0) {
         time_ns = time_ns_static;
         return 1;
     }
@@ -260,13 +289,8 @@ static int enable_percpu_timer(struct timer *timer)
 static void disable_percpu_timer(struct timer *timer)
 {
     timer_action.action = TIMER_ACTION_DISABLE;
-    timer_action.state = 0;
     timer_action.timer = timer;
-    timer_action.mask = CPUMASK_SELF;
-    send_timer_ipi();
-
-    timer_disable(timer);
-    __timer_action_wait();
+    __timer_action_run();
 }
 
 /*
@@ -279,15 +303,8 @@ static int update_percpu_timer(struct timer *old, struct timer *new)
     timer_action.action = TIMER_ACTION_UPDATE;
     timer_action.timer = old;
     timer_action.new_timer = new;
-    send_timer_ipi();
-
-    timer_disable(old);
-    if (timer_enable(new) != 0)
-        timer_action.state |= TIMER_ACTION_FAILED;
 
-    __timer_action_wait();
-
-    if (timer_action.state & TIMER_ACTION_FAILED) {
+    if (__timer_action_run() != 0) {
         time_ns = time_ns_static;
         return 1;
     }
@@ -479,50 +496,6 @@ void set_percpu_irq_timer_data(struct percpu_timer_data *pcpu_data)
     this_cpu_write(pcpu_irq_timer, pcpu_data);
 }
 
-/*
- * handle_timer_action:
- * Handler for the timer action IPI. Called by all CPUs in
- * the system except for the one issuing the action.
- * There are three types of timer actions, all of which can
- * apply to either a system timer or an IRQ timer.
- *
- * UPDATE       Replace a running per-CPU timer with a new per-CPU timer
- * ENABLE       Enable a per-CPU timer
- * DISABLE      Disable a per-CPU timer
- */
-void handle_timer_action(void)
-{
-    if (timer_action.action & TIMER_ACTION_IRQ_TIMER) {
-        /* TODO: add timer actions for IRQ timers */
-        switch (timer_action.action & 0xF) {
-        case TIMER_ACTION_UPDATE:
-            /* fallthrough */
-        case TIMER_ACTION_ENABLE:
-            break;
-        case TIMER_ACTION_DISABLE:
-            break;
-        }
-    } else {
-        switch (timer_action.action & 0xF) {
-        case TIMER_ACTION_UPDATE:
-            timer_disable(timer_action.timer);
-            /* fallthrough */
-        case TIMER_ACTION_ENABLE:
-            if (timer_enable(timer_action.timer) != 0)
-                timer_action.state |= TIMER_ACTION_FAILED;
-            break;
-        case TIMER_ACTION_DISABLE:
-            timer_disable(timer_action.timer);
-            break;
-        }
-    }
-
-    timer_action.mask |= CPUMASK_SELF;
-
-    while (!(timer_action.state & TIMER_ACTION_COMPLETE))
-        cpu_pause();
-}
-
 /*
  * cpu_timer_init:
  * Enable per-CPU timers on application processors on initial boot.
@@ -16,50 +16,84 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <radix/atomic.h>
 #include <radix/console.h>
+#include <radix/error.h>
+#include <radix/irq.h>
+#include <radix/kernel.h>
+#include <radix/klog.h>
+#include <radix/kthread.h>
 #include <radix/mutex.h>
+#include <radix/percpu.h>
+#include <radix/slab.h>
 #include <radix/tty.h>
 
 #include <ctype.h>
 #include <stdbool.h>
 #include <string.h>
 
-#define TTY_BUFSIZE 8192
-#define ASCII_ESC   0x1B
-
-static char tty_buf[TTY_BUFSIZE];
-static char *tty_pos = tty_buf;
-static struct mutex tty_mutex = MUTEX_INIT(tty_mutex);
-
-// Returns the command character from an ANSI escape command.
-static char get_ansi_command(char *s, size_t n)
+#define ASCII_ESC 0x1B
+
+// Writers copy their data into a per-CPU staging chunk, which is published
+// to the TTY's consumer once it fills up or a newline is written. Published
+// chunks are pushed onto a lock-free stack, which the consumer thread swaps
+// out and reverses to render them in order. Writers only ever wait on console
+// rendering if the consumer falls more than TTY_MAX_CHUNKS behind.
+#define TTY_CHUNK_SIZE (256 - sizeof(struct tty_chunk *) - sizeof(size_t))
+#define TTY_MAX_CHUNKS 64
+
+struct tty_chunk {
+    struct tty_chunk *next;
+    size_t len;
+    char data[];
+};
+
+static struct slab_cache *tty_chunk_cache = NULL;
+
+static DEFINE_PER_CPU(struct tty_chunk *, tty_staging) = NULL;
+static struct tty_chunk *tty_queue = NULL;
+static int tty_outstanding = 0;
+
+static struct task *tty_thread = NULL;
+
+// Held by the single consumer while it renders output to the console.
+static struct mutex tty_consumer_lock = MUTEX_INIT(tty_consumer_lock);
+
+#define TTY_ESC_MAX    32
+#define TTY_MAX_PARAMS 8
+
+// State of the ANSI escape sequence parser, which persists across chunks so
+// that sequences may be split between writes.
+enum tty_parse_state {
+    TTY_STATE_TEXT,
+    TTY_STATE_ESC,
+    TTY_STATE_CSI,
+};
+
+static struct {
+    enum tty_parse_state state;
+    int params[TTY_MAX_PARAMS];
+    int nparams;
+    bool have_param;
+
+    // Raw bytes of the current sequence, written out literally if the
+    // sequence turns out to be unsupported.
+    char seq[TTY_ESC_MAX];
+    size_t seq_len;
+} tty_parser = { .state = TTY_STATE_TEXT };
+
+// Sets console colors from the parameters of an ANSI graphics mode command.
+// Returns false if a parameter is not supported.
+static bool set_mode(const int *params, int nparams)
 {
-    while (n && (isdigit(*s) || *s == ';')) {
-        ++s;
-        --n;
-    }
-
-    return n ? *s : '\0';
-}
-
-// Set console buffer colors from an ANSI graphics mode.
-static size_t set_mode(char *s)
-{
-    size_t i, n;
     int intensity;
     int fg, bg;
 
-    n = 0;
     fg = bg = -1;
     intensity = CON_NORMAL;
 
-    while (s[n] != 'm') {
-        i = 0;
-
-        while (isdigit(s[n])) {
-            i = 10 * i + (s[n] - '0');
-            ++n;
-        }
+    for (int n = 0; n < nparams; ++n) {
+        int i = params[n];
 
         if (i == 0) {
             intensity = CON_NORMAL;
@@ -70,135 +104,298 @@ static size_t set_mode(char *s)
         } else if (i >= 40 && i <= 47) {
             bg = (i - 40) | intensity;
         } else {
-            return 0;
-        }
-
-        if (s[n] == ';') {
-            ++n;
+            return false;
         }
     }
     active_console->actions->set_color(active_console, fg, bg);
 
-    return n;
+    return true;
 }
 
-// Processes an ANSI escape sequence in string s and modifies the console
-// settings accordingly. Returns the number of characters skipped.
-static size_t process_ansi_esc(char *s, size_t n)
+// Runs a complete CSI command. Returns false if it is not supported.
+static bool tty_csi_command(char cmd)
 {
-    if (n == 0) {
-        return 0;
+    switch (cmd) {
+    case 'J':
+        if (tty_parser.nparams != 1 || tty_parser.params[0] != 2) {
+            return false;
+        }
+        active_console->actions->clear(active_console);
+        return true;
+
+    case 'm':
+        return set_mode(tty_parser.params, tty_parser.nparams);
+
+    default:
+        return false;
     }
+}
 
-    if (s[1] != '[') {
-        return 0;
+// Ends the current escape sequence. Unsupported sequences are written to the
+// console as text, with the escape character itself printed literally.
+static void tty_end_sequence(bool handled)
+{
+    if (!handled) {
+        active_console->actions->putc(active_console, ASCII_ESC);
+        if (tty_parser.seq_len > 1) {
+            active_console->actions->write(
+                active_console, tty_parser.seq + 1, tty_parser.seq_len - 1);
+        }
     }
 
-    size_t ret = 2;
-    s += ret;
-    char cmd = get_ansi_command(s, n - ret);
+    tty_parser.state = TTY_STATE_TEXT;
+}
 
-    switch (cmd) {
-    case 'J':
-        if (*s != '2') {
-            return 0;
-        }
-        active_console->actions->clear(active_console);
-        ++ret;
-        break;
+// Feeds a single character of an escape sequence to the parser. Returns false
+// if the character was not consumed, in which case it follows the sequence as
+// ordinary output.
+static bool tty_parse_sequence(char c)
+{
+    if (tty_parser.seq_len == TTY_ESC_MAX) {
+        tty_end_sequence(false);
+        return false;
+    }
+    tty_parser.seq[tty_parser.seq_len++] = c;
 
-    case 'm': {
-        int chars = set_mode(s);
-        if (chars == 0) {
-            return 0;
+    if (tty_parser.state == TTY_STATE_ESC) {
+        if (c == '[') {
+            tty_parser.state = TTY_STATE_CSI;
+            tty_parser.nparams = 0;
+            tty_parser.have_param = false;
+        } else {
+            tty_end_sequence(false);
         }
-        ret += chars;
-        break;
+        return true;
     }
 
-    default:
-        return 0;
+    if (isdigit(c)) {
+        if (!tty_parser.have_param) {
+            if (tty_parser.nparams == TTY_MAX_PARAMS) {
+                tty_end_sequence(false);
+                return true;
+            }
+            tty_parser.params[tty_parser.nparams++] = 0;
+            tty_parser.have_param = true;
+        }
+        int *p = &tty_parser.params[tty_parser.nparams - 1];
+        *p = 10 * *p + (c - '0');
+    } else if (c == ';') {
+        tty_parser.have_param = false;
+    } else {
+        tty_end_sequence(tty_csi_command(c));
     }
 
-    return ret;
+    return true;
 }
 
-static void __tty_flush_locked(void)
+// Renders `n` bytes of TTY output to the active console, processing ANSI
+// escape sequences. Runs of plain text are written to the console at once.
+//
+// Precondition: tty_consumer_lock is held.
+static void tty_render(const char *s, size_t n)
 {
-    char *pos = tty_buf;
-    char *esc;
-
-    // Split the string at ANSI escape sequences, processing each.
-    while ((esc = memchr(pos, ASCII_ESC, tty_pos - pos))) {
-        active_console->actions->write(active_console, pos, esc - pos);
-
-        size_t escape_size = process_ansi_esc(esc, tty_pos - esc);
-        if (escape_size == 0) {
-            // If there is no escape sequence, output a literal
-            // escape character.
-            active_console->actions->putc(active_console, ASCII_ESC);
+    const char *end = s + n;
+
+    if (!active_console) {
+        return;
+    }
+
+    while (s < end) {
+        if (tty_parser.state != TTY_STATE_TEXT) {
+            if (tty_parse_sequence(*s)) {
+                ++s;
+            }
+            continue;
         }
 
-        pos = esc + escape_size + 1;
-        if (pos >= tty_pos) {
+        const char *esc = memchr(s, ASCII_ESC, end - s);
+        const char *text_end = esc ? esc : end;
+
+        if (text_end > s) {
+            active_console->actions->write(active_console, s, text_end - s);
+        }
+        if (!esc) {
             break;
         }
+
+        tty_parser.state = TTY_STATE_ESC;
+        tty_parser.seq[0] = ASCII_ESC;
+        tty_parser.seq_len = 1;
+        s = esc + 1;
+    }
+}
+
+// Pushes a chunk onto the output queue. Returns true if the queue was empty.
+static bool tty_publish(struct tty_chunk *chunk)
+{
+    struct tty_chunk *head = atomic_read(&tty_queue);
+
+    while (1) {
+        chunk->next = head;
+        struct tty_chunk *prev = atomic_cmpxchg(&tty_queue, head, chunk);
+        if (prev == head) {
+            return head == NULL;
+        }
+        head = prev;
+    }
+}
+
+// Renders all published output.
+//
+// Precondition: tty_consumer_lock is held.
+static void __tty_consume(void)
+{
+    struct tty_chunk *chunk, *next, *list;
+
+    while ((chunk = atomic_swap(&tty_queue, NULL)) != NULL) {
+        // The queue is a stack; reverse it to render chunks in the order they
+        // were published.
+        list = NULL;
+        while (chunk) {
+            next = chunk->next;
+            chunk->next = list;
+            list = chunk;
+            chunk = next;
+        }
+
+        while (list) {
+            chunk = list;
+            list = chunk->next;
+
+            tty_render(chunk->data, chunk->len);
+            free_cache(tty_chunk_cache, chunk);
+            atomic_dec(&tty_outstanding);
+        }
+    }
+}
+
+static void tty_consume(void)
+{
+    mutex_lock(&tty_consumer_lock);
+    __tty_consume();
+    mutex_unlock(&tty_consumer_lock);
+}
+
+static void tty_thread_func(__unused void *arg)
+{
+    while (1) {
+        kthread_wait();
+        tty_consume();
     }
+}
 
-    // Write the remaining characters, if any.
-    if (pos < tty_pos) {
-        active_console->actions->write(active_console, pos, tty_pos - pos);
+// Publishes the current CPU's staging chunk, if any.
+// Returns true if the chunk was the first in the queue.
+//
+// Precondition: Interrupts are disabled.
+static bool tty_publish_staging(void)
+{
+    struct tty_chunk *chunk = this_cpu_read(tty_staging);
+
+    if (!chunk) {
+        return false;
     }
 
-    tty_pos = tty_buf;
+    this_cpu_write(tty_staging, NULL);
+    return tty_publish(chunk);
+}
+
+// Hands published output to the consumer thread. If the consumer has fallen
+// too far behind, or hasn't started yet, renders it from the calling context.
+static void tty_kick(bool wake)
+{
+    if (tty_thread && atomic_read(&tty_outstanding) <= TTY_MAX_CHUNKS) {
+        if (wake) {
+            kthread_wake(tty_thread);
+        }
+        return;
+    }
+
+    tty_consume();
 }
 
 // Writes `size` bytes of string data to the TTY.
 void tty_write(const char *data, size_t size)
 {
+    unsigned long irqstate;
+    bool wake = false;
+
     if (!data || size == 0) {
         return;
     }
 
-    mutex_lock(&tty_mutex);
+    // Until the chunk cache exists, there is nowhere to stage output.
+    if (!tty_chunk_cache) {
+        mutex_lock(&tty_consumer_lock);
+        tty_render(data, size);
+        mutex_unlock(&tty_consumer_lock);
+        return;
+    }
 
-    do {
-        bool flush = false;
+    irq_save(irqstate);
 
-        size_t remaining_space = TTY_BUFSIZE - (tty_pos - tty_buf);
-        size_t to_write;
+    while (size > 0) {
+        struct tty_chunk *chunk = this_cpu_read(tty_staging);
 
-        if (size > remaining_space) {
-            to_write = remaining_space;
-            flush = 1;
-        } else {
-            to_write = size;
+        if (!chunk) {
+            chunk = alloc_cache(tty_chunk_cache);
+            if (IS_ERR(chunk)) {
+                // Output can't be held anywhere; drop it.
+                break;
+            }
+            chunk->len = 0;
+            atomic_inc(&tty_outstanding);
+            this_cpu_write(tty_staging, chunk);
         }
 
-        // Split the input string at newlines, flushing after each.
-        char *nl;
-        if ((nl = memchr(data, '\n', to_write))) {
-            to_write = nl - data + 1;
-            flush = true;
-        }
+        size_t to_write = min(size, TTY_CHUNK_SIZE - chunk->len);
+        bool newline = memchr(data, '\n', to_write) != NULL;
 
-        memcpy(tty_pos, data, to_write);
-        tty_pos += to_write;
+        memcpy(chunk->data + chunk->len, data, to_write);
+        chunk->len += to_write;
         data += to_write;
         size -= to_write;
 
-        if (flush) {
-            __tty_flush_locked();
+        // Output is line buffered.
+        if (newline || chunk->len == TTY_CHUNK_SIZE) {
+            wake |= tty_publish_staging();
         }
-    } while (size > 0);
+    }
+
+    irq_restore(irqstate);
 
-    mutex_unlock(&tty_mutex);
+    tty_kick(wake);
 }
 
-// Flushes the TTY buffer to the active console.
+// Flushes the current CPU's buffered TTY output to the active console. Output
+// staged on other CPUs is flushed by their next newline or tty_flush call.
 void tty_flush(void)
 {
-    mutex_lock(&tty_mutex);
-    __tty_flush_locked();
-    mutex_unlock(&tty_mutex);
+    unsigned long irqstate;
+
+    irq_save(irqstate);
+    tty_publish_staging();
+    irq_restore(irqstate);
+
+    tty_consume();
+}
+
+void tty_init(void)
+{
+    struct task *thread;
+
+    tty_chunk_cache = create_cache("tty_chunk",
+                                   sizeof(struct tty_chunk) + TTY_CHUNK_SIZE,
+                                   SLAB_MIN_ALIGN,
+                                   SLAB_PANIC,
+                                   NULL);
+
+    thread = kthread_create(tty_thread_func, NULL, 0, "ktty");
+    if (IS_ERR(thread)) {
+        klog(KLOG_ERROR, "tty: failed to create output thread");
+        return;
+    }
+
+    kthread_start(thread);
+    atomic_write(&tty_thread, thread);
 }
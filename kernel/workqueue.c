@@ -0,0 +1,532 @@
+/*
+ * kernel/workqueue.c
+ * Copyright (C) 2022 Alexei Frolov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <radix/assert.h>
+#include <radix/atomic.h>
+#include <radix/error.h>
+#include <radix/event.h>
+#include <radix/irq.h>
+#include <radix/kernel.h>
+#include <radix/klog.h>
+#include <radix/kthread.h>
+#include <radix/percpu.h>
+#include <radix/slab.h>
+#include <radix/smp.h>
+#include <radix/spinlock.h>
+#include <radix/task.h>
+#include <radix/time.h>
+#include <radix/workqueue.h>
+
+#include <errno.h>
+#include <string.h>
+
+#define WORKQUEUE "workqueue: "
+
+// Maximum number of workers in a single pool, including blocked ones.
+#define WQ_MAX_WORKERS 32
+
+// Number of idle workers a pool keeps around. Workers which go idle beyond
+// this exit.
+#define WQ_MAX_IDLE_WORKERS 2
+
+// A set of worker threads which run work items from a shared list.
+//
+// Each pool tracks how many of its workers are runnable, i.e. running work and
+// not blocked. New work only wakes an idle worker if this is below the pool's
+// `max_active`, so a CPU-bound pool processes its work in a single thread
+// unless a work function blocks.
+struct worker_pool {
+    spinlock_t lock;
+    struct list worklist;
+    struct list idle;
+    int cpu;
+    unsigned int max_active;
+    unsigned int nr_workers;
+    unsigned int nr_idle;
+    unsigned int nr_running;
+    int need_worker;
+};
+
+struct worker {
+    struct task *task;
+    struct worker_pool *pool;
+    struct list entry;
+    struct work *current_work;
+    bool sleeping;
+};
+
+static DEFINE_PER_CPU(struct worker_pool, cpu_pools);
+
+// Pool for unbound work, and for bound work queued before a CPU's pool exists.
+static struct worker_pool unbound_pool = {
+    .lock = SPINLOCK_INIT,
+    .worklist = LIST_INIT(unbound_pool.worklist),
+    .idle = LIST_INIT(unbound_pool.idle),
+    .cpu = -1,
+    .max_active = 1,
+};
+
+// CPUs whose worker pools have been initialized.
+static cpumask_t wq_pool_cpus;
+
+// Thread which creates new workers on behalf of pools that need them. Workers
+// cannot be created from the contexts which discover the need for them, which
+// may be interrupt handlers or tasks about to block.
+static struct task *wq_manager = NULL;
+
+static struct workqueue system_wq_struct = { "events", 0 };
+static struct workqueue system_unbound_wq_struct = { "events_unbound",
+                                                     WQ_UNBOUND };
+
+struct workqueue *system_wq = &system_wq_struct;
+struct workqueue *system_unbound_wq = &system_unbound_wq_struct;
+
+void work_init(struct work *work, work_func_t func)
+{
+    list_init(&work->entry);
+    work->func = func;
+    work->pending = 0;
+    work->pool = NULL;
+}
+
+void delayed_work_init(struct delayed_work *dwork, work_func_t func)
+{
+    work_init(&dwork->work, func);
+    dwork->wq = NULL;
+    dwork->cpu = -1;
+    dwork->timer = 0;
+    dwork->timer_seq = 0;
+}
+
+struct workqueue *create_workqueue(const char *name, unsigned int flags)
+{
+    struct workqueue *wq = kmalloc(sizeof *wq);
+    if (!wq) {
+        return ERR_PTR(ENOMEM);
+    }
+
+    strncpy(wq->name, name, WQ_NAME_LEN - 1);
+    wq->name[WQ_NAME_LEN - 1] = '\0';
+    wq->flags = flags;
+
+    return wq;
+}
+
+void destroy_workqueue(struct workqueue *wq)
+{
+    assert(wq != system_wq && wq != system_unbound_wq);
+    kfree(wq);
+}
+
+static struct worker_pool *wq_select_pool(struct workqueue *wq, int cpu)
+{
+    if (!(wq->flags & WQ_UNBOUND) && cpu >= 0 &&
+        cpumask_test_cpu(&wq_pool_cpus, cpu)) {
+        return cpu_ptr(&cpu_pools, cpu);
+    }
+
+    return &unbound_pool;
+}
+
+// Makes another worker in `pool` runnable, waking an idle one if possible and
+// otherwise asking the manager to create one.
+//
+// Precondition: `pool->lock` is held.
+static void __pool_wake_worker(struct worker_pool *pool)
+{
+    if (!list_empty(&pool->idle)) {
+        struct worker *worker =
+            list_first_entry(&pool->idle, struct worker, entry);
+
+        // The waker takes the worker off the idle list and accounts for it
+        // as running, so that further work doesn't wake it again.
+        list_del(&worker->entry);
+        --pool->nr_idle;
+        ++pool->nr_running;
+        kthread_wake(worker->task);
+        return;
+    }
+
+    if (pool->nr_workers < WQ_MAX_WORKERS && !pool->need_worker) {
+        pool->need_worker = 1;
+        if (wq_manager) {
+            kthread_wake(wq_manager);
+        }
+    }
+}
+
+static void __queue_work(struct worker_pool *pool, struct work *work)
+{
+    unsigned long irqstate;
+
+    spin_lock_irq(&pool->lock, &irqstate);
+
+    work->pool = pool;
+    list_ins(&pool->worklist, &work->entry);
+
+    if (pool->nr_running < pool->max_active) {
+        __pool_wake_worker(pool);
+    }
+
+    spin_unlock_irq(&pool->lock, irqstate);
+}
+
+bool queue_work_on(int cpu, struct workqueue *wq, struct work *work)
+{
+    if (atomic_cmpxchg(&work->pending, 0, 1) != 0) {
+        return false;
+    }
+
+    __queue_work(wq_select_pool(wq, cpu), work);
+    return true;
+}
+
+bool queue_work(struct workqueue *wq, struct work *work)
+{
+    return queue_work_on(processor_id(), wq, work);
+}
+
+// Event callback for a delayed work item whose delay has expired. `seq`
+// identifies the timer which fired; if the work has since been cancelled or
+// re-armed, the timer no longer matches and nothing is done.
+static void delayed_work_timer(void *arg, unsigned long seq)
+{
+    struct delayed_work *dwork = arg;
+
+    if (atomic_cmpxchg(&dwork->timer, seq, 0) != seq) {
+        return;
+    }
+
+    __queue_work(wq_select_pool(dwork->wq, dwork->cpu), &dwork->work);
+}
+
+bool queue_delayed_work(struct workqueue *wq,
+                        struct delayed_work *dwork,
+                        uint64_t delay)
+{
+    struct work *work = &dwork->work;
+    unsigned long irqstate;
+    unsigned long seq;
+
+    if (atomic_cmpxchg(&work->pending, 0, 1) != 0) {
+        return false;
+    }
+
+    irq_save(irqstate);
+
+    dwork->wq = wq;
+    dwork->cpu = processor_id();
+
+    if (delay == 0) {
+        __queue_work(wq_select_pool(wq, dwork->cpu), work);
+        irq_restore(irqstate);
+        return true;
+    }
+
+    // Only the owner of the pending bit arms the timer, so the sequence number
+    // can be updated without further synchronization. Zero means no timer.
+    seq = ++dwork->timer_seq;
+    if (seq == 0) {
+        seq = ++dwork->timer_seq;
+    }
+    atomic_write(&dwork->timer, seq);
+
+    if (callback_event_add(time_ns() + delay, delayed_work_timer, dwork, seq) !=
+        0) {
+        // Without a timer, the best that can be done is to run the work now.
+        klog(KLOG_WARNING,
+             WORKQUEUE "failed to allocate timer, queueing work immediately");
+        atomic_write(&dwork->timer, 0);
+        __queue_work(wq_select_pool(wq, dwork->cpu), work);
+    }
+
+    irq_restore(irqstate);
+    return true;
+}
+
+bool cancel_work(struct work *work)
+{
+    struct worker_pool *pool;
+    unsigned long irqstate;
+    bool cancelled = false;
+
+    pool = atomic_read(&work->pool);
+    if (!pool) {
+        return false;
+    }
+
+    spin_lock_irq(&pool->lock, &irqstate);
+
+    // The work is still queued only if it is on this pool's list. A worker
+    // removes it from the list before clearing its pending bit.
+    if (work->pool == pool && !list_empty(&work->entry)) {
+        list_del(&work->entry);
+        atomic_write(&work->pending, 0);
+        cancelled = true;
+    }
+
+    spin_unlock_irq(&pool->lock, irqstate);
+    return cancelled;
+}
+
+bool cancel_delayed_work(struct delayed_work *dwork)
+{
+    unsigned long seq;
+
+    // Claiming the timer prevents it from queueing the work when it fires. Its
+    // event is then removed so that it does not outlive the work item.
+    seq = atomic_swap(&dwork->timer, 0);
+    if (seq != 0) {
+        callback_event_del(dwork->cpu, delayed_work_timer, dwork, seq);
+        atomic_write(&dwork->work.pending, 0);
+        return true;
+    }
+
+    return cancel_work(&dwork->work);
+}
+
+// Takes `worker` off its pool's idle list.
+//
+// Precondition: `pool->lock` is held.
+static void __worker_leave_idle(struct worker_pool *pool, struct worker *worker)
+{
+    list_del(&worker->entry);
+    --pool->nr_idle;
+    ++pool->nr_running;
+}
+
+static void worker_thread(void *arg)
+{
+    struct worker *worker = arg;
+    struct worker_pool *pool = worker->pool;
+    struct work *work;
+    unsigned long irqstate;
+
+    spin_lock_irq(&pool->lock, &irqstate);
+
+    while (1) {
+        // Go idle if there is nothing to do, or if blocked workers have since
+        // resumed and the pool is running more workers than it needs.
+        if (list_empty(&pool->worklist) ||
+            pool->nr_running > pool->max_active) {
+            if (pool->nr_idle >= WQ_MAX_IDLE_WORKERS) {
+                break;
+            }
+
+            --pool->nr_running;
+            ++pool->nr_idle;
+            list_add(&pool->idle, &worker->entry);
+            spin_unlock_irq(&pool->lock, irqstate);
+
+            kthread_wait();
+
+            spin_lock_irq(&pool->lock, &irqstate);
+            if (!list_empty(&worker->entry)) {
+                // Woken by something other than the pool.
+                __worker_leave_idle(pool, worker);
+            }
+            continue;
+        }
+
+        work = list_first_entry(&pool->worklist, struct work, entry);
+        list_del(&work->entry);
+        worker->current_work = work;
+
+        // From this point, the work may be queued again.
+        atomic_write(&work->pending, 0);
+        spin_unlock_irq(&pool->lock, irqstate);
+
+        work->func(work);
+
+        spin_lock_irq(&pool->lock, &irqstate);
+        worker->current_work = NULL;
+    }
+
+    --pool->nr_running;
+    --pool->nr_workers;
+    spin_unlock_irq(&pool->lock, irqstate);
+
+    worker->task->worker = NULL;
+    kfree(worker);
+}
+
+static int worker_create(struct worker_pool *pool)
+{
+    struct worker *worker;
+    struct task *thread;
+    unsigned long irqstate;
+
+    worker = kmalloc(sizeof *worker);
+    if (!worker) {
+        return ENOMEM;
+    }
+
+    worker->pool = pool;
+    worker->current_work = NULL;
+    worker->sleeping = false;
+    list_init(&worker->entry);
+
+    if (pool->cpu >= 0) {
+        thread = kthread_create(worker_thread, worker, 0, "kworker/%d:%u",
+                                pool->cpu, pool->nr_workers);
+    } else {
+        thread = kthread_create(worker_thread, worker, 0, "kworker/u:%u",
+                                pool->nr_workers);
+    }
+    if (IS_ERR(thread)) {
+        kfree(worker);
+        return ERR_VAL(thread);
+    }
+
+    if (pool->cpu >= 0) {
+        thread->cpu_restrict = CPUMASK_CPU(pool->cpu);
+    }
+    thread->worker = worker;
+    worker->task = thread;
+
+    // The new worker starts out runnable and checks the pool for work.
+    spin_lock_irq(&pool->lock, &irqstate);
+    ++pool->nr_workers;
+    ++pool->nr_running;
+    spin_unlock_irq(&pool->lock, irqstate);
+
+    kthread_start(thread);
+    return 0;
+}
+
+static void wq_pool_check(struct worker_pool *pool)
+{
+    int err;
+
+    if (atomic_swap(&pool->need_worker, 0) == 0) {
+        return;
+    }
+
+    if ((err = worker_create(pool)) != 0) {
+        klog(KLOG_ERROR,
+             WORKQUEUE "failed to create worker for pool %d: %s",
+             pool->cpu,
+             strerror(err));
+    }
+}
+
+static void wq_manager_func(__unused void *arg)
+{
+    int cpu;
+
+    while (1) {
+        kthread_wait();
+
+        for_each_cpu (cpu, &wq_pool_cpus) {
+            wq_pool_check(cpu_ptr(&cpu_pools, cpu));
+        }
+        wq_pool_check(&unbound_pool);
+    }
+}
+
+void wq_worker_sleeping(struct task *task)
+{
+    struct worker *worker = task->worker;
+    struct worker_pool *pool;
+
+    if (!worker || !worker->current_work) {
+        return;
+    }
+
+    pool = worker->pool;
+    spin_lock(&pool->lock);
+
+    worker->sleeping = true;
+    --pool->nr_running;
+
+    // Keep the pool's CPUs busy while this worker is blocked.
+    if (pool->nr_running < pool->max_active &&
+        !list_empty(&pool->worklist)) {
+        __pool_wake_worker(pool);
+    }
+
+    spin_unlock(&pool->lock);
+}
+
+void wq_worker_running(struct task *task)
+{
+    struct worker *worker = task->worker;
+    struct worker_pool *pool;
+    unsigned long irqstate;
+
+    if (!worker || !worker->sleeping) {
+        return;
+    }
+
+    pool = worker->pool;
+    spin_lock_irq(&pool->lock, &irqstate);
+    worker->sleeping = false;
+    ++pool->nr_running;
+    spin_unlock_irq(&pool->lock, irqstate);
+}
+
+static void worker_pool_init(struct worker_pool *pool, int cpu)
+{
+    spin_init(&pool->lock);
+    list_init(&pool->worklist);
+    list_init(&pool->idle);
+    pool->cpu = cpu;
+    pool->max_active = 1;
+    pool->nr_workers = 0;
+    pool->nr_idle = 0;
+    pool->nr_running = 0;
+    pool->need_worker = 0;
+}
+
+void workqueue_init(void)
+{
+    struct task *manager;
+    int cpu;
+
+    for_each_cpu (cpu, cpumask_online()) {
+        worker_pool_init(cpu_ptr(&cpu_pools, cpu), cpu);
+        if (worker_create(cpu_ptr(&cpu_pools, cpu)) != 0) {
+            klog(KLOG_ERROR, WORKQUEUE "failed to create workers for CPU %d",
+                 cpu);
+            continue;
+        }
+        cpumask_set_cpu(&wq_pool_cpus, cpu);
+    }
+
+    // Unbound work may keep every CPU busy.
+    unbound_pool.max_active = cpumask_weight(cpumask_online());
+    if (worker_create(&unbound_pool) != 0) {
+        panic("Failed to create unbound worker thread");
+    }
+
+    manager = kthread_create(wq_manager_func, NULL, 0, "kworker_manager");
+    if (IS_ERR(manager)) {
+        panic("Failed to create workqueue manager thread");
+    }
+
+    atomic_write(&wq_manager, manager);
+    kthread_start(manager);
+
+    // Pools may have requested workers before the manager existed.
+    kthread_wake(manager);
+
+    klog(KLOG_INFO, WORKQUEUE "started workers for %d CPUs",
+         cpumask_weight(&wq_pool_cpus));
+}
+
+bool workqueue_ready(void) { return atomic_read(&wq_manager) != NULL; }